@@ -0,0 +1,131 @@
+#ifndef _ACTUATOR_TABLE_H
+#define _ACTUATOR_TABLE_H
+
+#include <Arduino.h>
+
+#include <array>
+
+//
+// Actuators of the device, the channel count, attribute keys and pin bindings are declared here
+// once and everything else is derived from this table at compile time
+//
+constexpr int8_t ACTUATOR_NO_PIN = -1;
+
+#ifdef BOARD_SUPERMINI
+#define LED_BUILTIN_PIN 8
+#else
+#define LED_BUILTIN_PIN ACTUATOR_NO_PIN
+#endif
+
+struct Actuator {
+    const char* key;  // Shared and client attribute key, also the RPC parameter name
+    int8_t pin;       // Output driven by the actuator, ACTUATOR_NO_PIN if it has none
+    bool activeLow;
+};
+
+constexpr Actuator ACTUATORS[] = {
+    {"switch_state_0", LED_BUILTIN_PIN, true},
+    {"switch_state_1", ACTUATOR_NO_PIN, false},
+    {"switch_state_2", ACTUATOR_NO_PIN, false},
+    {"switch_state_3", ACTUATOR_NO_PIN, false},
+    {"switch_state_4", ACTUATOR_NO_PIN, false},
+    {"switch_state_5", ACTUATOR_NO_PIN, false},
+};
+
+constexpr uint8_t ACTUATOR_COUNT = sizeof(ACTUATORS) / sizeof(ACTUATORS[0]);
+
+//
+// Perfect hash of the actuator keys, an incoming key costs one FNV-1a pass and one strcmp()
+//
+
+/// @brief Smallest power of two with at least twice as many slots as there are actuators
+constexpr size_t Actuator_slotCount()
+{
+    size_t slots = 1;
+    while (slots < ACTUATOR_COUNT * 2U) {
+        slots *= 2;
+    }
+    return slots;
+}
+
+constexpr size_t ACTUATOR_SLOTS = Actuator_slotCount();
+
+constexpr uint32_t Actuator_hash(const char* key, uint32_t seed)
+{
+    uint32_t hash = 2166136261U ^ seed;
+    for (; *key != '\0'; key++) {
+        hash ^= static_cast<uint8_t>(*key);
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+constexpr bool Actuator_isPerfectSeed(uint32_t seed)
+{
+    bool used[ACTUATOR_SLOTS] = {};
+    for (uint8_t i = 0; i < ACTUATOR_COUNT; i++) {
+        const size_t slot = Actuator_hash(ACTUATORS[i].key, seed) & (ACTUATOR_SLOTS - 1U);
+        if (used[slot]) {
+            return false;
+        }
+        used[slot] = true;
+    }
+    return true;
+}
+
+constexpr uint32_t Actuator_findSeed()
+{
+    for (uint32_t seed = 0; seed < 4096U; seed++) {
+        if (Actuator_isPerfectSeed(seed)) {
+            return seed;
+        }
+    }
+    return UINT32_MAX;
+}
+
+constexpr uint32_t ACTUATOR_HASH_SEED = Actuator_findSeed();
+static_assert(ACTUATOR_HASH_SEED != UINT32_MAX, "No perfect hash seed for the actuator keys");
+
+/// @brief Slot to actuator index, -1 for empty slots
+constexpr std::array<int8_t, ACTUATOR_SLOTS> Actuator_buildSlots()
+{
+    std::array<int8_t, ACTUATOR_SLOTS> slots{};
+    for (size_t slot = 0; slot < ACTUATOR_SLOTS; slot++) {
+        slots[slot] = -1;
+    }
+    for (uint8_t i = 0; i < ACTUATOR_COUNT; i++) {
+        slots[Actuator_hash(ACTUATORS[i].key, ACTUATOR_HASH_SEED) & (ACTUATOR_SLOTS - 1U)] = i;
+    }
+    return slots;
+}
+
+constexpr std::array<int8_t, ACTUATOR_SLOTS> ACTUATOR_SLOT_INDEX = Actuator_buildSlots();
+
+/// @brief Resolve an attribute key to its actuator
+/// @return Index into ACTUATORS, -1 if the key does not belong to an actuator
+int Actuator_find(const char* key)
+{
+    if (key == nullptr) {
+        return -1;
+    }
+    const int index =
+        ACTUATOR_SLOT_INDEX[Actuator_hash(key, ACTUATOR_HASH_SEED) & (ACTUATOR_SLOTS - 1U)];
+    if (index < 0 || strcmp(ACTUATORS[index].key, key) != 0) {
+        return -1;
+    }
+    return index;
+}
+
+/// @brief Keys of all actuators, padded with nullptr, e.g. for attribute subscriptions
+template <size_t Size>
+constexpr std::array<const char*, Size> Actuator_keys()
+{
+    static_assert(ACTUATOR_COUNT <= Size, "More actuators than attribute slots");
+    std::array<const char*, Size> keys{};
+    for (uint8_t i = 0; i < ACTUATOR_COUNT; i++) {
+        keys[i] = ACTUATORS[i].key;
+    }
+    return keys;
+}
+
+#endif  // _ACTUATOR_TABLE_H
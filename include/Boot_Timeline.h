@@ -0,0 +1,91 @@
+#ifndef _BOOT_TIMELINE_H
+#define _BOOT_TIMELINE_H
+
+#include <Arduino.h>
+
+//
+// Boot to first telemetry timeline, each phase is stamped in micros() the first time it is
+// reached. Build with -DBOOT_TIMELINE=1 to enable, otherwise the macros compile to nothing.
+//
+enum class Boot_Phase : uint8_t {
+    SETUP_START,
+    WIFI_TASK_CREATED,
+    SETUP_END,  // Includes the delay between the creation of the tasks
+    WIFI_SETUP_DONE,
+    WIFI_BEGIN,
+    WIFI_GOT_IP,
+    THINGSBOARD_TASK_START,
+    PROVISION_SENT,
+    PROVISIONED,
+    MQTT_CONNECTED,
+    RPC_SUBSCRIBED,
+    ATTRIBUTES_SUBSCRIBED,
+    ATTRIBUTES_REQUESTED,
+    FIRST_TELEMETRY,
+    COUNT
+};
+
+#ifdef BOOT_TIMELINE
+
+constexpr const char* BOOT_PHASE_KEYS[] = {
+    "boot_setup_start_us",      "boot_wifi_task_created_us", "boot_setup_end_us",
+    "boot_wifi_setup_done_us",  "boot_wifi_begin_us",        "boot_wifi_got_ip_us",
+    "boot_tb_task_start_us",    "boot_provision_sent_us",    "boot_provisioned_us",
+    "boot_mqtt_connected_us",   "boot_rpc_subscribed_us",    "boot_attr_subscribed_us",
+    "boot_attr_requested_us",   "boot_first_telemetry_us"};
+static_assert(sizeof(BOOT_PHASE_KEYS) / sizeof(BOOT_PHASE_KEYS[0]) ==
+                  static_cast<size_t>(Boot_Phase::COUNT),
+              "A key is needed for every boot phase");
+
+// 0 means the phase has not been reached
+uint32_t Boot_timeline[static_cast<size_t>(Boot_Phase::COUNT)] = {};
+bool Boot_timelinePublished = false;
+
+void Boot_mark(Boot_Phase phase)
+{
+    uint32_t& stamp = Boot_timeline[static_cast<size_t>(phase)];
+    if (stamp == 0) {
+        const uint32_t now = micros();
+        stamp = now == 0 ? 1 : now;
+    }
+}
+
+/// @brief Print the timeline and publish it as one telemetry message, once per boot and only
+/// after the first telemetry went out
+template <typename Batch>
+void Boot_publishTimeline(Batch& batch)
+{
+    constexpr size_t firstTelemetry = static_cast<size_t>(Boot_Phase::FIRST_TELEMETRY);
+    if (Boot_timelinePublished || Boot_timeline[firstTelemetry] == 0) {
+        return;
+    }
+    Serial.println("Boot timeline:");
+    uint32_t previous = 0;
+    for (size_t i = 0; i < static_cast<size_t>(Boot_Phase::COUNT); i++) {
+        if (Boot_timeline[i] == 0) {
+            continue;
+        }
+        Serial.printf("  %-26s %10u us (%+d us)\n", BOOT_PHASE_KEYS[i],
+                      static_cast<unsigned>(Boot_timeline[i]),
+                      static_cast<int>(Boot_timeline[i] - previous));
+        previous = Boot_timeline[i];
+        batch.add(BOOT_PHASE_KEYS[i], Boot_timeline[i]);
+    }
+    Boot_timelinePublished = batch.flush();
+}
+
+#define BOOT_MARK(phase) Boot_mark(Boot_Phase::phase)
+#define BOOT_PUBLISH_TIMELINE(batch) Boot_publishTimeline(batch)
+
+#else
+
+#define BOOT_MARK(phase) \
+    do {                 \
+    } while (0)
+#define BOOT_PUBLISH_TIMELINE(batch) \
+    do {                             \
+    } while (0)
+
+#endif  // BOOT_TIMELINE
+
+#endif  // _BOOT_TIMELINE_H
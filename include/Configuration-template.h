@@ -17,9 +17,15 @@ String WiFi_pass = "LOCAL_WIFI_PASSWORD";
 // ThingsBoard server and device access token
 //
 String ThingsBoard_server = "iot-so.rmuti.ac.th";
-uint16_t ThingsBoard_port = 1883;
+uint16_t ThingsBoard_port = 1883;  // 8883 for MQTTS, built with -DMQTT_TLS=1
 String ThingsBoard_token = "DEVICE_ACCESS_TOKEN";  // Device Access Token
 
+// CA certificate the MQTTS server certificate is verified against, in PEM format
+constexpr char ThingsBoard_caCert[] = R"(-----BEGIN CERTIFICATE-----
+PASTE_THE_CA_CERTIFICATE_HERE
+-----END CERTIFICATE-----
+)";
+
 // See https://thingsboard.io/docs/user-guide/device-provisioning/
 // to understand how to create a device profile to be able to provision a device
 constexpr char ThingsBoard_Provision_Device_Key[] = "YOUR_PROVISION_DEVICE_KEY";
@@ -0,0 +1,80 @@
+#ifndef _DEVICE_EVENTS_H
+#define _DEVICE_EVENTS_H
+
+#include <Arduino.h>
+
+#include <algorithm>
+
+#include "SPSC_Queue.h"
+#include "Task_Events.h"
+
+//
+// Device events, produced by the button handling in loop() and consumed by the ThingsBoard task
+// only, so the ThingsBoard client and the switch states are never touched from two tasks
+//
+enum class Device_Event_Type : uint8_t {
+    SWITCH_TOGGLE,    // Short press, toggle the switch of the channel
+    LONG_PRESS,       // Button of the channel held for BUTTON_LONG_PRESS_TIME
+    SYNTHETIC_TOGGLE  // Toggle of the latency benchmark, not counted in Device_pressLatency
+};
+
+struct Device_Event {
+    Device_Event_Type type;
+    uint8_t channel;
+    uint32_t timestamp;  // micros() when the event was queued
+};
+
+constexpr size_t DEVICE_EVENT_QUEUE_SIZE = 16U;
+
+SPSC_Queue<Device_Event, DEVICE_EVENT_QUEUE_SIZE> Device_events;
+
+/// @brief Running latency statistics in microseconds
+struct Latency_Stats {
+    uint32_t count = 0;
+    uint32_t max = 0;
+    uint64_t sum = 0;
+
+    void add(uint32_t latency)
+    {
+        count++;
+        sum += latency;
+        max = std::max(max, latency);
+    }
+    uint32_t mean() const { return count == 0 ? 0 : static_cast<uint32_t>(sum / count); }
+    void reset() { *this = Latency_Stats(); }
+
+    /// @brief Remove the latencies of an earlier copy, e.g. once they were reported. The maximum
+    /// is kept until all are removed.
+    void remove(const Latency_Stats& reported)
+    {
+        if (reported.count >= count) {
+            reset();
+            return;
+        }
+        count -= reported.count;
+        sum -= reported.sum;
+    }
+};
+
+// Time from a button press being queued to its switch state being published, kept until the
+// message reporting it was acknowledged
+Latency_Stats Device_pressLatency;
+
+/// @brief Queue an event for the ThingsBoard task and wake it up, never blocks
+/// @param timestamp micros() the press latency is measured from
+bool Device_postEvent(Device_Event_Type type, uint8_t channel, uint32_t timestamp)
+{
+    const Device_Event event = {type, channel, timestamp};
+    if (!Device_events.push(event)) {
+        return false;
+    }
+    Events_signal(EVENT_DEVICE);
+    return true;
+}
+
+bool Device_postEvent(Device_Event_Type type, uint8_t channel)
+{
+    return Device_postEvent(type, channel, static_cast<uint32_t>(micros()));
+}
+
+#endif  // _DEVICE_EVENTS_H
@@ -0,0 +1,52 @@
+#ifndef _DEVICE_STATE_H
+#define _DEVICE_STATE_H
+
+#include <Arduino.h>
+
+#include <atomic>
+
+#include "Actuator_Table.h"
+#include "Task_Events.h"
+
+//
+// Device state published as client attributes, changed entries are marked dirty and only those
+// are published by the ThingsBoard task
+//
+constexpr uint8_t SWITCH_COUNT = ACTUATOR_COUNT;
+static_assert(SWITCH_COUNT <= 32, "Dirty bitmap holds 32 switches");
+
+bool switch_state[SWITCH_COUNT] = {};
+
+// Every switch, shifting by the width of the type is undefined, so 32 switches are spelled out
+constexpr uint32_t SWITCH_MASK_ALL = SWITCH_COUNT >= 32 ? ~0U : (1U << SWITCH_COUNT) - 1U;
+
+// Bit i set means switch_state[i] has not been published since it changed. All switches start
+// dirty, the server may still hold the states from before the last boot.
+std::atomic<uint32_t> Device_dirtySwitches{SWITCH_MASK_ALL};
+
+/// @brief Mark a switch for publishing and wake the ThingsBoard task
+void Device_markDirty(uint8_t i)
+{
+    Device_dirtySwitches.fetch_or(1U << i, std::memory_order_relaxed);
+    Events_signal(EVENT_ATTRIBUTES_DUE);
+}
+
+/// @brief Take the dirty switches for publishing, they are clean afterwards
+/// @return Bitmask of the dirty switches
+uint32_t Device_takeDirty()
+{
+    return Device_dirtySwitches.exchange(0, std::memory_order_relaxed);
+}
+
+/// @brief Mark switches dirty again after their publish failed
+void Device_restoreDirty(uint32_t mask)
+{
+    Device_dirtySwitches.fetch_or(mask, std::memory_order_relaxed);
+}
+
+bool Device_isDirty()
+{
+    return Device_dirtySwitches.load(std::memory_order_relaxed) != 0;
+}
+
+#endif  // _DEVICE_STATE_H
@@ -0,0 +1,313 @@
+#ifndef _JSON_FILTER_H
+#define _JSON_FILTER_H
+
+#include <Arduino.h>
+
+#include <algorithm>
+
+//
+// Incremental JSON filter, fed a document in chunks as it arrives and writing a compact copy
+// that only keeps the members whose key is wanted. Objects under other keys are descended into
+// and dropped if nothing in them is kept, everything else is skipped without being buffered, so
+// the memory used does not depend on the size of the document.
+//
+// {"shared":{"switch_state_0":true,"firmware":"...4 KB..."}} becomes
+// {"shared":{"switch_state_0":true}} if only switch_state_0 is wanted.
+//
+class Json_Filter {
+   public:
+    /// @brief Decides whether the member with the given key is kept
+    using Keep_Function = bool (*)(const char* key);
+
+    // Nesting of the objects descended into, deeper objects are skipped
+    static constexpr uint8_t MAX_DEPTH = 8;
+    // Keys at least this long are never kept
+    static constexpr size_t MAX_KEY_LENGTH = 32;
+
+    /// @brief Start a document
+    /// @param output Buffer of the filtered document
+    void begin(Keep_Function keep, char* output, size_t capacity)
+    {
+        m_keep = keep;
+        m_output = output;
+        m_capacity = capacity;
+        m_length = 0;
+        m_depth = 0;
+        m_state = State::START;
+        m_overflow = false;
+    }
+
+    void feed(const uint8_t* data, size_t length)
+    {
+        for (size_t i = 0; i < length; i++) {
+            // A character that ends a number or literal is processed again by the next state
+            while (!step(static_cast<char>(data[i]))) {
+            }
+        }
+    }
+
+    /// @brief Complete the document
+    /// @return Length of the filtered document, 0 if it was malformed or did not fit
+    size_t finish() const { return m_state == State::DONE && !m_overflow ? m_length : 0; }
+
+    /// @brief Whether the filtered document did not fit into the output buffer
+    bool overflowed() const { return m_overflow; }
+
+   private:
+    enum class State : uint8_t {
+        START,
+        KEY_OR_END,
+        KEY,
+        COLON,
+        VALUE,
+        RAW,
+        COMMA_OR_END,
+        DONE,
+        ERROR
+    };
+
+    struct Level {
+        size_t rewind;    // Output length before the member, restored if the object stays empty
+        uint8_t members;  // Members kept so far
+    };
+
+    static bool isSpace(char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; }
+
+    /// @return false if the character has to be processed again
+    bool step(char c)
+    {
+        switch (m_state) {
+            case State::START:
+                if (c == '{') {
+                    push(0);
+                    put('{');
+                    m_state = State::KEY_OR_END;
+                } else if (!isSpace(c)) {
+                    m_state = State::ERROR;
+                }
+                return true;
+            case State::KEY_OR_END:
+                if (c == '"') {
+                    m_keyLength = 0;
+                    m_keyEscape = false;
+                    m_keyTooLong = false;
+                    m_state = State::KEY;
+                } else if (c == '}') {
+                    close();
+                } else if (!isSpace(c)) {
+                    m_state = State::ERROR;
+                }
+                return true;
+            case State::KEY:
+                if (!m_keyEscape && c == '"') {
+                    m_key[m_keyLength] = '\0';
+                    m_state = State::COLON;
+                    return true;
+                }
+                // Escapes are kept as written, such keys are not wanted anyway
+                m_keyEscape = !m_keyEscape && c == '\\';
+                if (m_keyLength < MAX_KEY_LENGTH - 1) {
+                    m_key[m_keyLength++] = c;
+                } else {
+                    m_keyTooLong = true;
+                }
+                return true;
+            case State::COLON:
+                if (c == ':') {
+                    m_state = State::VALUE;
+                } else if (!isSpace(c)) {
+                    m_state = State::ERROR;
+                }
+                return true;
+            case State::VALUE:
+                if (isSpace(c)) {
+                    return true;
+                }
+                if (!m_keyTooLong && m_keep(m_key)) {
+                    putKey();
+                    startRaw(true);
+                    return raw(c);
+                }
+                if (c == '{' && m_depth < MAX_DEPTH) {
+                    const size_t rewind = m_length;
+                    putKey();
+                    put('{');
+                    push(rewind);
+                    m_state = State::KEY_OR_END;
+                    return true;
+                }
+                startRaw(false);
+                return raw(c);
+            case State::RAW:
+                return raw(c);
+            case State::COMMA_OR_END:
+                if (c == ',') {
+                    m_state = State::KEY_OR_END;
+                } else if (c == '}') {
+                    close();
+                } else if (!isSpace(c)) {
+                    m_state = State::ERROR;
+                }
+                return true;
+            case State::DONE:
+                if (!isSpace(c)) {
+                    m_state = State::ERROR;
+                }
+                return true;
+            case State::ERROR:
+                return true;
+        }
+        return true;
+    }
+
+    void startRaw(bool copy)
+    {
+        m_rawCopy = copy;
+        m_rawDepth = 0;
+        m_rawString = false;
+        m_rawEscape = false;
+        m_state = State::RAW;
+    }
+
+    /// @brief Copy or skip a value of any type
+    bool raw(char c)
+    {
+        if (m_rawString) {
+            emit(c);
+            if (m_rawEscape) {
+                m_rawEscape = false;
+            } else if (c == '\\') {
+                m_rawEscape = true;
+            } else if (c == '"') {
+                m_rawString = false;
+                if (m_rawDepth == 0) {
+                    endRaw();
+                }
+            }
+            return true;
+        }
+        switch (c) {
+            case '"':
+                m_rawString = true;
+                emit(c);
+                return true;
+            case '{':
+            case '[':
+                m_rawDepth++;
+                emit(c);
+                return true;
+            case '}':
+            case ']':
+                if (m_rawDepth == 0) {
+                    // Ends a number or literal and closes the enclosing object
+                    endRaw();
+                    return false;
+                }
+                emit(c);
+                if (--m_rawDepth == 0) {
+                    endRaw();
+                }
+                return true;
+            case ',':
+                if (m_rawDepth == 0) {
+                    endRaw();
+                    return false;
+                }
+                emit(c);
+                return true;
+            default:
+                if (isSpace(c)) {
+                    if (m_rawDepth == 0) {
+                        endRaw();
+                    }
+                    return true;
+                }
+                emit(c);
+                return true;
+        }
+    }
+
+    void endRaw()
+    {
+        if (m_rawCopy) {
+            m_levels[m_depth - 1].members++;
+        }
+        m_state = State::COMMA_OR_END;
+    }
+
+    void push(size_t rewind)
+    {
+        m_levels[m_depth].rewind = rewind;
+        m_levels[m_depth].members = 0;
+        m_depth++;
+    }
+
+    void close()
+    {
+        const Level level = m_levels[--m_depth];
+        if (m_depth == 0) {
+            put('}');
+            m_state = State::DONE;
+            return;
+        }
+        if (level.members == 0) {
+            // Nothing wanted in the object, the member is dropped
+            m_length = level.rewind;
+        } else {
+            put('}');
+            m_levels[m_depth - 1].members++;
+        }
+        m_state = State::COMMA_OR_END;
+    }
+
+    void putKey()
+    {
+        if (m_levels[m_depth - 1].members > 0) {
+            put(',');
+        }
+        put('"');
+        for (size_t i = 0; i < m_keyLength; i++) {
+            put(m_key[i]);
+        }
+        put('"');
+        put(':');
+    }
+
+    void emit(char c)
+    {
+        if (m_rawCopy) {
+            put(c);
+        }
+    }
+
+    void put(char c)
+    {
+        if (m_length < m_capacity) {
+            m_output[m_length++] = c;
+        } else {
+            m_overflow = true;
+        }
+    }
+
+    Keep_Function m_keep = nullptr;
+    char* m_output = nullptr;
+    size_t m_capacity = 0;
+    size_t m_length = 0;
+    bool m_overflow = false;
+    State m_state = State::START;
+
+    Level m_levels[MAX_DEPTH + 1] = {};
+    uint8_t m_depth = 0;
+
+    char m_key[MAX_KEY_LENGTH] = {};
+    size_t m_keyLength = 0;
+    bool m_keyEscape = false;
+    bool m_keyTooLong = false;
+
+    bool m_rawCopy = false;
+    uint16_t m_rawDepth = 0;
+    bool m_rawString = false;
+    bool m_rawEscape = false;
+};
+
+#endif  // _JSON_FILTER_H
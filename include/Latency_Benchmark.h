@@ -0,0 +1,138 @@
+#ifndef _LATENCY_BENCHMARK_H
+#define _LATENCY_BENCHMARK_H
+
+#include <Arduino.h>
+
+#include "Device_Events.h"
+#include "Latency_Histogram.h"
+#include "Task_Events.h"
+#include "Task_Topology.h"
+
+//
+// Build with -DTASK_LATENCY_BENCHMARK=1 to measure, under synthetic load, how long a switch RPC
+// takes from the socket to its output and a button press from its interrupt to the publish.
+// Load tasks at the ThingsBoard priority keep every core busy LATENCY_LOAD_BUSY of every
+// LATENCY_LOAD_PERIOD ms, standing in for the network stack working through a burst of traffic.
+// A stimulus task alternates a synthetic RPC, signalled as inbound MQTT data, with a synthetic
+// press, notified to the loop task like the button interrupts. Both travel the task path of the
+// real ones, the RPC through the switch_set callback, the MQTT parsing and the button debouncing
+// are not included. They are only recorded here, the latency telemetry of the device keeps
+// measuring the real ones. The results are printed with the task topology once
+// LATENCY_BENCHMARK_SAMPLES of each were measured, the press latencies need ThingsBoard to be
+// connected.
+//
+#ifdef TASK_LATENCY_BENCHMARK
+
+constexpr uint32_t LATENCY_BENCHMARK_INTERVAL = 100;  // 100 milliseconds between stimuli
+constexpr uint32_t LATENCY_BENCHMARK_SAMPLES = 200;
+constexpr uint32_t LATENCY_LOAD_PERIOD = 10;  // 10 milliseconds
+constexpr uint32_t LATENCY_LOAD_BUSY = 7;     // 7 milliseconds
+constexpr uint32_t LATENCY_TASK_STACK_SIZE = 2048;
+
+Latency_Histogram Latency_rpc;
+Latency_Histogram Latency_press;
+volatile bool Latency_running = false;
+volatile bool Latency_rpcPending = false;
+volatile bool Latency_pressPending = false;
+volatile uint32_t Latency_rpcAt = 0;
+volatile uint32_t Latency_pressAt = 0;
+TaskHandle_t Latency_buttonTask = nullptr;
+
+void Latency_loadTask(void* pvParameters)
+{
+    while (Latency_running) {
+        const uint32_t start = micros();
+        while (micros() - start < LATENCY_LOAD_BUSY * 1000) {
+        }
+        vTaskDelay(pdMS_TO_TICKS(LATENCY_LOAD_PERIOD - LATENCY_LOAD_BUSY));
+    }
+    vTaskDelete(NULL);
+}
+
+void Latency_print(const char* name, const Latency_Histogram& histogram)
+{
+    Serial.printf("  %-16s p50 %6u us, p99 %6u us, max %6u us, %u samples\n", name,
+                  static_cast<unsigned>(histogram.percentile(50)),
+                  static_cast<unsigned>(histogram.percentile(99)),
+                  static_cast<unsigned>(histogram.max()),
+                  static_cast<unsigned>(histogram.count()));
+}
+
+void Latency_stimulusTask(void* pvParameters)
+{
+    bool rpc = true;
+    while (Latency_rpc.count() < LATENCY_BENCHMARK_SAMPLES ||
+           Latency_press.count() < LATENCY_BENCHMARK_SAMPLES) {
+        vTaskDelay(pdMS_TO_TICKS(LATENCY_BENCHMARK_INTERVAL));
+        if (rpc && !Latency_rpcPending) {
+            Latency_rpcAt = micros();
+            Latency_rpcPending = true;
+            Events_signal(EVENT_MQTT_RX);
+        } else if (!rpc && !Latency_pressPending) {
+            Latency_pressAt = micros();
+            Latency_pressPending = true;
+            xTaskNotifyGive(Latency_buttonTask);
+        }
+        rpc = !rpc;
+    }
+    Latency_running = false;
+
+    Serial.printf("Latency benchmark, %u%% load on every core at priority %u:\n",
+                  static_cast<unsigned>(LATENCY_LOAD_BUSY * 100 / LATENCY_LOAD_PERIOD),
+                  static_cast<unsigned>(TASK_THINGSBOARD.priority));
+    Task_printTopology();
+    Latency_print("RPC to output", Latency_rpc);
+    Latency_print("Press to publish", Latency_press);
+    vTaskDelete(NULL);
+}
+
+/// @brief Start the load and the stimuli
+/// @param buttonTask Task running loop()
+void Latency_benchmarkBegin(TaskHandle_t buttonTask)
+{
+    Latency_buttonTask = buttonTask;
+    Latency_running = true;
+    for (BaseType_t core = 0; core < portNUM_PROCESSORS; core++) {
+        xTaskCreatePinnedToCore(Latency_loadTask, "Latency_load", LATENCY_TASK_STACK_SIZE, NULL,
+                                TASK_THINGSBOARD.priority, NULL, core);
+    }
+    // Above everything measured, so the stimuli are not delayed by the load
+    xTaskCreatePinnedToCore(Latency_stimulusTask, "Latency_stimulus", LATENCY_TASK_STACK_SIZE,
+                            NULL, configMAX_PRIORITIES - 2, NULL, tskNO_AFFINITY);
+}
+
+/// @brief Take a synthetic RPC, in the ThingsBoard task
+/// @param receivedAt micros() of the synthetic inbound data
+bool Latency_takeRpc(uint32_t& receivedAt)
+{
+    if (!Latency_rpcPending) {
+        return false;
+    }
+    receivedAt = Latency_rpcAt;
+    Latency_rpcPending = false;
+    return true;
+}
+
+/// @brief Take a synthetic press, in the loop task
+/// @param pressedAt micros() of the synthetic interrupt
+bool Latency_takePress(uint32_t& pressedAt)
+{
+    if (!Latency_pressPending) {
+        return false;
+    }
+    pressedAt = Latency_pressAt;
+    Latency_pressPending = false;
+    return true;
+}
+
+#define LATENCY_RECORD_RPC(latency) Latency_rpc.add(latency)
+#define LATENCY_RECORD_PRESS(latency) Latency_press.add(latency)
+
+#else
+
+#define LATENCY_RECORD_RPC(latency)
+#define LATENCY_RECORD_PRESS(latency)
+
+#endif  // TASK_LATENCY_BENCHMARK
+
+#endif  // _LATENCY_BENCHMARK_H
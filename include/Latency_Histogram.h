@@ -0,0 +1,228 @@
+#ifndef _LATENCY_HISTOGRAM_H
+#define _LATENCY_HISTOGRAM_H
+
+#include <Arduino.h>
+
+#include "Task_Events.h"
+#include "Telemetry_Batch.h"
+#include "ThingsBoard_Manager.h"
+
+/// @brief Latencies in microseconds counted in power of two buckets, a fixed 56 bytes whatever
+/// the number of samples. Percentiles are interpolated within their bucket, so they are off by
+/// less than the width of the bucket.
+class Latency_Histogram {
+   public:
+    // Bucket 0 holds 0 us, bucket i the latencies of i bits, [2^(i-1), 2^i) us, the last one
+    // everything from 2^(BUCKETS-2) us, about 4 seconds, on
+    static constexpr uint8_t BUCKETS = 24;
+
+    void add(uint32_t latency)
+    {
+        uint8_t bucket = 0;
+        while (bucket < BUCKETS - 1 && (latency >> bucket) != 0) {
+            bucket++;
+        }
+        if (m_buckets[bucket] < UINT16_MAX) {
+            m_buckets[bucket]++;
+            m_count++;
+        }
+        m_max = std::max(m_max, latency);
+    }
+
+    uint32_t count() const { return m_count; }
+    uint32_t max() const { return m_max; }
+
+    /// @param percent 1 to 100
+    /// @return The latency percent of the samples do not exceed, 0 without samples
+    uint32_t percentile(uint8_t percent) const
+    {
+        if (m_count == 0) {
+            return 0;
+        }
+        // 1 based rank of the sample
+        const uint32_t rank = std::max<uint32_t>(1, (m_count * percent + 99) / 100);
+        uint32_t below = 0;
+        for (uint8_t i = 0; i < BUCKETS; i++) {
+            if (below + m_buckets[i] < rank) {
+                below += m_buckets[i];
+                continue;
+            }
+            const uint32_t lower = i == 0 ? 0 : 1U << (i - 1);
+            const uint32_t upper = i == 0 ? 0 : i == BUCKETS - 1 ? m_max : (1U << i) - 1;
+            const uint32_t value =
+                lower + static_cast<uint32_t>(static_cast<uint64_t>(upper - lower) *
+                                              (rank - below) / m_buckets[i]);
+            return std::min(value, m_max);
+        }
+        return m_max;
+    }
+
+    void reset() { *this = Latency_Histogram(); }
+
+   private:
+    uint16_t m_buckets[BUCKETS] = {};  // Saturate, the samples beyond are not counted
+    uint32_t m_count = 0;
+    uint32_t m_max = 0;
+};
+
+//
+// Stages of the RPC and shared attribute update paths. A packet is received when the socket
+// watcher sees it arrive, or when the transport reads it if the ThingsBoard task was awake
+// already, dispatched when its callback starts. The response to an RPC is written by the client
+// after the callback returns, the transport tells when, and it is matched to its request by the
+// request id in the topic, however many packets the client handles in one loop().
+//
+enum class Latency_Stage : uint8_t {
+    MQTT_QUEUE,     // Socket readable to packet read by the transport
+    RPC_DISPATCH,   // Packet read to switch_set callback
+    RPC_ACTUATE,    // Callback to the outputs driven
+    RPC_RESPOND,    // Outputs driven to the response written whole
+    RPC_TOTAL,      // Received to the response written
+    ATTR_DISPATCH,  // Packet read to shared attribute callback
+    ATTR_APPLY,     // Callback to the attributes applied
+    ATTR_TOTAL,     // Received to the attributes applied
+    COUNT
+};
+
+constexpr const char* LATENCY_STAGE_KEYS[] = {"mqtt_queue",    "rpc_dispatch", "rpc_actuate",
+                                              "rpc_respond",   "rpc_total",    "attr_dispatch",
+                                              "attr_apply",    "attr_total"};
+static_assert(sizeof(LATENCY_STAGE_KEYS) / sizeof(LATENCY_STAGE_KEYS[0]) ==
+                  static_cast<size_t>(Latency_Stage::COUNT),
+              "A key is needed for every latency stage");
+
+// RPCs actuated and awaiting their response, the oldest is given up when another one comes
+constexpr size_t LATENCY_PENDING_RPCS = 4;
+
+/// @brief An RPC awaiting its response
+struct Latency_Rpc {
+    uint32_t requestId;
+    uint32_t receivedAt;  // micros()
+    uint32_t actuatedAt;  // micros()
+    bool pending;
+};
+
+Latency_Histogram Latency_stages[static_cast<size_t>(Latency_Stage::COUNT)];
+// micros() the packet whose callback runs was received
+uint32_t Latency_receivedAt = 0;
+Latency_Rpc Latency_pendingRpcs[LATENCY_PENDING_RPCS] = {};
+size_t Latency_nextRpc = 0;
+// Set while a synthetic request of the latency benchmark is handled, see Latency_Benchmark.h,
+// its stages are not the device's and are not recorded
+bool Latency_synthetic = false;
+
+void Latency_record(Latency_Stage stage, uint32_t latency)
+{
+    if (Latency_synthetic) {
+        return;
+    }
+    Latency_stages[static_cast<size_t>(stage)].add(latency);
+}
+
+/// @brief A callback starts on the packet the transport read last, record how long it waited
+/// @return micros() of the dispatch
+uint32_t Latency_dispatched(Latency_Stage stage)
+{
+    const uint32_t now = micros();
+    const uint32_t readAt = WiFi_client.receivedAt();
+    const uint32_t readableAt = Events_rxAt;
+    Latency_receivedAt = readAt;
+    // Cleared when the watcher is armed, set only if the packet arrived while the task waited
+    if (readableAt != 0 && static_cast<int32_t>(readAt - readableAt) >= 0) {
+        Latency_record(Latency_Stage::MQTT_QUEUE, readAt - readableAt);
+        Latency_receivedAt = readableAt;
+    }
+    Latency_record(stage, now - readAt);
+    return now;
+}
+
+/// @brief Request id at the end of an RPC topic
+/// @return false if the topic does not start with the prefix
+bool Latency_requestId(const char* topic, size_t topicLength, const char* prefix,
+                       uint32_t& requestId)
+{
+    const size_t prefixLength = strlen(prefix);
+    if (topicLength <= prefixLength || strncmp(topic, prefix, prefixLength) != 0) {
+        return false;
+    }
+    requestId = 0;
+    for (size_t i = prefixLength; i < topicLength; i++) {
+        if (topic[i] < '0' || topic[i] > '9') {
+            return false;
+        }
+        requestId = requestId * 10 + (topic[i] - '0');
+    }
+    return true;
+}
+
+/// @brief The switch_set callback drove its outputs, its response is written next
+void Latency_actuated(uint32_t dispatchedAt)
+{
+    if (Latency_synthetic) {
+        return;
+    }
+    const uint32_t now = micros();
+    Latency_record(Latency_Stage::RPC_ACTUATE, now - dispatchedAt);
+    const char* topic = WiFi_client.receivedTopic();
+    uint32_t requestId;
+    if (!Latency_requestId(topic, strlen(topic), RPC_REQUEST_TOPIC_PREFIX, requestId)) {
+        return;
+    }
+    Latency_pendingRpcs[Latency_nextRpc] = {requestId, Latency_receivedAt, now, true};
+    Latency_nextRpc = (Latency_nextRpc + 1) % LATENCY_PENDING_RPCS;
+}
+
+/// @brief A PUBLISH was written, if it is the response to an actuated RPC record its last stage,
+/// see MQTT_Transport::observePublishes()
+void Latency_published(const char* topic, size_t topicLength)
+{
+    uint32_t requestId;
+    if (!Latency_requestId(topic, topicLength, RPC_RESPONSE_TOPIC_PREFIX, requestId)) {
+        return;
+    }
+    const uint32_t now = micros();
+    for (Latency_Rpc& rpc : Latency_pendingRpcs) {
+        if (rpc.pending && rpc.requestId == requestId) {
+            Latency_record(Latency_Stage::RPC_RESPOND, now - rpc.actuatedAt);
+            Latency_record(Latency_Stage::RPC_TOTAL, now - rpc.receivedAt);
+            rpc.pending = false;
+            return;
+        }
+    }
+}
+
+/// @brief The shared attribute callback applied the update
+void Latency_applied(uint32_t dispatchedAt)
+{
+    const uint32_t now = micros();
+    Latency_record(Latency_Stage::ATTR_APPLY, now - dispatchedAt);
+    Latency_record(Latency_Stage::ATTR_TOTAL, now - Latency_receivedAt);
+}
+
+/// @brief Print the stages measured since the last report, add their count, p50 and p99 to the
+/// batch and start over
+void Latency_report(Telemetry_Batch& batch)
+{
+    for (size_t i = 0; i < static_cast<size_t>(Latency_Stage::COUNT); i++) {
+        Latency_Histogram& histogram = Latency_stages[i];
+        if (histogram.count() == 0) {
+            continue;
+        }
+        const uint32_t p50 = histogram.percentile(50);
+        const uint32_t p99 = histogram.percentile(99);
+        Serial.printf("Latency %-13s %5u samples, p50 %7u us, p99 %7u us, max %7u us\n",
+                      LATENCY_STAGE_KEYS[i], static_cast<unsigned>(histogram.count()),
+                      static_cast<unsigned>(p50), static_cast<unsigned>(p99),
+                      static_cast<unsigned>(histogram.max()));
+        char key[40];
+        snprintf(key, sizeof(key), "%s_count", LATENCY_STAGE_KEYS[i]);
+        batch.add(key, histogram.count());
+        snprintf(key, sizeof(key), "%s_p50_us", LATENCY_STAGE_KEYS[i]);
+        batch.add(key, p50);
+        snprintf(key, sizeof(key), "%s_p99_us", LATENCY_STAGE_KEYS[i]);
+        batch.add(key, p99);
+        histogram.reset();
+    }
+}
+
+#endif  // _LATENCY_HISTOGRAM_H
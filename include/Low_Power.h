@@ -0,0 +1,207 @@
+#ifndef _LOW_POWER_H
+#define _LOW_POWER_H
+
+#include <Arduino.h>
+
+//
+// Duty cycled deep sleep mode, build with -DLOW_POWER_MODE=1 to enable. The device wakes every
+// LOW_POWER_SAMPLE_INTERVAL, takes a sample into RTC memory and goes back to sleep without
+// starting WiFi. Every LOW_POWER_UPLOAD_WAKES wakes, or when the RTC buffer is full, the normal
+// tasks are started to upload the retained samples and the device sleeps again once they are sent.
+//
+#ifdef LOW_POWER_MODE
+
+#include <esp_sleep.h>
+
+#include "Telemetry_Batch.h"
+#include "Telemetry_Buffer.h"
+
+#ifndef LOW_POWER_SAMPLE_INTERVAL
+#define LOW_POWER_SAMPLE_INTERVAL 30000  // 30 seconds
+#endif
+#ifndef LOW_POWER_UPLOAD_WAKES
+#define LOW_POWER_UPLOAD_WAKES 10
+#endif
+// An upload wake gives up after this long, the unsent samples are kept for the next one
+#ifndef LOW_POWER_UPLOAD_TIMEOUT
+#define LOW_POWER_UPLOAD_TIMEOUT 30000  // 30 seconds
+#endif
+#ifndef LOW_POWER_RTC_CAPACITY
+#define LOW_POWER_RTC_CAPACITY 64
+#endif
+
+// Supply and currents used to estimate the energy per sample, measure them for the board in use
+#ifndef LOW_POWER_SUPPLY_MV
+#define LOW_POWER_SUPPLY_MV 3300
+#endif
+#ifndef LOW_POWER_CPU_MA
+#define LOW_POWER_CPU_MA 25  // Awake with the radio off
+#endif
+#ifndef LOW_POWER_RADIO_MA
+#define LOW_POWER_RADIO_MA 100  // Awake with WiFi connected, also the always-on figure
+#endif
+#ifndef LOW_POWER_SLEEP_UA
+#define LOW_POWER_SLEEP_UA 10
+#endif
+
+// Time for the TCP stack to send the last messages before the radio is powered down
+constexpr uint32_t LOW_POWER_LINGER = 100;  // 100 milliseconds
+
+constexpr uint32_t LOW_POWER_MAGIC = 0x4c504d31;  // "LPM1"
+
+struct Low_Power_State {
+    uint32_t magic;
+    uint32_t wakes;
+    // Milliseconds since the first boot, millis() restarts on every wake
+    uint32_t clock;
+    // Sleep and sample wake time since the last upload wake, and how many samples were taken
+    uint32_t sleepMs;
+    uint32_t cpuAwakeMs;
+    uint32_t samples;
+    // Time awake of the last upload wake, it is only known once the device went to sleep and is
+    // used as the estimate for the current one
+    uint32_t lastUploadMs;
+    uint32_t count;
+    Telemetry_Sample buffer[LOW_POWER_RTC_CAPACITY];  // Timestamps on the clock above
+};
+
+RTC_DATA_ATTR Low_Power_State Low_Power_state = {};
+
+// Whether this wake uploads, decided in Low_Power_begin()
+bool Low_Power_upload = false;
+
+/// @brief Milliseconds since the first boot
+uint32_t Low_Power_now() { return Low_Power_state.clock + millis(); }
+
+/// @brief Account for the wake, call first thing in setup()
+/// @return true if this wake uploads and the tasks have to be started
+bool Low_Power_begin()
+{
+    Low_Power_State& state = Low_Power_state;
+    if (state.magic != LOW_POWER_MAGIC ||
+        esp_sleep_get_wakeup_cause() != ESP_SLEEP_WAKEUP_TIMER) {
+        // Power on or reset, upload right away to get provisioned and in sync
+        state = {};
+        state.magic = LOW_POWER_MAGIC;
+        Low_Power_upload = true;
+    } else {
+        state.wakes++;
+        Low_Power_upload = state.wakes % LOW_POWER_UPLOAD_WAKES == 0 ||
+                           state.count + 1 >= LOW_POWER_RTC_CAPACITY;
+    }
+    return Low_Power_upload;
+}
+
+/// @brief Keep a sample in RTC memory, the oldest one is dropped when the buffer is full
+/// @param sample Sample stamped with Low_Power_now()
+void Low_Power_retain(const Telemetry_Sample& sample)
+{
+    Low_Power_State& state = Low_Power_state;
+    if (state.count == LOW_POWER_RTC_CAPACITY) {
+        memmove(&state.buffer[0], &state.buffer[1],
+                (LOW_POWER_RTC_CAPACITY - 1) * sizeof(Telemetry_Sample));
+        state.count--;
+    }
+    state.buffer[state.count++] = sample;
+}
+
+/// @brief Retain the sample taken on this wake
+void Low_Power_store(const Telemetry_Sample& sample)
+{
+    Low_Power_retain(sample);
+    Low_Power_state.samples++;
+}
+
+/// @brief Move the retained samples into the telemetry buffer for upload
+template <typename Buffer>
+void Low_Power_restore(Buffer& buffer)
+{
+    Low_Power_State& state = Low_Power_state;
+    const uint32_t now = Low_Power_now();
+    for (uint32_t i = 0; i < state.count; i++) {
+        Telemetry_Sample sample = state.buffer[i];
+        // Back to the millis() of this wake, older samples wrap around like in the buffer
+        sample.timestamp = millis() - (now - sample.timestamp);
+        buffer.push(sample);
+    }
+    Serial.printf("Low power: uploading %u sample(s) taken over %u wake(s)\n",
+                  static_cast<unsigned>(state.count), static_cast<unsigned>(state.samples));
+    state.count = 0;
+}
+
+/// @brief Estimated energy in microjoules
+uint64_t Low_Power_energyUj(uint64_t cpuMs, uint64_t radioMs, uint64_t sleepMs)
+{
+    const uint64_t uj = LOW_POWER_CPU_MA * cpuMs + LOW_POWER_RADIO_MA * radioMs +
+                        LOW_POWER_SLEEP_UA * sleepMs / 1000U;
+    return uj * LOW_POWER_SUPPLY_MV / 1000U;
+}
+
+/// @brief Print and add the figures of the last completed upload cycle, once per upload wake
+void Low_Power_report(Telemetry_Batch& batch)
+{
+    const Low_Power_State& state = Low_Power_state;
+    if (state.samples == 0) {
+        return;
+    }
+    const uint32_t energy =
+        Low_Power_energyUj(state.cpuAwakeMs, state.lastUploadMs, state.sleepMs) / state.samples;
+    const uint32_t alwaysOn = Low_Power_energyUj(0, LOW_POWER_SAMPLE_INTERVAL, 0);
+    Serial.printf("Low power: %u uJ per sample (always on %u uJ), last upload awake %u ms\n",
+                  static_cast<unsigned>(energy), static_cast<unsigned>(alwaysOn),
+                  static_cast<unsigned>(state.lastUploadMs));
+    batch.add("lp_energy_per_sample_uj", energy);
+    batch.add("lp_upload_awake_ms", state.lastUploadMs);
+    batch.add("lp_sample_awake_ms", state.cpuAwakeMs / state.samples);
+}
+
+/// @brief Milliseconds left until the upload wake times out
+uint32_t Low_Power_uploadRemaining()
+{
+    const uint32_t now = millis();
+    return now < LOW_POWER_UPLOAD_TIMEOUT ? LOW_POWER_UPLOAD_TIMEOUT - now : 0;
+}
+
+/// @brief Whether the upload wake should end, either everything was sent or it took too long
+bool Low_Power_uploadFinished(bool sent) { return sent || Low_Power_uploadRemaining() == 0; }
+
+/// @brief Keep the samples an upload did not send, then sleep until the next sample is due
+template <typename Buffer>
+void Low_Power_sleep(Buffer& buffer)
+{
+    Low_Power_State& state = Low_Power_state;
+    const uint32_t now = Low_Power_now();
+
+    Telemetry_Sample sample;
+    while (buffer.peek(&sample, 1) == 1) {
+        buffer.pop(1);
+        sample.timestamp = now - (millis() - sample.timestamp);
+        // Oldest first, so the newest are kept when they do not all fit
+        Low_Power_retain(sample);
+    }
+
+    const uint32_t awake = millis();
+    if (Low_Power_upload) {
+        // A new cycle starts, this upload is accounted to it on the next upload
+        state.lastUploadMs = awake;
+        state.sleepMs = 0;
+        state.cpuAwakeMs = 0;
+        state.samples = 0;
+    } else {
+        state.cpuAwakeMs += awake;
+    }
+    const uint32_t sleep =
+        awake + 10 < LOW_POWER_SAMPLE_INTERVAL ? LOW_POWER_SAMPLE_INTERVAL - awake : 10;
+    state.sleepMs += sleep;
+    state.clock += awake + sleep;
+
+    Serial.printf("Low power: awake %u ms, sleeping %u ms\n", static_cast<unsigned>(awake),
+                  static_cast<unsigned>(sleep));
+    Serial.flush();
+    esp_sleep_enable_timer_wakeup(static_cast<uint64_t>(sleep) * 1000U);
+    esp_deep_sleep_start();
+}
+
+#endif  // LOW_POWER_MODE
+
+#endif  // _LOW_POWER_H
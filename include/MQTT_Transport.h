@@ -0,0 +1,624 @@
+#ifndef _MQTT_TRANSPORT_H
+#define _MQTT_TRANSPORT_H
+
+#include <Arduino.h>
+#include <WiFiClient.h>
+
+#include <algorithm>
+
+#include "Json_Filter.h"
+#include "TLS_Transport.h"
+
+//
+// Transport of the MQTT client, a WiFiClient or with MQTT_TLS a TLS_Transport, that follows the
+// packet framing of what the MQTT client reads. It records how the last connection attempt went,
+// so failures can be told apart, and collects the PUBACKs of QoS 1 publishes, which the MQTT
+// client ignores.
+//
+// PUBLISH packets on the topics given to filter() are read ahead and their JSON payload is run
+// through a Json_Filter as it arrives, the MQTT client receives the packet with only the wanted
+// members. Its receive buffer then only has to hold MQTT_FILTERED_PACKET_SIZE, however large the
+// attribute documents on the server are.
+//
+// PUBLISH packets on the topic given to divert() never reach the MQTT client, their payload is
+// handed to an MQTT_Payload_Sink as it arrives, for binary payloads larger than any buffer, e.g.
+// firmware chunks.
+//
+// The outbound packets are followed as well, the observer given to observePublishes() is told of
+// every PUBLISH once it was written whole, e.g. to time the responses to RPCs.
+//
+constexpr uint8_t MQTT_CONNACK = 0x20;
+constexpr uint8_t MQTT_PUBLISH = 0x30;
+constexpr uint8_t MQTT_PUBACK = 0x40;
+constexpr uint8_t MQTT_PUBLISH_QOS_MASK = 0x06;
+constexpr uint8_t MQTT_CONNACK_BAD_CREDENTIALS = 4;
+constexpr uint8_t MQTT_CONNACK_NOT_AUTHORIZED = 5;
+
+// PUBACKs not yet taken by the publish pipeline, the oldest is dropped when it is full
+constexpr size_t MQTT_ACK_QUEUE_SIZE = 16;
+
+// Largest filtered packet, header and topic included
+constexpr size_t MQTT_FILTERED_PACKET_SIZE = 512;
+// Topics of filtered packets are at most this long, others are passed through
+constexpr size_t MQTT_FILTER_TOPIC_SIZE = 64;
+constexpr size_t MQTT_FILTER_TOPICS_MAX = 4;
+
+/// @brief Receives the payloads of diverted packets, see MQTT_Transport::divert()
+class MQTT_Payload_Sink {
+   public:
+    /// @brief A payload starts
+    /// @return false to skip it
+    virtual bool open(const char* topic, size_t topicLength, size_t length) = 0;
+    /// @brief The next bytes of the payload
+    virtual void write(const uint8_t* data, size_t length) = 0;
+    /// @brief The payload is complete, not called if the connection was lost before
+    virtual void close() = 0;
+};
+
+/// @brief Told of a PUBLISH written whole, see MQTT_Transport::observePublishes()
+using MQTT_Publish_Observer = void (*)(const char* topic, size_t topicLength);
+
+#ifdef MQTT_TLS
+using MQTT_Socket = TLS_Transport;
+#else
+using MQTT_Socket = WiFiClient;
+#endif
+
+class MQTT_Transport : public MQTT_Socket {
+   public:
+    using MQTT_Socket::connect;
+    using MQTT_Socket::read;
+    using MQTT_Socket::write;
+
+    int connect(IPAddress ip, uint16_t port) override
+    {
+        return recordAttempt(MQTT_Socket::connect(ip, port));
+    }
+
+    int connect(const char* host, uint16_t port) override
+    {
+        if (m_resolvedHost != nullptr && strcmp(host, m_resolvedHost) == 0) {
+            m_resolvedHost = nullptr;
+#ifdef MQTT_TLS
+            // The certificate is still verified against the name
+            return recordAttempt(MQTT_Socket::connect(m_resolvedIp, host, port));
+#else
+            return recordAttempt(MQTT_Socket::connect(m_resolvedIp, port));
+#endif
+        }
+        return recordAttempt(MQTT_Socket::connect(host, port));
+    }
+
+    /// @brief Connect the next connect() to host to an address resolved beforehand, the MQTT
+    /// client only passes the name on
+    void resolved(const char* host, IPAddress ip)
+    {
+        m_resolvedHost = host;
+        m_resolvedIp = ip;
+    }
+
+    int available() override
+    {
+        if (m_inSocket) {
+            // Called back from within the socket
+            return MQTT_Socket::available();
+        }
+        pump();
+        if (m_outPosition < m_outLength) {
+            return m_outLength - m_outPosition;
+        }
+        return m_passRemaining > 0 ? std::min<int>(MQTT_Socket::available(), m_passRemaining) : 0;
+    }
+
+    int read() override
+    {
+        // The socket read() may itself call the virtual read() below, the byte is inspected once
+        uint8_t c;
+        return read(&c, 1) == 1 ? c : -1;
+    }
+
+    int read(uint8_t* buffer, size_t size) override
+    {
+        if (m_inSocket) {
+            return MQTT_Socket::read(buffer, size);
+        }
+        pump();
+        int count = -1;
+        if (m_outPosition < m_outLength) {
+            count = std::min(size, m_outLength - m_outPosition);
+            memcpy(buffer, m_out + m_outPosition, count);
+            m_outPosition += count;
+        } else if (m_passRemaining > 0) {
+            count = socketRead(buffer, std::min<size_t>(size, m_passRemaining));
+            if (count > 0) {
+                m_passRemaining -= count;
+            }
+        }
+        if (count > 0) {
+            inspect(buffer, count);
+        }
+        return count;
+    }
+
+    size_t write(const uint8_t* buffer, size_t size) override
+    {
+        const size_t written = MQTT_Socket::write(buffer, size);
+        if (m_publishObserver != nullptr) {
+            follow(buffer, written);
+        }
+        return written;
+    }
+
+    void stop() override
+    {
+        MQTT_Socket::stop();
+        // A packet cut short by the close is not continued by what is written next
+        m_sendState = Frame_State::HEADER;
+    }
+
+    /// @brief micros() when the first byte of the last filtered packet was read
+    uint32_t receivedAt() const { return m_receivedAt; }
+
+    /// @brief Topic of the last filtered packet
+    const char* receivedTopic() const { return m_receivedTopic; }
+
+    /// @brief Tell the observer of every PUBLISH packet once it was written whole
+    void observePublishes(MQTT_Publish_Observer observer) { m_publishObserver = observer; }
+
+    /// @brief Filter the JSON payload of PUBLISH packets whose topic starts with one of the given
+    /// prefixes, keeping the members keep() wants
+    void filter(const char* const* prefixes, size_t count, Json_Filter::Keep_Function keep)
+    {
+        m_prefixCount = std::min(count, MQTT_FILTER_TOPICS_MAX);
+        for (size_t i = 0; i < m_prefixCount; i++) {
+            m_prefixes[i] = prefixes[i];
+        }
+        m_keep = keep;
+    }
+
+    /// @brief Hand the payload of PUBLISH packets whose topic starts with the given prefix to the
+    /// sink instead of the MQTT client
+    void divert(const char* prefix, MQTT_Payload_Sink* sink)
+    {
+        m_divertPrefix = prefix;
+        m_sink = sink;
+    }
+
+    /// @brief Bytes received and not read by the MQTT client yet, they do not make the socket
+    /// readable again
+    size_t buffered() const
+    {
+        size_t pending = m_outLength - m_outPosition;
+#ifdef MQTT_TLS
+        pending += MQTT_Socket::buffered();
+#endif
+        return pending;
+    }
+
+    /// @brief Whether the TCP connection of the last attempt was established
+    bool tcpConnected() const { return m_tcpConnected; }
+
+    /// @brief Return code of the CONNACK of the last attempt, -1 if none was received
+    int connackCode() const { return m_connackCode; }
+
+    bool authRefused() const
+    {
+        return connackCode() == MQTT_CONNACK_BAD_CREDENTIALS ||
+               connackCode() == MQTT_CONNACK_NOT_AUTHORIZED;
+    }
+
+    /// @brief Take the packet id of the oldest PUBACK received
+    /// @return false if there is none
+    bool takeAck(uint16_t& packetId)
+    {
+        if (m_ackCount == 0) {
+            return false;
+        }
+        packetId = m_acks[m_ackHead];
+        m_ackHead = (m_ackHead + 1) % MQTT_ACK_QUEUE_SIZE;
+        m_ackCount--;
+        return true;
+    }
+
+    /// @brief Print the filtered packets and bytes since the last call, and the TLS statistics
+    void printStats()
+    {
+#ifdef MQTT_TLS
+        MQTT_Socket::printStats();
+#endif
+        Serial.printf("MQTT filter: %u packet(s), %u of %u bytes kept, %u dropped, %u diverted\n",
+                      static_cast<unsigned>(m_filtered), static_cast<unsigned>(m_filteredOut),
+                      static_cast<unsigned>(m_filteredIn), static_cast<unsigned>(m_dropped),
+                      static_cast<unsigned>(m_diverted));
+        m_diverted = 0;
+        m_filtered = 0;
+        m_filteredIn = 0;
+        m_filteredOut = 0;
+        m_dropped = 0;
+    }
+
+   private:
+    enum class Frame_State : uint8_t { HEADER, LENGTH, BODY };
+    enum class Read_State : uint8_t { HEADER, LENGTH, TOPIC, FILTER, DIVERT };
+
+    int recordAttempt(int result)
+    {
+        m_tcpConnected = result != 0;
+        m_connackCode = -1;
+        m_state = Frame_State::HEADER;
+        m_ackCount = 0;
+        m_readState = Read_State::HEADER;
+        m_outPosition = 0;
+        m_outLength = 0;
+        m_passRemaining = 0;
+        m_sinkOpen = false;
+        m_sendState = Frame_State::HEADER;
+        return result;
+    }
+
+    /// @brief Read from the socket, whose read() may call the virtual available() and read()
+    int socketRead(uint8_t* buffer, size_t size)
+    {
+        m_inSocket = true;
+        const int count = MQTT_Socket::read(buffer, size);
+        m_inSocket = false;
+        return count;
+    }
+
+    /// @brief Read the start of the next packet from the socket once the last one was delivered,
+    /// until it is known whether it is passed through or filtered
+    void pump()
+    {
+        while (m_outPosition == m_outLength && m_passRemaining == 0) {
+            if (m_readState == Read_State::FILTER || m_readState == Read_State::DIVERT) {
+                if (!(m_readState == Read_State::FILTER ? filterBody() : divertBody())) {
+                    return;
+                }
+                continue;
+            }
+            uint8_t byte;
+            if (socketRead(&byte, 1) != 1) {
+                return;
+            }
+            m_head[m_headLength++] = byte;
+            switch (m_readState) {
+                case Read_State::HEADER:
+                    m_packetStart = micros();
+                    m_bodyRemaining = 0;
+                    m_readShift = 0;
+                    m_readState = Read_State::LENGTH;
+                    break;
+                case Read_State::LENGTH:
+                    if (m_readShift == 21 && (byte & 0x80) != 0) {
+                        // The remaining length has at most four bytes, the stream is corrupt
+                        Serial.println("MQTT remaining length over four bytes, disconnecting");
+                        m_headLength = 0;
+                        m_readState = Read_State::HEADER;
+                        stop();
+                        return;
+                    }
+                    m_bodyRemaining |= static_cast<uint32_t>(byte & 0x7F) << m_readShift;
+                    m_readShift += 7;
+                    if ((byte & 0x80) == 0) {
+                        const bool filterable = (m_prefixCount > 0 || m_sink != nullptr) &&
+                                                (m_head[0] & 0xF0) == MQTT_PUBLISH &&
+                                                (m_head[0] & MQTT_PUBLISH_QOS_MASK) == 0 &&
+                                                m_bodyRemaining > 2;
+                        m_topicStart = m_headLength;
+                        if (filterable) {
+                            m_readState = Read_State::TOPIC;
+                        } else {
+                            passThrough();
+                        }
+                    }
+                    break;
+                case Read_State::TOPIC:
+                    m_bodyRemaining--;
+                    readTopic();
+                    break;
+                case Read_State::FILTER:
+                case Read_State::DIVERT:
+                    break;
+            }
+        }
+    }
+
+    /// @brief Decide on the packet once its topic has been read
+    void readTopic()
+    {
+        const size_t read = m_headLength - m_topicStart;
+        if (read < 2) {
+            return;
+        }
+        const size_t topicLength = m_head[m_topicStart] << 8 | m_head[m_topicStart + 1];
+        if (read == 2 && (topicLength >= MQTT_FILTER_TOPIC_SIZE || topicLength > m_bodyRemaining)) {
+            passThrough();
+            return;
+        }
+        if (read < 2 + topicLength) {
+            return;
+        }
+        const char* topic = reinterpret_cast<const char*>(m_head + m_topicStart + 2);
+        if (m_sink != nullptr && strlen(m_divertPrefix) <= topicLength &&
+            memcmp(topic, m_divertPrefix, strlen(m_divertPrefix)) == 0) {
+            m_sinkOpen = m_sink->open(topic, topicLength, m_bodyRemaining);
+            m_headLength = 0;
+            m_readState = Read_State::DIVERT;
+            return;
+        }
+        bool matches = false;
+        for (size_t i = 0; i < m_prefixCount && !matches; i++) {
+            const size_t prefixLength = strlen(m_prefixes[i]);
+            matches =
+                prefixLength <= topicLength && memcmp(topic, m_prefixes[i], prefixLength) == 0;
+        }
+        if (!matches) {
+            passThrough();
+            return;
+        }
+        // Leave room for the fixed header and the topic, they are written before the payload
+        // once its length is known
+        m_payloadStart = 5 + 2 + topicLength;
+        m_filterIn = m_bodyRemaining;
+        m_filter.begin(m_keep, reinterpret_cast<char*>(m_out) + m_payloadStart,
+                       sizeof(m_out) - m_payloadStart);
+        m_readState = Read_State::FILTER;
+    }
+
+    /// @brief Deliver the bytes read ahead and the rest of the packet unchanged
+    void passThrough()
+    {
+        memcpy(m_out, m_head, m_headLength);
+        m_outPosition = 0;
+        m_outLength = m_headLength;
+        m_passRemaining = m_bodyRemaining;
+        m_headLength = 0;
+        m_readState = Read_State::HEADER;
+    }
+
+    /// @brief Feed what arrived of the payload to the filter, the packet is delivered once it is
+    /// complete
+    /// @return false if the socket has nothing more for now
+    bool filterBody()
+    {
+        uint8_t chunk[64];
+        while (m_bodyRemaining > 0) {
+            const int count =
+                socketRead(chunk, std::min<size_t>(sizeof(chunk), m_bodyRemaining));
+            if (count <= 0) {
+                return false;
+            }
+            m_filter.feed(chunk, count);
+            m_bodyRemaining -= count;
+        }
+
+        const size_t topicLength = m_headLength - m_topicStart - 2;
+        const size_t payloadLength = m_filter.finish();
+        m_headLength = 0;
+        m_readState = Read_State::HEADER;
+        if (payloadLength == 0) {
+            Serial.printf("MQTT message of %u bytes on %.*s %s, dropped\n",
+                          static_cast<unsigned>(m_filterIn), static_cast<int>(topicLength),
+                          reinterpret_cast<const char*>(m_head + m_topicStart + 2),
+                          m_filter.overflowed() ? "too large after filtering" : "malformed");
+            m_dropped++;
+            return true;
+        }
+
+        // Right aligned before the payload: type, remaining length, topic length and topic
+        size_t position = m_payloadStart - topicLength;
+        memcpy(m_out + position, m_head + m_topicStart + 2, topicLength);
+        m_out[--position] = topicLength & 0xFF;
+        m_out[--position] = topicLength >> 8;
+        const uint32_t remaining = 2 + topicLength + payloadLength;
+        uint8_t length[4];
+        size_t lengthBytes = 0;
+        for (uint32_t value = remaining; lengthBytes == 0 || value > 0; value >>= 7) {
+            length[lengthBytes++] = (value & 0x7F) | (value > 0x7F ? 0x80 : 0);
+        }
+        position -= lengthBytes;
+        memcpy(m_out + position, length, lengthBytes);
+        m_out[--position] = m_head[0];
+        m_outPosition = position;
+        m_outLength = m_payloadStart + payloadLength;
+
+        m_receivedAt = m_packetStart;
+        memcpy(m_receivedTopic, m_head + m_topicStart + 2, topicLength);
+        m_receivedTopic[topicLength] = '\0';
+        m_filtered++;
+        m_filteredIn += m_filterIn;
+        m_filteredOut += payloadLength;
+        return true;
+    }
+
+    /// @brief Hand what arrived of the payload to the sink, or drop it if the sink skipped it
+    /// @return false if the socket has nothing more for now
+    bool divertBody()
+    {
+        uint8_t chunk[256];
+        while (m_bodyRemaining > 0) {
+            const int count =
+                socketRead(chunk, std::min<size_t>(sizeof(chunk), m_bodyRemaining));
+            if (count <= 0) {
+                return false;
+            }
+            if (m_sinkOpen) {
+                m_sink->write(chunk, count);
+            }
+            m_bodyRemaining -= count;
+        }
+        if (m_sinkOpen) {
+            m_sink->close();
+            m_sinkOpen = false;
+        }
+        m_diverted++;
+        m_readState = Read_State::HEADER;
+        return true;
+    }
+
+    /// @brief Follow the framing of the outbound packets, only the topic of a PUBLISH is kept
+    void follow(const uint8_t* data, size_t length)
+    {
+        size_t i = 0;
+        while (i < length) {
+            const uint8_t byte = data[i];
+            switch (m_sendState) {
+                case Frame_State::HEADER:
+                    m_sendType = byte & 0xF0;
+                    m_sendRemaining = 0;
+                    m_sendShift = 0;
+                    m_sendBody = 0;
+                    m_sendState = Frame_State::LENGTH;
+                    i++;
+                    break;
+                case Frame_State::LENGTH:
+                    m_sendRemaining |= static_cast<uint32_t>(byte & 0x7F) << m_sendShift;
+                    m_sendShift += 7;
+                    i++;
+                    if ((byte & 0x80) == 0) {
+                        m_sendState = Frame_State::BODY;
+                    }
+                    break;
+                case Frame_State::BODY: {
+                    const size_t count = std::min<size_t>(length - i, m_sendRemaining);
+                    if (m_sendBody < sizeof(m_sendHead)) {
+                        memcpy(m_sendHead + m_sendBody, data + i,
+                               std::min(count, sizeof(m_sendHead) - m_sendBody));
+                    }
+                    m_sendBody += count;
+                    m_sendRemaining -= count;
+                    i += count;
+                    break;
+                }
+            }
+            if (m_sendState == Frame_State::BODY && m_sendRemaining == 0) {
+                sent();
+                m_sendState = Frame_State::HEADER;
+            }
+        }
+    }
+
+    /// @brief An outbound packet was written whole
+    void sent()
+    {
+        if (m_sendType != MQTT_PUBLISH || m_sendBody < 2) {
+            return;
+        }
+        const size_t topicLength = m_sendHead[0] << 8 | m_sendHead[1];
+        if (topicLength <= std::min(m_sendBody, sizeof(m_sendHead)) - 2) {
+            m_publishObserver(reinterpret_cast<const char*>(m_sendHead + 2), topicLength);
+        }
+    }
+
+    /// @brief Follow the framing of the inbound packets, only the first bytes of a body are kept
+    void inspect(const uint8_t* data, size_t length)
+    {
+        for (size_t i = 0; i < length; i++) {
+            const uint8_t byte = data[i];
+            switch (m_state) {
+                case Frame_State::HEADER:
+                    m_type = byte & 0xF0;
+                    m_remaining = 0;
+                    m_lengthShift = 0;
+                    m_bodyLength = 0;
+                    m_state = Frame_State::LENGTH;
+                    break;
+                case Frame_State::LENGTH:
+                    m_remaining |= static_cast<uint32_t>(byte & 0x7F) << m_lengthShift;
+                    m_lengthShift += 7;
+                    if ((byte & 0x80) == 0) {
+                        m_state = m_remaining == 0 ? Frame_State::HEADER : Frame_State::BODY;
+                    }
+                    break;
+                case Frame_State::BODY:
+                    if (m_bodyLength < sizeof(m_body)) {
+                        m_body[m_bodyLength++] = byte;
+                    }
+                    if (--m_remaining == 0) {
+                        packetReceived();
+                        m_state = Frame_State::HEADER;
+                    }
+                    break;
+            }
+        }
+    }
+
+    void packetReceived()
+    {
+        if (m_type == MQTT_CONNACK && m_bodyLength >= 2) {
+            m_connackCode = m_body[1];
+        } else if (m_type == MQTT_PUBACK && m_bodyLength >= 2) {
+            if (m_ackCount == MQTT_ACK_QUEUE_SIZE) {
+                // Unacknowledged publishes are retransmitted, nothing is lost
+                m_ackHead = (m_ackHead + 1) % MQTT_ACK_QUEUE_SIZE;
+                m_ackCount--;
+            }
+            m_acks[(m_ackHead + m_ackCount) % MQTT_ACK_QUEUE_SIZE] =
+                static_cast<uint16_t>(m_body[0] << 8 | m_body[1]);
+            m_ackCount++;
+        }
+    }
+
+    bool m_tcpConnected = false;
+    int m_connackCode = -1;
+    // See resolved()
+    const char* m_resolvedHost = nullptr;
+    IPAddress m_resolvedIp;
+
+    Frame_State m_state = Frame_State::HEADER;
+    uint8_t m_type = 0;
+    uint32_t m_remaining = 0;
+    uint8_t m_lengthShift = 0;
+    uint8_t m_body[4] = {};
+    size_t m_bodyLength = 0;
+
+    uint16_t m_acks[MQTT_ACK_QUEUE_SIZE] = {};
+    size_t m_ackHead = 0;
+    size_t m_ackCount = 0;
+
+    // Read ahead of the packets
+    bool m_inSocket = false;
+    Read_State m_readState = Read_State::HEADER;
+    uint8_t m_head[5 + 2 + MQTT_FILTER_TOPIC_SIZE] = {};
+    size_t m_headLength = 0;
+    uint32_t m_bodyRemaining = 0;
+    uint8_t m_readShift = 0;
+    size_t m_topicStart = 0;
+    size_t m_passRemaining = 0;
+
+    // Filtered packet, or the bytes read ahead of a packet passed through
+    uint8_t m_out[MQTT_FILTERED_PACKET_SIZE] = {};
+    size_t m_outPosition = 0;
+    size_t m_outLength = 0;
+    size_t m_payloadStart = 0;
+    uint32_t m_filterIn = 0;
+    Json_Filter m_filter;
+    uint32_t m_packetStart = 0;
+    uint32_t m_receivedAt = 0;
+    char m_receivedTopic[MQTT_FILTER_TOPIC_SIZE] = {};
+
+    const char* m_prefixes[MQTT_FILTER_TOPICS_MAX] = {};
+    size_t m_prefixCount = 0;
+    Json_Filter::Keep_Function m_keep = nullptr;
+
+    const char* m_divertPrefix = nullptr;
+    MQTT_Payload_Sink* m_sink = nullptr;
+    bool m_sinkOpen = false;
+
+    // Framing of the outbound packets
+    MQTT_Publish_Observer m_publishObserver = nullptr;
+    Frame_State m_sendState = Frame_State::HEADER;
+    uint8_t m_sendType = 0;
+    uint32_t m_sendRemaining = 0;
+    uint8_t m_sendShift = 0;
+    size_t m_sendBody = 0;
+    uint8_t m_sendHead[2 + MQTT_FILTER_TOPIC_SIZE] = {};
+
+    uint32_t m_filtered = 0;
+    uint32_t m_filteredIn = 0;
+    uint32_t m_filteredOut = 0;
+    uint32_t m_dropped = 0;
+    uint32_t m_diverted = 0;
+};
+
+#endif  // _MQTT_TRANSPORT_H
@@ -0,0 +1,123 @@
+#ifndef _MEMORY_MONITOR_H
+#define _MEMORY_MONITOR_H
+
+#include <Arduino.h>
+#include <esp_heap_caps.h>
+
+#include "Latency_Histogram.h"
+#include "OTA_Update.h"
+#include "Publish_Pipeline.h"
+#include "Telemetry_Batch.h"
+#include "Telemetry_Buffer.h"
+#include "ThingsBoard_Manager.h"
+
+//
+// Memory instrumentation, stack high water marks of the registered tasks and heap statistics
+// are reported as telemetry, the static footprint of the ThingsBoard objects is printed at boot
+//
+constexpr uint8_t MEMORY_MAX_TASKS = 8;
+
+struct Memory_Task {
+    TaskHandle_t handle;
+    uint32_t stackSize;  // Bytes the task was created with
+};
+
+Memory_Task Memory_tasks[MEMORY_MAX_TASKS];
+uint8_t Memory_taskCount = 0;
+
+/// @brief Include a task in the stack reports
+void Memory_watchTask(TaskHandle_t handle, uint32_t stackSize)
+{
+    if (handle == nullptr || Memory_taskCount == MEMORY_MAX_TASKS) {
+        return;
+    }
+    Memory_tasks[Memory_taskCount++] = {handle, stackSize};
+}
+
+/// @brief Sample the stacks and the heap, print them and add them to the batch
+void Memory_report(Telemetry_Batch& batch)
+{
+    const size_t heapFree = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    const size_t heapLargest = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+    const size_t heapMinimum = heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
+    Serial.printf("Heap free %u, largest block %u, minimum free %u bytes\n",
+                  static_cast<unsigned>(heapFree), static_cast<unsigned>(heapLargest),
+                  static_cast<unsigned>(heapMinimum));
+    batch.add("heap_free", heapFree);
+    batch.add("heap_largest_block", heapLargest);
+    batch.add("heap_min_free", heapMinimum);
+
+    for (uint8_t i = 0; i < Memory_taskCount; i++) {
+        // Bytes on ESP-IDF, the high water mark is the least stack ever left unused
+        const uint32_t unused = uxTaskGetStackHighWaterMark(Memory_tasks[i].handle);
+        const char* name = pcTaskGetName(Memory_tasks[i].handle);
+        Serial.printf("Stack %s: %u of %u bytes never used\n", name,
+                      static_cast<unsigned>(unused),
+                      static_cast<unsigned>(Memory_tasks[i].stackSize));
+        char key[40];
+        snprintf(key, sizeof(key), "stack_free_%s", name);
+        batch.add(key, unused);
+    }
+}
+
+//
+// Static memory budget, known at build time
+//
+struct Memory_Budget_Entry {
+    const char* name;
+    size_t size;
+};
+
+constexpr Memory_Budget_Entry MEMORY_BUDGET[] = {
+    {"ThingsBoard_client", sizeof(ThingsBoard_client)},
+    {"MQTT_client", sizeof(MQTT_client)},
+    {"WiFi_client", sizeof(WiFi_client)},
+    {"prov", sizeof(prov)},
+    {"TB_client_rpc", sizeof(TB_client_rpc)},
+    {"TB_server_rpc", sizeof(TB_server_rpc)},
+    {"TB_attribute_request", sizeof(TB_attribute_request)},
+    {"TB_shared_update", sizeof(TB_shared_update)},
+    {"Telemetry_batch", sizeof(Telemetry_batch)},
+    {"Attribute_batch", sizeof(Attribute_batch)},
+    {"Telemetry_buffer", sizeof(Telemetry_buffer)},
+    {"Publish_pipeline", sizeof(Publish_pipeline)},
+    {"OTA_update", sizeof(OTA_update)},
+    {"OTA_progressSetting", sizeof(OTA_progressSetting)},
+    {"Latency_stages", sizeof(Latency_stages)},
+#ifdef MQTT_TLS
+    {"TLS_arena", sizeof(TLS_arena)},
+#ifdef MQTT_TLS_SESSION_RESUMPTION
+    {"TLS_sessionSetting", sizeof(TLS_sessionSetting)},
+#endif
+#endif
+};
+
+constexpr size_t Memory_budgetTotal()
+{
+    size_t total = 0;
+    for (const Memory_Budget_Entry& entry : MEMORY_BUDGET) {
+        total += entry.size;
+    }
+    return total;
+}
+
+// Build with e.g. -DSTATIC_MEMORY_BUDGET=40000 to fail the build when the objects outgrow it
+#ifdef STATIC_MEMORY_BUDGET
+static_assert(Memory_budgetTotal() <= STATIC_MEMORY_BUDGET,
+              "Static ThingsBoard objects exceed STATIC_MEMORY_BUDGET");
+#endif
+
+/// @brief Print the static footprint, the buffers the ThingsBoard client allocates at runtime
+/// are listed separately
+void Memory_printBudget()
+{
+    Serial.println("Static memory budget:");
+    for (const Memory_Budget_Entry& entry : MEMORY_BUDGET) {
+        Serial.printf("  %-22s %6u bytes\n", entry.name, static_cast<unsigned>(entry.size));
+    }
+    Serial.printf("  %-22s %6u bytes\n", "total", static_cast<unsigned>(Memory_budgetTotal()));
+    Serial.printf("  %-22s %6u bytes (heap)\n", "MQTT buffers",
+                  static_cast<unsigned>(MAX_MESSAGE_RECEIVE_SIZE + MAX_MESSAGE_SEND_SIZE));
+}
+
+#endif  // _MEMORY_MONITOR_H
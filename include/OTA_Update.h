@@ -0,0 +1,557 @@
+#ifndef _OTA_UPDATE_H
+#define _OTA_UPDATE_H
+
+#include <Arduino.h>
+#include <esp_ota_ops.h>
+#include <esp_partition.h>
+#include <esp_system.h>
+#include <mbedtls/sha256.h>
+
+#include <algorithm>
+
+#include "MQTT_Transport.h"
+#include "Settings_Store.h"
+#include "Telemetry_Batch.h"
+#include "ThingsBoard_Manager.h"
+
+//
+// Firmware update over the ThingsBoard MQTT firmware API. The fw_* shared attributes describe the
+// firmware assigned on the server, its image is requested in chunks on
+// v2/fw/request/<request id>/chunk/<index> and answered on v2/fw/response/<request id>/chunk/
+// <index>. Up to OTA_WINDOW chunk requests are outstanding, so the download is not bound by one
+// round trip per chunk.
+//
+// The responses are diverted by MQTT_Transport and written to the inactive OTA partition as they
+// arrive, in whatever order. The SHA-256 follows the contiguous part of the image, read back from
+// flash, so it covers what was written before a reboot as well. The progress is persisted every
+// OTA_PROGRESS_INTERVAL bytes, a reboot or a lost connection resumes from there.
+//
+#ifndef OTA_CHUNK_SIZE
+#define OTA_CHUNK_SIZE 4096
+#endif
+#ifndef OTA_WINDOW
+#define OTA_WINDOW 4
+#endif
+#ifndef OTA_FIRMWARE_TITLE
+#define OTA_FIRMWARE_TITLE DEVICE_MODEL
+#endif
+static_assert((OTA_CHUNK_SIZE & (OTA_CHUNK_SIZE - 1)) == 0 && OTA_CHUNK_SIZE >= 256 &&
+                  OTA_CHUNK_SIZE <= 65536,
+              "OTA_CHUNK_SIZE must be a power of two between 256 and 65536");
+static_assert(OTA_WINDOW >= 1 && OTA_WINDOW <= 16, "OTA_WINDOW must be between 1 and 16");
+
+// A chunk request without response is repeated after this long, the update fails after
+// OTA_CHUNK_RETRIES repetitions of the same chunk
+constexpr uint32_t OTA_CHUNK_TIMEOUT = 10000;  // 10 seconds
+constexpr uint8_t OTA_CHUNK_RETRIES = 5;
+// Persisted progress, a multiple of the flash sector and of any chunk size
+constexpr uint32_t OTA_PROGRESS_INTERVAL = 64 * 1024;
+// Time for the UPDATING state to go out before the restart
+constexpr uint32_t OTA_RESTART_DELAY = 2000;  // 2 seconds
+constexpr uint32_t OTA_SECTOR_SIZE = 4096;
+
+constexpr char OTA_CHUNK_RESPONSE_PREFIX[] = "v2/fw/response/";
+constexpr char OTA_CHUNK_RESPONSE_TOPICS[] = "v2/fw/response/+/chunk/+";
+
+constexpr char OTA_PREFS_NAMESPACE[] = "ota";
+constexpr char OTA_PREFS_PROGRESS[] = "progress";
+constexpr uint32_t OTA_PROGRESS_MAGIC = 0x4F544131;  // "OTA1"
+
+/// @brief Firmware assigned on the server, from the fw_* shared attributes
+struct OTA_Firmware {
+    char title[32];
+    char version[32];
+    char checksum[65];  // Hexadecimal
+    char algorithm[16];
+    uint32_t size;
+};
+
+/// @brief Download kept over reboots
+struct OTA_Progress {
+    uint32_t magic;
+    uint32_t partition;  // Address of the partition written
+    uint32_t size;
+    uint32_t chunkSize;
+    uint32_t written;  // Complete and in flash up to here, a multiple of OTA_PROGRESS_INTERVAL
+    uint8_t checksum[32];
+    char title[32];
+    char version[32];
+};
+
+Settings_Store OTA_settings(OTA_PREFS_NAMESPACE);
+Setting<OTA_Progress> OTA_progressSetting(OTA_settings, OTA_PREFS_PROGRESS, OTA_Progress{});
+
+enum class OTA_State : uint8_t { IDLE, DOWNLOADING, UPDATING, FAILED };
+
+class OTA_Update : public MQTT_Payload_Sink {
+   public:
+    explicit OTA_Update(MQTT_Transport& transport) : m_transport(transport) {}
+
+    /// @brief Load the progress of an interrupted download and take over the chunk responses,
+    /// call once before connecting
+    void begin()
+    {
+        OTA_settings.begin();
+        m_transport.divert(OTA_CHUNK_RESPONSE_PREFIX, this);
+    }
+
+    /// @brief Subscribe to the chunk responses and report the running firmware, call on every
+    /// new connection
+    void connected()
+    {
+        if (!MQTT_client.subscribe(OTA_CHUNK_RESPONSE_TOPICS)) {
+            Serial.println("Failed to subscribe for firmware chunks");
+        }
+        if (!m_confirmed) {
+            // Reaching the server proves the image, a pending rollback is cancelled
+            esp_ota_mark_app_valid_cancel_rollback();
+            m_confirmed = true;
+        }
+        char payload[128];
+        snprintf(payload, sizeof(payload),
+                 "{\"current_fw_title\":\"%s\",\"current_fw_version\":\"%s\"}",
+                 OTA_FIRMWARE_TITLE, DEVICE_SW_VERSION);
+        publishTelemetry(payload);
+
+        // Requests of the old connection are lost, a chunk cut off is requested again
+        for (uint32_t chunk = m_done; chunk < m_next; chunk++) {
+            slot(chunk).sent = false;
+        }
+    }
+
+    OTA_State state() const { return m_state; }
+
+    bool active() const
+    {
+        return m_state == OTA_State::DOWNLOADING || m_state == OTA_State::UPDATING;
+    }
+
+    /// @brief Firmware assigned on the server, downloaded unless it is running already. A
+    /// firmware that failed is not tried again until the server assigns another one.
+    void offer(const OTA_Firmware& firmware, uint32_t now)
+    {
+        if (firmware.title[0] == '\0' || firmware.version[0] == '\0') {
+            return;
+        }
+        if (m_state == OTA_State::UPDATING) {
+            // The verified image boots first, a later assignment is offered again after that
+            return;
+        }
+        if ((m_state == OTA_State::DOWNLOADING || m_state == OTA_State::FAILED) &&
+            sameFirmware(firmware, m_firmware)) {
+            // Offered again with every attribute response
+            return;
+        }
+        m_firmware = firmware;
+        if (strcmp(firmware.title, OTA_FIRMWARE_TITLE) != 0) {
+            fail("Firmware title mismatch");
+            return;
+        }
+        if (strcmp(firmware.version, DEVICE_SW_VERSION) == 0) {
+            report("UPDATED");
+            m_state = OTA_State::IDLE;
+            return;
+        }
+        if (strcasecmp(firmware.algorithm, "SHA256") != 0) {
+            fail("Unsupported checksum algorithm");
+            return;
+        }
+        if (!parseChecksum(firmware.checksum, m_checksum)) {
+            fail("Malformed checksum");
+            return;
+        }
+        m_partition = esp_ota_get_next_update_partition(nullptr);
+        if (m_partition == nullptr || firmware.size == 0 || firmware.size > m_partition->size) {
+            fail("Firmware does not fit the update partition");
+            return;
+        }
+
+        // Resume a download of the same image into the same partition
+        const OTA_Progress& progress = OTA_progressSetting.get();
+        const bool resume = progress.magic == OTA_PROGRESS_MAGIC &&
+                            progress.partition == m_partition->address &&
+                            progress.size == firmware.size &&
+                            progress.chunkSize == OTA_CHUNK_SIZE &&
+                            memcmp(progress.checksum, m_checksum, sizeof(m_checksum)) == 0;
+        const uint32_t written = resume ? progress.written : 0;
+        if (m_state == OTA_State::DOWNLOADING) {
+            // Another firmware was assigned meanwhile
+            mbedtls_sha256_free(&m_sha);
+        }
+        mbedtls_sha256_init(&m_sha);
+        mbedtls_sha256_starts(&m_sha, 0);
+        if (!hashFlash(0, written)) {
+            fail("Flash read failed");
+            return;
+        }
+        m_requestId++;
+        m_done = written / OTA_CHUNK_SIZE;
+        m_next = m_done;
+        m_erased = written;
+        m_persisted = written;
+        m_resumedAt = written;
+        m_error = nullptr;
+        m_startedAt = now;
+        m_requests = 0;
+        m_retransmits = 0;
+        m_ignored = 0;
+        m_state = OTA_State::DOWNLOADING;
+        Serial.printf("OTA: downloading %s %s, %u bytes in %u byte chunks, window %u, from %u\n",
+                      firmware.title, firmware.version, static_cast<unsigned>(firmware.size),
+                      static_cast<unsigned>(OTA_CHUNK_SIZE), static_cast<unsigned>(OTA_WINDOW),
+                      static_cast<unsigned>(written));
+        report("DOWNLOADING");
+    }
+
+    /// @brief Hash and persist what arrived, request the next chunks and repeat overdue requests,
+    /// call after the MQTT client read from the connection
+    void poll(uint32_t now)
+    {
+        if (m_state == OTA_State::UPDATING) {
+            if (now - m_restartAt >= OTA_RESTART_DELAY) {
+                esp_restart();
+            }
+            return;
+        }
+        if (m_state != OTA_State::DOWNLOADING) {
+            return;
+        }
+        if (m_error != nullptr) {
+            fail(m_error);
+            return;
+        }
+
+        // The hash only advances over the chunks complete in order
+        while (m_done < m_next && slot(m_done).received) {
+            if (!hashFlash(m_done * OTA_CHUNK_SIZE, chunkLength(m_done))) {
+                fail("Flash read failed");
+                return;
+            }
+            m_done++;
+        }
+        if (m_done == chunks()) {
+            finish(now);
+            return;
+        }
+        const uint32_t complete =
+            m_done * OTA_CHUNK_SIZE / OTA_PROGRESS_INTERVAL * OTA_PROGRESS_INTERVAL;
+        if (complete > m_persisted) {
+            saveProgress(complete);
+        }
+
+        for (uint32_t chunk = m_done; chunk < m_next; chunk++) {
+            Slot& request = slot(chunk);
+            if (request.received || (request.sent && now - request.sentAt < OTA_CHUNK_TIMEOUT)) {
+                continue;
+            }
+            if (request.sent) {
+                if (++request.retries > OTA_CHUNK_RETRIES) {
+                    fail("Chunk request timed out");
+                    return;
+                }
+                m_retransmits++;
+            }
+            if (!send(chunk, now)) {
+                return;
+            }
+        }
+        while (m_next < chunks() && m_next - m_done < OTA_WINDOW) {
+            if (!erase(m_next)) {
+                fail("Flash erase failed");
+                return;
+            }
+            slot(m_next) = Slot{};
+            m_next++;
+            if (!send(m_next - 1, now)) {
+                return;
+            }
+        }
+    }
+
+    /// @brief Milliseconds until poll() has something to do without a message arriving
+    uint32_t remaining(uint32_t now) const
+    {
+        if (m_state == OTA_State::UPDATING) {
+            const uint32_t elapsed = now - m_restartAt;
+            return elapsed >= OTA_RESTART_DELAY ? 0 : OTA_RESTART_DELAY - elapsed;
+        }
+        if (m_state != OTA_State::DOWNLOADING) {
+            return UINT32_MAX;
+        }
+        if (m_error != nullptr || (m_next < chunks() && m_next - m_done < OTA_WINDOW) ||
+            (m_done < m_next && slot(m_done).received)) {
+            return 0;
+        }
+        uint32_t wait = UINT32_MAX;
+        for (uint32_t chunk = m_done; chunk < m_next; chunk++) {
+            const Slot& request = slot(chunk);
+            if (request.received) {
+                continue;
+            }
+            if (!request.sent) {
+                return 0;
+            }
+            const uint32_t elapsed = now - request.sentAt;
+            wait = std::min(wait, elapsed >= OTA_CHUNK_TIMEOUT ? 0 : OTA_CHUNK_TIMEOUT - elapsed);
+        }
+        return wait;
+    }
+
+    /// @brief Print the state of the download and its requests since it started
+    void printStats() const
+    {
+        static const char* const STATES[] = {"idle", "downloading", "updating", "failed"};
+        Serial.printf("OTA: %s, %u of %u bytes, %u request(s), %u repeated, %u response(s) "
+                      "ignored\n",
+                      STATES[static_cast<uint8_t>(m_state)],
+                      static_cast<unsigned>(std::min(m_done * OTA_CHUNK_SIZE, m_firmware.size)),
+                      static_cast<unsigned>(m_firmware.size), static_cast<unsigned>(m_requests),
+                      static_cast<unsigned>(m_retransmits), static_cast<unsigned>(m_ignored));
+    }
+
+    //
+    // MQTT_Payload_Sink, the chunk responses as they arrive
+    //
+    bool open(const char* topic, size_t topicLength, size_t length) override
+    {
+        char copy[MQTT_FILTER_TOPIC_SIZE];
+        const size_t copyLength = std::min(topicLength, sizeof(copy) - 1);
+        memcpy(copy, topic, copyLength);
+        copy[copyLength] = '\0';
+        unsigned requestId;
+        unsigned chunk;
+        if (m_state != OTA_State::DOWNLOADING ||
+            sscanf(copy, "v2/fw/response/%u/chunk/%u", &requestId, &chunk) != 2 ||
+            requestId != m_requestId || chunk < m_done || chunk >= m_next ||
+            slot(chunk).received || length != chunkLength(chunk)) {
+            // Stale, repeated or cut short, the chunk is requested again if it is still missing
+            m_ignored++;
+            return false;
+        }
+        m_writeChunk = chunk;
+        m_writeOffset = chunk * OTA_CHUNK_SIZE;
+        m_writeEnd = m_writeOffset + length;
+        return true;
+    }
+
+    void write(const uint8_t* data, size_t length) override
+    {
+        if (m_error != nullptr) {
+            return;
+        }
+        if (esp_partition_write(m_partition, m_writeOffset, data, length) != ESP_OK) {
+            m_error = "Flash write failed";
+        }
+        m_writeOffset += length;
+    }
+
+    void close() override
+    {
+        if (m_error == nullptr && m_writeOffset == m_writeEnd) {
+            slot(m_writeChunk).received = true;
+        }
+    }
+
+   private:
+    struct Slot {
+        bool sent;
+        bool received;
+        uint8_t retries;
+        uint32_t sentAt;
+    };
+
+    uint32_t chunks() const { return (m_firmware.size + OTA_CHUNK_SIZE - 1) / OTA_CHUNK_SIZE; }
+
+    size_t chunkLength(uint32_t chunk) const
+    {
+        return std::min<size_t>(OTA_CHUNK_SIZE, m_firmware.size - chunk * OTA_CHUNK_SIZE);
+    }
+
+    Slot& slot(uint32_t chunk) { return m_slots[chunk % OTA_WINDOW]; }
+    const Slot& slot(uint32_t chunk) const { return m_slots[chunk % OTA_WINDOW]; }
+
+    static bool sameFirmware(const OTA_Firmware& a, const OTA_Firmware& b)
+    {
+        return strcmp(a.title, b.title) == 0 && strcmp(a.version, b.version) == 0 &&
+               strcasecmp(a.checksum, b.checksum) == 0 && a.size == b.size;
+    }
+
+    static bool parseChecksum(const char* hex, uint8_t* digest)
+    {
+        if (strlen(hex) != 64) {
+            return false;
+        }
+        for (size_t i = 0; i < 32; i++) {
+            const char byte[3] = {hex[i * 2], hex[i * 2 + 1], '\0'};
+            char* end;
+            digest[i] = static_cast<uint8_t>(strtoul(byte, &end, 16));
+            if (end != byte + 2) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /// @brief Erase the sectors the chunk is written to, ahead of its request
+    bool erase(uint32_t chunk)
+    {
+        const uint32_t end = (chunk * OTA_CHUNK_SIZE + chunkLength(chunk) + OTA_SECTOR_SIZE - 1) /
+                             OTA_SECTOR_SIZE * OTA_SECTOR_SIZE;
+        if (end <= m_erased) {
+            return true;
+        }
+        if (esp_partition_erase_range(m_partition, m_erased, end - m_erased) != ESP_OK) {
+            return false;
+        }
+        m_erased = end;
+        return true;
+    }
+
+    bool hashFlash(uint32_t offset, uint32_t length)
+    {
+        uint8_t buffer[256];
+        while (length > 0) {
+            const size_t count = std::min<size_t>(sizeof(buffer), length);
+            if (esp_partition_read(m_partition, offset, buffer, count) != ESP_OK) {
+                return false;
+            }
+            mbedtls_sha256_update(&m_sha, buffer, count);
+            offset += count;
+            length -= count;
+        }
+        return true;
+    }
+
+    bool send(uint32_t chunk, uint32_t now)
+    {
+        char topic[48];
+        char payload[8];
+        snprintf(topic, sizeof(topic), "v2/fw/request/%u/chunk/%u",
+                 static_cast<unsigned>(m_requestId), static_cast<unsigned>(chunk));
+        snprintf(payload, sizeof(payload), "%u", static_cast<unsigned>(OTA_CHUNK_SIZE));
+        if (!ThingsBoard_publish(topic, reinterpret_cast<const uint8_t*>(payload),
+                                 strlen(payload))) {
+            return false;
+        }
+        Slot& request = slot(chunk);
+        request.sent = true;
+        request.sentAt = now;
+        m_requests++;
+        return true;
+    }
+
+    void saveProgress(uint32_t written)
+    {
+        OTA_Progress progress = {};
+        progress.magic = OTA_PROGRESS_MAGIC;
+        progress.partition = m_partition->address;
+        progress.size = m_firmware.size;
+        progress.chunkSize = OTA_CHUNK_SIZE;
+        progress.written = written;
+        memcpy(progress.checksum, m_checksum, sizeof(m_checksum));
+        strncpy(progress.title, m_firmware.title, sizeof(progress.title) - 1);
+        strncpy(progress.version, m_firmware.version, sizeof(progress.version) - 1);
+        if (OTA_progressSetting.set(progress)) {
+            OTA_settings.commit();
+        }
+        m_persisted = written;
+    }
+
+    void clearProgress()
+    {
+        if (OTA_progressSetting.set(OTA_Progress{})) {
+            OTA_settings.commit();
+        }
+    }
+
+    /// @brief The image is complete, verify it and boot it
+    void finish(uint32_t now)
+    {
+        uint8_t digest[32];
+        mbedtls_sha256_finish(&m_sha, digest);
+        mbedtls_sha256_free(&m_sha);
+        const uint32_t elapsed = now - m_startedAt;
+        const uint32_t downloaded = m_firmware.size - m_resumedAt;
+        Serial.printf("OTA: %u bytes in %u ms (%.1f KB/s), chunk %u, window %u, %u request(s), "
+                      "%u repeated\n",
+                      static_cast<unsigned>(downloaded), static_cast<unsigned>(elapsed),
+                      elapsed == 0 ? 0.0f : downloaded * 1000.0f / 1024 / elapsed,
+                      static_cast<unsigned>(OTA_CHUNK_SIZE), static_cast<unsigned>(OTA_WINDOW),
+                      static_cast<unsigned>(m_requests), static_cast<unsigned>(m_retransmits));
+        clearProgress();
+        if (memcmp(digest, m_checksum, sizeof(m_checksum)) != 0) {
+            fail("Checksum mismatch");
+            return;
+        }
+        report("DOWNLOADED");
+        report("VERIFIED");
+        const esp_err_t error = esp_ota_set_boot_partition(m_partition);
+        if (error != ESP_OK) {
+            fail(esp_err_to_name(error));
+            return;
+        }
+        report("UPDATING");
+        m_state = OTA_State::UPDATING;
+        m_restartAt = now;
+    }
+
+    void fail(const char* error)
+    {
+        Serial.printf("OTA: %s %s failed, %s\n", m_firmware.title, m_firmware.version, error);
+        if (m_state == OTA_State::DOWNLOADING) {
+            mbedtls_sha256_free(&m_sha);
+        }
+        m_state = OTA_State::FAILED;
+        report("FAILED", error);
+    }
+
+    void report(const char* state, const char* error = nullptr)
+    {
+        char payload[160];
+        if (error != nullptr) {
+            snprintf(payload, sizeof(payload), "{\"fw_state\":\"%s\",\"fw_error\":\"%s\"}", state,
+                     error);
+        } else {
+            snprintf(payload, sizeof(payload), "{\"fw_state\":\"%s\"}", state);
+        }
+        publishTelemetry(payload);
+    }
+
+    static void publishTelemetry(const char* payload)
+    {
+        ThingsBoard_publish(TELEMETRY_BATCH_TOPIC, reinterpret_cast<const uint8_t*>(payload),
+                            strlen(payload));
+    }
+
+    MQTT_Transport& m_transport;
+    OTA_State m_state = OTA_State::IDLE;
+    OTA_Firmware m_firmware = {};
+    uint8_t m_checksum[32] = {};
+    const esp_partition_t* m_partition = nullptr;
+    mbedtls_sha256_context m_sha = {};
+    bool m_confirmed = false;
+
+    uint32_t m_requestId = 0;
+    Slot m_slots[OTA_WINDOW] = {};
+    uint32_t m_done = 0;       // Chunks before this one are written and hashed
+    uint32_t m_next = 0;       // Next chunk to request
+    uint32_t m_erased = 0;     // Bytes of the partition erased
+    uint32_t m_persisted = 0;  // Bytes recorded in OTA_progressSetting
+    uint32_t m_restartAt = 0;
+
+    // Chunk being received
+    uint32_t m_writeChunk = 0;
+    uint32_t m_writeOffset = 0;
+    uint32_t m_writeEnd = 0;
+    const char* m_error = nullptr;
+
+    uint32_t m_startedAt = 0;
+    uint32_t m_resumedAt = 0;
+    uint32_t m_requests = 0;
+    uint32_t m_retransmits = 0;
+    uint32_t m_ignored = 0;
+};
+
+OTA_Update OTA_update(WiFi_client);
+
+#endif  // _OTA_UPDATE_H
@@ -0,0 +1,489 @@
+#ifndef _PAYLOAD_ENCODER_H
+#define _PAYLOAD_ENCODER_H
+
+#include <Arduino.h>
+
+#include <cmath>
+
+#include "Payload_Schema.h"
+#include "ThingsBoard_Manager.h"
+#include "Time_Manager.h"
+
+//
+// Payload encoders of the telemetry and attribute batches. JSON is the default, build with
+// -DPAYLOAD_PROTOBUF=1 for the Protobuf payload of the ThingsBoard MQTT transport, the device
+// profile then needs the schemas in proto/. Both encode each pair straight into the message
+// buffer that is published, there is no intermediate document or message struct.
+//
+enum class Batch_Type : uint8_t { TELEMETRY, ATTRIBUTES };
+
+enum class Append_Result : uint8_t {
+    ADDED,
+    FULL,     // Does not fit into the pending message
+    UNKNOWN,  // The key has no field in the payload schema
+    INVALID,  // NaN or infinity, neither payload can carry it
+};
+
+/// @brief A value of a batch, typed so each encoder can render it its own way
+struct Payload_Value {
+    enum class Type : uint8_t { BOOL, INTEGER, FLOAT, STRING, FRAGMENT };
+
+    explicit Payload_Value(bool value) : type(Type::BOOL), integer(value) {}
+    explicit Payload_Value(int64_t value) : type(Type::INTEGER), integer(value) {}
+    explicit Payload_Value(float value) : type(Type::FLOAT), real(value) {}
+    explicit Payload_Value(const char* value) : type(Type::STRING), text(value) {}
+    /// @brief Pairs already encoded by the same encoder
+    Payload_Value(const char* fragment, size_t length)
+        : type(Type::FRAGMENT), text(fragment), length(length)
+    {
+    }
+
+    int64_t asInteger() const { return type == Type::FLOAT ? llroundf(real) : integer; }
+    float asFloat() const { return type == Type::FLOAT ? real : static_cast<float>(integer); }
+
+    Type type;
+    int64_t integer = 0;
+    float real = 0.0f;
+    const char* text = nullptr;
+    size_t length = 0;
+};
+
+//
+// JSON, {"key":value,..} or [{"ts":..,"values":{..}},..] once entries are timestamped
+//
+class Json_Encoder {
+   public:
+    // Timestamps are optional, the server stamps values sent without one
+    static constexpr bool NEEDS_TIMESTAMPS = false;
+    static constexpr size_t MAX_STRING_VALUE_SIZE = 96U;
+
+    Json_Encoder(Batch_Type type, size_t capacity)
+        : m_type(type),
+          m_capacity(capacity),
+          m_length(0),
+          m_timestamped(false),
+          m_entryOpen(false),
+          m_entryTs(0)
+    {
+    }
+
+    const char* data() const { return m_buffer; }
+    bool empty() const { return m_length == 0; }
+
+    /// @brief Group the following pairs under a timestamp in epoch milliseconds
+    /// @return false if the pending message has to be sent first
+    bool beginEntry(uint64_t ts)
+    {
+        if (m_length != 0 && !m_timestamped) {
+            return false;
+        }
+        m_timestamped = true;
+        m_entryOpen = false;
+        m_entryTs = ts;
+        return true;
+    }
+
+    /// @brief Following messages are not timestamped
+    void endEntries() { m_timestamped = false; }
+
+    Append_Result append(const char* key, const Payload_Value& value)
+    {
+        char prefix[48];
+        const size_t prefixLength = renderPrefix(prefix, sizeof(prefix));
+        if (m_length + prefixLength + closingLength() > m_capacity) {
+            return Append_Result::FULL;
+        }
+        size_t pairLength;
+        const Append_Result result =
+            encodePair(m_buffer + m_length + prefixLength,
+                       m_capacity - m_length - prefixLength - closingLength(), pairLength, m_type,
+                       key, value, false);
+        if (result != Append_Result::ADDED) {
+            return result;
+        }
+        memcpy(m_buffer + m_length, prefix, prefixLength);
+        m_length += prefixLength + pairLength;
+        m_entryOpen = true;
+        return Append_Result::ADDED;
+    }
+
+    /// @brief Close the pending message
+    /// @return Length of the message
+    size_t finish()
+    {
+        memcpy(m_buffer + m_length, m_timestamped ? "}}]" : "}", closingLength());
+        m_length += closingLength();
+        m_buffer[m_length] = '\0';
+        return m_length;
+    }
+
+    /// @brief Start the next message, the current entry is reopened in it
+    void clear()
+    {
+        m_length = 0;
+        m_entryOpen = false;
+    }
+
+    /// @brief Encode "key":value, preceded by a comma if separated
+    static Append_Result encodePair(char* out, size_t size, size_t& length, Batch_Type type,
+                                    const char* key, const Payload_Value& value, bool separated)
+    {
+        (void)type;
+        char rendered[MAX_STRING_VALUE_SIZE];
+        const char* text = rendered;
+        size_t textLength = 0;
+        switch (value.type) {
+            case Payload_Value::Type::BOOL:
+                text = value.integer != 0 ? "true" : "false";
+                textLength = strlen(text);
+                break;
+            case Payload_Value::Type::INTEGER:
+                textLength = snprintf(rendered, sizeof(rendered), "%lld",
+                                      static_cast<long long>(value.integer));
+                break;
+            case Payload_Value::Type::FLOAT:
+                // nan and inf are not JSON, the server would reject the whole message
+                if (!std::isfinite(value.real)) {
+                    return Append_Result::INVALID;
+                }
+                textLength = snprintf(rendered, sizeof(rendered), "%.2f", value.real);
+                break;
+            case Payload_Value::Type::STRING:
+                textLength = renderString(rendered, sizeof(rendered), value.text);
+                break;
+            case Payload_Value::Type::FRAGMENT:
+                text = value.text;
+                textLength = value.length;
+                break;
+        }
+
+        // A fragment has its keys already
+        const bool withKey = value.type != Payload_Value::Type::FRAGMENT;
+        length = (separated ? 1 : 0) + (withKey ? strlen(key) + 3 : 0) + textLength;
+        if (length > size) {
+            return Append_Result::FULL;
+        }
+        char* end = out;
+        if (separated) {
+            *end++ = ',';
+        }
+        if (withKey) {
+            *end++ = '"';
+            memcpy(end, key, strlen(key));
+            end += strlen(key);
+            *end++ = '"';
+            *end++ = ':';
+        }
+        memcpy(end, text, textLength);
+        return Append_Result::ADDED;
+    }
+
+    /// @brief Render a value as a quoted JSON string, truncated to fit
+    /// @param size Size of rendered, at least 3
+    /// @return Length of the rendered string
+    static size_t renderString(char* rendered, size_t size, const char* value)
+    {
+        size_t length = 0;
+        rendered[length++] = '"';
+        for (const char* c = value; *c != '\0' && length < size - 3; c++) {
+            if (*c == '"' || *c == '\\') {
+                rendered[length++] = '\\';
+            } else if (static_cast<uint8_t>(*c) < 0x20) {
+                continue;
+            }
+            rendered[length++] = *c;
+        }
+        rendered[length++] = '"';
+        rendered[length] = '\0';
+        return length;
+    }
+
+   private:
+    size_t closingLength() const { return m_timestamped ? 3 : 1; }
+
+    /// @brief Render what has to precede the next pair in the current message
+    size_t renderPrefix(char* prefix, size_t size) const
+    {
+        if (!m_timestamped) {
+            return snprintf(prefix, size, "%s", m_length == 0 ? "{" : ",");
+        }
+        if (m_entryOpen) {
+            return snprintf(prefix, size, ",");
+        }
+        return snprintf(prefix, size, "%s{\"ts\":%llu,\"values\":{", m_length == 0 ? "[" : "}},",
+                        static_cast<unsigned long long>(m_entryTs));
+    }
+
+    const Batch_Type m_type;
+    const size_t m_capacity;
+    size_t m_length;
+    bool m_timestamped;
+    bool m_entryOpen;
+    uint64_t m_entryTs;
+    char m_buffer[BATCH_MESSAGE_SIZE];
+};
+
+//
+// Protobuf wire format
+//
+enum class Protobuf_Wire : uint8_t { VARINT = 0, LENGTH_DELIMITED = 2, FIXED32 = 5 };
+
+/// @brief Writes wire format into a fixed buffer, overflow() tells whether everything fit
+class Protobuf_Writer {
+   public:
+    Protobuf_Writer(char* out, size_t size) : m_out(out), m_size(size), m_length(0) {}
+
+    void varint(uint64_t value)
+    {
+        do {
+            const uint8_t byte = value & 0x7F;
+            value >>= 7;
+            put(value != 0 ? byte | 0x80 : byte);
+        } while (value != 0);
+    }
+
+    void tag(uint8_t number, Protobuf_Wire wire)
+    {
+        varint(static_cast<uint32_t>(number) << 3 | static_cast<uint8_t>(wire));
+    }
+
+    void fixed32(uint32_t value)
+    {
+        for (uint8_t i = 0; i < 4; i++) {
+            put(value >> (8 * i));
+        }
+    }
+
+    void bytes(const char* data, size_t length)
+    {
+        for (size_t i = 0; i < length; i++) {
+            put(data[i]);
+        }
+    }
+
+    size_t length() const { return m_length; }
+    bool overflow() const { return m_length > m_size; }
+
+   private:
+    void put(uint8_t byte)
+    {
+        if (m_length < m_size) {
+            m_out[m_length] = byte;
+        }
+        m_length++;
+    }
+
+    char* const m_out;
+    const size_t m_size;
+    size_t m_length;
+};
+
+//
+// Protobuf, Telemetry of proto/telemetry.proto or Attributes of proto/attributes.proto
+//
+class Protobuf_Encoder {
+   public:
+    // A Telemetry message always carries its ts, values without one are stamped when sent
+    static constexpr bool NEEDS_TIMESTAMPS = true;
+    static constexpr size_t MAX_STRING_VALUE_SIZE = 96U;
+
+    Protobuf_Encoder(Batch_Type type, size_t capacity)
+        : m_type(type), m_capacity(capacity), m_length(0), m_timestamped(false), m_entryTs(0)
+    {
+    }
+
+    const char* data() const { return m_buffer; }
+    bool empty() const { return m_length == 0; }
+
+    /// @brief Timestamp of the following pairs in epoch milliseconds
+    /// @return false if the pending message has to be sent first, it has another timestamp
+    bool beginEntry(uint64_t ts)
+    {
+        if (m_length != 0 && (!m_timestamped || ts != m_entryTs)) {
+            return false;
+        }
+        m_timestamped = true;
+        m_entryTs = ts;
+        return true;
+    }
+
+    /// @brief Following messages are stamped with the time they are sent
+    void endEntries() { m_timestamped = false; }
+
+    Append_Result append(const char* key, const Payload_Value& value)
+    {
+        // Telemetry.values is opened with its tag and a length to be filled in by finish()
+        const size_t start = m_length == 0 ? valuesHeaderLength() : m_length;
+        if (start + closingLength() > m_capacity) {
+            return Append_Result::FULL;
+        }
+        size_t length;
+        const Append_Result result =
+            encodePair(m_buffer + start, m_capacity - start - closingLength(), length, m_type, key,
+                       value, false);
+        if (result == Append_Result::ADDED) {
+            m_length = start + length;
+        }
+        return result;
+    }
+
+    /// @brief Close the pending message
+    /// @return Length of the message, 0 if it needs a timestamp and the clock is not set
+    size_t finish()
+    {
+        if (m_type != Batch_Type::TELEMETRY) {
+            return m_length;
+        }
+        const uint64_t ts = m_timestamped ? m_entryTs : Time_epochMs();
+        if (ts == 0) {
+            return 0;
+        }
+
+        const size_t values = m_length - VALUES_HEADER_LENGTH;
+        Protobuf_Writer header(m_buffer, VALUES_HEADER_LENGTH);
+        header.tag(PAYLOAD_TELEMETRY_VALUES, Protobuf_Wire::LENGTH_DELIMITED);
+        if (values < 0x80) {
+            // One length byte is enough, the values move up into the spare one
+            header.varint(values);
+            memmove(m_buffer + header.length(), m_buffer + VALUES_HEADER_LENGTH, values);
+            m_length--;
+        } else {
+            header.varint(values);
+        }
+
+        // Field order does not matter, the ts goes last as it is only known now
+        Protobuf_Writer writer(m_buffer + m_length, closingLength());
+        writer.tag(PAYLOAD_TELEMETRY_TS, Protobuf_Wire::VARINT);
+        writer.varint(ts);
+        m_length += writer.length();
+        return m_length;
+    }
+
+    void clear() { m_length = 0; }
+
+    /// @brief Encode the field of a key, separated is ignored, fields just follow each other
+    static Append_Result encodePair(char* out, size_t size, size_t& length, Batch_Type type,
+                                    const char* key, const Payload_Value& value, bool separated)
+    {
+        (void)separated;
+        if (value.type == Payload_Value::Type::FRAGMENT) {
+            if (value.length > size) {
+                return Append_Result::FULL;
+            }
+            memcpy(out, value.text, value.length);
+            length = value.length;
+            return Append_Result::ADDED;
+        }
+        // Rejected like the JSON encoder does, so both payloads carry the same values
+        if (value.type == Payload_Value::Type::FLOAT && !std::isfinite(value.real)) {
+            return Append_Result::INVALID;
+        }
+
+        const Payload_Field* field = type == Batch_Type::TELEMETRY
+                                         ? Payload_TelemetrySchema::find(key)
+                                         : Payload_AttributeSchema::find(key);
+        if (field == nullptr ||
+            (field->kind == Payload_Kind::STRING) != (value.type == Payload_Value::Type::STRING)) {
+            return Append_Result::UNKNOWN;
+        }
+
+        Protobuf_Writer writer(out, size);
+        switch (field->kind) {
+            case Payload_Kind::FLOAT: {
+                const float real = value.asFloat();
+                uint32_t bits;
+                memcpy(&bits, &real, sizeof(bits));
+                writer.tag(field->number, Protobuf_Wire::FIXED32);
+                writer.fixed32(bits);
+                break;
+            }
+            case Payload_Kind::UINT:
+                writer.tag(field->number, Protobuf_Wire::VARINT);
+                writer.varint(static_cast<uint32_t>(value.asInteger()));
+                break;
+            case Payload_Kind::SINT: {
+                // Zigzag, small negative numbers like the RSSI stay one byte
+                const int32_t integer = static_cast<int32_t>(value.asInteger());
+                writer.tag(field->number, Protobuf_Wire::VARINT);
+                writer.varint(static_cast<uint32_t>(integer) << 1 ^
+                              static_cast<uint32_t>(integer >> 31));
+                break;
+            }
+            case Payload_Kind::BOOL:
+                writer.tag(field->number, Protobuf_Wire::VARINT);
+                writer.varint(value.asInteger() != 0 ? 1 : 0);
+                break;
+            case Payload_Kind::STRING: {
+                const size_t textLength = strnlen(value.text, MAX_STRING_VALUE_SIZE);
+                writer.tag(field->number, Protobuf_Wire::LENGTH_DELIMITED);
+                writer.varint(textLength);
+                writer.bytes(value.text, textLength);
+                break;
+            }
+        }
+        if (writer.overflow()) {
+            return Append_Result::FULL;
+        }
+        length = writer.length();
+        return Append_Result::ADDED;
+    }
+
+   private:
+    // Tag and a two byte length, messages are shorter than 16 KiB
+    static constexpr size_t VALUES_HEADER_LENGTH = 3;
+    static_assert(BATCH_MESSAGE_SIZE < 0x4000, "The values length takes two bytes at most");
+    // Tag and varint of the ts
+    static constexpr size_t TS_LENGTH = 11;
+
+    size_t valuesHeaderLength() const
+    {
+        return m_type == Batch_Type::TELEMETRY ? VALUES_HEADER_LENGTH : 0;
+    }
+    size_t closingLength() const { return m_type == Batch_Type::TELEMETRY ? TS_LENGTH : 0; }
+
+    const Batch_Type m_type;
+    const size_t m_capacity;
+    size_t m_length;
+    bool m_timestamped;
+    uint64_t m_entryTs;
+    char m_buffer[BATCH_MESSAGE_SIZE];
+};
+
+#ifdef PAYLOAD_PROTOBUF
+using Payload_Encoder = Protobuf_Encoder;
+#else
+using Payload_Encoder = Json_Encoder;
+#endif
+
+/// @brief Pairs encoded once and added to several messages, see Telemetry_Batch::addFragment()
+template <size_t Size>
+class Payload_Fragment {
+   public:
+    explicit Payload_Fragment(Batch_Type type) : m_type(type), m_length(0) {}
+
+    /// @return false if the pair does not fit or has no field, the fragment is left as it was
+    bool add(const char* key, const char* value)
+    {
+        size_t length;
+        if (Payload_Encoder::encodePair(m_data + m_length, Size - m_length, length, m_type, key,
+                                        Payload_Value(value),
+                                        m_length != 0) != Append_Result::ADDED) {
+            return false;
+        }
+        m_length += length;
+        return true;
+    }
+
+    void clear() { m_length = 0; }
+
+    const char* data() const { return m_data; }
+    size_t length() const { return m_length; }
+    bool empty() const { return m_length == 0; }
+
+   private:
+    const Batch_Type m_type;
+    size_t m_length;
+    char m_data[Size];
+};
+
+#endif  // _PAYLOAD_ENCODER_H
@@ -0,0 +1,232 @@
+#ifndef _PAYLOAD_SCHEMA_H
+#define _PAYLOAD_SCHEMA_H
+
+#include <Arduino.h>
+
+#include <array>
+
+#include "Actuator_Table.h"
+
+//
+// Field tables of the Protobuf payload mode, one entry per field of proto/telemetry.proto and
+// proto/attributes.proto. Keys resolve to their field through a perfect hash built at compile
+// time, like the actuator keys.
+//
+enum class Payload_Kind : uint8_t { FLOAT, UINT, SINT, BOOL, STRING };
+
+struct Payload_Field {
+    const char* key;
+    uint8_t number;
+    Payload_Kind kind;
+};
+
+// Telemetry.Values of proto/telemetry.proto
+constexpr Payload_Field PAYLOAD_TELEMETRY_FIELDS[] = {
+    {"temperature", 1, Payload_Kind::FLOAT},
+    {"humidity", 2, Payload_Kind::FLOAT},
+    {"rssi", 3, Payload_Kind::SINT},
+    {"readings", 4, Payload_Kind::UINT},
+    {"temperature_min", 5, Payload_Kind::FLOAT},
+    {"temperature_max", 6, Payload_Kind::FLOAT},
+    {"temperature_last", 7, Payload_Kind::FLOAT},
+    {"temperature_stddev", 8, Payload_Kind::FLOAT},
+    {"humidity_min", 9, Payload_Kind::FLOAT},
+    {"humidity_max", 10, Payload_Kind::FLOAT},
+    {"humidity_last", 11, Payload_Kind::FLOAT},
+    {"humidity_stddev", 12, Payload_Kind::FLOAT},
+    {"press_count", 13, Payload_Kind::UINT},
+    {"press_latency_mean_us", 14, Payload_Kind::UINT},
+    {"press_latency_max_us", 15, Payload_Kind::UINT},
+    {"heap_free", 16, Payload_Kind::UINT},
+    {"heap_largest_block", 17, Payload_Kind::UINT},
+    {"heap_min_free", 18, Payload_Kind::UINT},
+    {"stack_free_loopTask", 19, Payload_Kind::UINT},
+    {"stack_free_WiFi_task", 20, Payload_Kind::UINT},
+    {"stack_free_ThingsBoard_task", 21, Payload_Kind::UINT},
+    {"stack_free_Sensor_task", 22, Payload_Kind::UINT},
+    {"stack_free_Events_socketWatcher", 23, Payload_Kind::UINT},
+    {"boot_setup_start_us", 24, Payload_Kind::UINT},
+    {"boot_wifi_task_created_us", 25, Payload_Kind::UINT},
+    {"boot_setup_end_us", 26, Payload_Kind::UINT},
+    {"boot_wifi_setup_done_us", 27, Payload_Kind::UINT},
+    {"boot_wifi_begin_us", 28, Payload_Kind::UINT},
+    {"boot_wifi_got_ip_us", 29, Payload_Kind::UINT},
+    {"boot_tb_task_start_us", 30, Payload_Kind::UINT},
+    {"boot_provision_sent_us", 31, Payload_Kind::UINT},
+    {"boot_provisioned_us", 32, Payload_Kind::UINT},
+    {"boot_mqtt_connected_us", 33, Payload_Kind::UINT},
+    {"boot_rpc_subscribed_us", 34, Payload_Kind::UINT},
+    {"boot_attr_subscribed_us", 35, Payload_Kind::UINT},
+    {"boot_attr_requested_us", 36, Payload_Kind::UINT},
+    {"boot_first_telemetry_us", 37, Payload_Kind::UINT},
+    {"lp_energy_per_sample_uj", 38, Payload_Kind::UINT},
+    {"lp_upload_awake_ms", 39, Payload_Kind::UINT},
+    {"lp_sample_awake_ms", 40, Payload_Kind::UINT},
+    {"mqtt_queue_count", 41, Payload_Kind::UINT},
+    {"mqtt_queue_p50_us", 42, Payload_Kind::UINT},
+    {"mqtt_queue_p99_us", 43, Payload_Kind::UINT},
+    {"rpc_dispatch_count", 44, Payload_Kind::UINT},
+    {"rpc_dispatch_p50_us", 45, Payload_Kind::UINT},
+    {"rpc_dispatch_p99_us", 46, Payload_Kind::UINT},
+    {"rpc_actuate_count", 47, Payload_Kind::UINT},
+    {"rpc_actuate_p50_us", 48, Payload_Kind::UINT},
+    {"rpc_actuate_p99_us", 49, Payload_Kind::UINT},
+    {"rpc_respond_count", 50, Payload_Kind::UINT},
+    {"rpc_respond_p50_us", 51, Payload_Kind::UINT},
+    {"rpc_respond_p99_us", 52, Payload_Kind::UINT},
+    {"rpc_total_count", 53, Payload_Kind::UINT},
+    {"rpc_total_p50_us", 54, Payload_Kind::UINT},
+    {"rpc_total_p99_us", 55, Payload_Kind::UINT},
+    {"attr_dispatch_count", 56, Payload_Kind::UINT},
+    {"attr_dispatch_p50_us", 57, Payload_Kind::UINT},
+    {"attr_dispatch_p99_us", 58, Payload_Kind::UINT},
+    {"attr_apply_count", 59, Payload_Kind::UINT},
+    {"attr_apply_p50_us", 60, Payload_Kind::UINT},
+    {"attr_apply_p99_us", 61, Payload_Kind::UINT},
+    {"attr_total_count", 62, Payload_Kind::UINT},
+    {"attr_total_p50_us", 63, Payload_Kind::UINT},
+    {"attr_total_p99_us", 64, Payload_Kind::UINT},
+};
+
+// Attributes of proto/attributes.proto
+constexpr Payload_Field PAYLOAD_ATTRIBUTE_FIELDS[] = {
+    {"hwVersion", 1, Payload_Kind::STRING},      {"hwSerial", 2, Payload_Kind::STRING},
+    {"fwVersion", 3, Payload_Kind::STRING},      {"ssid", 4, Payload_Kind::STRING},
+    {"macAddress", 5, Payload_Kind::STRING},     {"ipAddress", 6, Payload_Kind::STRING},
+    {"switch_state_0", 7, Payload_Kind::BOOL},   {"switch_state_1", 8, Payload_Kind::BOOL},
+    {"switch_state_2", 9, Payload_Kind::BOOL},   {"switch_state_3", 10, Payload_Kind::BOOL},
+    {"switch_state_4", 11, Payload_Kind::BOOL},  {"switch_state_5", 12, Payload_Kind::BOOL},
+};
+
+// Fields of Telemetry itself
+constexpr uint8_t PAYLOAD_TELEMETRY_TS = 1;
+constexpr uint8_t PAYLOAD_TELEMETRY_VALUES = 2;
+
+constexpr uint32_t Payload_hash(const char* key, uint32_t seed)
+{
+    uint32_t hash = 2166136261U ^ seed;
+    for (; *key != '\0'; key++) {
+        hash ^= static_cast<uint8_t>(*key);
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+constexpr bool Payload_equal(const char* a, const char* b)
+{
+    for (; *a != '\0' && *a == *b; a++, b++) {
+    }
+    return *a == *b;
+}
+
+/// @brief Perfect hash index of a field table
+template <const auto& Fields>
+class Payload_Schema {
+   public:
+    static constexpr size_t COUNT = sizeof(Fields) / sizeof(Fields[0]);
+
+    /// @brief Resolve a key to its field
+    /// @return nullptr if the key is not in the schema
+    static const Payload_Field* find(const char* key)
+    {
+        const int index = INDEX[Payload_hash(key, SEED) & (SLOTS - 1U)];
+        if (index < 0 || strcmp(Fields[index].key, key) != 0) {
+            return nullptr;
+        }
+        return &Fields[index];
+    }
+
+    /// @brief Whether the table has the key, for compile time checks
+    static constexpr bool contains(const char* key)
+    {
+        for (size_t i = 0; i < COUNT; i++) {
+            if (Payload_equal(Fields[i].key, key)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+   private:
+    static_assert(COUNT < INT8_MAX, "Too many fields for the index");
+
+    /// @brief Eight slots per field, a perfect seed for the 64 telemetry fields is found after a
+    /// few dozen tries
+    static constexpr size_t slotCount()
+    {
+        size_t slots = 1;
+        while (slots < COUNT * 8U) {
+            slots *= 2;
+        }
+        return slots;
+    }
+
+    static constexpr bool isPerfectSeed(uint32_t seed)
+    {
+        bool used[slotCount()] = {};
+        for (size_t i = 0; i < COUNT; i++) {
+            const size_t slot = Payload_hash(Fields[i].key, seed) & (slotCount() - 1U);
+            if (used[slot]) {
+                return false;
+            }
+            used[slot] = true;
+        }
+        return true;
+    }
+
+    static constexpr uint32_t findSeed()
+    {
+        for (uint32_t seed = 0; seed < 4096U; seed++) {
+            if (isPerfectSeed(seed)) {
+                return seed;
+            }
+        }
+        return UINT32_MAX;
+    }
+
+    static constexpr std::array<int8_t, slotCount()> buildIndex(uint32_t seed)
+    {
+        std::array<int8_t, slotCount()> index{};
+        for (size_t slot = 0; slot < slotCount(); slot++) {
+            index[slot] = -1;
+        }
+        for (size_t i = 0; i < COUNT; i++) {
+            index[Payload_hash(Fields[i].key, seed) & (slotCount() - 1U)] = i;
+        }
+        return index;
+    }
+
+    static constexpr bool numbersUnique()
+    {
+        for (size_t i = 0; i < COUNT; i++) {
+            for (size_t j = i + 1; j < COUNT; j++) {
+                if (Fields[i].number == Fields[j].number) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    static constexpr size_t SLOTS = slotCount();
+    static constexpr uint32_t SEED = findSeed();
+    static_assert(SEED != UINT32_MAX, "No perfect hash seed for the payload keys");
+    static_assert(numbersUnique(), "Field numbers must be unique");
+    static constexpr std::array<int8_t, SLOTS> INDEX = buildIndex(SEED);
+};
+
+using Payload_TelemetrySchema = Payload_Schema<PAYLOAD_TELEMETRY_FIELDS>;
+using Payload_AttributeSchema = Payload_Schema<PAYLOAD_ATTRIBUTE_FIELDS>;
+
+constexpr bool Payload_hasActuatorKeys()
+{
+    for (uint8_t i = 0; i < ACTUATOR_COUNT; i++) {
+        if (!Payload_AttributeSchema::contains(ACTUATORS[i].key)) {
+            return false;
+        }
+    }
+    return true;
+}
+static_assert(Payload_hasActuatorKeys(), "Every actuator key needs a field in attributes.proto");
+
+#endif  // _PAYLOAD_SCHEMA_H
@@ -0,0 +1,288 @@
+#ifndef _PUBLISH_PIPELINE_H
+#define _PUBLISH_PIPELINE_H
+
+#include <Arduino.h>
+
+#include <algorithm>
+
+#include "MQTT_Transport.h"
+#include "Telemetry_Batch.h"
+#include "ThingsBoard_Manager.h"
+
+//
+// QoS 1 publishing of buffered telemetry. Up to window() messages are in flight unacknowledged,
+// so the upload rate is not bound by one round trip per message. A message covers a range of
+// sample sequence numbers of the store-and-forward buffer, the samples are only released once
+// the message and every message before it have been acknowledged.
+//
+// The MQTT client only publishes QoS 0, the QoS 1 PUBLISH packets are written to the transport
+// directly and the PUBACKs are picked up by MQTT_Transport.
+//
+#ifndef PUBLISH_WINDOW_MAX
+#define PUBLISH_WINDOW_MAX 4
+#endif
+#ifndef PUBLISH_WINDOW
+#define PUBLISH_WINDOW PUBLISH_WINDOW_MAX
+#endif
+static_assert(PUBLISH_WINDOW >= 1 && PUBLISH_WINDOW <= PUBLISH_WINDOW_MAX,
+              "PUBLISH_WINDOW must be between 1 and PUBLISH_WINDOW_MAX");
+
+// An unacknowledged message is sent again, flagged as duplicate, after this long
+constexpr uint32_t PUBLISH_ACK_TIMEOUT = 5000;  // 5 seconds
+// Packet ids of the pipeline, the MQTT client numbers its subscriptions from 1
+constexpr uint16_t PUBLISH_FIRST_PACKET_ID = 0x8000;
+
+constexpr uint8_t MQTT_PUBLISH_QOS1 = 0x32;
+constexpr uint8_t MQTT_PUBLISH_DUP = 0x08;
+
+class Publish_Pipeline {
+   public:
+    /// @brief Called with the packet id of an acknowledged message and the time from first sending
+    /// it to its acknowledgement
+    using Ack_Observer = void (*)(uint16_t packetId, uint32_t latencyMs);
+
+    Publish_Pipeline(MQTT_Transport& transport, const char* topic)
+        : m_transport(transport), m_topic(topic), m_topicLength(strlen(topic))
+    {
+    }
+
+    uint8_t window() const { return m_window; }
+
+    /// @brief Change the number of messages allowed in flight, messages already in flight stay
+    void setWindow(uint8_t window) { m_window = constrain(window, 1, PUBLISH_WINDOW_MAX); }
+
+    size_t inFlight() const { return m_count; }
+    bool full() const { return m_count >= m_window; }
+
+    void setAckObserver(Ack_Observer observer) { m_ackObserver = observer; }
+
+    /// @brief Packet id of the last message accepted by publish()
+    uint16_t lastPacketId() const { return m_lastPacketId; }
+
+    /// @brief Number of samples not sent yet
+    /// @param first Sequence number of the oldest sample in the buffer
+    /// @param size Number of samples in the buffer
+    size_t pending(uint32_t first, size_t size) const
+    {
+        if (m_restart || static_cast<int32_t>(m_next - first) < 0) {
+            return size;
+        }
+        return std::min(size, static_cast<size_t>(first + size - m_next));
+    }
+
+    /// @brief Sequence number of the first sample not sent yet
+    /// @param first Sequence number of the oldest sample in the buffer
+    uint32_t next(uint32_t first)
+    {
+        if (m_restart || static_cast<int32_t>(m_next - first) < 0) {
+            // Restarted or the overflow policy removed samples that had not been sent
+            m_next = first;
+            m_restart = false;
+        }
+        m_broken = false;
+        return m_next;
+    }
+
+    /// @brief The samples before end are complete in the pending message
+    void mark(uint32_t end) { m_end = end; }
+
+    /// @brief Send a message, see Telemetry_Batch::setPublisher()
+    /// @return HELD if the window is full, FAILED if the message is too large or was not written
+    /// completely. The following messages are refused until the next call of next() so no
+    /// samples are skipped. A message that was not written stays in flight, the connection was
+    /// closed and it is sent again on timeout or after reconnecting.
+    Publish_Result publish(const char* payload, size_t length, uint32_t now)
+    {
+        if (full()) {
+            m_broken = true;
+            return Publish_Result::HELD;
+        }
+        if (m_broken || length > sizeof(m_entries[0].payload)) {
+            m_broken = true;
+            return Publish_Result::FAILED;
+        }
+        Entry& entry = m_entries[(m_first + m_count) % PUBLISH_WINDOW_MAX];
+        entry.packetId = m_packetId;
+        entry.acked = false;
+        entry.sentAt = now;
+        entry.firstSentAt = now;
+        entry.end = m_end;
+        entry.length = length;
+        memcpy(entry.payload, payload, length);
+        m_lastPacketId = m_packetId;
+        m_packetId = m_packetId == UINT16_MAX ? PUBLISH_FIRST_PACKET_ID : m_packetId + 1;
+        m_count++;
+        m_next = m_end;
+        if (!write(entry, false)) {
+            m_broken = true;
+            return Publish_Result::FAILED;
+        }
+        m_sent++;
+        return Publish_Result::SENT;
+    }
+
+    /// @brief Process the received acknowledgements and retransmit timed out messages, call after
+    /// the MQTT client read from the connection
+    template <typename Buffer>
+    void poll(Buffer& buffer, uint32_t now)
+    {
+        uint16_t packetId;
+        while (m_transport.takeAck(packetId)) {
+            for (size_t i = 0; i < m_count; i++) {
+                Entry& entry = m_entries[(m_first + i) % PUBLISH_WINDOW_MAX];
+                if (entry.packetId == packetId && !entry.acked) {
+                    entry.acked = true;
+                    m_acked++;
+                    m_ackLatency += now - entry.firstSentAt;
+                    if (m_ackObserver != nullptr) {
+                        m_ackObserver(packetId, now - entry.firstSentAt);
+                    }
+                    break;
+                }
+            }
+        }
+
+        // Samples are released in order, a message acknowledged early waits for its predecessors
+        bool released = false;
+        uint32_t end = 0;
+        while (m_count > 0 && m_entries[m_first].acked) {
+            end = m_entries[m_first].end;
+            released = true;
+            m_first = (m_first + 1) % PUBLISH_WINDOW_MAX;
+            m_count--;
+        }
+        if (released) {
+            buffer.release(end);
+        }
+
+        for (size_t i = 0; i < m_count; i++) {
+            Entry& entry = m_entries[(m_first + i) % PUBLISH_WINDOW_MAX];
+            if (!entry.acked && now - entry.sentAt >= PUBLISH_ACK_TIMEOUT) {
+                entry.sentAt = now;
+                m_retransmits++;
+                if (!write(entry, true)) {
+                    // The connection was closed, the messages are sent again after reconnecting
+                    break;
+                }
+            }
+        }
+    }
+
+    /// @brief Milliseconds until the oldest unacknowledged message times out, UINT32_MAX if none
+    uint32_t remaining(uint32_t now) const
+    {
+        uint32_t remaining = UINT32_MAX;
+        for (size_t i = 0; i < m_count; i++) {
+            const Entry& entry = m_entries[(m_first + i) % PUBLISH_WINDOW_MAX];
+            if (!entry.acked) {
+                const uint32_t elapsed = now - entry.sentAt;
+                remaining = std::min(remaining, elapsed >= PUBLISH_ACK_TIMEOUT
+                                                    ? 0U
+                                                    : PUBLISH_ACK_TIMEOUT - elapsed);
+            }
+        }
+        return remaining;
+    }
+
+    /// @brief Forget the messages in flight, e.g. after a new connection, their samples are sent
+    /// again from the oldest one still buffered
+    void reset()
+    {
+        m_first = 0;
+        m_count = 0;
+        m_restart = true;
+    }
+
+    /// @brief Print the throughput since the last call
+    void printStats(uint32_t now)
+    {
+        const uint32_t elapsed = now - m_statsSince;
+        Serial.printf("Publish pipeline: window %u, %u sent, %u acked (%.2f msg/s), %u "
+                      "retransmitted, mean ack latency %u ms\n",
+                      static_cast<unsigned>(m_window), static_cast<unsigned>(m_sent),
+                      static_cast<unsigned>(m_acked),
+                      elapsed == 0 ? 0.0f : m_acked * 1000.0f / elapsed,
+                      static_cast<unsigned>(m_retransmits),
+                      static_cast<unsigned>(m_acked == 0 ? 0 : m_ackLatency / m_acked));
+        m_statsSince = now;
+        m_sent = 0;
+        m_acked = 0;
+        m_retransmits = 0;
+        m_ackLatency = 0;
+    }
+
+   private:
+    struct Entry {
+        uint16_t packetId;
+        bool acked;
+        uint32_t sentAt;
+        uint32_t firstSentAt;
+        uint32_t end;  // Samples before this sequence number are complete in the message
+        size_t length;
+        char payload[BATCH_MESSAGE_SIZE];
+    };
+
+    /// @brief Write the PUBLISH packet of an entry to the connection. A packet written in part
+    /// would corrupt the MQTT stream, the connection is closed then.
+    bool write(const Entry& entry, bool duplicate)
+    {
+        uint8_t header[8 + sizeof(TELEMETRY_BATCH_TOPIC)];
+        size_t length = 0;
+        header[length++] = MQTT_PUBLISH_QOS1 | (duplicate ? MQTT_PUBLISH_DUP : 0);
+        uint32_t remaining = 2 + m_topicLength + 2 + entry.length;
+        do {
+            uint8_t byte = remaining & 0x7F;
+            remaining >>= 7;
+            header[length++] = remaining > 0 ? byte | 0x80 : byte;
+        } while (remaining > 0);
+        header[length++] = m_topicLength >> 8;
+        header[length++] = m_topicLength & 0xFF;
+        if (length + m_topicLength + 2 > sizeof(header)) {
+            return false;
+        }
+        memcpy(header + length, m_topic, m_topicLength);
+        length += m_topicLength;
+        header[length++] = entry.packetId >> 8;
+        header[length++] = entry.packetId & 0xFF;
+        if (m_transport.write(header, length) == length &&
+            m_transport.write(reinterpret_cast<const uint8_t*>(entry.payload), entry.length) ==
+                entry.length) {
+            return true;
+        }
+        Serial.printf("Publish of packet %u (%u bytes) cut short, closing the connection\n",
+                      static_cast<unsigned>(entry.packetId), static_cast<unsigned>(entry.length));
+        m_transport.stop();
+        return false;
+    }
+
+    MQTT_Transport& m_transport;
+    const char* const m_topic;
+    const size_t m_topicLength;
+    uint8_t m_window = PUBLISH_WINDOW;
+    Entry m_entries[PUBLISH_WINDOW_MAX];
+    size_t m_first = 0;
+    size_t m_count = 0;
+    uint16_t m_packetId = PUBLISH_FIRST_PACKET_ID;
+    uint16_t m_lastPacketId = 0;
+    uint32_t m_next = 0;
+    uint32_t m_end = 0;
+    bool m_restart = true;
+    bool m_broken = false;
+    Ack_Observer m_ackObserver = nullptr;
+
+    uint32_t m_statsSince = 0;
+    uint32_t m_sent = 0;
+    uint32_t m_acked = 0;
+    uint32_t m_retransmits = 0;
+    uint64_t m_ackLatency = 0;
+};
+
+Publish_Pipeline Publish_pipeline(WiFi_client, TELEMETRY_BATCH_TOPIC);
+
+/// @brief Telemetry_Batch publisher of the buffered samples
+Publish_Result Publish_telemetry(const char* payload, size_t length)
+{
+    return Publish_pipeline.publish(payload, length, millis());
+}
+
+#endif  // _PUBLISH_PIPELINE_H
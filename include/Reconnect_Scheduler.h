@@ -0,0 +1,123 @@
+#ifndef _RECONNECT_SCHEDULER_H
+#define _RECONNECT_SCHEDULER_H
+
+#include <Arduino.h>
+
+#include <algorithm>
+
+//
+// Reconnect scheduling shared by WiFi and ThingsBoard, capped exponential backoff with
+// decorrelated jitter so that a fleet losing its broker at the same time does not come back in
+// lockstep
+//
+enum class Connect_Failure : uint8_t {
+    DNS,        // Server name did not resolve
+    TCP,        // TCP connection refused or timed out
+    MQTT_AUTH,  // CONNACK refused the credentials
+    MQTT,       // Any other MQTT level failure, e.g. a refused subscription
+    LINK        // WiFi association or DHCP did not complete
+};
+
+const char* Connect_failureName(Connect_Failure failure)
+{
+    switch (failure) {
+        case Connect_Failure::DNS:
+            return "DNS";
+        case Connect_Failure::TCP:
+            return "TCP";
+        case Connect_Failure::MQTT_AUTH:
+            return "MQTT auth";
+        case Connect_Failure::MQTT:
+            return "MQTT";
+        case Connect_Failure::LINK:
+            return "link";
+    }
+    return "unknown";
+}
+
+/// @brief Decides when the next connection attempt may start. After a failure the delay is drawn
+/// from [base, 3 * previous delay] and capped, after a lost connection the first attempt is spread
+/// over [0, base].
+class Reconnect_Scheduler {
+   public:
+    Reconnect_Scheduler(const char* name, uint32_t baseMs, uint32_t capMs)
+        : m_name(name),
+          m_base(baseMs),
+          m_cap(capMs),
+          m_backoff(baseMs),
+          m_scheduledAt(0),
+          m_delay(0),
+          m_authFailures(0)
+    {
+    }
+
+    bool due(uint32_t now) const { return now - m_scheduledAt >= m_delay; }
+
+    /// @brief Time left until the next attempt is due
+    uint32_t remaining(uint32_t now) const
+    {
+        return due(now) ? 0 : m_delay - (now - m_scheduledAt);
+    }
+
+    /// @brief Connection established, the next attempt (e.g. the next setup step) is due at once
+    void succeeded()
+    {
+        m_backoff = m_base;
+        m_delay = 0;
+        m_authFailures = 0;
+    }
+
+    /// @brief Back off after a failed attempt
+    void failed(Connect_Failure failure, uint32_t now)
+    {
+        const uint32_t upper = static_cast<uint32_t>(std::min<uint64_t>(m_cap, m_backoff * 3ULL));
+        m_backoff = std::min(m_cap, static_cast<uint32_t>(random(m_base, upper + 1)));
+        schedule(m_backoff, now);
+        if (failure == Connect_Failure::MQTT_AUTH) {
+            m_authFailures++;
+        }
+        Serial.printf("%s %s failure, next attempt in %u ms\n", m_name,
+                      Connect_failureName(failure), static_cast<unsigned>(m_delay));
+    }
+
+    /// @brief An established connection dropped, spread the first attempt over the base delay
+    void lost(uint32_t now)
+    {
+        m_backoff = m_base;
+        schedule(static_cast<uint32_t>(random(0, m_base + 1)), now);
+        Serial.printf("%s connection lost, next attempt in %u ms\n", m_name,
+                      static_cast<unsigned>(m_delay));
+    }
+
+    /// @brief Hold the next attempt back without backing off, e.g. while an attempt is pending
+    void defer(uint32_t delay, uint32_t now) { schedule(delay, now); }
+
+    /// @brief Make the next attempt due at once, e.g. after new credentials arrived
+    void reset()
+    {
+        m_backoff = m_base;
+        m_delay = 0;
+    }
+
+    /// @brief Number of consecutive attempts refused for their credentials
+    uint8_t authFailures() const { return m_authFailures; }
+
+    void clearAuthFailures() { m_authFailures = 0; }
+
+   private:
+    void schedule(uint32_t delay, uint32_t now)
+    {
+        m_scheduledAt = now;
+        m_delay = delay;
+    }
+
+    const char* const m_name;
+    const uint32_t m_base;
+    const uint32_t m_cap;
+    uint32_t m_backoff;
+    uint32_t m_scheduledAt;
+    uint32_t m_delay;
+    uint8_t m_authFailures;
+};
+
+#endif  // _RECONNECT_SCHEDULER_H
@@ -0,0 +1,108 @@
+#ifndef _REPORT_POLICY_H
+#define _REPORT_POLICY_H
+
+#include <Arduino.h>
+
+#include <math.h>
+
+//
+// Report-by-exception, a reading is only reported when it moved past its deadband since the last
+// reported value or when its heartbeat expired
+//
+enum class Deadband_Type : uint8_t {
+    ABSOLUTE,  // Deadband in the unit of the reading
+    PERCENT    // Deadband in percent of the last reported value
+};
+
+struct Report_Policy {
+    const char* key;
+    Deadband_Type deadbandType;
+    float deadband;
+    uint32_t minInterval;  // Rate limit, changes within this time after a report are held back
+    uint32_t maxInterval;  // Heartbeat, the reading is reported at least this often
+};
+
+/// @brief Decides per key whether a reading has to be reported. Keys are identified by their
+/// index in the policy table, the result of report() is a bitmask of these indexes.
+template <size_t Count>
+class Report_Filter {
+    static_assert(Count <= 8, "Report_Filter masks are 8 bits wide");
+
+   public:
+    explicit Report_Filter(const Report_Policy (&policies)[Count]) : m_policies(policies) {}
+
+    const Report_Policy& policy(size_t index) const { return m_policies[index]; }
+
+    /// @brief Evaluate one reading of every key, the reported ones become the new reference
+    /// @return Bitmask of the keys to report
+    uint8_t report(const float (&values)[Count], uint32_t now)
+    {
+        uint8_t mask = 0;
+        for (size_t i = 0; i < Count; i++) {
+            m_evaluated++;
+            if (!due(i, values[i], now)) {
+                continue;
+            }
+            m_states[i].value = values[i];
+            m_states[i].reportedAt = now;
+            m_states[i].reported = true;
+            m_reported++;
+            mask |= 1U << i;
+        }
+        return mask;
+    }
+
+    /// @brief Report every key on the next reading, e.g. after a new session started
+    void invalidate()
+    {
+        for (size_t i = 0; i < Count; i++) {
+            m_states[i].reported = false;
+        }
+    }
+
+    /// @brief Number of readings evaluated since the last resetStats()
+    uint32_t evaluated() const { return m_evaluated; }
+
+    /// @brief Number of readings reported since the last resetStats()
+    uint32_t reported() const { return m_reported; }
+
+    void resetStats()
+    {
+        m_evaluated = 0;
+        m_reported = 0;
+    }
+
+   private:
+    struct State {
+        float value = 0;
+        uint32_t reportedAt = 0;
+        bool reported = false;
+    };
+
+    bool due(size_t index, float value, uint32_t now) const
+    {
+        const Report_Policy& policy = m_policies[index];
+        const State& state = m_states[index];
+        if (!state.reported) {
+            return true;
+        }
+        const uint32_t elapsed = now - state.reportedAt;
+        if (elapsed >= policy.maxInterval) {
+            return true;
+        }
+        if (elapsed < policy.minInterval) {
+            return false;
+        }
+        const float band = policy.deadbandType == Deadband_Type::PERCENT
+                               ? fabsf(state.value) * policy.deadband / 100.0f
+                               : policy.deadband;
+        return fabsf(value - state.value) > band;
+    }
+
+    const Report_Policy (&m_policies)[Count];
+    State m_states[Count];
+    uint32_t m_evaluated = 0;
+    uint32_t m_reported = 0;
+};
+
+#endif  // _REPORT_POLICY_H
@@ -0,0 +1,59 @@
+#ifndef _SPSC_QUEUE_H
+#define _SPSC_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/// @brief Lock-free, allocation-free queue for exactly one producer and one consumer, which may
+/// run on different tasks or cores. Capacity must be a power of two, one slot stays unused.
+template <typename T, size_t Capacity>
+class SPSC_Queue {
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0,
+                  "SPSC_Queue capacity must be a power of two");
+
+   public:
+    /// @brief Producer side
+    /// @return false if the queue is full, the item is not queued
+    bool push(const T& item)
+    {
+        const size_t head = m_head.load(std::memory_order_relaxed);
+        const size_t next = (head + 1) & (Capacity - 1);
+        if (next == m_tail.load(std::memory_order_acquire)) {
+            m_overflows.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        m_items[head] = item;
+        m_head.store(next, std::memory_order_release);
+        return true;
+    }
+
+    /// @brief Consumer side
+    /// @return false if the queue is empty
+    bool pop(T& item)
+    {
+        const size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail == m_head.load(std::memory_order_acquire)) {
+            return false;
+        }
+        item = m_items[tail];
+        m_tail.store((tail + 1) & (Capacity - 1), std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const
+    {
+        return m_tail.load(std::memory_order_acquire) == m_head.load(std::memory_order_acquire);
+    }
+
+    /// @brief Number of items rejected because the queue was full
+    uint32_t overflows() const { return m_overflows.load(std::memory_order_relaxed); }
+
+   private:
+    T m_items[Capacity];
+    std::atomic<size_t> m_head{0};
+    std::atomic<size_t> m_tail{0};
+    std::atomic<uint32_t> m_overflows{0};
+};
+
+#endif  // _SPSC_QUEUE_H
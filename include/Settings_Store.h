@@ -0,0 +1,261 @@
+#ifndef _SETTINGS_STORE_H
+#define _SETTINGS_STORE_H
+
+#include <Arduino.h>
+#include <Preferences.h>
+
+#include <type_traits>
+
+//
+// Typed settings on top of Preferences. Values are cached in RAM, reads never touch flash, and
+// set() only marks a value dirty when it actually changed. commit() writes the dirty values of a
+// namespace in one Preferences session, so a group of changes costs one open and no rewrites of
+// unchanged keys.
+//
+class Settings_Store;
+
+/// @brief One key of a settings namespace, the value lives in storage owned by the subclass
+class Setting_Base {
+   public:
+    Setting_Base(Settings_Store& store, const char* key, void* data, size_t capacity,
+                 bool isString);
+
+    const char* key() const { return m_key; }
+
+    /// @brief Number of times the value was written to flash since boot
+    uint32_t writes() const { return m_writes; }
+
+    bool dirty() const { return m_dirty; }
+
+   protected:
+    /// @brief Replace the cached value, unchanged values are not marked dirty
+    /// @return true if the value changed
+    bool assign(const void* value, size_t length);
+
+    /// @brief Take a value known to match flash without marking it dirty
+    void adopt(const void* value, size_t length);
+
+    size_t length() const { return m_length; }
+
+   private:
+    friend class Settings_Store;
+
+    void load(Preferences& preferences);
+    void save(Preferences& preferences);
+
+    Settings_Store& m_store;
+    const char* const m_key;
+    void* const m_data;
+    const size_t m_capacity;
+    const bool m_isString;  // Kept as an NVS string, for keys written with putString() before
+    size_t m_length;
+    bool m_dirty = false;
+    uint32_t m_writes = 0;
+    Setting_Base* m_next = nullptr;
+};
+
+class Settings_Store {
+   public:
+    explicit Settings_Store(const char* name) : m_name(name) {}
+
+    /// @brief Load every setting of the namespace into RAM, keys not in flash keep their defaults
+    bool begin()
+    {
+        if (!m_preferences.begin(m_name, true)) {
+            Serial.printf("Failed to open settings namespace %s for reading\n", m_name);
+            return false;
+        }
+        for (Setting_Base* setting = m_settings; setting != nullptr; setting = setting->m_next) {
+            setting->load(m_preferences);
+        }
+        m_preferences.end();
+        return true;
+    }
+
+    /// @brief Write the dirty settings in one Preferences session
+    /// @return false if the namespace could not be opened, the settings stay dirty
+    bool commit()
+    {
+        if (m_dirtyCount == 0) {
+            return true;
+        }
+        if (!m_preferences.begin(m_name, false)) {
+            Serial.printf("Failed to open settings namespace %s for writing\n", m_name);
+            return false;
+        }
+        for (Setting_Base* setting = m_settings; setting != nullptr; setting = setting->m_next) {
+            if (setting->m_dirty) {
+                setting->save(m_preferences);
+                m_writes++;
+            }
+        }
+        m_preferences.end();
+        m_dirtyCount = 0;
+        m_commits++;
+        return true;
+    }
+
+    /// @brief Commit once no setting changed for settleMs, so a burst of changes is written once
+    bool commitIfSettled(uint32_t settleMs, uint32_t now)
+    {
+        if (m_dirtyCount == 0 || now - m_changedAt < settleMs) {
+            return true;
+        }
+        return commit();
+    }
+
+    bool dirty() const { return m_dirtyCount != 0; }
+
+    /// @brief Number of values written to flash since boot, flash wear is driven by it
+    uint32_t writes() const { return m_writes; }
+    uint32_t commits() const { return m_commits; }
+    /// @brief Number of set() calls that left the value unchanged and so cost no write
+    uint32_t avoided() const { return m_avoided; }
+
+   private:
+    friend class Setting_Base;
+
+    void attach(Setting_Base* setting)
+    {
+        setting->m_next = m_settings;
+        m_settings = setting;
+    }
+
+    const char* const m_name;
+    Preferences m_preferences;
+    Setting_Base* m_settings = nullptr;
+    uint32_t m_dirtyCount = 0;
+    uint32_t m_changedAt = 0;
+    uint32_t m_writes = 0;
+    uint32_t m_commits = 0;
+    uint32_t m_avoided = 0;
+};
+
+Setting_Base::Setting_Base(Settings_Store& store, const char* key, void* data, size_t capacity,
+                           bool isString)
+    : m_store(store),
+      m_key(key),
+      m_data(data),
+      m_capacity(capacity),
+      m_isString(isString),
+      // The default value, an empty string is its terminator
+      m_length(isString ? 1 : capacity)
+{
+    m_store.attach(this);
+}
+
+bool Setting_Base::assign(const void* value, size_t length)
+{
+    length = length < m_capacity ? length : m_capacity;
+    if (length == m_length && memcmp(m_data, value, length) == 0) {
+        m_store.m_avoided++;
+        return false;
+    }
+    memcpy(m_data, value, length);
+    m_length = length;
+    m_store.m_changedAt = millis();
+    if (!m_dirty) {
+        m_dirty = true;
+        m_store.m_dirtyCount++;
+    }
+    return true;
+}
+
+void Setting_Base::adopt(const void* value, size_t length)
+{
+    length = length < m_capacity ? length : m_capacity;
+    memcpy(m_data, value, length);
+    m_length = length;
+}
+
+void Setting_Base::load(Preferences& preferences)
+{
+    if (!preferences.isKey(m_key)) {
+        return;
+    }
+    if (m_isString) {
+        // Includes the terminator, as the length given to assign() does
+        const size_t length = preferences.getString(m_key, static_cast<char*>(m_data), m_capacity);
+        if (length > 0) {
+            m_length = length;
+        }
+    } else if (preferences.getBytesLength(m_key) == m_capacity) {
+        m_length = preferences.getBytes(m_key, m_data, m_capacity);
+    }
+}
+
+void Setting_Base::save(Preferences& preferences)
+{
+    if (m_isString) {
+        preferences.putString(m_key, static_cast<const char*>(m_data));
+    } else {
+        preferences.putBytes(m_key, m_data, m_length);
+    }
+    m_dirty = false;
+    m_writes++;
+}
+
+/// @brief Setting holding a trivially copyable value, stored as bytes
+template <typename T>
+class Setting : public Setting_Base {
+    static_assert(std::is_trivially_copyable<T>::value, "Settings are stored as raw bytes");
+
+   public:
+    Setting(Settings_Store& store, const char* key, const T& defaultValue)
+        : Setting_Base(store, key, &m_value, sizeof(T), false), m_value(defaultValue)
+    {
+    }
+
+    const T& get() const { return m_value; }
+
+    bool set(const T& value)
+    {
+        // Compared and copied through a local, m_value is the destination
+        const T copy = value;
+        return assign(&copy, sizeof(T));
+    }
+
+    /// @brief Take a value known to be in flash already, e.g. a copy kept over deep sleep
+    void adopt(const T& value) { Setting_Base::adopt(&value, sizeof(T)); }
+
+   private:
+    T m_value;
+};
+
+/// @brief Setting holding a string of at most Capacity - 1 characters, longer values are rejected
+template <size_t Capacity>
+class String_Setting : public Setting_Base {
+   public:
+    String_Setting(Settings_Store& store, const char* key)
+        : Setting_Base(store, key, m_value, Capacity, true)
+    {
+    }
+
+    const char* c_str() const { return m_value; }
+    bool empty() const { return m_value[0] == '\0'; }
+
+    /// @brief Whether the value can be stored, nullptr stores an empty string
+    static bool fits(const char* value) { return value == nullptr || strlen(value) < Capacity; }
+
+    /// @return true if the value changed, false if it was unchanged or does not fit
+    bool set(const char* value)
+    {
+        if (value == nullptr) {
+            value = "";
+        }
+        if (!fits(value)) {
+            // A truncated credential or name would be wrong, keep the last good value
+            Serial.printf("Setting %s of %u characters exceeds %u, rejected\n", key(),
+                          static_cast<unsigned>(strlen(value)),
+                          static_cast<unsigned>(Capacity - 1));
+            return false;
+        }
+        // Compared including the terminator, so a shorter value never matches a longer one
+        return assign(value, strlen(value) + 1);
+    }
+
+   private:
+    char m_value[Capacity] = "";
+};
+
+#endif  // _SETTINGS_STORE_H
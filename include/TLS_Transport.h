@@ -0,0 +1,544 @@
+#ifndef _TLS_TRANSPORT_H
+#define _TLS_TRANSPORT_H
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <WiFiClient.h>
+
+#include <algorithm>
+
+//
+// MQTTS transport, build with -DMQTT_TLS=1, point ThingsBoard_port to the TLS listener (8883)
+// and set ThingsBoard_caCert in Configuration.h. The TLS buffers come from a static arena, the
+// handshake does not touch the heap.
+//
+// Experimental, add -DMQTT_TLS_SESSION_RESUMPTION=1: the TLS session is kept in RTC memory and
+// NVS and offered on the next connection, so reconnects and wakes from deep sleep resume it with
+// an abbreviated handshake instead of a full one. It has not been run against a broker yet.
+//
+// Each handshake prints its time, the memory report the mean of full and resumed ones. To measure
+// them, run a local mosquitto with a TLS listener ('listener 8883' with cafile, certfile and
+// keyfile), clear the "tls" namespace for a full handshake and reconnect or wake for resumed ones.
+//
+#ifdef MQTT_TLS
+
+#ifdef BOARD_NATIVE
+#error "MQTT_TLS needs the mbedtls of ESP-IDF, it is not available in the native build"
+#endif
+
+#include <esp_random.h>
+#include <mbedtls/net_sockets.h>
+#include <mbedtls/platform.h>
+#include <mbedtls/ssl.h>
+#include <mbedtls/version.h>
+#include <mbedtls/x509_crt.h>
+
+#include "Configuration.h"
+#include "Settings_Store.h"
+
+// Static memory the TLS contexts are allocated from, allocations that do not fit fall back to the
+// heap and are counted as misses
+#ifndef TLS_ARENA_SIZE
+#define TLS_ARENA_SIZE 40960
+#endif
+constexpr uint32_t TLS_HANDSHAKE_TIMEOUT = 10000;  // 10 seconds
+constexpr uint32_t TLS_WRITE_TIMEOUT = 5000;       // 5 seconds
+
+#ifdef MQTT_TLS_SESSION_RESUMPTION
+// Serialized session, it includes the server certificate if mbedtls keeps peer certificates
+// (CONFIG_MBEDTLS_SSL_KEEP_PEER_CERTIFICATE), without it 512 bytes are enough
+#ifndef TLS_SESSION_CACHE_SIZE
+#define TLS_SESSION_CACHE_SIZE 2048
+#endif
+
+constexpr char TLS_PREFS_NAMESPACE[] = "tls";
+constexpr char TLS_PREFS_SESSION[] = "session";
+constexpr uint32_t TLS_SESSION_MAGIC = 0x544c5331;  // "TLS1"
+
+struct TLS_Session_Cache {
+    uint32_t magic;
+    uint32_t server;  // Hash of the host and port the session belongs to
+    uint16_t length;
+    uint8_t data[TLS_SESSION_CACHE_SIZE];
+};
+
+Settings_Store TLS_settings(TLS_PREFS_NAMESPACE);
+Setting<TLS_Session_Cache> TLS_sessionSetting(TLS_settings, TLS_PREFS_SESSION,
+                                              TLS_Session_Cache{});
+
+// Survives deep sleep, so a wake resumes without reading NVS
+RTC_DATA_ATTR TLS_Session_Cache TLS_session = {};
+#endif  // MQTT_TLS_SESSION_RESUMPTION
+
+/// @brief First fit allocator over a fixed block of memory, adjacent free blocks are merged
+template <size_t Size>
+class TLS_Arena {
+   public:
+    TLS_Arena()
+    {
+        Header* first = reinterpret_cast<Header*>(m_memory);
+        first->size = Size;
+        first->free = 1;
+    }
+
+    void* allocate(size_t bytes)
+    {
+        const size_t needed = sizeof(Header) + ((bytes + ALIGNMENT - 1) & ~(ALIGNMENT - 1));
+        for (size_t offset = 0; offset < Size; offset += header(offset)->size) {
+            Header* block = header(offset);
+            if (!block->free || block->size < needed) {
+                continue;
+            }
+            if (block->size - needed >= sizeof(Header) + ALIGNMENT) {
+                Header* rest = header(offset + needed);
+                rest->size = block->size - needed;
+                rest->free = 1;
+                block->size = needed;
+            }
+            block->free = 0;
+            m_used += block->size;
+            m_peak = std::max(m_peak, m_used);
+            return block + 1;
+        }
+        return nullptr;
+    }
+
+    void release(void* pointer)
+    {
+        Header* block = static_cast<Header*>(pointer) - 1;
+        block->free = 1;
+        m_used -= block->size;
+        for (size_t offset = 0; offset < Size; offset += header(offset)->size) {
+            Header* current = header(offset);
+            while (current->free && offset + current->size < Size &&
+                   header(offset + current->size)->free) {
+                current->size += header(offset + current->size)->size;
+            }
+        }
+    }
+
+    bool owns(const void* pointer) const
+    {
+        return pointer >= m_memory && pointer < m_memory + Size;
+    }
+
+    size_t used() const { return m_used; }
+    size_t peak() const { return m_peak; }
+
+   private:
+    static constexpr size_t ALIGNMENT = 8;
+
+    struct Header {
+        uint32_t size;  // Including the header
+        uint32_t free;
+    };
+    static_assert(sizeof(Header) % ALIGNMENT == 0, "Blocks must stay aligned");
+
+    Header* header(size_t offset) { return reinterpret_cast<Header*>(m_memory + offset); }
+
+    alignas(ALIGNMENT) uint8_t m_memory[Size];
+    size_t m_used = 0;
+    size_t m_peak = 0;
+};
+
+TLS_Arena<TLS_ARENA_SIZE> TLS_arena;
+// Only allocations of this task go to the arena, mbedtls is also used by the WiFi stack
+TaskHandle_t TLS_arenaOwner = nullptr;
+uint32_t TLS_arenaMisses = 0;
+
+void* TLS_calloc(size_t count, size_t size)
+{
+    if (xTaskGetCurrentTaskHandle() == TLS_arenaOwner && size != 0 &&
+        count <= SIZE_MAX / size) {
+        void* pointer = TLS_arena.allocate(count * size);
+        if (pointer != nullptr) {
+            return memset(pointer, 0, count * size);
+        }
+        TLS_arenaMisses++;
+    }
+    return calloc(count, size);
+}
+
+void TLS_free(void* pointer)
+{
+    if (TLS_arena.owns(pointer)) {
+        TLS_arena.release(pointer);
+    } else {
+        free(pointer);
+    }
+}
+
+int TLS_random(void* context, unsigned char* output, size_t length)
+{
+    (void)context;
+    // Hardware RNG, random while the radio is on
+    esp_fill_random(output, length);
+    return 0;
+}
+
+#ifdef MQTT_TLS_SESSION_RESUMPTION
+uint32_t TLS_serverKey(const char* host, uint16_t port)
+{
+    uint32_t hash = 2166136261U ^ port;
+    for (; host != nullptr && *host != '\0'; host++) {
+        hash ^= static_cast<uint8_t>(*host);
+        hash *= 16777619U;
+    }
+    return hash;
+}
+#endif
+
+/// @brief TLS 1.2 client over a WiFiClient, see the top of the file
+class TLS_Transport : public Client {
+   public:
+    using Print::write;
+
+    int connect(IPAddress ip, uint16_t port) override
+    {
+        // No name to verify the certificate against, only the chain is checked
+        return open(ip, nullptr, port);
+    }
+
+    int connect(const char* host, uint16_t port) override
+    {
+        IPAddress ip;
+        if (!WiFi.hostByName(host, ip)) {
+            return 0;
+        }
+        return open(ip, host, port);
+    }
+
+    /// @brief Connect to an address resolved beforehand, the certificate is verified against host
+    int connect(IPAddress ip, const char* host, uint16_t port) { return open(ip, host, port); }
+
+    size_t write(uint8_t c) override { return write(&c, 1); }
+
+    size_t write(const uint8_t* buffer, size_t size) override
+    {
+        size_t written = 0;
+        const uint32_t start = millis();
+        while (m_connected && written < size) {
+            const int result = mbedtls_ssl_write(&m_ssl, buffer + written, size - written);
+            if (result > 0) {
+                written += result;
+            } else if ((result != MBEDTLS_ERR_SSL_WANT_WRITE &&
+                        result != MBEDTLS_ERR_SSL_WANT_READ) ||
+                       millis() - start > TLS_WRITE_TIMEOUT) {
+                close(false);
+            } else {
+                delay(1);
+            }
+        }
+        return written;
+    }
+
+    int available() override
+    {
+        if (!m_connected) {
+            return 0;
+        }
+        // Process what arrived on the socket, the decrypted bytes are then available
+        const int result = mbedtls_ssl_read(&m_ssl, nullptr, 0);
+        if (result < 0 && result != MBEDTLS_ERR_SSL_WANT_READ &&
+            result != MBEDTLS_ERR_SSL_WANT_WRITE) {
+            close(false);
+            return 0;
+        }
+        return mbedtls_ssl_get_bytes_avail(&m_ssl);
+    }
+
+    int read() override
+    {
+        uint8_t c;
+        return read(&c, 1) == 1 ? c : -1;
+    }
+
+    int read(uint8_t* buffer, size_t size) override
+    {
+        if (!m_connected) {
+            return -1;
+        }
+        const int result = mbedtls_ssl_read(&m_ssl, buffer, size);
+        if (result > 0) {
+            return result;
+        }
+        if (result != MBEDTLS_ERR_SSL_WANT_READ && result != MBEDTLS_ERR_SSL_WANT_WRITE) {
+            // Closed by the broker or broken
+            close(false);
+        }
+        return -1;
+    }
+
+    int peek() override { return -1; }
+    void flush() override {}
+    void stop() override { close(true); }
+
+    uint8_t connected() override
+    {
+        return m_connected && (m_tcp.connected() || mbedtls_ssl_get_bytes_avail(&m_ssl) > 0);
+    }
+
+    operator bool() override { return connected(); }
+
+    /// @brief Socket of the TCP connection, to wait for data
+    int fd() const { return m_tcp.fd(); }
+
+    /// @brief Decrypted bytes not read yet, they do not make the socket readable
+    size_t buffered() const { return m_connected ? mbedtls_ssl_get_bytes_avail(&m_ssl) : 0; }
+
+    /// @brief Print the handshake times, full and resumed, and the arena usage
+    void printStats() const
+    {
+        Serial.printf("TLS: %u full handshake(s), mean %u ms, %u resumed, mean %u ms, %u "
+                      "failed\n",
+                      static_cast<unsigned>(m_full.count), static_cast<unsigned>(m_full.mean()),
+                      static_cast<unsigned>(m_resumed.count),
+                      static_cast<unsigned>(m_resumed.mean()), static_cast<unsigned>(m_failed));
+        Serial.printf("TLS arena: %u of %u bytes in use, peak %u, %u allocation(s) from the "
+                      "heap\n",
+                      static_cast<unsigned>(TLS_arena.used()),
+                      static_cast<unsigned>(TLS_ARENA_SIZE),
+                      static_cast<unsigned>(TLS_arena.peak()),
+                      static_cast<unsigned>(TLS_arenaMisses));
+    }
+
+   private:
+    struct Handshake_Stats {
+        uint32_t count = 0;
+        uint64_t totalMs = 0;
+        uint32_t mean() const { return count == 0 ? 0 : totalMs / count; }
+        void add(uint32_t ms)
+        {
+            count++;
+            totalMs += ms;
+        }
+    };
+
+    /// @brief Parse the CA certificate and set up the configuration shared by all connections
+    bool setup()
+    {
+        if (m_configured) {
+            return true;
+        }
+        TLS_arenaOwner = xTaskGetCurrentTaskHandle();
+#if defined(MBEDTLS_PLATFORM_MEMORY) && !defined(MBEDTLS_PLATFORM_CALLOC_MACRO)
+        mbedtls_platform_set_calloc_free(TLS_calloc, TLS_free);
+#else
+        Serial.println("TLS: mbedtls has no memory hooks, the TLS buffers come from the heap");
+#endif
+
+        mbedtls_x509_crt_init(&m_ca);
+        mbedtls_ssl_config_init(&m_config);
+        // Includes the terminator, mbedtls tells PEM from DER by it
+        const unsigned char* certificate =
+            reinterpret_cast<const unsigned char*>(ThingsBoard_caCert);
+        if (mbedtls_x509_crt_parse(&m_ca, certificate, strlen(ThingsBoard_caCert) + 1) != 0) {
+            Serial.println("TLS: failed to parse ThingsBoard_caCert");
+            // Set up again on the next connect
+            mbedtls_x509_crt_free(&m_ca);
+            mbedtls_ssl_config_free(&m_config);
+            return false;
+        }
+        if (mbedtls_ssl_config_defaults(&m_config, MBEDTLS_SSL_IS_CLIENT,
+                                        MBEDTLS_SSL_TRANSPORT_STREAM,
+                                        MBEDTLS_SSL_PRESET_DEFAULT) != 0) {
+            mbedtls_x509_crt_free(&m_ca);
+            mbedtls_ssl_config_free(&m_config);
+            return false;
+        }
+        mbedtls_ssl_conf_authmode(&m_config, MBEDTLS_SSL_VERIFY_REQUIRED);
+        mbedtls_ssl_conf_ca_chain(&m_config, &m_ca, nullptr);
+        mbedtls_ssl_conf_rng(&m_config, TLS_random, nullptr);
+        mbedtls_ssl_conf_verify(&m_config, verified, this);
+        // TLS 1.2, its tickets arrive within the handshake and are resumed by every broker
+#if MBEDTLS_VERSION_MAJOR >= 3
+        mbedtls_ssl_conf_max_tls_version(&m_config, MBEDTLS_SSL_VERSION_TLS1_2);
+#else
+        mbedtls_ssl_conf_max_version(&m_config, MBEDTLS_SSL_MAJOR_VERSION_3,
+                                     MBEDTLS_SSL_MINOR_VERSION_3);
+#endif
+#ifdef MQTT_TLS_SESSION_RESUMPTION
+#ifdef MBEDTLS_SSL_SESSION_TICKETS
+        mbedtls_ssl_conf_session_tickets(&m_config, MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+#endif
+        loadSession();
+#endif
+        m_configured = true;
+        return true;
+    }
+
+    int open(IPAddress ip, const char* host, uint16_t port)
+    {
+        close(true);
+        if (!setup() || !m_tcp.connect(ip, port)) {
+            return 0;
+        }
+        const uint32_t start = millis();
+        mbedtls_ssl_init(&m_ssl);
+        if (mbedtls_ssl_setup(&m_ssl, &m_config) != 0 ||
+            (host != nullptr && mbedtls_ssl_set_hostname(&m_ssl, host) != 0)) {
+            mbedtls_ssl_free(&m_ssl);
+            m_tcp.stop();
+            return 0;
+        }
+        m_contextReady = true;
+        mbedtls_ssl_set_bio(&m_ssl, &m_tcp, send, receive, nullptr);
+
+#ifdef MQTT_TLS_SESSION_RESUMPTION
+        m_server = TLS_serverKey(host, port);
+        const bool offered = offerSession();
+#else
+        const bool offered = false;
+#endif
+        m_verified = false;
+        int result;
+        while ((result = mbedtls_ssl_handshake(&m_ssl)) != 0) {
+            if ((result != MBEDTLS_ERR_SSL_WANT_READ && result != MBEDTLS_ERR_SSL_WANT_WRITE) ||
+                millis() - start > TLS_HANDSHAKE_TIMEOUT) {
+                Serial.printf("TLS handshake failed: -0x%04x\n", static_cast<unsigned>(-result));
+                m_failed++;
+                close(false);
+                return 0;
+            }
+            delay(1);
+        }
+        m_connected = true;
+
+        // A resumed handshake skips the certificate, so nothing was verified
+        const bool resumed = offered && !m_verified;
+        const uint32_t elapsed = millis() - start;
+        (resumed ? m_resumed : m_full).add(elapsed);
+        Serial.printf("TLS %s handshake in %u ms\n", resumed ? "resumed" : "full",
+                      static_cast<unsigned>(elapsed));
+#ifdef MQTT_TLS_SESSION_RESUMPTION
+        storeSession(!resumed);
+#endif
+        return 1;
+    }
+
+    /// @param notify Whether to tell the broker, a session closed without it cannot be resumed
+    void close(bool notify)
+    {
+        if (m_connected && notify) {
+            mbedtls_ssl_close_notify(&m_ssl);
+        }
+        m_connected = false;
+        if (m_contextReady) {
+            mbedtls_ssl_free(&m_ssl);
+            m_contextReady = false;
+        }
+        m_tcp.stop();
+    }
+
+#ifdef MQTT_TLS_SESSION_RESUMPTION
+    /// @brief Take the cached session, the RTC copy if it survived, NVS otherwise
+    void loadSession()
+    {
+        if (TLS_session.magic == TLS_SESSION_MAGIC) {
+            TLS_sessionSetting.adopt(TLS_session);
+            return;
+        }
+        if (TLS_settings.begin() && TLS_sessionSetting.get().magic == TLS_SESSION_MAGIC) {
+            TLS_session = TLS_sessionSetting.get();
+        }
+    }
+
+    /// @brief Offer the cached session of this server for resumption
+    bool offerSession()
+    {
+        if (TLS_session.magic != TLS_SESSION_MAGIC || TLS_session.server != m_server) {
+            return false;
+        }
+        mbedtls_ssl_session session;
+        mbedtls_ssl_session_init(&session);
+        const bool offered =
+            mbedtls_ssl_session_load(&session, TLS_session.data, TLS_session.length) == 0 &&
+            mbedtls_ssl_set_session(&m_ssl, &session) == 0;
+        mbedtls_ssl_session_free(&session);
+        return offered;
+    }
+
+    /// @brief Cache the session of the new connection
+    /// @param persist Also write it to NVS, only after a full handshake as a renewed ticket of a
+    /// resumed session is not worth a flash write
+    void storeSession(bool persist)
+    {
+        mbedtls_ssl_session session;
+        mbedtls_ssl_session_init(&session);
+        // Serialized aside, the cached session stays usable if this one does not fit
+        size_t length = 0;
+        const int result = mbedtls_ssl_get_session(&m_ssl, &session) == 0
+                               ? mbedtls_ssl_session_save(&session, m_sessionBuffer,
+                                                          sizeof(m_sessionBuffer), &length)
+                               : -1;
+        mbedtls_ssl_session_free(&session);
+        if (result != 0) {
+            Serial.printf("TLS session of %u bytes not cached, see TLS_SESSION_CACHE_SIZE\n",
+                          static_cast<unsigned>(length));
+            return;
+        }
+        TLS_session.magic = TLS_SESSION_MAGIC;
+        TLS_session.server = m_server;
+        TLS_session.length = length;
+        memcpy(TLS_session.data, m_sessionBuffer, length);
+        memset(TLS_session.data + length, 0, sizeof(TLS_session.data) - length);
+        if (persist && TLS_sessionSetting.set(TLS_session)) {
+            TLS_settings.commit();
+        }
+    }
+#endif  // MQTT_TLS_SESSION_RESUMPTION
+
+    static int send(void* context, const unsigned char* buffer, size_t length)
+    {
+        WiFiClient& tcp = *static_cast<WiFiClient*>(context);
+        const size_t written = tcp.write(buffer, length);
+        if (written > 0) {
+            return written;
+        }
+        return tcp.connected() ? MBEDTLS_ERR_SSL_WANT_WRITE : MBEDTLS_ERR_NET_CONN_RESET;
+    }
+
+    static int receive(void* context, unsigned char* buffer, size_t length)
+    {
+        WiFiClient& tcp = *static_cast<WiFiClient*>(context);
+        if (tcp.available() > 0) {
+            const int count = tcp.read(buffer, length);
+            if (count > 0) {
+                return count;
+            }
+        }
+        return tcp.connected() ? MBEDTLS_ERR_SSL_WANT_READ : MBEDTLS_ERR_NET_CONN_RESET;
+    }
+
+    /// @brief Certificate verification callback, only called in full handshakes
+    static int verified(void* context, mbedtls_x509_crt* certificate, int depth, uint32_t* flags)
+    {
+        (void)certificate;
+        (void)depth;
+        (void)flags;
+        static_cast<TLS_Transport*>(context)->m_verified = true;
+        return 0;
+    }
+
+    WiFiClient m_tcp;
+    mbedtls_ssl_context m_ssl;
+    mbedtls_ssl_config m_config;
+    mbedtls_x509_crt m_ca;
+    bool m_configured = false;
+    bool m_contextReady = false;
+    bool m_connected = false;
+    bool m_verified = false;
+#ifdef MQTT_TLS_SESSION_RESUMPTION
+    uint32_t m_server = 0;
+    // Serialized session, too large for the stack
+    uint8_t m_sessionBuffer[TLS_SESSION_CACHE_SIZE];
+#endif
+
+    Handshake_Stats m_full;
+    Handshake_Stats m_resumed;
+    uint32_t m_failed = 0;
+};
+
+#endif  // MQTT_TLS
+
+#endif  // _TLS_TRANSPORT_H
@@ -0,0 +1,128 @@
+#ifndef _TASK_EVENTS_H
+#define _TASK_EVENTS_H
+
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
+#include <freertos/timers.h>
+#include <lwip/sockets.h>
+
+#include "Task_Topology.h"
+
+//
+// Events the ThingsBoard task blocks on instead of polling
+//
+constexpr EventBits_t EVENT_WIFI_UP = BIT0;
+constexpr EventBits_t EVENT_WIFI_DOWN = BIT1;
+constexpr EventBits_t EVENT_TELEMETRY_DUE = BIT2;
+constexpr EventBits_t EVENT_ATTRIBUTES_DUE = BIT3;
+constexpr EventBits_t EVENT_MQTT_RX = BIT4;
+constexpr EventBits_t EVENT_DEVICE = BIT5;
+constexpr EventBits_t EVENT_MEMORY_DUE = BIT6;
+constexpr EventBits_t EVENT_SENSOR_READINGS = BIT7;
+constexpr EventBits_t EVENT_ALL = EVENT_WIFI_UP | EVENT_WIFI_DOWN | EVENT_TELEMETRY_DUE |
+                                  EVENT_ATTRIBUTES_DUE | EVENT_MQTT_RX | EVENT_DEVICE |
+                                  EVENT_MEMORY_DUE | EVENT_SENSOR_READINGS;
+
+// Longest time the socket watcher waits for inbound data before it has to be re-armed
+constexpr uint32_t EVENTS_SOCKET_WATCH_TIMEOUT = 5000;  // 5 seconds
+
+EventGroupHandle_t Events_group = nullptr;
+TaskHandle_t Events_socketWatcher = nullptr;
+uint32_t Events_wakeups = 0;
+// micros() when the socket watcher saw inbound data, 0 until it does after being armed
+volatile uint32_t Events_rxAt = 0;
+
+void Events_socketWatcherTask(void* pvParameters);
+
+/// @brief Create the event group and the socket watcher, must run before any task uses events
+void Events_setup()
+{
+    Events_group = xEventGroupCreate();
+    Task_create(TASK_EVENTS, Events_socketWatcherTask, &Events_socketWatcher);
+}
+
+void Events_signal(EventBits_t bits)
+{
+    if (Events_group == nullptr) {
+        return;
+    }
+    if (xPortInIsrContext()) {
+        BaseType_t higherPriorityTaskWoken = pdFALSE;
+        xEventGroupSetBitsFromISR(Events_group, bits, &higherPriorityTaskWoken);
+        portYIELD_FROM_ISR(higherPriorityTaskWoken);
+    } else {
+        xEventGroupSetBits(Events_group, bits);
+    }
+}
+
+void Events_timerCallback(TimerHandle_t timer)
+{
+    Events_signal(static_cast<EventBits_t>(reinterpret_cast<uintptr_t>(pvTimerGetTimerID(timer))));
+}
+
+/// @brief Start an auto reload timer signalling the given bits every period
+TimerHandle_t Events_startTimer(const char* name, uint32_t periodMs, EventBits_t bits)
+{
+    TimerHandle_t timer = xTimerCreate(name, pdMS_TO_TICKS(periodMs), pdTRUE,
+                                       reinterpret_cast<void*>(static_cast<uintptr_t>(bits)),
+                                       Events_timerCallback);
+    xTimerStart(timer, portMAX_DELAY);
+    return timer;
+}
+
+/// @brief Block until one of the bits is signalled or the timeout expires
+/// @return The signalled bits, they are cleared
+EventBits_t Events_wait(EventBits_t bits, uint32_t timeoutMs)
+{
+    const TickType_t ticks = timeoutMs == UINT32_MAX ? portMAX_DELAY : pdMS_TO_TICKS(timeoutMs);
+    const EventBits_t events = xEventGroupWaitBits(Events_group, bits, pdTRUE, pdFALSE, ticks);
+
+    Events_wakeups++;
+    static unsigned long _lastWakeupReport = 0;
+    if (millis() - _lastWakeupReport >= 60000) {
+        _lastWakeupReport = millis();
+        Serial.printf("Task wakeups in the last minute: %u\n",
+                      static_cast<unsigned>(Events_wakeups));
+        Events_wakeups = 0;
+    }
+    return events & bits;
+}
+
+/// @brief Have the socket watcher signal EVENT_MQTT_RX once the socket becomes readable. The
+/// watcher fires at most once per call, re-arm it after the pending data has been consumed.
+void Events_watchSocket(int fd)
+{
+    if (Events_socketWatcher == nullptr || fd < 0) {
+        return;
+    }
+    Events_rxAt = 0;
+    xTaskNotify(Events_socketWatcher, static_cast<uint32_t>(fd) + 1U, eSetValueWithOverwrite);
+}
+
+//
+// Task blocking in select() on the MQTT socket on behalf of the ThingsBoard task
+//
+void Events_socketWatcherTask(void* pvParameters)
+{
+    for (;;) {
+        uint32_t armed = 0;
+        xTaskNotifyWait(0, UINT32_MAX, &armed, portMAX_DELAY);
+        if (armed == 0) {
+            continue;
+        }
+        const int fd = static_cast<int>(armed - 1U);
+
+        fd_set readable;
+        FD_ZERO(&readable);
+        FD_SET(fd, &readable);
+        struct timeval timeout = {EVENTS_SOCKET_WATCH_TIMEOUT / 1000, 0};
+        if (select(fd + 1, &readable, nullptr, nullptr, &timeout) > 0) {
+            Events_rxAt = micros();
+            Events_signal(EVENT_MQTT_RX);
+        }
+    }
+    vTaskDelete(NULL);
+}
+
+#endif  // _TASK_EVENTS_H
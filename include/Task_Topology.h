@@ -0,0 +1,148 @@
+#ifndef _TASK_TOPOLOGY_H
+#define _TASK_TOPOLOGY_H
+
+#include <Arduino.h>
+
+//
+// Core affinity, priority and stack size of every task, chosen per board in platformio.ini.
+// Without flags the tasks float between the cores as before, the dual core environments keep
+// the network tasks on core 0 next to the WiFi driver and the sampling and the buttons on core 1,
+// so a burst of network traffic never delays a reading or a press.
+//
+// TASK_<name>_CORE       0, 1 or tskNO_AFFINITY
+// TASK_<name>_PRIORITY   1 to configMAX_PRIORITIES - 1, the WiFi driver and lwIP run far above
+// TASK_<name>_STACK_SIZE In bytes, see the stack_free_* telemetry for how much of it is used
+//
+// The button handling runs in the Arduino loop task, its core is ARDUINO_RUNNING_CORE and only
+// its priority is set here.
+//
+#ifndef TASK_WIFI_CORE
+#define TASK_WIFI_CORE tskNO_AFFINITY
+#endif
+#ifndef TASK_WIFI_PRIORITY
+#define TASK_WIFI_PRIORITY 1
+#endif
+#ifndef TASK_WIFI_STACK_SIZE
+#define TASK_WIFI_STACK_SIZE 8192
+#endif
+
+#ifndef TASK_THINGSBOARD_CORE
+#define TASK_THINGSBOARD_CORE tskNO_AFFINITY
+#endif
+#ifndef TASK_THINGSBOARD_PRIORITY
+#define TASK_THINGSBOARD_PRIORITY 1
+#endif
+#ifndef TASK_THINGSBOARD_STACK_SIZE
+#ifdef MQTT_TLS
+// The key exchange of the TLS handshake needs several KB more
+#define TASK_THINGSBOARD_STACK_SIZE 12288
+#else
+#define TASK_THINGSBOARD_STACK_SIZE 8192
+#endif
+#endif
+
+// Higher priority than the network tasks so the sample rate does not depend on them
+#ifndef TASK_SENSOR_CORE
+#define TASK_SENSOR_CORE tskNO_AFFINITY
+#endif
+#ifndef TASK_SENSOR_PRIORITY
+#define TASK_SENSOR_PRIORITY 2
+#endif
+#ifndef TASK_SENSOR_STACK_SIZE
+#define TASK_SENSOR_STACK_SIZE 4096
+#endif
+
+// The socket watcher only wakes the ThingsBoard task, it belongs on the same core
+#ifndef TASK_EVENTS_CORE
+#define TASK_EVENTS_CORE TASK_THINGSBOARD_CORE
+#endif
+#ifndef TASK_EVENTS_PRIORITY
+#define TASK_EVENTS_PRIORITY TASK_THINGSBOARD_PRIORITY
+#endif
+#ifndef TASK_EVENTS_STACK_SIZE
+#define TASK_EVENTS_STACK_SIZE 2048
+#endif
+
+#ifndef TASK_BUTTON_PRIORITY
+#define TASK_BUTTON_PRIORITY 1
+#endif
+#ifdef ARDUINO_RUNNING_CORE
+#define TASK_BUTTON_CORE ARDUINO_RUNNING_CORE
+#else
+#define TASK_BUTTON_CORE tskNO_AFFINITY
+#endif
+
+struct Task_Config {
+    const char* name;
+    uint32_t stackSize;  // Bytes
+    UBaseType_t priority;
+    BaseType_t core;  // tskNO_AFFINITY to let the scheduler choose
+};
+
+constexpr Task_Config TASK_WIFI = {"WiFi_task", TASK_WIFI_STACK_SIZE, TASK_WIFI_PRIORITY,
+                                   TASK_WIFI_CORE};
+constexpr Task_Config TASK_THINGSBOARD = {"ThingsBoard_task", TASK_THINGSBOARD_STACK_SIZE,
+                                          TASK_THINGSBOARD_PRIORITY, TASK_THINGSBOARD_CORE};
+constexpr Task_Config TASK_SENSOR = {"Sensor_task", TASK_SENSOR_STACK_SIZE, TASK_SENSOR_PRIORITY,
+                                     TASK_SENSOR_CORE};
+constexpr Task_Config TASK_EVENTS = {"Events_socketWatcher", TASK_EVENTS_STACK_SIZE,
+                                     TASK_EVENTS_PRIORITY, TASK_EVENTS_CORE};
+// Created by the Arduino core, see Task_setupButton()
+constexpr Task_Config TASK_BUTTON = {"loopTask", CONFIG_ARDUINO_LOOP_STACK_SIZE,
+                                     TASK_BUTTON_PRIORITY, TASK_BUTTON_CORE};
+
+/// @brief Whether the configuration can be created on this chip
+constexpr bool Task_valid(const Task_Config& config)
+{
+    return config.priority >= 1 && config.priority < configMAX_PRIORITIES &&
+           config.stackSize >= 1024 &&
+           (config.core == tskNO_AFFINITY ||
+            (config.core >= 0 && config.core < portNUM_PROCESSORS));
+}
+
+static_assert(Task_valid(TASK_WIFI), "Invalid TASK_WIFI_* flags for this chip");
+static_assert(Task_valid(TASK_THINGSBOARD), "Invalid TASK_THINGSBOARD_* flags for this chip");
+static_assert(Task_valid(TASK_SENSOR), "Invalid TASK_SENSOR_* flags for this chip");
+static_assert(Task_valid(TASK_EVENTS), "Invalid TASK_EVENTS_* flags for this chip");
+static_assert(Task_valid(TASK_BUTTON), "Invalid TASK_BUTTON_PRIORITY");
+
+/// @brief Create a task as configured
+/// @return false if it could not be created, e.g. out of memory for its stack
+bool Task_create(const Task_Config& config, TaskFunction_t function, TaskHandle_t* handle)
+{
+    const BaseType_t created = xTaskCreatePinnedToCore(function, config.name, config.stackSize,
+                                                       NULL, config.priority, handle, config.core);
+    if (created != pdPASS) {
+        Serial.printf("Failed to create %s\n", config.name);
+        return false;
+    }
+    return true;
+}
+
+/// @brief Give the calling loop task the button priority
+void Task_setupButton() { vTaskPrioritySet(NULL, TASK_BUTTON.priority); }
+
+/// @brief Print where a task runs and with which priority and stack
+void Task_print(const Task_Config& config)
+{
+    char core[4] = "any";
+    if (config.core != tskNO_AFFINITY) {
+        snprintf(core, sizeof(core), "%d", static_cast<int>(config.core));
+    }
+    Serial.printf("Task %-20s core %s, priority %u, stack %u bytes\n", config.name, core,
+                  static_cast<unsigned>(config.priority),
+                  static_cast<unsigned>(config.stackSize));
+}
+
+void Task_printTopology()
+{
+    Task_print(TASK_WIFI);
+    Task_print(TASK_THINGSBOARD);
+#ifndef LOW_POWER_MODE
+    Task_print(TASK_SENSOR);
+#endif
+    Task_print(TASK_EVENTS);
+    Task_print(TASK_BUTTON);
+}
+
+#endif  // _TASK_TOPOLOGY_H
@@ -0,0 +1,176 @@
+#ifndef _TELEMETRY_BATCH_H
+#define _TELEMETRY_BATCH_H
+
+#include <Arduino.h>
+
+#include <type_traits>
+
+#include "Payload_Encoder.h"
+#include "ThingsBoard_Manager.h"
+
+// MQTT PUBLISH fixed header (up to 5 bytes) plus the 2 byte topic length prefix
+constexpr size_t MQTT_PUBLISH_OVERHEAD = 7U;
+
+constexpr char TELEMETRY_BATCH_TOPIC[] = "v1/devices/me/telemetry";
+constexpr char ATTRIBUTE_BATCH_TOPIC[] = "v1/devices/me/attributes";
+
+/// @brief Outcome of publishing a rendered message
+enum class Publish_Result : uint8_t {
+    SENT,
+    HELD,   // Back-pressure, e.g. the publish window is full, the message is rendered again later
+    FAILED
+};
+
+/// @brief Collects key/value pairs of one send cycle into a single document and publishes it as
+/// one MQTT message. If the next pair would not fit into BATCH_MESSAGE_SIZE the pending
+/// document is flushed first, so a large cycle is split into as few messages as possible.
+/// After beginEntry() the pairs are grouped per timestamp. The document is encoded by
+/// Payload_Encoder, JSON or Protobuf.
+class Telemetry_Batch {
+   public:
+    /// @brief Publishes a rendered message instead of the ThingsBoard client
+    using Publish_Function = Publish_Result (*)(const char* payload, size_t length);
+
+    explicit Telemetry_Batch(Batch_Type type)
+        : m_type(type),
+          m_encoder(type, BATCH_MESSAGE_SIZE - MQTT_PUBLISH_OVERHEAD - strlen(topic())),
+          m_failed(false),
+          m_publishes(0),
+          m_bytes(0)
+    {
+    }
+
+    bool add(const char* key, bool value) { return append(key, Payload_Value(value)); }
+
+    template <typename T, typename std::enable_if<std::is_integral<T>::value &&
+                                                      !std::is_same<T, bool>::value,
+                                                  int>::type = 0>
+    bool add(const char* key, T value)
+    {
+        return append(key, Payload_Value(static_cast<int64_t>(value)));
+    }
+
+    bool add(const char* key, float value) { return append(key, Payload_Value(value)); }
+
+    bool add(const char* key, const char* value) { return append(key, Payload_Value(value)); }
+
+    /// @brief Add pairs encoded beforehand, e.g. a document cached across messages
+    bool addFragment(const char* fragment, size_t length)
+    {
+        return append(nullptr, Payload_Value(fragment, length));
+    }
+
+    /// @brief Start a group of values sharing the given timestamp in epoch milliseconds, the
+    /// following add() calls go into this group
+    void beginEntry(uint64_t ts)
+    {
+        if (!m_encoder.beginEntry(ts)) {
+            send();
+            m_encoder.beginEntry(ts);
+        }
+    }
+
+    /// @brief Publish the pending document, if any
+    /// @return false if any message of the batch failed to publish or was held back, the pending
+    /// pairs are dropped in either case
+    bool flush()
+    {
+        send();
+        m_encoder.endEntries();
+        bool sent = !m_failed;
+        m_failed = false;
+        return sent;
+    }
+
+    /// @brief Drop the pending pairs without publishing them
+    void discard()
+    {
+        m_encoder.clear();
+        m_encoder.endEntries();
+        m_failed = false;
+    }
+
+    /// @brief Route the messages through publish, nullptr restores the ThingsBoard client
+    void setPublisher(Publish_Function publish) { m_publish = publish; }
+
+    /// @brief Number of MQTT messages published since the last resetStats()
+    uint32_t publishes() const { return m_publishes; }
+
+    /// @brief Number of payload bytes published since the last resetStats()
+    uint32_t bytes() const { return m_bytes; }
+
+    void resetStats()
+    {
+        m_publishes = 0;
+        m_bytes = 0;
+    }
+
+   private:
+    const char* topic() const
+    {
+        return m_type == Batch_Type::TELEMETRY ? TELEMETRY_BATCH_TOPIC : ATTRIBUTE_BATCH_TOPIC;
+    }
+
+    bool append(const char* key, const Payload_Value& value)
+    {
+        Append_Result result = m_encoder.append(key, value);
+        if (result == Append_Result::FULL && !m_encoder.empty()) {
+            send();
+            result = m_encoder.append(key, value);
+        }
+        if (result == Append_Result::FULL) {
+            Serial.printf("Batch key %s does not fit into a message, dropped\n",
+                          key == nullptr ? "fragment" : key);
+        } else if (result == Append_Result::UNKNOWN) {
+            Serial.printf("Batch key %s is not in the payload schema, dropped\n", key);
+        } else if (result == Append_Result::INVALID) {
+            Serial.printf("Batch key %s is not a finite number, dropped\n", key);
+        }
+        return result == Append_Result::ADDED;
+    }
+
+    /// @brief Close and publish the pending message, the current entry is reopened in the next one
+    void send()
+    {
+        if (m_encoder.empty()) {
+            return;
+        }
+        const size_t length = m_encoder.finish();
+
+        Publish_Result result = Publish_Result::FAILED;
+        if (length == 0) {
+            Serial.printf("%s batch needs the system time, dropped\n", topic());
+        } else if (m_publish != nullptr) {
+            result = m_publish(m_encoder.data(), length);
+        } else if (ThingsBoard_publish(topic(),
+                                       reinterpret_cast<const uint8_t*>(m_encoder.data()),
+                                       length)) {
+            result = Publish_Result::SENT;
+        }
+        if (result == Publish_Result::SENT) {
+            m_publishes++;
+            m_bytes += length;
+        } else if (result == Publish_Result::HELD) {
+            Serial.printf("%s batch held back (%u bytes), publish window full\n", topic(),
+                          static_cast<unsigned>(length));
+            m_failed = true;
+        } else {
+            Serial.printf("Failed to send %s batch (%u bytes)\n", topic(),
+                          static_cast<unsigned>(length));
+            m_failed = true;
+        }
+        m_encoder.clear();
+    }
+
+    const Batch_Type m_type;
+    Payload_Encoder m_encoder;
+    bool m_failed;
+    uint32_t m_publishes;
+    uint32_t m_bytes;
+    Publish_Function m_publish = nullptr;
+};
+
+Telemetry_Batch Telemetry_batch(Batch_Type::TELEMETRY);
+Telemetry_Batch Attribute_batch(Batch_Type::ATTRIBUTES);
+
+#endif  // _TELEMETRY_BATCH_H
@@ -0,0 +1,346 @@
+#ifndef _TELEMETRY_BUFFER_H
+#define _TELEMETRY_BUFFER_H
+
+#include <Arduino.h>
+
+#include <algorithm>
+
+#include "Time_Manager.h"
+
+#ifdef TELEMETRY_SPILL_PARTITION
+#include <esp_partition.h>
+#endif
+
+//
+// Store-and-forward telemetry buffer, samples are kept while WiFi or ThingsBoard is down and
+// drained in batches once the connection is back
+//
+#ifndef TELEMETRY_BUFFER_CAPACITY
+#define TELEMETRY_BUFFER_CAPACITY 512
+#endif
+
+/// @brief Statistics of the readings of one aggregation window, in hundredths of the unit
+struct Telemetry_Window {
+    int16_t min;
+    int16_t max;
+    int16_t last;
+    uint16_t stddev;
+};
+
+struct Telemetry_Sample {
+    uint32_t timestamp;  // millis() when the sample was taken
+    float temperature;   // Mean of the window, or a single reading if count is 0
+    float humidity;
+    int16_t rssi;
+    uint16_t count;    // Readings aggregated into the windows, 0 if there are no windows
+    uint8_t reported;  // Bitmask of the TELEMETRY_KEY_* values to report, see Report_Policy.h
+    Telemetry_Window temperatureWindow;
+    Telemetry_Window humidityWindow;
+};
+
+enum class Overflow_Policy : uint8_t {
+    DROP_OLDEST,  // Overwrite the oldest sample
+    DECIMATE      // Halve the resolution of the buffered samples and of the incoming ones
+};
+
+#ifdef TELEMETRY_SPILL_PARTITION
+/// @brief Circular log of samples on a raw data partition, used when the RAM buffer is full.
+/// Only the read and write positions are kept in RAM, the spilled samples do not survive a reboot.
+class Telemetry_Spill {
+   public:
+    bool begin(const char* label)
+    {
+        m_partition =
+            esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+        if (m_partition == nullptr) {
+            Serial.printf("Telemetry spill partition (%s) not found, spilling disabled\n", label);
+            return false;
+        }
+        m_slots = m_partition->size / SPI_FLASH_SEC_SIZE * SAMPLES_PER_SECTOR;
+        m_read = 0;
+        m_count = 0;
+        return true;
+    }
+
+    size_t size() const { return m_count; }
+
+    bool push(const Telemetry_Sample& sample)
+    {
+        // Keep a whole sector free between the write and the read position, it is erased before
+        // it gets written
+        if (m_partition == nullptr || m_count + SAMPLES_PER_SECTOR * 2 > m_slots) {
+            return false;
+        }
+        const size_t slot = (m_read + m_count) % m_slots;
+        const size_t offset = slotOffset(slot);
+        if (slot % SAMPLES_PER_SECTOR == 0 &&
+            esp_partition_erase_range(m_partition, offset, SPI_FLASH_SEC_SIZE) != ESP_OK) {
+            return false;
+        }
+        if (esp_partition_write(m_partition, offset, &sample, sizeof(sample)) != ESP_OK) {
+            return false;
+        }
+        m_count++;
+        return true;
+    }
+
+    bool read(size_t index, Telemetry_Sample& sample) const
+    {
+        return esp_partition_read(m_partition, slotOffset((m_read + index) % m_slots), &sample,
+                                  sizeof(sample)) == ESP_OK;
+    }
+
+    void pop(size_t count)
+    {
+        count = std::min(count, m_count);
+        if (count == 0) {
+            // Nothing spilled, m_slots is 0 if the partition was not found
+            return;
+        }
+        m_read = (m_read + count) % m_slots;
+        m_count -= count;
+    }
+
+   private:
+    static constexpr size_t SAMPLES_PER_SECTOR = SPI_FLASH_SEC_SIZE / sizeof(Telemetry_Sample);
+
+    /// @brief Samples do not straddle sectors, every sector is erased before its first slot is
+    /// written
+    static size_t slotOffset(size_t slot)
+    {
+        return slot / SAMPLES_PER_SECTOR * SPI_FLASH_SEC_SIZE +
+               slot % SAMPLES_PER_SECTOR * sizeof(Telemetry_Sample);
+    }
+
+    const esp_partition_t* m_partition = nullptr;
+    size_t m_slots = 0;
+    size_t m_read = 0;
+    size_t m_count = 0;
+};
+#endif
+
+/// @brief Fixed capacity ring buffer of telemetry samples, no heap allocations. Samples are
+/// consumed with peek() and only removed with pop() once they have been sent. Every sample has
+/// a sequence number, counting up from the first sample ever pushed, so a consumer can keep
+/// track of samples it has sent but not removed yet.
+template <size_t Capacity>
+class Telemetry_Buffer {
+   public:
+    explicit Telemetry_Buffer(Overflow_Policy policy)
+        : m_policy(policy),
+          m_head(0),
+          m_count(0),
+          m_first(0),
+          m_decimation(1),
+          m_skipped(0),
+          m_dropped(0)
+    {
+    }
+
+#ifdef TELEMETRY_SPILL_PARTITION
+    void begin() { m_spillEnabled = m_spill.begin(TELEMETRY_SPILL_PARTITION); }
+#else
+    void begin() {}
+#endif
+
+    size_t size() const { return spilled() + m_count; }
+    bool empty() const { return size() == 0; }
+
+    /// @brief Number of samples lost to the overflow policy
+    uint32_t dropped() const { return m_dropped; }
+
+    /// @brief Sequence number of the oldest sample
+    uint32_t first() const { return m_first; }
+
+    void push(const Telemetry_Sample& sample)
+    {
+        if (m_decimation > 1 && ++m_skipped < m_decimation) {
+            return;
+        }
+        m_skipped = 0;
+
+        if (m_count == Capacity && !spillOldest()) {
+            if (m_policy == Overflow_Policy::DROP_OLDEST) {
+                // With the spill area full its oldest sample goes, the RAM one moves into its slot
+                do {
+                    dropOldest();
+                } while (m_count == Capacity && !spillOldest());
+            } else {
+                decimate();
+            }
+        }
+        m_samples[(m_head + m_count) % Capacity] = sample;
+        m_count++;
+    }
+
+    /// @brief Copy up to count of the oldest samples without removing them
+    /// @param offset Number of the oldest samples to skip
+    /// @return Number of samples copied
+    size_t peek(Telemetry_Sample* out, size_t count, size_t offset = 0) const
+    {
+        if (offset >= size()) {
+            return 0;
+        }
+        count = std::min(count, size() - offset);
+        for (size_t i = offset; i < offset + count; i++) {
+#ifdef TELEMETRY_SPILL_PARTITION
+            if (i < spilled()) {
+                m_spill.read(i, out[i - offset]);
+                continue;
+            }
+#endif
+            out[i - offset] = m_samples[(m_head + i - spilled()) % Capacity];
+        }
+        return count;
+    }
+
+    /// @brief Remove up to count of the oldest samples
+    void pop(size_t count)
+    {
+        count = std::min(count, size());
+        m_first += count;
+#ifdef TELEMETRY_SPILL_PARTITION
+        const size_t fromSpill = std::min(count, spilled());
+        m_spill.pop(fromSpill);
+        count -= fromSpill;
+#endif
+        m_head = (m_head + count) % Capacity;
+        m_count -= count;
+        if (empty()) {
+            m_decimation = 1;
+            m_skipped = 0;
+        }
+    }
+
+    /// @brief Remove the samples with sequence numbers before end
+    void release(uint32_t end)
+    {
+        if (static_cast<int32_t>(end - m_first) > 0) {
+            pop(end - m_first);
+        }
+    }
+
+   private:
+#ifdef TELEMETRY_SPILL_PARTITION
+    size_t spilled() const { return m_spill.size(); }
+
+    /// @brief Move the oldest RAM sample to flash to make room for a new one
+    bool spillOldest()
+    {
+        if (!m_spillEnabled || !m_spill.push(m_samples[m_head])) {
+            return false;
+        }
+        m_head = (m_head + 1) % Capacity;
+        m_count--;
+        return true;
+    }
+#else
+    size_t spilled() const { return 0; }
+    bool spillOldest() { return false; }
+#endif
+
+    /// @brief Drop the oldest sample, a spilled one before any in RAM
+    void dropOldest()
+    {
+        m_first++;
+        m_dropped++;
+#ifdef TELEMETRY_SPILL_PARTITION
+        if (spilled() > 0) {
+            m_spill.pop(1);
+            return;
+        }
+#endif
+        m_head = (m_head + 1) % Capacity;
+        m_count--;
+    }
+
+    /// @brief Keep every other buffered sample and accept only every other incoming one from now on
+    void decimate()
+    {
+        // The kept samples move, they are numbered as new samples so a consumer does not take
+        // them for the ones it has sent
+        m_first += size();
+        size_t kept = 0;
+        for (size_t i = 0; i < m_count; i += 2) {
+            m_samples[(m_head + kept) % Capacity] = m_samples[(m_head + i) % Capacity];
+            kept++;
+        }
+        m_dropped += m_count - kept;
+        m_count = kept;
+        m_decimation *= 2;
+        Serial.printf("Telemetry buffer full, decimating by %u\n",
+                      static_cast<unsigned>(m_decimation));
+    }
+
+    const Overflow_Policy m_policy;
+    Telemetry_Sample m_samples[Capacity];
+    size_t m_head;
+    size_t m_count;
+    uint32_t m_first;  // Sequence number of the oldest sample
+    uint32_t m_decimation;
+    uint32_t m_skipped;
+    uint32_t m_dropped;
+#ifdef TELEMETRY_SPILL_PARTITION
+    Telemetry_Spill m_spill;
+    bool m_spillEnabled = false;
+#endif
+};
+
+#ifdef TELEMETRY_BUFFER_DECIMATE
+Telemetry_Buffer<TELEMETRY_BUFFER_CAPACITY> Telemetry_buffer(Overflow_Policy::DECIMATE);
+#else
+Telemetry_Buffer<TELEMETRY_BUFFER_CAPACITY> Telemetry_buffer(Overflow_Policy::DROP_OLDEST);
+#endif
+
+// A sample sent without a timestamp is stamped by the server when it arrives, that is only close
+// to when it was taken for a fresh one. Older samples wait for the system time, but not for good:
+// without SNTP and RTC it may never be set, and the samples behind the oldest one wait as well.
+constexpr uint32_t TELEMETRY_UNSTAMPED_AGE_MAX = 2000;  // 2 seconds
+#ifndef TELEMETRY_CLOCK_WAIT_MAX
+// Samples this old are sent stamped by the server, or dropped if the payload cannot carry them
+// without their timestamp
+#define TELEMETRY_CLOCK_WAIT_MAX 30000  // 30 seconds
+#endif
+
+/// @brief Whether a sample waited for the system time as long as it may
+bool Telemetry_late(const Telemetry_Sample& sample)
+{
+    const uint32_t age = millis() - sample.timestamp;
+    return !Time_valid() && age >= TELEMETRY_CLOCK_WAIT_MAX;
+}
+
+/// @brief How long a sample still waits for the system time
+/// @param needsTimestamp The payload cannot carry a sample without its timestamp
+/// @return 0 if it is to be sent now, or dropped if it is late and needs its timestamp
+uint32_t Telemetry_clockWait(const Telemetry_Sample& sample, bool needsTimestamp)
+{
+    if (Time_valid()) {
+        return 0;
+    }
+    const uint32_t age = millis() - sample.timestamp;
+    if (!needsTimestamp && age <= TELEMETRY_UNSTAMPED_AGE_MAX) {
+        return 0;
+    }
+    return age >= TELEMETRY_CLOCK_WAIT_MAX ? 0 : TELEMETRY_CLOCK_WAIT_MAX - age;
+}
+
+/// @brief Convert the millis() timestamp of a sample into epoch milliseconds
+/// @param nowMs Time_epochMs() read at now. Read once for the samples of a message, otherwise a
+/// millisecond passing between the two clocks gives samples taken together different times.
+/// @param now millis() when nowMs was read
+/// @return 0 if the system time has not been set yet
+uint64_t Telemetry_sampleEpochMs(uint32_t timestamp, uint64_t nowMs, uint32_t now)
+{
+    if (nowMs == 0) {
+        return 0;
+    }
+    return nowMs - static_cast<uint32_t>(now - timestamp);
+}
+
+uint64_t Telemetry_sampleEpochMs(uint32_t timestamp)
+{
+    const uint32_t now = millis();
+    return Telemetry_sampleEpochMs(timestamp, Time_epochMs(), now);
+}
+
+#endif  // _TELEMETRY_BUFFER_H
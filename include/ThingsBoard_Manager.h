@@ -5,7 +5,6 @@
 #include <Arduino_MQTT_Client.h>
 #include <Attribute_Request.h>
 #include <Client_Side_RPC.h>
-#include <Preferences.h>
 #include <Provision.h>
 #include <Server_Side_RPC.h>
 #include <Shared_Attribute_Update.h>
@@ -13,30 +12,50 @@
 #include <WiFi.h>
 #include <WiFiClient.h>
 
+#include "Actuator_Table.h"
+#include "Boot_Timeline.h"
 #include "Configuration.h"
+#include "MQTT_Transport.h"
+#include "Reconnect_Scheduler.h"
+#include "Settings_Store.h"
 
 constexpr char* DEVICE_NAME_PREFIX = "Smart Office";
 constexpr char* DEVICE_ID_PREFIX = "smartoffice";
 
-String deviceName = "";
-String deviceId = "";
-String deviceMac = "";
-String deviceModel = "";
+// Device identity, derived from the MAC address in ThingsBoard_setup()
+char deviceName[40] = "";
+char deviceId[40] = "";
+char deviceMac[18] = "";
+char deviceModel[40] = "";
 
-Preferences ThingsBoard_pref;
 constexpr char* PREFS_NAMESPACE = "tb_prefs";
 constexpr char* PREFS_DEVICE_ID = "dev_id";
 constexpr char* PREFS_DEVICE_USER = "dev_user";
 constexpr char* PREFS_DEVICE_PASS = "dev_pass";
+constexpr char* PREFS_TELEMETRY_INTERVAL = "tel_interval";
+constexpr char* PREFS_SENSOR_INTERVAL = "sen_interval";
 
-// Initialize underlying client, used to establish a connection
-WiFiClient WiFi_client;
+Settings_Store ThingsBoard_settings(PREFS_NAMESPACE);
 
-constexpr uint64_t THINGSBOARD_CONNECT_ATTEMPS_TIMOUT = 10000;  // 10 seconds
+// Initialize underlying client, used to establish a connection
+MQTT_Transport WiFi_client;
+
+// Reconnects back off from the base interval up to the max interval
+constexpr uint32_t THINGSBOARD_RECONNECT_BASE_INTERVAL = 2000;         // 2 seconds
+constexpr uint32_t THINGSBOARD_RECONNECT_MAX_INTERVAL = 5 * 60 * 1000;  // 5 minutes
+// Time to wait for the provisioning response before the request may be repeated
+constexpr uint32_t THINGSBOARD_PROVISION_TIMEOUT = 10000;  // 10 seconds
+// Credentials are dropped for re-provisioning after this many refused connections
 constexpr uint8_t THINGSBOARD_ATTEMPS_MAX = 5;
 
-constexpr uint16_t MAX_MESSAGE_RECEIVE_SIZE = 1024U;
-constexpr uint16_t MAX_MESSAGE_SEND_SIZE = 1024U;
+// Attribute and RPC payloads are filtered by the transport down to the keys the device uses, the
+// largest packet passed through as it is is the provisioning response
+constexpr uint16_t MAX_MESSAGE_RECEIVE_SIZE = MQTT_FILTERED_PACKET_SIZE;
+// Packets the client builds itself, subscriptions, requests, RPC responses and the provisioning
+// request. Batches are streamed to the connection and do not pass through the send buffer
+constexpr uint16_t MAX_MESSAGE_SEND_SIZE = 256U;
+// Telemetry and attribute batches, see Telemetry_Batch
+constexpr uint16_t BATCH_MESSAGE_SIZE = 1024U;
 
 constexpr uint64_t REQUEST_TIMEOUT_MICROSECONDS = 5000U * 1000U;
 
@@ -54,7 +73,7 @@ constexpr uint8_t MAX_RPC_REQUEST = 5U;
 constexpr uint8_t MAX_RPC_RESPONSE = 8U;
 constexpr uint8_t MAX_ATTRIBUTE_REQUESTS = 20U;
 constexpr uint8_t MAX_SHARED_ATTRIBUTES_UPDATE = 20U;
-constexpr uint8_t MAX_ATTRIBUTES = 8U;
+constexpr uint8_t MAX_ATTRIBUTES = 16U;
 
 // Initialize used ThingsBoard APIs
 Provision<> prov;
@@ -76,17 +95,74 @@ constexpr char X509_CERTIFICATE_CRED_TYPE[] = "X509_CERTIFICATE";
 // Server Side RPC related constants
 constexpr char RPC_SWITCH_SET_METHOD[] = "switch_set";
 
-// Shared Attribute Update related constants
-constexpr char SWITCH_STATE_0_KEY[] = "switch_state_0";
-constexpr char SWITCH_STATE_1_KEY[] = "switch_state_1";
-constexpr char SWITCH_STATE_2_KEY[] = "switch_state_2";
-constexpr char SWITCH_STATE_3_KEY[] = "switch_state_3";
-constexpr char SWITCH_STATE_4_KEY[] = "switch_state_4";
-constexpr char SWITCH_STATE_5_KEY[] = "switch_state_5";
+// Shared attribute setting the telemetry sample interval in milliseconds
+constexpr char TELEMETRY_INTERVAL_ATTRIBUTE[] = "telemetry_interval";
+// Shared attribute setting the sensor read interval in milliseconds
+constexpr char SENSOR_INTERVAL_ATTRIBUTE[] = "sensor_interval";
+// Shared attributes limiting the upload cadence, see Upload_Controller.h
+constexpr char UPLOAD_INTERVAL_MIN_ATTRIBUTE[] = "upload_min_ms";
+constexpr char UPLOAD_INTERVAL_MAX_ATTRIBUTE[] = "upload_max_ms";
+constexpr char UPLOAD_BATCH_ATTRIBUTE[] = "upload_batch";
+// Shared attributes describing the firmware assigned on the server, see OTA_Update.h
+constexpr char FW_TITLE_ATTRIBUTE[] = "fw_title";
+constexpr char FW_VERSION_ATTRIBUTE[] = "fw_version";
+constexpr char FW_CHECKSUM_ATTRIBUTE[] = "fw_checksum";
+constexpr char FW_CHECKSUM_ALGORITHM_ATTRIBUTE[] = "fw_checksum_algorithm";
+constexpr char FW_SIZE_ATTRIBUTE[] = "fw_size";
+
+/// @brief Shared attributes subscribed to and requested, one per actuator, the settings and the
+/// assigned firmware
+constexpr std::array<const char*, MAX_ATTRIBUTES> ThingsBoard_sharedAttributes()
+{
+    static_assert(ACTUATOR_COUNT + 10U <= MAX_ATTRIBUTES,
+                  "No attribute slots left for the settings");
+    std::array<const char*, MAX_ATTRIBUTES> keys = Actuator_keys<MAX_ATTRIBUTES>();
+    keys[ACTUATOR_COUNT] = TELEMETRY_INTERVAL_ATTRIBUTE;
+    keys[ACTUATOR_COUNT + 1U] = UPLOAD_INTERVAL_MIN_ATTRIBUTE;
+    keys[ACTUATOR_COUNT + 2U] = UPLOAD_INTERVAL_MAX_ATTRIBUTE;
+    keys[ACTUATOR_COUNT + 3U] = UPLOAD_BATCH_ATTRIBUTE;
+    keys[ACTUATOR_COUNT + 4U] = FW_TITLE_ATTRIBUTE;
+    keys[ACTUATOR_COUNT + 5U] = FW_VERSION_ATTRIBUTE;
+    keys[ACTUATOR_COUNT + 6U] = FW_CHECKSUM_ATTRIBUTE;
+    keys[ACTUATOR_COUNT + 7U] = FW_CHECKSUM_ALGORITHM_ATTRIBUTE;
+    keys[ACTUATOR_COUNT + 8U] = FW_SIZE_ATTRIBUTE;
+    keys[ACTUATOR_COUNT + 9U] = SENSOR_INTERVAL_ATTRIBUTE;
+    return keys;
+}
+
+constexpr std::array<const char*, MAX_ATTRIBUTES> SHARED_ATTRIBUTES =
+    ThingsBoard_sharedAttributes();
 
 const std::array<IAPI_Implementation*, 5U> APIs = {&prov, &TB_client_rpc, &TB_server_rpc,
                                                    &TB_attribute_request, &TB_shared_update};
 
+// Server side RPCs, followed by the request id
+constexpr char RPC_REQUEST_TOPIC_PREFIX[] = "v1/devices/me/rpc/request/";
+constexpr char RPC_RESPONSE_TOPIC_PREFIX[] = "v1/devices/me/rpc/response/";
+
+// Topics of the payloads filtered by the transport, attribute updates and responses and RPC
+// requests
+constexpr const char* THINGSBOARD_FILTERED_TOPICS[] = {"v1/devices/me/attributes",
+                                                       RPC_REQUEST_TOPIC_PREFIX};
+constexpr char RPC_METHOD_KEY[] = "method";
+constexpr char RPC_PARAMS_KEY[] = "params";
+
+/// @brief Members of attribute and RPC payloads the device uses, the shared attributes and the
+/// RPC method and parameters. The parameters are kept whole whatever the method, a request whose
+/// parameters do not fit into MQTT_FILTERED_PACKET_SIZE is dropped.
+bool ThingsBoard_keepKey(const char* key)
+{
+    if (strcmp(key, RPC_METHOD_KEY) == 0 || strcmp(key, RPC_PARAMS_KEY) == 0) {
+        return true;
+    }
+    for (const char* attribute : SHARED_ATTRIBUTES) {
+        if (attribute != nullptr && strcmp(key, attribute) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
 // Initialize ThingsBoard instance with the maximum needed buffer size and stack size
 // APIs are registered on main code
 ThingsBoard ThingsBoard_client(MQTT_client, MAX_MESSAGE_RECEIVE_SIZE, MAX_MESSAGE_SEND_SIZE,
@@ -99,15 +175,26 @@ bool serverRpcSubscribed = false;
 bool sharedAttributeSubscribed = false;
 bool sharedAttributeRequested = false;
 
-// Struct for client connecting after provisioning
+// Credentials the client connects with after provisioning, kept in ThingsBoard_settings
+constexpr size_t CREDENTIAL_SIZE = 65;
+
 struct Credentials {
-    std::string client_id;
-    std::string username;
-    std::string password;
+    String_Setting<CREDENTIAL_SIZE> client_id{ThingsBoard_settings, PREFS_DEVICE_ID};
+    String_Setting<CREDENTIAL_SIZE> username{ThingsBoard_settings, PREFS_DEVICE_USER};
+    String_Setting<CREDENTIAL_SIZE> password{ThingsBoard_settings, PREFS_DEVICE_PASS};
 } credentials;
+// The server refused the credentials, the device provisions again. They stay in flash until new
+// ones arrive, so a failed provisioning does not leave the device without any.
+bool credentialsRefused = false;
+
+/// @brief Whether there are credentials to connect with
+bool ThingsBoard_provisioned()
+{
+    return !credentials.username.empty() && !credentialsRefused;
+}
 
-unsigned long _lastConnectAttempt = 0;
-uint8_t _thingsBoardConnectAttempts = 0;
+Reconnect_Scheduler ThingsBoard_reconnect("ThingsBoard", THINGSBOARD_RECONNECT_BASE_INTERVAL,
+                                          THINGSBOARD_RECONNECT_MAX_INTERVAL);
 
 // ThingsBoard callbacks forward declarations
 extern void processSwitchStateRPC(const JsonVariantConst& json, JsonDocument& response);
@@ -116,46 +203,14 @@ extern void processSharedAttributeUpdate(const JsonObjectConst& json);
 bool saveThingsBoardPreferences()
 {
     Serial.println("Saving device ThingsBoard preferences to flash...");
-    // Open the NVS namespace in read/write mode (false)
-    if (!ThingsBoard_pref.begin(PREFS_NAMESPACE, false)) {
-        Serial.println("Failed to open Preferences namespace for writing");
-        return false;
-    }
-
-    // Put the string value into the NVS with the defined key
-    ThingsBoard_pref.putString(PREFS_DEVICE_ID, credentials.client_id.c_str());
-    ThingsBoard_pref.putString(PREFS_DEVICE_USER, credentials.username.c_str());
-    ThingsBoard_pref.putString(PREFS_DEVICE_PASS, credentials.password.c_str());
-
-    // Close the preferences
-    ThingsBoard_pref.end();
-
-    Serial.println("Device credentials saved to flash.");
-    return true;
+    // Only the credentials that changed are written
+    return ThingsBoard_settings.commit();
 }
 
 bool loadThingsBoardPreferences()
 {
     Serial.println("Loading device ThingsBoard preferences from flash...");
-    // Open NVS namespace in read-only mode
-    if (!ThingsBoard_pref.begin(PREFS_NAMESPACE, true)) {
-        Serial.println("Failed to open Preferences namespace for reading!");
-        return false;
-    }
-
-    // Load each item. The second argument ("") is the default if the key isn't found.
-    String str;
-    str = ThingsBoard_pref.getString(PREFS_DEVICE_ID, "");
-    credentials.client_id = str.c_str();
-    str = ThingsBoard_pref.getString(PREFS_DEVICE_USER, "");
-    credentials.username = str.c_str();
-    str = ThingsBoard_pref.getString(PREFS_DEVICE_PASS, "");
-    credentials.password = str.c_str();
-
-    // Close the preferences
-    ThingsBoard_pref.end();
-
-    return true;
+    return ThingsBoard_settings.begin();
 }
 
 /// @brief Provision request did not receive a response in the expected amount of microseconds
@@ -165,16 +220,17 @@ void provisionTimedOut()
         "Provision request timed out did not receive a response in (%llu) microseconds. Ensure "
         "client is connected to the MQTT broker\n",
         REQUEST_TIMEOUT_MICROSECONDS);
+    provisionRequestSent = false;
 }
 
 /// @brief Process the provisioning response received from the server
 /// @param json Reference to the object containing the provisioning response
 void processProvisionResponse(const JsonDocument& json)
 {
-    const size_t jsonSize = Helper::Measure_Json(json);
-    char buffer[jsonSize];
-    serializeJson(json, buffer, jsonSize);
-    Serial.printf("Received device provision response (%s)\n", buffer);
+    // Serialized straight to the console, no copy of the document on the stack
+    Serial.print("Received device provision response (");
+    serializeJson(json, Serial);
+    Serial.println(")");
 
     if (strncmp(json["status"], "SUCCESS", strlen("SUCCESS")) != 0) {
         Serial.printf("Provision response contains the error: (%s)\n",
@@ -183,23 +239,36 @@ void processProvisionResponse(const JsonDocument& json)
         return;
     }
 
+    const char* clientId = "";
+    const char* username = "";
+    const char* password = "";
     if (strncmp(json[CREDENTIALS_TYPE], ACCESS_TOKEN_CRED_TYPE, strlen(ACCESS_TOKEN_CRED_TYPE)) ==
         0) {
-        credentials.client_id = "";
-        credentials.username = json[CREDENTIALS_VALUE].as<std::string>();
-        credentials.password = "";
+        username = json[CREDENTIALS_VALUE].as<const char*>();
     } else if (strncmp(json[CREDENTIALS_TYPE], MQTT_BASIC_CRED_TYPE,
                        strlen(MQTT_BASIC_CRED_TYPE)) == 0) {
         auto credentials_value = json[CREDENTIALS_VALUE].as<JsonObjectConst>();
-        credentials.client_id = credentials_value[CLIENT_ID].as<std::string>();
-        credentials.username = credentials_value[CLIENT_USERNAME].as<std::string>();
-        credentials.password = credentials_value[CLIENT_PASSWORD].as<std::string>();
+        clientId = credentials_value[CLIENT_ID].as<const char*>();
+        username = credentials_value[CLIENT_USERNAME].as<const char*>();
+        password = credentials_value[CLIENT_PASSWORD].as<const char*>();
     } else {
         Serial.printf("Unexpected provision credentialsType: (%s)\n",
                       json[CREDENTIALS_TYPE].as<const char*>());
         provisionRequestSent = false;
         return;
     }
+    // All or nothing, a truncated credential would only be refused by the server
+    if (!credentials.client_id.fits(clientId) || !credentials.username.fits(username) ||
+        !credentials.password.fits(password)) {
+        Serial.printf("Provisioned credentials exceed %u characters, not stored\n",
+                      static_cast<unsigned>(CREDENTIAL_SIZE - 1));
+        provisionRequestSent = false;
+        return;
+    }
+    credentials.client_id.set(clientId);
+    credentials.username.set(username);
+    credentials.password.set(password);
+    credentialsRefused = false;
 
     // Disconnect from the cloud client connected to the provision account, because it is no longer
     // needed the device has been provisioned and we can reconnect to the cloud with the newly
@@ -209,8 +278,9 @@ void processProvisionResponse(const JsonDocument& json)
     }
 
     saveThingsBoardPreferences();
+    BOOT_MARK(PROVISIONED);
 
-    _lastConnectAttempt = 0;
+    ThingsBoard_reconnect.reset();
     provisionRequestSent = false;
 }
 
@@ -239,20 +309,59 @@ void ThingsBoard_setup()
 {
     loadThingsBoardPreferences();
 
-    String macUpper = WiFi.macAddress();
-    macUpper.toUpperCase();
-    String macUCNo = macUpper;
-    macUCNo.replace(":", "");
-    String macLCNo = macUCNo;
-    macLCNo.toLowerCase();
+    uint8_t mac[6];
+    WiFi.macAddress(mac);
 
-    deviceName = String(DEVICE_NAME_PREFIX) + " " + macUCNo;  // upper, no colons
-    deviceId = String(DEVICE_ID_PREFIX) + " - " + macLCNo;    // lower, no colons
-    deviceMac = macUpper;                                     // upper, with colons
-    deviceModel = String(DEVICE_NAME_PREFIX) + " " + String(DEVICE_MODEL);
+    // upper, no colons
+    snprintf(deviceName, sizeof(deviceName), "%s %02X%02X%02X%02X%02X%02X", DEVICE_NAME_PREFIX,
+             mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+    // lower, no colons
+    snprintf(deviceId, sizeof(deviceId), "%s - %02x%02x%02x%02x%02x%02x", DEVICE_ID_PREFIX, mac[0],
+             mac[1], mac[2], mac[3], mac[4], mac[5]);
+    // upper, with colons
+    snprintf(deviceMac, sizeof(deviceMac), "%02X:%02X:%02X:%02X:%02X:%02X", mac[0], mac[1], mac[2],
+             mac[3], mac[4], mac[5]);
+    snprintf(deviceModel, sizeof(deviceModel), "%s %s", DEVICE_NAME_PREFIX, DEVICE_MODEL);
 
     currentThingsBoardConnectionStatus = ThingsBoard_client.connected();
     lastThingsBoardConnectionStatus = ThingsBoard_client.connected();
+
+    WiFi_client.filter(THINGSBOARD_FILTERED_TOPICS,
+                       sizeof(THINGSBOARD_FILTERED_TOPICS) / sizeof(THINGSBOARD_FILTERED_TOPICS[0]),
+                       ThingsBoard_keepKey);
+}
+
+/// @brief Publish a message written to the connection as it is, it does not pass through the
+/// send buffer of the client
+bool ThingsBoard_publish(const char* topic, const uint8_t* payload, size_t length)
+{
+    return MQTT_client.begin_publish(topic, length) &&
+           MQTT_client.write(payload, length) == length && MQTT_client.end_publish();
+}
+
+/// @brief Connect the MQTT client, a failure is classified and backs off the next attempt
+bool ThingsBoard_connectClient(const char* username, const char* clientId, const char* password)
+{
+    // Resolved here so a DNS failure is told apart, the transport connects to the address
+    IPAddress serverIp;
+    if (!WiFi.hostByName(ThingsBoard_server.c_str(), serverIp)) {
+        ThingsBoard_reconnect.failed(Connect_Failure::DNS, millis());
+        return false;
+    }
+    WiFi_client.resolved(ThingsBoard_server.c_str(), serverIp);
+    if (!ThingsBoard_client.connect(ThingsBoard_server.c_str(), username, ThingsBoard_port,
+                                    clientId, password)) {
+        Connect_Failure failure = Connect_Failure::MQTT;
+        if (!WiFi_client.tcpConnected()) {
+            failure = Connect_Failure::TCP;
+        } else if (WiFi_client.authRefused()) {
+            failure = Connect_Failure::MQTT_AUTH;
+        }
+        ThingsBoard_reconnect.failed(failure, millis());
+        return false;
+    }
+    ThingsBoard_reconnect.succeeded();
+    return true;
 }
 
 void ThingsBoard_connect()
@@ -261,21 +370,18 @@ void ThingsBoard_connect()
         return;
     }
 
-    if (_lastConnectAttempt != 0 &&
-        millis() - _lastConnectAttempt < THINGSBOARD_CONNECT_ATTEMPS_TIMOUT) {
+    if (!ThingsBoard_reconnect.due(millis())) {
         return;
     }
-    _lastConnectAttempt = millis();
 
     if (!provisionRequestSent) {
-        if (credentials.username.empty()) {
+        if (!ThingsBoard_provisioned()) {
             serverRpcSubscribed = false;
             sharedAttributeSubscribed = false;
             sharedAttributeRequested = false;
 
             Serial.printf("Connecting to %s for provisioning...\n", ThingsBoard_server.c_str());
-            if (!ThingsBoard_client.connect(ThingsBoard_server.c_str(), "provision",
-                                            ThingsBoard_port)) {
+            if (!ThingsBoard_connectClient("provision", nullptr, nullptr)) {
                 Serial.println("Failed to connect");
                 provisionRequestSent = false;
                 return;
@@ -286,13 +392,15 @@ void ThingsBoard_connect()
 
             const Provision_Callback provisionCallback(
                 Access_Token(), &processProvisionResponse, ThingsBoard_Provision_Device_Key,
-                ThingsBoard_Provision_Device_Secret, deviceId.c_str(), REQUEST_TIMEOUT_MICROSECONDS,
+                ThingsBoard_Provision_Device_Secret, deviceId, REQUEST_TIMEOUT_MICROSECONDS,
                 &provisionTimedOut);
             provisionRequestSent = prov.Provision_Request(provisionCallback);
+            BOOT_MARK(PROVISION_SENT);
+            ThingsBoard_reconnect.defer(THINGSBOARD_PROVISION_TIMEOUT, millis());
         }
     }
 
-    if (!credentials.username.empty()) {
+    if (ThingsBoard_provisioned()) {
         if (!ThingsBoard_client.connected()) {
             serverRpcSubscribed = false;
             sharedAttributeSubscribed = false;
@@ -300,23 +408,22 @@ void ThingsBoard_connect()
 
             // Connect to the ThingsBoard server, as the provisioned client
             Serial.printf("Connecting to %s after provision\n", ThingsBoard_server.c_str());
-            if (!ThingsBoard_client.connect(
-                    ThingsBoard_server.c_str(), credentials.username.c_str(), ThingsBoard_port,
-                    credentials.client_id.c_str(), credentials.password.c_str())) {
+            if (!ThingsBoard_connectClient(credentials.username.c_str(),
+                                           credentials.client_id.c_str(),
+                                           credentials.password.c_str())) {
                 Serial.println("Failed to connect");
-                _thingsBoardConnectAttempts++;
-                if (_thingsBoardConnectAttempts >= THINGSBOARD_ATTEMPS_MAX) {
+                // Only refused credentials are a reason to provision again, the server being
+                // unreachable is not
+                if (ThingsBoard_reconnect.authFailures() >= THINGSBOARD_ATTEMPS_MAX) {
                     Serial.println(
                         "Max ThingsBoard connection attempts reached, "
                         "do re-provisioning...");
-                    credentials.username = "";
-                    _thingsBoardConnectAttempts = 0;
+                    credentialsRefused = true;
+                    ThingsBoard_reconnect.clearAuthFailures();
                 }
                 return;
-            } else {
-                // Serial.println("Connected!");
-                _lastConnectAttempt = 0;
             }
+            BOOT_MARK(MQTT_CONNECTED);
         } else {
             currentThingsBoardConnectionStatus = true;
 
@@ -332,48 +439,46 @@ void ThingsBoard_connect()
                 // as denoted by callbacks array.
                 if (!TB_server_rpc.RPC_Subscribe(callbacks.cbegin(), callbacks.cend())) {
                     Serial.println("Failed to subscribe for RPC");
+                    ThingsBoard_reconnect.failed(Connect_Failure::MQTT, millis());
                     return;
                 }
 
                 Serial.println("Subscribe done");
                 serverRpcSubscribed = true;
+                BOOT_MARK(RPC_SUBSCRIBED);
             }
 
             if (!sharedAttributeSubscribed) {
                 Serial.println("Subscribing for shared attribute updates...");
 
-                // Shared attributes we want to request from the server
-                constexpr std::array<const char*, MAX_ATTRIBUTES> SUBSCRIBED_SHARED_ATTRIBUTES = {
-                    SWITCH_STATE_0_KEY, SWITCH_STATE_1_KEY, SWITCH_STATE_2_KEY,
-                    SWITCH_STATE_3_KEY, SWITCH_STATE_4_KEY, SWITCH_STATE_5_KEY};
                 const Shared_Attribute_Callback<MAX_ATTRIBUTES> callback(
-                    &processSharedAttributeUpdate, SUBSCRIBED_SHARED_ATTRIBUTES);
+                    &processSharedAttributeUpdate, SHARED_ATTRIBUTES);
                 if (!TB_shared_update.Shared_Attributes_Subscribe(callback)) {
                     Serial.println("Failed to subscribe for shared attribute updates");
+                    ThingsBoard_reconnect.failed(Connect_Failure::MQTT, millis());
                     return;
                 }
 
                 Serial.println("Subscribe done");
                 sharedAttributeSubscribed = true;
+                BOOT_MARK(ATTRIBUTES_SUBSCRIBED);
             }
 
             if (!sharedAttributeRequested && sharedAttributeSubscribed) {
                 Serial.println("Requesting shared attributes...");
 
-                // Shared attributes we want to request from the server
-                constexpr std::array<const char*, MAX_ATTRIBUTES> REQUESTED_SHARED_ATTRIBUTES = {
-                    SWITCH_STATE_0_KEY, SWITCH_STATE_1_KEY, SWITCH_STATE_2_KEY,
-                    SWITCH_STATE_3_KEY, SWITCH_STATE_4_KEY, SWITCH_STATE_5_KEY};
                 const Attribute_Request_Callback<MAX_ATTRIBUTES> sharedCallback(
                     &processSharedAttributeUpdate, REQUEST_TIMEOUT_MICROSECONDS, &requestTimedOut,
-                    REQUESTED_SHARED_ATTRIBUTES);
+                    SHARED_ATTRIBUTES);
                 if (!TB_attribute_request.Shared_Attributes_Request(sharedCallback)) {
                     Serial.println("Failed to request shared attributes");
+                    ThingsBoard_reconnect.failed(Connect_Failure::MQTT, millis());
                     return;
                 }
 
                 Serial.println("Request done");
                 sharedAttributeRequested = true;
+                BOOT_MARK(ATTRIBUTES_REQUESTED);
             }
 
             currentThingsBoardConnectionStatus = ThingsBoard_client.connected();
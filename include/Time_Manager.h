@@ -0,0 +1,200 @@
+#ifndef _TIME_MANAGER_H
+#define _TIME_MANAGER_H
+
+#include <Arduino.h>
+#include <esp_sntp.h>
+#include <sys/time.h>
+#include <time.h>
+
+#ifdef USE_DS3231
+#include <Wire.h>
+#endif
+
+//
+// System time, disciplined by SNTP while online. With USE_DS3231 the battery backed RTC sets the
+// clock at boot, before the network is up, and is written back on every SNTP sync.
+//
+#define TIME_NTP_SERVER "pool.ntp.org"
+#define TIME_NTP_SERVER2 "time.google.com"
+
+// Anything before 2020 means the clock was never set
+constexpr time_t TIME_VALID_AFTER = 1577836800;
+
+enum class Time_Source : uint8_t { NONE, SYSTEM, DS3231, SNTP };
+
+Time_Source Time_source = Time_Source::NONE;
+// millis() of the last SNTP sync
+unsigned long Time_lastSync = 0;
+
+/// @brief Whether the system time has been set, by any source
+bool Time_valid()
+{
+    struct timeval now;
+    gettimeofday(&now, nullptr);
+    return now.tv_sec >= TIME_VALID_AFTER;
+}
+
+/// @brief Current time in epoch milliseconds, 0 while the clock is not set
+uint64_t Time_epochMs()
+{
+    struct timeval now;
+    gettimeofday(&now, nullptr);
+    if (now.tv_sec < TIME_VALID_AFTER) {
+        return 0;
+    }
+    return static_cast<uint64_t>(now.tv_sec) * 1000U + now.tv_usec / 1000U;
+}
+
+const char* Time_sourceName(Time_Source source)
+{
+    switch (source) {
+        case Time_Source::SYSTEM:
+            return "system";
+        case Time_Source::DS3231:
+            return "DS3231";
+        case Time_Source::SNTP:
+            return "SNTP";
+        default:
+            return "none";
+    }
+}
+
+/// @brief Days since 1970-01-01 of a proleptic Gregorian date, no time zone involved
+constexpr int32_t Time_daysFromCivil(int32_t year, uint32_t month, uint32_t day)
+{
+    year -= month <= 2 ? 1 : 0;
+    const int32_t era = (year >= 0 ? year : year - 399) / 400;
+    const uint32_t yearOfEra = static_cast<uint32_t>(year - era * 400);
+    const uint32_t dayOfYear = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    const uint32_t dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+    return era * 146097 + static_cast<int32_t>(dayOfEra) - 719468;
+}
+static_assert(Time_daysFromCivil(2020, 1, 1) * 86400LL == TIME_VALID_AFTER,
+              "Civil date conversion is off");
+
+#ifdef USE_DS3231
+//
+// DS3231 over I2C, the time is kept in UTC and 24 hour mode
+//
+constexpr uint8_t DS3231_ADDRESS = 0x68;
+constexpr uint8_t DS3231_REG_SECONDS = 0x00;
+constexpr uint8_t DS3231_REG_STATUS = 0x0F;
+constexpr uint8_t DS3231_STATUS_OSF = 0x80;  // Oscillator stopped, the time is not valid
+
+uint8_t DS3231_fromBcd(uint8_t value) { return (value >> 4) * 10 + (value & 0x0F); }
+uint8_t DS3231_toBcd(uint8_t value) { return ((value / 10) << 4) | (value % 10); }
+
+bool DS3231_readRegisters(uint8_t reg, uint8_t* data, uint8_t count)
+{
+    Wire.beginTransmission(DS3231_ADDRESS);
+    Wire.write(reg);
+    if (Wire.endTransmission() != 0) {
+        return false;
+    }
+    if (Wire.requestFrom(DS3231_ADDRESS, count) != count) {
+        return false;
+    }
+    for (uint8_t i = 0; i < count; i++) {
+        data[i] = Wire.read();
+    }
+    return true;
+}
+
+bool DS3231_writeRegisters(uint8_t reg, const uint8_t* data, uint8_t count)
+{
+    Wire.beginTransmission(DS3231_ADDRESS);
+    Wire.write(reg);
+    Wire.write(data, count);
+    return Wire.endTransmission() == 0;
+}
+
+/// @brief Read the RTC
+/// @return false if the RTC does not answer or lost its time
+bool DS3231_read(time_t& time)
+{
+    uint8_t status;
+    if (!DS3231_readRegisters(DS3231_REG_STATUS, &status, 1) || (status & DS3231_STATUS_OSF)) {
+        return false;
+    }
+    uint8_t regs[7];
+    if (!DS3231_readRegisters(DS3231_REG_SECONDS, regs, sizeof(regs))) {
+        return false;
+    }
+    const uint32_t seconds = DS3231_fromBcd(regs[0] & 0x7F);
+    const uint32_t minutes = DS3231_fromBcd(regs[1] & 0x7F);
+    const uint32_t hours = DS3231_fromBcd(regs[2] & 0x3F);
+    const uint32_t day = DS3231_fromBcd(regs[4] & 0x3F);
+    const uint32_t month = DS3231_fromBcd(regs[5] & 0x1F);
+    const int32_t year = 2000 + DS3231_fromBcd(regs[6]) + ((regs[5] & 0x80) ? 100 : 0);
+    time = static_cast<time_t>(Time_daysFromCivil(year, month, day)) * 86400 + hours * 3600 +
+           minutes * 60 + seconds;
+    return time >= TIME_VALID_AFTER;
+}
+
+/// @brief Set the RTC and clear its oscillator stop flag
+bool DS3231_write(time_t time)
+{
+    struct tm utc;
+    gmtime_r(&time, &utc);
+    const uint8_t regs[7] = {
+        DS3231_toBcd(utc.tm_sec),
+        DS3231_toBcd(utc.tm_min),
+        DS3231_toBcd(utc.tm_hour),
+        static_cast<uint8_t>(utc.tm_wday + 1),
+        DS3231_toBcd(utc.tm_mday),
+        static_cast<uint8_t>(DS3231_toBcd(utc.tm_mon + 1) | (utc.tm_year >= 200 ? 0x80 : 0)),
+        DS3231_toBcd(utc.tm_year % 100),
+    };
+    if (!DS3231_writeRegisters(DS3231_REG_SECONDS, regs, sizeof(regs))) {
+        return false;
+    }
+    uint8_t status;
+    if (!DS3231_readRegisters(DS3231_REG_STATUS, &status, 1)) {
+        return false;
+    }
+    status &= ~DS3231_STATUS_OSF;
+    return DS3231_writeRegisters(DS3231_REG_STATUS, &status, 1);
+}
+#endif  // USE_DS3231
+
+/// @brief Called by the SNTP client whenever the system time was adjusted
+void Time_onSync(struct timeval* tv)
+{
+    const bool first = Time_source != Time_Source::SNTP;
+    Time_source = Time_Source::SNTP;
+    Time_lastSync = millis();
+    if (first) {
+        Serial.printf("Time synced by SNTP: %ld\n", static_cast<long>(tv->tv_sec));
+    }
+#ifdef USE_DS3231
+    if (!DS3231_write(tv->tv_sec)) {
+        Serial.println("Failed to set the DS3231");
+    }
+#endif
+}
+
+/// @brief Set the clock from the RTC if it is not valid yet and start SNTP, call once the network
+/// interface exists
+void Time_setup()
+{
+    if (Time_valid()) {
+        // Kept over deep sleep or a software reset
+        Time_source = Time_Source::SYSTEM;
+    }
+#ifdef USE_DS3231
+    Wire.begin();
+    time_t rtc;
+    if (Time_source == Time_Source::NONE && DS3231_read(rtc)) {
+        const struct timeval now = {rtc, 0};
+        settimeofday(&now, nullptr);
+        Time_source = Time_Source::DS3231;
+    }
+#endif
+    Serial.printf("Time source at boot: %s\n", Time_sourceName(Time_source));
+
+    sntp_set_time_sync_notification_cb(Time_onSync);
+    // UTC, telemetry timestamps are epoch based
+    configTime(0, 0, TIME_NTP_SERVER, TIME_NTP_SERVER2);
+}
+
+#endif  // _TIME_MANAGER_H
@@ -0,0 +1,189 @@
+#ifndef _UPLOAD_CONTROLLER_H
+#define _UPLOAD_CONTROLLER_H
+
+#include <Arduino.h>
+
+#include <algorithm>
+
+#include "Settings_Store.h"
+#include "Telemetry_Buffer.h"
+#include "ThingsBoard_Manager.h"
+
+//
+// Upload cadence of the buffered telemetry. The link quality, taken from the RSSI and the PUBACK
+// latency of the publish pipeline, sets how many samples are collected and how long they may wait
+// before they are sent: on a good link every sample goes out at once, on a poor one the radio is
+// woken for larger and fewer bursts. A filling buffer shortens the wait, at half full it is
+// drained at once. The limits are shared attributes, see UPLOAD_*_ATTRIBUTE.
+//
+struct Upload_Limits {
+    uint32_t minInterval;  // Longest wait on a good link, in milliseconds
+    uint32_t maxInterval;  // Longest wait on a poor link, in milliseconds
+    uint32_t maxBatch;     // Samples collected before a burst on a poor link
+};
+
+constexpr Upload_Limits UPLOAD_DEFAULT_LIMITS = {0, 60000, 60};
+constexpr uint32_t UPLOAD_INTERVAL_MAX = 60 * 60 * 1000;  // 1 hour
+constexpr uint32_t UPLOAD_BATCH_MAX = 500;
+
+// Link quality is 0 at or below the poor end and 1 at or above the good end
+constexpr float UPLOAD_RSSI_POOR = -85.0f;
+constexpr float UPLOAD_RSSI_GOOD = -60.0f;
+constexpr float UPLOAD_LATENCY_POOR = 2000.0f;  // 2 seconds
+constexpr float UPLOAD_LATENCY_GOOD = 100.0f;   // 100 milliseconds
+// Weight of a new measurement in the moving averages
+constexpr float UPLOAD_SMOOTHING = 0.25f;
+
+constexpr char PREFS_UPLOAD_LIMITS[] = "upload_limits";
+
+class Upload_Controller {
+   public:
+    explicit Upload_Controller(const Upload_Limits& limits) : m_limits(limits) {}
+
+    const Upload_Limits& limits() const { return m_limits; }
+
+    /// @brief Change the limits, the intervals are ordered and capped
+    void setLimits(Upload_Limits limits)
+    {
+        limits.maxInterval = std::min(limits.maxInterval, UPLOAD_INTERVAL_MAX);
+        limits.minInterval = std::min(limits.minInterval, limits.maxInterval);
+        limits.maxBatch = constrain(limits.maxBatch, 1U, UPLOAD_BATCH_MAX);
+        m_limits = limits;
+    }
+
+    void addRssi(int rssi) { average(m_rssi, m_hasRssi, rssi); }
+
+    /// @brief Time from publishing a message to its PUBACK
+    void addLatency(uint32_t latencyMs) { average(m_latency, m_hasLatency, latencyMs); }
+
+    /// @brief Link quality between 0 (poor) and 1 (good), the worse of RSSI and latency
+    float quality() const
+    {
+        const float rssi = m_hasRssi ? scale(m_rssi, UPLOAD_RSSI_POOR, UPLOAD_RSSI_GOOD) : 1.0f;
+        const float latency =
+            m_hasLatency ? scale(m_latency, UPLOAD_LATENCY_POOR, UPLOAD_LATENCY_GOOD) : 1.0f;
+        return std::min(rssi, latency);
+    }
+
+    /// @brief Samples collected before a burst
+    uint32_t batch() const
+    {
+        return 1 + lroundf((1.0f - quality()) * (m_limits.maxBatch - 1));
+    }
+
+    /// @brief Longest wait of a sample before a burst
+    /// @param fill Fraction of the buffer in use
+    uint32_t interval(float fill) const
+    {
+        const float span = m_limits.maxInterval - m_limits.minInterval;
+        const float interval = m_limits.minInterval + (1.0f - quality()) * span;
+        return interval * std::max(0.0f, 1.0f - 2.0f * fill);
+    }
+
+    /// @brief Whether buffered samples are to be sent now, true from the start of a burst until
+    /// drained() ends it. A burst spans several passes while the publish pipeline is full, a pass
+    /// that stops for any other reason ends it, the samples left over wait for the next one.
+    /// @param pending Samples not sent yet
+    /// @param capacity Capacity of the buffer
+    bool due(size_t pending, size_t capacity, uint32_t now)
+    {
+        if (!m_draining && pending > 0 &&
+            (pending >= batch() || now - m_last >= interval(fill(pending, capacity)))) {
+            m_draining = true;
+            m_bursts++;
+            m_burstSamples += pending;
+        }
+        return m_draining;
+    }
+
+    /// @brief The burst ended, the wait for the next one starts
+    void drained(uint32_t now)
+    {
+        m_draining = false;
+        m_last = now;
+    }
+
+    /// @brief Milliseconds until the pending samples are due, UINT32_MAX if none
+    uint32_t remaining(size_t pending, size_t capacity, uint32_t now) const
+    {
+        if (pending == 0) {
+            return UINT32_MAX;
+        }
+        if (m_draining || pending >= batch()) {
+            return 0;
+        }
+        const uint32_t elapsed = now - m_last;
+        const uint32_t wait = interval(fill(pending, capacity));
+        return elapsed >= wait ? 0 : wait - elapsed;
+    }
+
+    /// @brief Print the link estimate and the bursts since the last call
+    void printStats()
+    {
+        Serial.printf("Upload: quality %.2f (RSSI %.0f dBm, latency %.0f ms), batch %u, interval "
+                      "%u ms, %u burst(s), %.1f samples per burst\n",
+                      quality(), m_rssi, m_latency, static_cast<unsigned>(batch()),
+                      static_cast<unsigned>(interval(0.0f)), static_cast<unsigned>(m_bursts),
+                      m_bursts == 0 ? 0.0f : static_cast<float>(m_burstSamples) / m_bursts);
+        m_bursts = 0;
+        m_burstSamples = 0;
+    }
+
+   private:
+    static float scale(float value, float poor, float good)
+    {
+        return constrain((value - poor) / (good - poor), 0.0f, 1.0f);
+    }
+
+    static float fill(size_t pending, size_t capacity)
+    {
+        return capacity == 0 ? 0.0f : static_cast<float>(pending) / capacity;
+    }
+
+    static void average(float& average, bool& initialized, float value)
+    {
+        average = initialized ? average + UPLOAD_SMOOTHING * (value - average) : value;
+        initialized = true;
+    }
+
+    Upload_Limits m_limits;
+    float m_rssi = 0.0f;
+    bool m_hasRssi = false;
+    float m_latency = 0.0f;
+    bool m_hasLatency = false;
+    bool m_draining = false;
+    uint32_t m_last = 0;
+
+    uint32_t m_bursts = 0;
+    uint32_t m_burstSamples = 0;
+};
+
+Setting<Upload_Limits> Upload_limitsSetting(ThingsBoard_settings, PREFS_UPLOAD_LIMITS,
+                                            UPLOAD_DEFAULT_LIMITS);
+Upload_Controller Upload_controller(UPLOAD_DEFAULT_LIMITS);
+
+/// @brief Feed the time a telemetry message took to be acknowledged, see Publish_Pipeline
+void Upload_ackLatency(uint32_t latencyMs)
+{
+    Upload_controller.addLatency(latencyMs);
+}
+
+/// @brief Apply the limits stored in ThingsBoard_settings, call after they were loaded
+void Upload_begin()
+{
+    Upload_controller.setLimits(Upload_limitsSetting.get());
+}
+
+/// @brief Change the limits, persisted by the settings commit
+void Upload_setLimits(const Upload_Limits& limits)
+{
+    Upload_controller.setLimits(limits);
+    if (Upload_limitsSetting.set(Upload_controller.limits())) {
+        Serial.printf("Upload limits: %u to %u ms, batch up to %u\n",
+                      static_cast<unsigned>(Upload_controller.limits().minInterval),
+                      static_cast<unsigned>(Upload_controller.limits().maxInterval),
+                      static_cast<unsigned>(Upload_controller.limits().maxBatch));
+    }
+}
+
+#endif  // _UPLOAD_CONTROLLER_H
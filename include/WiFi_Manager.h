@@ -4,18 +4,124 @@
 #include <Arduino.h>
 #include <WiFi.h>
 
+#include "Boot_Timeline.h"
 #include "Configuration.h"
+#include "Reconnect_Scheduler.h"
+#include "Settings_Store.h"
+#include "Task_Events.h"
 
+#ifndef WIFI_CONNECT_ATTEMPS_TIMOUT
 #define WIFI_CONNECT_ATTEMPS_TIMOUT 10000
+#endif
 #define WIFI_ATTEMPS_MAX 5
+#define WIFI_RECONNECT_MAX_INTERVAL (5 * 60 * 1000)
+
+Reconnect_Scheduler WiFi_reconnect("WiFi", WIFI_CONNECT_ATTEMPS_TIMOUT,
+                                   WIFI_RECONNECT_MAX_INTERVAL);
 
 uint8_t lastWiFiStatus = WL_IDLE_STATUS;
 uint8_t lastWiFiAttemps = 0;
 
+//
+// Last good access point and lease, used for a directed connect without scanning
+//
+constexpr uint32_t WIFI_CACHE_MAGIC = 0x57434631;  // "WCF1"
+
+struct WiFi_Cache {
+    uint32_t magic;
+    uint8_t bssid[6];
+    uint8_t channel;
+    uint32_t ip;
+    uint32_t gateway;
+    uint32_t subnet;
+    uint32_t dns;
+};
+
+constexpr char* WIFI_PREFS_NAMESPACE = "wifi_prefs";
+constexpr char* WIFI_PREFS_CACHE = "cache";
+
+//
+// Fixed address, skips DHCP. Build with e.g. '-DWIFI_STATIC_IP="192.168.1.50"' and
+// '-DWIFI_STATIC_GATEWAY="192.168.1.1"', the subnet defaults to 255.255.255.0 and the DNS server
+// to the gateway.
+//
+#ifdef WIFI_STATIC_IP
+#ifndef WIFI_STATIC_GATEWAY
+#error "WIFI_STATIC_IP needs WIFI_STATIC_GATEWAY"
+#endif
+#ifndef WIFI_STATIC_SUBNET
+#define WIFI_STATIC_SUBNET "255.255.255.0"
+#endif
+#ifndef WIFI_STATIC_DNS
+#define WIFI_STATIC_DNS WIFI_STATIC_GATEWAY
+#endif
+#endif
+
+Settings_Store WiFi_settings(WIFI_PREFS_NAMESPACE);
+Setting<WiFi_Cache> WiFi_cacheSetting(WiFi_settings, WIFI_PREFS_CACHE, WiFi_Cache{});
+
+// Survives deep sleep, saves the NVS read on wake up
+RTC_DATA_ATTR WiFi_Cache WiFi_cache = {};
+
+// Whether the current attempt is a directed connect, and when it started
+bool WiFi_fastConnect = false;
+unsigned long WiFi_attemptStartedAt = 0;
+
 void WiFi_setup();
 void WiFi_connect();
 void WiFi_onEvent(WiFiEvent_t event);
 
+void WiFi_loadCache()
+{
+    if (WiFi_cache.magic == WIFI_CACHE_MAGIC) {
+        // Stored before the deep sleep, the settings only need to know it
+        WiFi_cacheSetting.adopt(WiFi_cache);
+        return;
+    }
+    if (WiFi_settings.begin() && WiFi_cacheSetting.get().magic == WIFI_CACHE_MAGIC) {
+        WiFi_cache = WiFi_cacheSetting.get();
+    }
+}
+
+/// @brief Remember the access point and lease of the current connection, NVS is only written
+/// when they changed
+void WiFi_storeCache()
+{
+    WiFi_Cache cache = {};
+    cache.magic = WIFI_CACHE_MAGIC;
+    const uint8_t* bssid = WiFi.BSSID();
+    if (bssid == nullptr) {
+        return;
+    }
+    memcpy(cache.bssid, bssid, sizeof(cache.bssid));
+    cache.channel = WiFi.channel();
+    cache.ip = WiFi.localIP();
+    cache.gateway = WiFi.gatewayIP();
+    cache.subnet = WiFi.subnetMask();
+    cache.dns = WiFi.dnsIP();
+    WiFi_cache = cache;
+    if (WiFi_cacheSetting.set(cache)) {
+        WiFi_settings.commit();
+    }
+}
+
+#ifdef WIFI_STATIC_IP
+/// @brief Configure the fixed address of the build, DHCP is used if it does not parse
+void WiFi_configStatic()
+{
+    IPAddress address;
+    IPAddress gateway;
+    IPAddress subnet;
+    IPAddress dns;
+    if (!address.fromString(WIFI_STATIC_IP) || !gateway.fromString(WIFI_STATIC_GATEWAY) ||
+        !subnet.fromString(WIFI_STATIC_SUBNET) || !dns.fromString(WIFI_STATIC_DNS)) {
+        Serial.println("WiFi static address is invalid, using DHCP");
+        return;
+    }
+    WiFi.config(address, gateway, subnet, dns);
+}
+#endif
+
 void WiFi_setup()
 {
     Serial.println("setup_WiFi()");
@@ -24,36 +130,66 @@ void WiFi_setup()
     WiFi.onEvent(WiFi_onEvent);
     lastWiFiStatus = WiFi.status();
     lastWiFiAttemps = 0;
+    WiFi_loadCache();
+#ifdef WIFI_STATIC_IP
+    WiFi_configStatic();
+#endif
 }
 
+/// @brief Keep the WiFi connection up, call periodically. Attempts are scheduled by
+/// WiFi_reconnect, an attempt not connected within WIFI_CONNECT_ATTEMPS_TIMOUT has failed.
 void WiFi_connect()
 {
     // Serial.println("WiFi_connect()");
 
-    static uint8_t _lastWiFiStatus = WL_IDLE_STATUS;
+    static bool _attemptPending = false;
+    static bool _wasConnected = false;
     if (WiFi.status() == WL_CONNECTED) {
-        if (WiFi.status() != _lastWiFiStatus) {
-            // Serial.println();
-            // Serial.println("WiFi connected.");
-            // Serial.println("IP address: ");
-            // Serial.println(WiFi.localIP());
+        if (!_wasConnected) {
+            WiFi_reconnect.succeeded();
+            WiFi_storeCache();
         }
-        _lastWiFiStatus = WiFi.status();
+        _attemptPending = false;
+        _wasConnected = true;
+        return;
+    }
+    if (_wasConnected) {
+        _wasConnected = false;
+        WiFi_reconnect.lost(millis());
         return;
     }
 
-    static unsigned long _lastConnectAttempt = 0;
-    if (_lastConnectAttempt != 0 && millis() - _lastConnectAttempt < WIFI_CONNECT_ATTEMPS_TIMOUT) {
+    if (!WiFi_reconnect.due(millis())) {
+        return;
+    }
+    if (_attemptPending) {
+        _attemptPending = false;
+        if (WiFi_fastConnect) {
+            // The access point moved or the lease is gone, scan on the next attempt
+            Serial.println("WiFi fast connect failed, falling back to a full scan");
+            WiFi_cache.magic = 0;
+        }
+        WiFi_reconnect.failed(Connect_Failure::LINK, millis());
         return;
     }
-    _lastConnectAttempt = millis();
+    _attemptPending = true;
+    WiFi_reconnect.defer(WIFI_CONNECT_ATTEMPS_TIMOUT, millis());
     // lastWiFiAttemps++;
 
+    BOOT_MARK(WIFI_BEGIN);
+    WiFi_fastConnect = WiFi_cache.magic == WIFI_CACHE_MAGIC;
+    WiFi_attemptStartedAt = millis();
+
     Serial.print(lastWiFiAttemps + 1);
-    Serial.print(" - Connecting WiFi to ");
+    Serial.print(WiFi_fastConnect ? " - Fast connecting WiFi to " : " - Connecting WiFi to ");
     Serial.println(WiFi_ssid);
-    WiFi.disconnect(true);
-    WiFi.begin(WiFi_ssid, WiFi_pass);
+    // Abort a pending attempt only, turning the radio off would cost a restart
+    WiFi.disconnect();
+    if (WiFi_fastConnect) {
+        WiFi.begin(WiFi_ssid.c_str(), WiFi_pass.c_str(), WiFi_cache.channel, WiFi_cache.bssid);
+    } else {
+        WiFi.begin(WiFi_ssid.c_str(), WiFi_pass.c_str());
+    }
 }
 
 void WiFi_onEvent(WiFiEvent_t event)
@@ -63,13 +199,19 @@ void WiFi_onEvent(WiFiEvent_t event)
             Serial.println("WiFi connected.");
             break;
         case IP_EVENT_STA_GOT_IP:
+            BOOT_MARK(WIFI_GOT_IP);
             Serial.print("IP address: ");
             Serial.println(WiFi.localIP());
+            Serial.printf("WiFi got IP %lu ms after boot, %lu ms after %s\n", millis(),
+                          millis() - WiFi_attemptStartedAt,
+                          WiFi_fastConnect ? "a fast connect" : "a full scan");
             lastWiFiAttemps = 0;
+            Events_signal(EVENT_WIFI_UP);
             break;
         case WIFI_EVENT_STA_DISCONNECTED:
             Serial.println("WiFi disconnected or failed.");
             lastWiFiAttemps++;
+            Events_signal(EVENT_WIFI_DOWN);
             break;
         default:
             break;
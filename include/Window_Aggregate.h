@@ -0,0 +1,56 @@
+#ifndef _WINDOW_AGGREGATE_H
+#define _WINDOW_AGGREGATE_H
+
+#include <cmath>
+#include <cstdint>
+
+/// @brief Streaming statistics of the readings of one window, constant memory and time per
+/// reading. The variance uses Welford's update, which stays accurate when the readings are
+/// large compared to their spread. Accumulator is the type the mean and variance are kept in.
+template <typename T, typename Accumulator = float>
+class Window_Aggregate {
+   public:
+    void add(T value)
+    {
+        if (m_count == 0) {
+            m_min = value;
+            m_max = value;
+        } else {
+            m_min = value < m_min ? value : m_min;
+            m_max = value > m_max ? value : m_max;
+        }
+        m_last = value;
+        m_count++;
+        const Accumulator delta = static_cast<Accumulator>(value) - m_mean;
+        m_mean += delta / static_cast<Accumulator>(m_count);
+        m_m2 += delta * (static_cast<Accumulator>(value) - m_mean);
+    }
+
+    void reset() { *this = Window_Aggregate(); }
+
+    uint32_t count() const { return m_count; }
+    bool empty() const { return m_count == 0; }
+
+    // Only meaningful if the window is not empty
+    T min() const { return m_min; }
+    T max() const { return m_max; }
+    T last() const { return m_last; }
+    Accumulator mean() const { return m_mean; }
+
+    /// @brief Sample variance, 0 for fewer than two readings
+    Accumulator variance() const
+    {
+        return m_count < 2 ? Accumulator() : m_m2 / static_cast<Accumulator>(m_count - 1);
+    }
+    Accumulator stddev() const { return std::sqrt(variance()); }
+
+   private:
+    uint32_t m_count = 0;
+    T m_min = T();
+    T m_max = T();
+    T m_last = T();
+    Accumulator m_mean = Accumulator();
+    Accumulator m_m2 = Accumulator();
+};
+
+#endif  // _WINDOW_AGGREGATE_H
@@ -0,0 +1,117 @@
+#include "Arduino.h"
+
+#include <chrono>
+#include <mutex>
+#include <random>
+#include <thread>
+
+HardwareSerial Serial;
+
+namespace {
+
+const auto startTime = std::chrono::steady_clock::now();
+
+std::mutex gpioMutex;
+uint8_t gpioLevel[NATIVE_GPIO_COUNT];
+uint8_t gpioMode[NATIVE_GPIO_COUNT];
+void (*gpioHandler[NATIVE_GPIO_COUNT])(void);
+
+// Seeded per process like the hardware RNG of the ESP32, so host devices do not share a sequence
+std::mt19937 randomEngine{std::random_device{}()};
+
+}  // namespace
+
+unsigned long millis()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() -
+                                                                 startTime)
+        .count();
+}
+
+unsigned long micros()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() -
+                                                                 startTime)
+        .count();
+}
+
+void delay(unsigned long ms) { std::this_thread::sleep_for(std::chrono::milliseconds(ms)); }
+
+void delayMicroseconds(unsigned int us)
+{
+    std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+void yield() { std::this_thread::yield(); }
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+    if (pin >= NATIVE_GPIO_COUNT) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(gpioMutex);
+    gpioMode[pin] = mode;
+    if (mode == INPUT_PULLUP) {
+        gpioLevel[pin] = HIGH;
+    }
+}
+
+void digitalWrite(uint8_t pin, uint8_t level)
+{
+    if (pin >= NATIVE_GPIO_COUNT) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(gpioMutex);
+    gpioLevel[pin] = level;
+}
+
+int digitalRead(uint8_t pin)
+{
+    if (pin >= NATIVE_GPIO_COUNT) {
+        return LOW;
+    }
+    std::lock_guard<std::mutex> lock(gpioMutex);
+    return gpioLevel[pin];
+}
+
+void attachInterrupt(uint8_t pin, void (*handler)(void), int mode)
+{
+    (void)mode;
+    if (pin >= NATIVE_GPIO_COUNT) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(gpioMutex);
+    gpioHandler[pin] = handler;
+}
+
+void detachInterrupt(uint8_t pin) { attachInterrupt(pin, nullptr, 0); }
+
+void Native_setPin(uint8_t pin, uint8_t level)
+{
+    if (pin >= NATIVE_GPIO_COUNT) {
+        return;
+    }
+    void (*handler)(void) = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(gpioMutex);
+        if (gpioLevel[pin] != level) {
+            handler = gpioHandler[pin];
+        }
+        gpioLevel[pin] = level;
+    }
+    if (handler != nullptr) {
+        handler();
+    }
+}
+
+long random(long max) { return max <= 0 ? 0 : random(0, max); }
+
+long random(long min, long max)
+{
+    if (max <= min) {
+        return min;
+    }
+    return std::uniform_int_distribution<long>(min, max - 1)(randomEngine);
+}
+
+void randomSeed(unsigned long seed) { randomEngine.seed(seed); }
@@ -0,0 +1,75 @@
+#ifndef _NATIVE_ARDUINO_H
+#define _NATIVE_ARDUINO_H
+
+//
+// Host stand-in for the Arduino core, only what the firmware and its libraries use
+//
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#include "Client.h"
+#include "HardwareSerial.h"
+#include "IPAddress.h"
+#include "Print.h"
+#include "Stream.h"
+#include "WString.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#define HIGH 0x1
+#define LOW 0x0
+
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define INPUT_PULLUP 0x05
+#define INPUT_PULLDOWN 0x09
+
+#define CHANGE 0x03
+#define FALLING 0x02
+#define RISING 0x01
+
+#define PI 3.1415926535897932384626433832795
+
+#define NOT_AN_INTERRUPT -1
+#define NATIVE_GPIO_COUNT 48
+#define digitalPinToInterrupt(pin) (((pin) < NATIVE_GPIO_COUNT) ? (pin) : NOT_AN_INTERRUPT)
+
+#define IRAM_ATTR
+#define RTC_DATA_ATTR
+#define PROGMEM
+#define CONFIG_ARDUINO_LOOP_STACK_SIZE 8192
+#define F(str) (str)
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+typedef bool boolean;
+typedef uint8_t byte;
+typedef uint8_t u8_t;
+typedef uint16_t u16_t;
+typedef uint32_t u32_t;
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield();
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t level);
+int digitalRead(uint8_t pin);
+void attachInterrupt(uint8_t pin, void (*handler)(void), int mode);
+void detachInterrupt(uint8_t pin);
+
+long random(long max);
+long random(long min, long max);
+void randomSeed(unsigned long seed);
+
+void configTime(long gmtOffset, int daylightOffset, const char* server1,
+                const char* server2 = nullptr, const char* server3 = nullptr);
+
+/// @brief Drive an input pin from a host harness, the attached interrupt handler fires on change
+void Native_setPin(uint8_t pin, uint8_t level);
+
+#endif  // _NATIVE_ARDUINO_H
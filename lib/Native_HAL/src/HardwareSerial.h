@@ -0,0 +1,31 @@
+#ifndef _NATIVE_HARDWARESERIAL_H
+#define _NATIVE_HARDWARESERIAL_H
+
+#include <cstdio>
+
+#include "Stream.h"
+
+/// @brief Serial console mapped to stdout, nothing is ever received
+class HardwareSerial : public Stream {
+   public:
+    void begin(unsigned long baud) { (void)baud; }
+    void end() {}
+
+    int available() override { return 0; }
+    int read() override { return -1; }
+    int peek() override { return -1; }
+    void flush() override { fflush(stdout); }
+
+    using Print::write;
+    size_t write(uint8_t c) override { return fputc(c, stdout) == EOF ? 0 : 1; }
+    size_t write(const uint8_t* buffer, size_t size) override
+    {
+        return fwrite(buffer, 1, size, stdout);
+    }
+
+    operator bool() const { return true; }
+};
+
+extern HardwareSerial Serial;
+
+#endif  // _NATIVE_HARDWARESERIAL_H
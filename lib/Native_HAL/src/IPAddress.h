@@ -0,0 +1,53 @@
+#ifndef _NATIVE_IPADDRESS_H
+#define _NATIVE_IPADDRESS_H
+
+#include <cstdint>
+#include <cstdio>
+
+#include "Print.h"
+#include "Printable.h"
+#include "WString.h"
+
+class IPAddress : public Printable {
+   public:
+    IPAddress() : m_bytes{0, 0, 0, 0} {}
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : m_bytes{a, b, c, d} {}
+    IPAddress(uint32_t address) { memcpy(m_bytes, &address, sizeof(m_bytes)); }
+
+    operator uint32_t() const
+    {
+        uint32_t address;
+        memcpy(&address, m_bytes, sizeof(address));
+        return address;
+    }
+    bool operator==(const IPAddress& rhs) const { return memcmp(m_bytes, rhs.m_bytes, 4) == 0; }
+    bool operator!=(const IPAddress& rhs) const { return !(*this == rhs); }
+    uint8_t operator[](int index) const { return m_bytes[index]; }
+    uint8_t& operator[](int index) { return m_bytes[index]; }
+
+    bool fromString(const char* address)
+    {
+        unsigned a, b, c, d;
+        if (sscanf(address, "%u.%u.%u.%u", &a, &b, &c, &d) != 4 || a > 255 || b > 255 ||
+            c > 255 || d > 255) {
+            return false;
+        }
+        *this = IPAddress(a, b, c, d);
+        return true;
+    }
+
+    String toString() const
+    {
+        char buffer[16];
+        snprintf(buffer, sizeof(buffer), "%u.%u.%u.%u", m_bytes[0], m_bytes[1], m_bytes[2],
+                 m_bytes[3]);
+        return String(buffer);
+    }
+
+    size_t printTo(Print& p) const override { return p.print(toString()); }
+
+   private:
+    uint8_t m_bytes[4];
+};
+
+#endif  // _NATIVE_IPADDRESS_H
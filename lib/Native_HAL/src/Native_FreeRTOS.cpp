@@ -0,0 +1,403 @@
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "freertos/task.h"
+#include "freertos/timers.h"
+
+using Native_Clock = std::chrono::steady_clock;
+
+namespace {
+
+/// @brief Deadline for a wait of the given ticks, portMAX_DELAY waits forever
+Native_Clock::time_point deadline(TickType_t ticks)
+{
+    if (ticks == portMAX_DELAY) {
+        return Native_Clock::time_point::max();
+    }
+    return Native_Clock::now() + std::chrono::milliseconds(ticks);
+}
+
+template <typename Predicate>
+bool waitUntil(std::condition_variable& cv, std::unique_lock<std::mutex>& lock,
+               Native_Clock::time_point until, Predicate predicate)
+{
+    if (until == Native_Clock::time_point::max()) {
+        cv.wait(lock, predicate);
+        return true;
+    }
+    return cv.wait_until(lock, until, predicate);
+}
+
+struct Native_TaskExit {};
+
+}  // namespace
+
+//
+// Tasks
+//
+struct Native_Task {
+    std::string name;
+    uint32_t stackDepth;
+    std::mutex mutex;
+    std::condition_variable cv;
+    uint32_t notifyValue = 0;
+    bool notifyPending = false;
+};
+
+namespace {
+
+thread_local Native_Task* currentTask = nullptr;
+
+void taskTrampoline(Native_Task* task, TaskFunction_t function, void* parameters)
+{
+    currentTask = task;
+    try {
+        function(parameters);
+    } catch (const Native_TaskExit&) {
+    }
+}
+
+}  // namespace
+
+BaseType_t xTaskCreate(TaskFunction_t function, const char* name, uint32_t stackDepth,
+                       void* parameters, UBaseType_t priority, TaskHandle_t* handle)
+{
+    (void)priority;
+    Native_Task* task = new Native_Task();
+    task->name = name != nullptr ? name : "";
+    task->stackDepth = stackDepth;
+    if (handle != nullptr) {
+        *handle = task;
+    }
+    std::thread(taskTrampoline, task, function, parameters).detach();
+    return pdPASS;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char* name, uint32_t stackDepth,
+                                   void* parameters, UBaseType_t priority, TaskHandle_t* handle,
+                                   BaseType_t core)
+{
+    (void)core;
+    return xTaskCreate(function, name, stackDepth, parameters, priority, handle);
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    if (task == nullptr || task == currentTask) {
+        throw Native_TaskExit();
+    }
+    // Deleting another task is not supported on the host, the thread keeps running
+}
+
+void vTaskDelay(TickType_t ticks) { std::this_thread::sleep_for(std::chrono::milliseconds(ticks)); }
+
+TickType_t xTaskGetTickCount()
+{
+    static const Native_Clock::time_point start = Native_Clock::now();
+    return static_cast<TickType_t>(
+        std::chrono::duration_cast<std::chrono::milliseconds>(Native_Clock::now() - start)
+            .count());
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle()
+{
+    if (currentTask == nullptr) {
+        // Threads not created through xTaskCreate(), e.g. the one running setup() and loop()
+        currentTask = new Native_Task();
+        currentTask->name = "loopTask";
+        currentTask->stackDepth = 8192;
+    }
+    return currentTask;
+}
+
+const char* pcTaskGetName(TaskHandle_t task)
+{
+    return (task != nullptr ? task : xTaskGetCurrentTaskHandle())->name.c_str();
+}
+
+void vTaskPrioritySet(TaskHandle_t task, UBaseType_t priority)
+{
+    (void)task;
+    (void)priority;
+}
+
+BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value, eNotifyAction action)
+{
+    {
+        std::lock_guard<std::mutex> lock(task->mutex);
+        switch (action) {
+            case eSetBits:
+                task->notifyValue |= value;
+                break;
+            case eIncrement:
+                task->notifyValue++;
+                break;
+            case eSetValueWithOverwrite:
+                task->notifyValue = value;
+                break;
+            case eNoAction:
+            default:
+                break;
+        }
+        task->notifyPending = true;
+    }
+    task->cv.notify_all();
+    return pdPASS;
+}
+
+BaseType_t xTaskNotifyFromISR(TaskHandle_t task, uint32_t value, eNotifyAction action,
+                              BaseType_t* higherPriorityTaskWoken)
+{
+    if (higherPriorityTaskWoken != nullptr) {
+        *higherPriorityTaskWoken = pdFALSE;
+    }
+    return xTaskNotify(task, value, action);
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) { return xTaskNotify(task, 0, eIncrement); }
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t* higherPriorityTaskWoken)
+{
+    xTaskNotifyFromISR(task, 0, eIncrement, higherPriorityTaskWoken);
+}
+
+BaseType_t xTaskNotifyWait(uint32_t clearOnEntry, uint32_t clearOnExit, uint32_t* value,
+                           TickType_t ticks)
+{
+    Native_Task* task = xTaskGetCurrentTaskHandle();
+    std::unique_lock<std::mutex> lock(task->mutex);
+    if (!task->notifyPending) {
+        task->notifyValue &= ~clearOnEntry;
+    }
+    const bool notified =
+        waitUntil(task->cv, lock, deadline(ticks), [task] { return task->notifyPending; });
+    if (value != nullptr) {
+        *value = task->notifyValue;
+    }
+    if (!notified) {
+        return pdFALSE;
+    }
+    task->notifyPending = false;
+    task->notifyValue &= ~clearOnExit;
+    return pdTRUE;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticks)
+{
+    Native_Task* task = xTaskGetCurrentTaskHandle();
+    std::unique_lock<std::mutex> lock(task->mutex);
+    waitUntil(task->cv, lock, deadline(ticks), [task] { return task->notifyValue != 0; });
+    const uint32_t value = task->notifyValue;
+    if (value != 0) {
+        task->notifyValue = clearOnExit ? 0 : value - 1;
+    }
+    task->notifyPending = false;
+    return value;
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task)
+{
+    return (task != nullptr ? task : xTaskGetCurrentTaskHandle())->stackDepth;
+}
+
+//
+// Event groups
+//
+struct Native_EventGroup {
+    std::mutex mutex;
+    std::condition_variable cv;
+    EventBits_t bits = 0;
+};
+
+EventGroupHandle_t xEventGroupCreate() { return new Native_EventGroup(); }
+
+void vEventGroupDelete(EventGroupHandle_t group) { delete group; }
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits)
+{
+    EventBits_t value;
+    {
+        std::lock_guard<std::mutex> lock(group->mutex);
+        group->bits |= bits;
+        value = group->bits;
+    }
+    group->cv.notify_all();
+    return value;
+}
+
+BaseType_t xEventGroupSetBitsFromISR(EventGroupHandle_t group, EventBits_t bits,
+                                     BaseType_t* higherPriorityTaskWoken)
+{
+    if (higherPriorityTaskWoken != nullptr) {
+        *higherPriorityTaskWoken = pdFALSE;
+    }
+    xEventGroupSetBits(group, bits);
+    return pdPASS;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits)
+{
+    std::lock_guard<std::mutex> lock(group->mutex);
+    const EventBits_t value = group->bits;
+    group->bits &= ~bits;
+    return value;
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group)
+{
+    std::lock_guard<std::mutex> lock(group->mutex);
+    return group->bits;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clearOnExit,
+                                BaseType_t waitForAll, TickType_t ticks)
+{
+    std::unique_lock<std::mutex> lock(group->mutex);
+    auto satisfied = [group, bits, waitForAll] {
+        return waitForAll ? (group->bits & bits) == bits : (group->bits & bits) != 0;
+    };
+    const bool signalled = waitUntil(group->cv, lock, deadline(ticks), satisfied);
+    const EventBits_t value = group->bits;
+    if (signalled && clearOnExit) {
+        group->bits &= ~bits;
+    }
+    return value;
+}
+
+//
+// Software timers, served by one daemon thread like the FreeRTOS timer task
+//
+struct Native_Timer {
+    std::string name;
+    TickType_t period;
+    bool autoReload;
+    void* id;
+    TimerCallbackFunction_t callback;
+    bool active = false;
+    Native_Clock::time_point expiry;
+};
+
+namespace {
+
+std::mutex timerMutex;
+std::condition_variable timerCv;
+std::list<Native_Timer*> timers;
+
+void timerDaemon()
+{
+    std::unique_lock<std::mutex> lock(timerMutex);
+    for (;;) {
+        Native_Clock::time_point next = Native_Clock::time_point::max();
+        for (Native_Timer* timer : timers) {
+            if (timer->active) {
+                next = std::min(next, timer->expiry);
+            }
+        }
+        if (next == Native_Clock::time_point::max()) {
+            timerCv.wait(lock);
+        } else {
+            timerCv.wait_until(lock, next);
+        }
+
+        const Native_Clock::time_point now = Native_Clock::now();
+        for (Native_Timer* timer : timers) {
+            if (!timer->active || timer->expiry > now) {
+                continue;
+            }
+            if (timer->autoReload) {
+                timer->expiry += std::chrono::milliseconds(timer->period);
+            } else {
+                timer->active = false;
+            }
+            lock.unlock();
+            timer->callback(timer);
+            lock.lock();
+        }
+    }
+}
+
+void startTimerDaemon()
+{
+    static std::once_flag started;
+    std::call_once(started, [] { std::thread(timerDaemon).detach(); });
+}
+
+BaseType_t armTimer(TimerHandle_t timer, bool active)
+{
+    {
+        std::lock_guard<std::mutex> lock(timerMutex);
+        timer->active = active;
+        timer->expiry = Native_Clock::now() + std::chrono::milliseconds(timer->period);
+    }
+    timerCv.notify_all();
+    return pdPASS;
+}
+
+}  // namespace
+
+TimerHandle_t xTimerCreate(const char* name, TickType_t period, UBaseType_t autoReload,
+                           void* timerId, TimerCallbackFunction_t callback)
+{
+    startTimerDaemon();
+    Native_Timer* timer = new Native_Timer();
+    timer->name = name != nullptr ? name : "";
+    timer->period = period;
+    timer->autoReload = autoReload != pdFALSE;
+    timer->id = timerId;
+    timer->callback = callback;
+    std::lock_guard<std::mutex> lock(timerMutex);
+    timers.push_back(timer);
+    return timer;
+}
+
+BaseType_t xTimerStart(TimerHandle_t timer, TickType_t ticks)
+{
+    (void)ticks;
+    return armTimer(timer, true);
+}
+
+BaseType_t xTimerStop(TimerHandle_t timer, TickType_t ticks)
+{
+    (void)ticks;
+    return armTimer(timer, false);
+}
+
+BaseType_t xTimerReset(TimerHandle_t timer, TickType_t ticks)
+{
+    (void)ticks;
+    return armTimer(timer, true);
+}
+
+BaseType_t xTimerChangePeriod(TimerHandle_t timer, TickType_t period, TickType_t ticks)
+{
+    (void)ticks;
+    {
+        std::lock_guard<std::mutex> lock(timerMutex);
+        timer->period = period;
+    }
+    return armTimer(timer, true);
+}
+
+BaseType_t xTimerDelete(TimerHandle_t timer, TickType_t ticks)
+{
+    (void)ticks;
+    std::lock_guard<std::mutex> lock(timerMutex);
+    // Timers are few and long lived, a deleted one is only disarmed
+    timer->active = false;
+    return pdPASS;
+}
+
+BaseType_t xTimerIsTimerActive(TimerHandle_t timer)
+{
+    std::lock_guard<std::mutex> lock(timerMutex);
+    return timer->active ? pdTRUE : pdFALSE;
+}
+
+void* pvTimerGetTimerID(TimerHandle_t timer) { return timer->id; }
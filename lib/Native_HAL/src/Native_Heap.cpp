@@ -0,0 +1,76 @@
+#include <malloc.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+
+#include "esp_heap_caps.h"
+
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* pointer, size_t size);
+void __libc_free(void* pointer);
+}
+
+namespace {
+
+std::atomic<size_t> minimumFree{SIZE_MAX};
+std::atomic<size_t> allocations{0};
+
+size_t heapSize()
+{
+    const char* value = getenv("NATIVE_HEAP_SIZE");
+    return value != nullptr ? strtoul(value, nullptr, 10) : 320U * 1024U;
+}
+
+}  // namespace
+
+size_t heap_caps_get_free_size(uint32_t caps)
+{
+    (void)caps;
+    const size_t size = heapSize();
+    const size_t used = mallinfo2().uordblks;
+    const size_t free = used < size ? size - used : 0;
+    size_t minimum = minimumFree.load();
+    while (free < minimum && !minimumFree.compare_exchange_weak(minimum, free)) {
+    }
+    return free;
+}
+
+size_t heap_caps_get_largest_free_block(uint32_t caps)
+{
+    // No fragmentation on the host
+    return heap_caps_get_free_size(caps);
+}
+
+size_t heap_caps_get_minimum_free_size(uint32_t caps)
+{
+    const size_t free = heap_caps_get_free_size(caps);
+    return std::min(free, minimumFree.load());
+}
+
+size_t Native_heapAllocations() { return allocations.load(std::memory_order_relaxed); }
+
+//
+// The allocator of the C library, counted. operator new allocates through malloc().
+//
+extern "C" void* malloc(size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+extern "C" void* calloc(size_t count, size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(count, size);
+}
+
+extern "C" void* realloc(void* pointer, size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(pointer, size);
+}
+
+extern "C" void free(void* pointer) { __libc_free(pointer); }
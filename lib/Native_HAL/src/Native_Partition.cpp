@@ -0,0 +1,193 @@
+#include <sys/stat.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "Arduino.h"
+#include "esp_ota_ops.h"
+#include "esp_partition.h"
+#include "esp_system.h"
+
+namespace {
+
+constexpr uint32_t OTA_PARTITION_ADDRESS = 0x10000 + 0x1E0000;
+
+std::mutex flashMutex;
+
+uint32_t partitionSize()
+{
+    const char* value = getenv("NATIVE_OTA_PARTITION_SIZE");
+    return value != nullptr ? strtoul(value, nullptr, 0) : 0x1E0000;
+}
+
+uint32_t dataPartitionSize()
+{
+    const char* value = getenv("NATIVE_DATA_PARTITION_SIZE");
+    return value != nullptr ? strtoul(value, nullptr, 0) : 0x10000;
+}
+
+// Found so far, a deque keeps the pointers handed out valid
+std::deque<esp_partition_t> dataPartitions;
+
+esp_partition_t factoryPartition = {0x10000, 0x1E0000, "factory"};
+esp_partition_t updatePartition = {OTA_PARTITION_ADDRESS, partitionSize(), "ota_0"};
+const esp_partition_t* bootPartition = &factoryPartition;
+
+std::string partitionPath(const esp_partition_t* partition)
+{
+    const char* directory = getenv("NATIVE_NVS_DIR");
+    const std::string path = directory != nullptr ? directory : ".nvs";
+    mkdir(path.c_str(), 0755);
+    return path + "/" + partition->label + ".bin";
+}
+
+/// @brief Open the file of the partition, created erased at its full size
+FILE* openPartition(const esp_partition_t* partition)
+{
+    const std::string path = partitionPath(partition);
+    FILE* file = fopen(path.c_str(), "r+b");
+    if (file == nullptr) {
+        file = fopen(path.c_str(), "w+b");
+        if (file == nullptr) {
+            return nullptr;
+        }
+        const std::vector<uint8_t> erased(SPI_FLASH_SEC_SIZE, 0xFF);
+        for (uint32_t offset = 0; offset < partition->size; offset += SPI_FLASH_SEC_SIZE) {
+            fwrite(erased.data(), 1, erased.size(), file);
+        }
+    }
+    return file;
+}
+
+bool inRange(const esp_partition_t* partition, size_t offset, size_t size)
+{
+    return partition != nullptr && offset <= partition->size && size <= partition->size - offset;
+}
+
+}  // namespace
+
+const char* esp_err_to_name(esp_err_t code)
+{
+    switch (code) {
+        case ESP_OK:
+            return "ESP_OK";
+        case ESP_ERR_INVALID_ARG:
+            return "ESP_ERR_INVALID_ARG";
+        case ESP_ERR_INVALID_SIZE:
+            return "ESP_ERR_INVALID_SIZE";
+        case ESP_ERR_NOT_FOUND:
+            return "ESP_ERR_NOT_FOUND";
+        default:
+            return "ESP_FAIL";
+    }
+}
+
+const esp_partition_t* esp_partition_find_first(esp_partition_type_t type,
+                                                esp_partition_subtype_t subtype, const char* label)
+{
+    (void)subtype;
+    if (type != ESP_PARTITION_TYPE_DATA || label == nullptr) {
+        return nullptr;
+    }
+    std::lock_guard<std::mutex> lock(flashMutex);
+    for (const esp_partition_t& partition : dataPartitions) {
+        if (strcmp(partition.label, label) == 0) {
+            return &partition;
+        }
+    }
+    esp_partition_t partition = {0, dataPartitionSize(), ""};
+    strncpy(partition.label, label, sizeof(partition.label) - 1);
+    dataPartitions.push_back(partition);
+    return &dataPartitions.back();
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t* partition, size_t offset, size_t size)
+{
+    if (!inRange(partition, offset, size) || offset % SPI_FLASH_SEC_SIZE != 0 ||
+        size % SPI_FLASH_SEC_SIZE != 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    std::lock_guard<std::mutex> lock(flashMutex);
+    FILE* file = openPartition(partition);
+    if (file == nullptr) {
+        return ESP_FAIL;
+    }
+    const std::vector<uint8_t> erased(size, 0xFF);
+    fseek(file, offset, SEEK_SET);
+    const bool written = fwrite(erased.data(), 1, size, file) == size;
+    fclose(file);
+    return written ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t* partition, size_t offset, const void* source,
+                              size_t size)
+{
+    if (!inRange(partition, offset, size)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    std::lock_guard<std::mutex> lock(flashMutex);
+    FILE* file = openPartition(partition);
+    if (file == nullptr) {
+        return ESP_FAIL;
+    }
+    // Programming only clears bits
+    std::vector<uint8_t> flash(size);
+    fseek(file, offset, SEEK_SET);
+    bool ok = fread(flash.data(), 1, size, file) == size;
+    const uint8_t* bytes = static_cast<const uint8_t*>(source);
+    for (size_t i = 0; i < size; i++) {
+        flash[i] &= bytes[i];
+    }
+    fseek(file, offset, SEEK_SET);
+    ok = ok && fwrite(flash.data(), 1, size, file) == size;
+    fclose(file);
+    return ok ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t* partition, size_t offset, void* destination,
+                             size_t size)
+{
+    if (!inRange(partition, offset, size)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    std::lock_guard<std::mutex> lock(flashMutex);
+    FILE* file = openPartition(partition);
+    if (file == nullptr) {
+        return ESP_FAIL;
+    }
+    fseek(file, offset, SEEK_SET);
+    const bool read = fread(destination, 1, size, file) == size;
+    fclose(file);
+    return read ? ESP_OK : ESP_FAIL;
+}
+
+const esp_partition_t* esp_ota_get_running_partition() { return &factoryPartition; }
+
+const esp_partition_t* esp_ota_get_next_update_partition(const esp_partition_t* start)
+{
+    (void)start;
+    return &updatePartition;
+}
+
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t* partition)
+{
+    if (partition == nullptr) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    bootPartition = partition;
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_mark_app_valid_cancel_rollback() { return ESP_OK; }
+
+void esp_restart()
+{
+    Serial.printf("Restart requested, boot partition %s, exiting\n", bootPartition->label);
+    Serial.flush();
+    _Exit(0);
+}
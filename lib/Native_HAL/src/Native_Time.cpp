@@ -0,0 +1,93 @@
+#include <sys/time.h>
+#include <time.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+#include "Arduino.h"
+#include "esp_sntp.h"
+
+namespace {
+
+sntp_sync_time_cb_t syncCallback = nullptr;
+
+long syncDelay()
+{
+    const char* value = getenv("NATIVE_SNTP_MS");
+    return value != nullptr ? strtol(value, nullptr, 10) : 200;
+}
+
+int64_t hostMicros()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return static_cast<int64_t>(now.tv_sec) * 1000000 + now.tv_nsec / 1000;
+}
+
+/// @brief System time minus host time. NATIVE_CLOCK=unset boots at the epoch like a cold ESP32,
+/// the default keeps the host time like a device whose clock survived a software reset.
+int64_t initialOffset()
+{
+    const char* clock = getenv("NATIVE_CLOCK");
+    return clock != nullptr && strcmp(clock, "unset") == 0 ? -hostMicros() : 0;
+}
+
+std::atomic<int64_t>& clockOffset()
+{
+    static std::atomic<int64_t> offset{initialOffset()};
+    return offset;
+}
+
+}  // namespace
+
+//
+// The system clock of the device, set by settimeofday() like on the ESP32. The host clock is
+// never touched.
+//
+extern "C" int gettimeofday(struct timeval* tv, void* tz)
+{
+    (void)tz;
+    const int64_t now = hostMicros() + clockOffset().load();
+    tv->tv_sec = static_cast<time_t>(now / 1000000);
+    tv->tv_usec = static_cast<suseconds_t>(now % 1000000);
+    return 0;
+}
+
+extern "C" int settimeofday(const struct timeval* tv, const struct timezone* tz)
+{
+    (void)tz;
+    if (tv != nullptr) {
+        clockOffset() = static_cast<int64_t>(tv->tv_sec) * 1000000 + tv->tv_usec - hostMicros();
+    }
+    return 0;
+}
+
+void sntp_set_time_sync_notification_cb(sntp_sync_time_cb_t callback) { syncCallback = callback; }
+
+void configTime(long gmtOffset, int daylightOffset, const char* server1, const char* server2,
+                const char* server3)
+{
+    (void)gmtOffset;
+    (void)daylightOffset;
+    (void)server1;
+    (void)server2;
+    (void)server3;
+    // The sync sets the system clock to the host time and notifies. A negative delay never syncs,
+    // like a device without internet access.
+    const long delayMs = syncDelay();
+    if (delayMs < 0) {
+        return;
+    }
+    std::thread([delayMs]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(delayMs));
+        clockOffset() = 0;
+        struct timeval now;
+        gettimeofday(&now, nullptr);
+        if (syncCallback != nullptr) {
+            syncCallback(&now);
+        }
+    }).detach();
+}
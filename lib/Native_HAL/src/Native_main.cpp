@@ -0,0 +1,35 @@
+#include <chrono>
+#include <cstdlib>
+#include <thread>
+
+#include "Arduino.h"
+
+// The tests under test/ bring their own main()
+#ifndef PIO_UNIT_TESTING
+
+void setup();
+void loop();
+
+/// @brief Runs the firmware like the Arduino loop task does. NATIVE_RUN_SECONDS bounds the run so
+/// a CI job can collect the serial output and exit.
+int main()
+{
+    const char* seconds = getenv("NATIVE_RUN_SECONDS");
+    const unsigned long runMs = seconds != nullptr ? strtoul(seconds, nullptr, 10) * 1000UL : 0;
+    if (runMs > 0) {
+        // loop() blocks until it has work, the run is ended from outside of it
+        std::thread([runMs] {
+            std::this_thread::sleep_for(std::chrono::milliseconds(runMs - millis()));
+            // The task threads never return, leave without running static destructors under them
+            Serial.flush();
+            _Exit(0);
+        }).detach();
+    }
+
+    setup();
+    for (;;) {
+        loop();
+    }
+}
+
+#endif  // PIO_UNIT_TESTING
@@ -0,0 +1,154 @@
+#include "Preferences.h"
+
+#include <sys/stat.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+namespace {
+
+// NVS limits keys and namespaces to 15 characters
+constexpr size_t NVS_KEY_NAME_MAX_SIZE = 15;
+
+const char* nvsDirectory()
+{
+    const char* directory = getenv("NATIVE_NVS_DIR");
+    return directory != nullptr ? directory : ".nvs";
+}
+
+}  // namespace
+
+bool Preferences::begin(const char* name, bool readOnly, const char* partitionLabel)
+{
+    (void)partitionLabel;
+    if (m_started || name == nullptr || strlen(name) > NVS_KEY_NAME_MAX_SIZE) {
+        return false;
+    }
+    mkdir(nvsDirectory(), 0755);
+    m_path = std::string(nvsDirectory()) + "/" + name + ".nvs";
+    m_readOnly = readOnly;
+    m_started = load();
+    return m_started;
+}
+
+void Preferences::end()
+{
+    m_started = false;
+    m_values.clear();
+}
+
+bool Preferences::clear()
+{
+    if (!m_started || m_readOnly) {
+        return false;
+    }
+    m_values.clear();
+    return save();
+}
+
+bool Preferences::remove(const char* key)
+{
+    if (!m_started || m_readOnly || m_values.erase(key) == 0) {
+        return false;
+    }
+    return save();
+}
+
+bool Preferences::isKey(const char* key) { return m_started && m_values.count(key) != 0; }
+
+size_t Preferences::putString(const char* key, const char* value)
+{
+    // Stored with the terminating zero, like NVS does
+    return putBytes(key, value, strlen(value) + 1) != 0 ? strlen(value) : 0;
+}
+
+size_t Preferences::putBytes(const char* key, const void* value, size_t length)
+{
+    if (!m_started || m_readOnly || key == nullptr || strlen(key) > NVS_KEY_NAME_MAX_SIZE) {
+        return 0;
+    }
+    const uint8_t* bytes = static_cast<const uint8_t*>(value);
+    m_values[key].assign(bytes, bytes + length);
+    return save() ? length : 0;
+}
+
+String Preferences::getString(const char* key, const String& defaultValue)
+{
+    auto it = m_values.find(key);
+    if (!m_started || it == m_values.end() || it->second.empty()) {
+        return defaultValue;
+    }
+    return String(reinterpret_cast<const char*>(it->second.data()));
+}
+
+size_t Preferences::getString(const char* key, char* value, size_t maxLength)
+{
+    auto it = m_values.find(key);
+    if (!m_started || it == m_values.end() || it->second.size() > maxLength) {
+        return 0;
+    }
+    memcpy(value, it->second.data(), it->second.size());
+    return it->second.size();
+}
+
+size_t Preferences::getBytesLength(const char* key)
+{
+    auto it = m_values.find(key);
+    return m_started && it != m_values.end() ? it->second.size() : 0;
+}
+
+size_t Preferences::getBytes(const char* key, void* buffer, size_t maxLength)
+{
+    auto it = m_values.find(key);
+    if (!m_started || it == m_values.end() || it->second.size() > maxLength) {
+        return 0;
+    }
+    memcpy(buffer, it->second.data(), it->second.size());
+    return it->second.size();
+}
+
+/// @brief One "key hex-value" line per entry
+bool Preferences::load()
+{
+    m_values.clear();
+    std::ifstream file(m_path);
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream fields(line);
+        std::string key;
+        std::string hex;
+        fields >> key >> hex;
+        if (key.empty()) {
+            continue;
+        }
+        std::vector<uint8_t>& value = m_values[key];
+        for (size_t i = 0; i + 1 < hex.size(); i += 2) {
+            value.push_back(static_cast<uint8_t>(strtoul(hex.substr(i, 2).c_str(), nullptr, 16)));
+        }
+    }
+    return true;
+}
+
+bool Preferences::save()
+{
+    const std::string temporary = m_path + ".tmp";
+    {
+        std::ofstream file(temporary, std::ios::trunc);
+        if (!file) {
+            return false;
+        }
+        for (const auto& entry : m_values) {
+            file << entry.first << ' ';
+            char hex[3];
+            for (uint8_t byte : entry.second) {
+                snprintf(hex, sizeof(hex), "%02x", byte);
+                file << hex;
+            }
+            file << '\n';
+        }
+    }
+    return rename(temporary.c_str(), m_path.c_str()) == 0;
+}
@@ -0,0 +1,102 @@
+#ifndef _NATIVE_PREFERENCES_H
+#define _NATIVE_PREFERENCES_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "WString.h"
+
+/// @brief NVS namespace stand-in backed by one file per namespace in NATIVE_NVS_DIR (default
+/// ".nvs"). Every put rewrites the file, which mirrors an NVS commit.
+class Preferences {
+   public:
+    bool begin(const char* name, bool readOnly = false, const char* partitionLabel = nullptr);
+    void end();
+
+    bool clear();
+    bool remove(const char* key);
+    bool isKey(const char* key);
+
+    size_t putBool(const char* key, bool value) { return putValue(key, value); }
+    size_t putUChar(const char* key, uint8_t value) { return putValue(key, value); }
+    size_t putChar(const char* key, int8_t value) { return putValue(key, value); }
+    size_t putUShort(const char* key, uint16_t value) { return putValue(key, value); }
+    size_t putShort(const char* key, int16_t value) { return putValue(key, value); }
+    size_t putUInt(const char* key, uint32_t value) { return putValue(key, value); }
+    size_t putInt(const char* key, int32_t value) { return putValue(key, value); }
+    size_t putULong(const char* key, uint32_t value) { return putValue(key, value); }
+    size_t putLong(const char* key, int32_t value) { return putValue(key, value); }
+    size_t putULong64(const char* key, uint64_t value) { return putValue(key, value); }
+    size_t putLong64(const char* key, int64_t value) { return putValue(key, value); }
+    size_t putFloat(const char* key, float value) { return putValue(key, value); }
+    size_t putString(const char* key, const char* value);
+    size_t putString(const char* key, const String& value) { return putString(key, value.c_str()); }
+    size_t putBytes(const char* key, const void* value, size_t length);
+
+    bool getBool(const char* key, bool defaultValue = false) { return getValue(key, defaultValue); }
+    uint8_t getUChar(const char* key, uint8_t defaultValue = 0)
+    {
+        return getValue(key, defaultValue);
+    }
+    int8_t getChar(const char* key, int8_t defaultValue = 0) { return getValue(key, defaultValue); }
+    uint16_t getUShort(const char* key, uint16_t defaultValue = 0)
+    {
+        return getValue(key, defaultValue);
+    }
+    int16_t getShort(const char* key, int16_t defaultValue = 0)
+    {
+        return getValue(key, defaultValue);
+    }
+    uint32_t getUInt(const char* key, uint32_t defaultValue = 0)
+    {
+        return getValue(key, defaultValue);
+    }
+    int32_t getInt(const char* key, int32_t defaultValue = 0) { return getValue(key, defaultValue); }
+    uint32_t getULong(const char* key, uint32_t defaultValue = 0)
+    {
+        return getValue(key, defaultValue);
+    }
+    int32_t getLong(const char* key, int32_t defaultValue = 0)
+    {
+        return getValue(key, defaultValue);
+    }
+    uint64_t getULong64(const char* key, uint64_t defaultValue = 0)
+    {
+        return getValue(key, defaultValue);
+    }
+    int64_t getLong64(const char* key, int64_t defaultValue = 0)
+    {
+        return getValue(key, defaultValue);
+    }
+    float getFloat(const char* key, float defaultValue = 0) { return getValue(key, defaultValue); }
+    String getString(const char* key, const String& defaultValue = String());
+    size_t getString(const char* key, char* value, size_t maxLength);
+    size_t getBytesLength(const char* key);
+    size_t getBytes(const char* key, void* buffer, size_t maxLength);
+
+   private:
+    template <typename T>
+    size_t putValue(const char* key, T value)
+    {
+        return putBytes(key, &value, sizeof(value));
+    }
+
+    template <typename T>
+    T getValue(const char* key, T defaultValue)
+    {
+        T value;
+        return getBytes(key, &value, sizeof(value)) == sizeof(value) ? value : defaultValue;
+    }
+
+    bool load();
+    bool save();
+
+    bool m_started = false;
+    bool m_readOnly = false;
+    std::string m_path;
+    std::map<std::string, std::vector<uint8_t>> m_values;
+};
+
+#endif  // _NATIVE_PREFERENCES_H
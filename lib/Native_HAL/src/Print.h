@@ -0,0 +1,93 @@
+#ifndef _NATIVE_PRINT_H
+#define _NATIVE_PRINT_H
+
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include "Printable.h"
+#include "WString.h"
+
+#define DEC 10
+#define HEX 16
+
+class Print {
+   public:
+    virtual ~Print() = default;
+
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t* buffer, size_t size)
+    {
+        size_t written = 0;
+        while (written < size && write(buffer[written])) {
+            written++;
+        }
+        return written;
+    }
+    size_t write(const char* str) { return str != nullptr ? write(str, strlen(str)) : 0; }
+    size_t write(const char* buffer, size_t size)
+    {
+        return write(reinterpret_cast<const uint8_t*>(buffer), size);
+    }
+    virtual void flush() {}
+
+    __attribute__((format(printf, 2, 3))) size_t printf(const char* format, ...)
+    {
+        char buffer[256];
+        va_list args;
+        va_start(args, format);
+        int length = vsnprintf(buffer, sizeof(buffer), format, args);
+        va_end(args);
+        if (length < 0) {
+            return 0;
+        }
+        if (static_cast<size_t>(length) < sizeof(buffer)) {
+            return write(buffer, length);
+        }
+        std::string large(length + 1, '\0');
+        va_start(args, format);
+        vsnprintf(&large[0], large.size(), format, args);
+        va_end(args);
+        return write(large.c_str(), length);
+    }
+
+    size_t print(const char* str) { return write(str); }
+    size_t print(const String& str) { return write(str.c_str(), str.length()); }
+    size_t print(char c) { return write(static_cast<uint8_t>(c)); }
+    size_t print(int value, int base = DEC) { return print(static_cast<long long>(value), base); }
+    size_t print(unsigned int value, int base = DEC)
+    {
+        return print(static_cast<unsigned long long>(value), base);
+    }
+    size_t print(long value, int base = DEC) { return print(static_cast<long long>(value), base); }
+    size_t print(unsigned long value, int base = DEC)
+    {
+        return print(static_cast<unsigned long long>(value), base);
+    }
+    size_t print(long long value, int base = DEC)
+    {
+        return base == HEX ? printf("%llx", value) : printf("%lld", value);
+    }
+    size_t print(unsigned long long value, int base = DEC)
+    {
+        return base == HEX ? printf("%llx", value) : printf("%llu", value);
+    }
+    size_t print(double value, int digits = 2) { return printf("%.*f", digits, value); }
+    size_t print(const Printable& printable) { return printable.printTo(*this); }
+
+    size_t println() { return write("\r\n"); }
+    template <typename T>
+    size_t println(const T& value)
+    {
+        return print(value) + println();
+    }
+    template <typename T>
+    size_t println(const T& value, int format)
+    {
+        return print(value, format) + println();
+    }
+};
+
+#endif  // _NATIVE_PRINT_H
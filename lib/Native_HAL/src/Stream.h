@@ -0,0 +1,36 @@
+#ifndef _NATIVE_STREAM_H
+#define _NATIVE_STREAM_H
+
+#include "Print.h"
+
+class Stream : public Print {
+   public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+
+    void setTimeout(unsigned long timeout) { m_timeout = timeout; }
+    unsigned long getTimeout() const { return m_timeout; }
+
+    size_t readBytes(char* buffer, size_t length)
+    {
+        return readBytes(reinterpret_cast<uint8_t*>(buffer), length);
+    }
+    size_t readBytes(uint8_t* buffer, size_t length)
+    {
+        size_t count = 0;
+        while (count < length) {
+            int c = read();
+            if (c < 0) {
+                break;
+            }
+            buffer[count++] = static_cast<uint8_t>(c);
+        }
+        return count;
+    }
+
+   protected:
+    unsigned long m_timeout = 1000;
+};
+
+#endif  // _NATIVE_STREAM_H
@@ -0,0 +1,169 @@
+#ifndef _NATIVE_WSTRING_H
+#define _NATIVE_WSTRING_H
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <utility>
+
+class __FlashStringHelper;
+
+/// @brief Arduino String on top of std::string, covers the members used by the firmware and its
+/// libraries
+class String {
+   public:
+    String() = default;
+    String(const char* str) : m_str(str != nullptr ? str : "") {}
+    String(const std::string& str) : m_str(str) {}
+    explicit String(char c) : m_str(1, c) {}
+    explicit String(int value) : m_str(std::to_string(value)) {}
+    explicit String(unsigned int value) : m_str(std::to_string(value)) {}
+    explicit String(long value) : m_str(std::to_string(value)) {}
+    explicit String(unsigned long value) : m_str(std::to_string(value)) {}
+    explicit String(long long value) : m_str(std::to_string(value)) {}
+    explicit String(unsigned long long value) : m_str(std::to_string(value)) {}
+    explicit String(double value, unsigned int decimalPlaces = 2)
+    {
+        char buffer[64];
+        snprintf(buffer, sizeof(buffer), "%.*f", decimalPlaces, value);
+        m_str = buffer;
+    }
+
+    const char* c_str() const { return m_str.c_str(); }
+    unsigned int length() const { return m_str.length(); }
+    bool isEmpty() const { return m_str.empty(); }
+    bool reserve(unsigned int size)
+    {
+        m_str.reserve(size);
+        return true;
+    }
+
+    char charAt(unsigned int index) const { return index < m_str.size() ? m_str[index] : '\0'; }
+    char operator[](unsigned int index) const { return charAt(index); }
+    char& operator[](unsigned int index) { return m_str[index]; }
+
+    bool concat(const String& str)
+    {
+        m_str += str.m_str;
+        return true;
+    }
+    bool concat(const char* str)
+    {
+        m_str += str != nullptr ? str : "";
+        return true;
+    }
+    bool concat(const char* str, unsigned int length)
+    {
+        m_str.append(str, length);
+        return true;
+    }
+    bool concat(char c)
+    {
+        m_str += c;
+        return true;
+    }
+
+    String& operator+=(const String& str)
+    {
+        concat(str);
+        return *this;
+    }
+    String& operator+=(const char* str)
+    {
+        concat(str);
+        return *this;
+    }
+    String& operator+=(char c)
+    {
+        concat(c);
+        return *this;
+    }
+
+    friend String operator+(const String& lhs, const String& rhs) { return lhs.m_str + rhs.m_str; }
+    friend String operator+(const String& lhs, const char* rhs) { return lhs.m_str + rhs; }
+    friend String operator+(const char* lhs, const String& rhs) { return lhs + rhs.m_str; }
+
+    bool operator==(const String& rhs) const { return m_str == rhs.m_str; }
+    bool operator==(const char* rhs) const { return m_str == (rhs != nullptr ? rhs : ""); }
+    bool operator!=(const String& rhs) const { return !(*this == rhs); }
+    bool operator!=(const char* rhs) const { return !(*this == rhs); }
+    bool operator<(const String& rhs) const { return m_str < rhs.m_str; }
+    bool equals(const String& rhs) const { return *this == rhs; }
+
+    bool startsWith(const String& prefix) const { return m_str.rfind(prefix.m_str, 0) == 0; }
+    bool endsWith(const String& suffix) const
+    {
+        return m_str.size() >= suffix.m_str.size() &&
+               m_str.compare(m_str.size() - suffix.m_str.size(), suffix.m_str.size(),
+                             suffix.m_str) == 0;
+    }
+
+    int indexOf(char c, unsigned int from = 0) const { return toIndex(m_str.find(c, from)); }
+    int indexOf(const String& str, unsigned int from = 0) const
+    {
+        return toIndex(m_str.find(str.m_str, from));
+    }
+    int lastIndexOf(char c) const { return toIndex(m_str.rfind(c)); }
+
+    String substring(unsigned int from) const
+    {
+        return from < m_str.size() ? String(m_str.substr(from)) : String();
+    }
+    String substring(unsigned int from, unsigned int to) const
+    {
+        if (from > to) {
+            std::swap(from, to);
+        }
+        return from < m_str.size() ? String(m_str.substr(from, to - from)) : String();
+    }
+
+    void replace(const String& find, const String& replace)
+    {
+        if (find.m_str.empty()) {
+            return;
+        }
+        size_t position = 0;
+        while ((position = m_str.find(find.m_str, position)) != std::string::npos) {
+            m_str.replace(position, find.m_str.size(), replace.m_str);
+            position += replace.m_str.size();
+        }
+    }
+    void remove(unsigned int index) { m_str.erase(std::min<size_t>(index, m_str.size())); }
+    void remove(unsigned int index, unsigned int count) { m_str.erase(index, count); }
+
+    void toUpperCase()
+    {
+        for (char& c : m_str) {
+            c = static_cast<char>(toupper(static_cast<unsigned char>(c)));
+        }
+    }
+    void toLowerCase()
+    {
+        for (char& c : m_str) {
+            c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+        }
+    }
+    void trim()
+    {
+        const size_t first = m_str.find_first_not_of(" \t\r\n");
+        const size_t last = m_str.find_last_not_of(" \t\r\n");
+        m_str = first == std::string::npos ? "" : m_str.substr(first, last - first + 1);
+    }
+
+    long toInt() const { return strtol(m_str.c_str(), nullptr, 10); }
+    float toFloat() const { return strtof(m_str.c_str(), nullptr); }
+    double toDouble() const { return strtod(m_str.c_str(), nullptr); }
+
+   private:
+    static int toIndex(size_t position)
+    {
+        return position == std::string::npos ? -1 : static_cast<int>(position);
+    }
+
+    std::string m_str;
+};
+
+#endif  // _NATIVE_WSTRING_H
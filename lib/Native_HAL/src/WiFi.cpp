@@ -0,0 +1,299 @@
+#include "WiFi.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "lwip/sockets.h"
+
+WiFiClass WiFi;
+
+namespace {
+
+using Native_Clock = std::chrono::steady_clock;
+
+std::mutex wifiMutex;
+std::condition_variable wifiCv;
+std::multimap<Native_Clock::time_point, std::function<void()>> wifiActions;
+WiFiEventCb wifiCallback = nullptr;
+
+bool linkUp = true;
+wl_status_t wifiStatus = WL_IDLE_STATUS;
+uint32_t connectGeneration = 0;
+bool staticIp = false;
+IPAddress staticAddress;
+IPAddress staticGateway;
+IPAddress staticSubnet;
+IPAddress staticDns;
+std::string ssid;
+uint8_t bssid[6] = {0x02, 0x00, 0x00, 0x00, 0x00, 0xAA};
+
+unsigned long envMs(const char* name, unsigned long fallback)
+{
+    const char* value = getenv(name);
+    return value != nullptr ? strtoul(value, nullptr, 10) : fallback;
+}
+
+/// @brief Worker standing in for the ESP-IDF event loop task
+void wifiWorker()
+{
+    std::unique_lock<std::mutex> lock(wifiMutex);
+    for (;;) {
+        if (wifiActions.empty()) {
+            wifiCv.wait(lock);
+            continue;
+        }
+        const Native_Clock::time_point when = wifiActions.begin()->first;
+        if (Native_Clock::now() < when) {
+            wifiCv.wait_until(lock, when);
+            continue;
+        }
+        std::function<void()> action = wifiActions.begin()->second;
+        wifiActions.erase(wifiActions.begin());
+        action();
+    }
+}
+
+/// @brief Queue an action on the event worker, it runs with wifiMutex held
+void schedule(unsigned long delayMs, std::function<void()> action)
+{
+    static std::once_flag started;
+    std::call_once(started, [] { std::thread(wifiWorker).detach(); });
+    wifiActions.emplace(Native_Clock::now() + std::chrono::milliseconds(delayMs), action);
+    wifiCv.notify_all();
+}
+
+void fire(WiFiEvent_t event)
+{
+    WiFiEventCb callback = wifiCallback;
+    if (callback != nullptr) {
+        wifiMutex.unlock();
+        callback(event);
+        wifiMutex.lock();
+    }
+}
+
+void dropLink()
+{
+    connectGeneration++;
+    if (wifiStatus == WL_CONNECTED) {
+        wifiStatus = WL_CONNECTION_LOST;
+        fire(WIFI_EVENT_STA_DISCONNECTED);
+    }
+}
+
+/// @brief Parse NATIVE_WIFI_SCRIPT into scheduled link changes
+void loadScript()
+{
+    const char* script = getenv("NATIVE_WIFI_SCRIPT");
+    if (script == nullptr) {
+        return;
+    }
+    std::string steps(script);
+    size_t position = 0;
+    while (position < steps.size()) {
+        size_t end = steps.find(',', position);
+        if (end == std::string::npos) {
+            end = steps.size();
+        }
+        const std::string step = steps.substr(position, end - position);
+        const size_t at = step.find('@');
+        if (at != std::string::npos) {
+            const unsigned long when = strtoul(step.c_str() + at + 1, nullptr, 10);
+            if (step.compare(0, at, "down") == 0) {
+                schedule(when, [] {
+                    linkUp = false;
+                    dropLink();
+                });
+            } else if (step.compare(0, at, "up") == 0) {
+                schedule(when, [] { linkUp = true; });
+            }
+        }
+        position = end + 1;
+    }
+}
+
+}  // namespace
+
+bool WiFiClass::mode(wifi_mode_t mode)
+{
+    static std::once_flag scripted;
+    std::lock_guard<std::mutex> lock(wifiMutex);
+    m_mode = mode;
+    std::call_once(scripted, loadScript);
+    return true;
+}
+
+void WiFiClass::onEvent(WiFiEventCb callback)
+{
+    std::lock_guard<std::mutex> lock(wifiMutex);
+    wifiCallback = callback;
+}
+
+wl_status_t WiFiClass::begin(const char* ssidName, const char* passphrase, int32_t channel,
+                             const uint8_t* bssidFilter, bool connect)
+{
+    (void)passphrase;
+    std::lock_guard<std::mutex> lock(wifiMutex);
+    ssid = ssidName != nullptr ? ssidName : "";
+    if (!connect) {
+        return wifiStatus;
+    }
+    wifiStatus = WL_DISCONNECTED;
+    const uint32_t generation = ++connectGeneration;
+
+    // A directed connect skips the scan, a static address skips DHCP
+    const bool directed = channel != 0 && bssidFilter != nullptr;
+    const unsigned long scanMs = directed ? 0 : envMs("NATIVE_WIFI_SCAN_MS", 1500);
+    const unsigned long associateMs = envMs("NATIVE_WIFI_ASSOCIATE_MS", 100);
+    const unsigned long dhcpMs = staticIp ? 0 : envMs("NATIVE_WIFI_DHCP_MS", 500);
+
+    schedule(scanMs + associateMs, [generation] {
+        if (generation != connectGeneration) {
+            return;
+        }
+        if (!linkUp) {
+            wifiStatus = WL_NO_SSID_AVAIL;
+            fire(WIFI_EVENT_STA_DISCONNECTED);
+            return;
+        }
+        fire(WIFI_EVENT_STA_CONNECTED);
+    });
+    schedule(scanMs + associateMs + dhcpMs, [generation] {
+        if (generation != connectGeneration || !linkUp) {
+            return;
+        }
+        wifiStatus = WL_CONNECTED;
+        fire(IP_EVENT_STA_GOT_IP);
+    });
+    return wifiStatus;
+}
+
+bool WiFiClass::config(IPAddress localIP, IPAddress gateway, IPAddress subnet, IPAddress dns1,
+                       IPAddress dns2)
+{
+    (void)dns2;
+    std::lock_guard<std::mutex> lock(wifiMutex);
+    staticIp = localIP != IPAddress();
+    staticAddress = localIP;
+    staticGateway = gateway;
+    staticSubnet = subnet;
+    staticDns = dns1;
+    return true;
+}
+
+bool WiFiClass::disconnect(bool wifiOff, bool eraseAp)
+{
+    (void)wifiOff;
+    (void)eraseAp;
+    std::lock_guard<std::mutex> lock(wifiMutex);
+    if (wifiStatus == WL_CONNECTED) {
+        schedule(0, [] { fire(WIFI_EVENT_STA_DISCONNECTED); });
+    }
+    connectGeneration++;
+    wifiStatus = WL_DISCONNECTED;
+    return true;
+}
+
+wl_status_t WiFiClass::status()
+{
+    std::lock_guard<std::mutex> lock(wifiMutex);
+    return wifiStatus;
+}
+
+String WiFiClass::macAddress()
+{
+    uint8_t mac[6];
+    macAddress(mac);
+    char buffer[18];
+    snprintf(buffer, sizeof(buffer), "%02X:%02X:%02X:%02X:%02X:%02X", mac[0], mac[1], mac[2],
+             mac[3], mac[4], mac[5]);
+    return String(buffer);
+}
+
+uint8_t* WiFiClass::macAddress(uint8_t* mac)
+{
+    // Locally administered address, the last byte can be set to tell simulated devices apart
+    const unsigned long device = envMs("NATIVE_DEVICE_INDEX", 1);
+    const uint8_t address[6] = {0x02, 0x00, 0x00, 0x00, static_cast<uint8_t>(device >> 8),
+                                static_cast<uint8_t>(device)};
+    memcpy(mac, address, sizeof(address));
+    return mac;
+}
+
+String WiFiClass::SSID()
+{
+    std::lock_guard<std::mutex> lock(wifiMutex);
+    return String(ssid);
+}
+
+uint8_t* WiFiClass::BSSID() { return bssid; }
+
+int32_t WiFiClass::channel() { return 6; }
+
+int8_t WiFiClass::RSSI()
+{
+    if (status() != WL_CONNECTED) {
+        return 0;
+    }
+    return static_cast<int8_t>(-static_cast<long>(envMs("NATIVE_WIFI_RSSI", 55)));
+}
+
+IPAddress WiFiClass::localIP()
+{
+    std::lock_guard<std::mutex> lock(wifiMutex);
+    return staticIp ? staticAddress : IPAddress(127, 0, 0, 1);
+}
+
+IPAddress WiFiClass::gatewayIP()
+{
+    std::lock_guard<std::mutex> lock(wifiMutex);
+    return staticIp ? staticGateway : IPAddress(127, 0, 0, 1);
+}
+
+IPAddress WiFiClass::subnetMask()
+{
+    std::lock_guard<std::mutex> lock(wifiMutex);
+    return staticIp ? staticSubnet : IPAddress(255, 0, 0, 0);
+}
+
+IPAddress WiFiClass::dnsIP(uint8_t index)
+{
+    (void)index;
+    std::lock_guard<std::mutex> lock(wifiMutex);
+    return staticIp ? staticDns : IPAddress(127, 0, 0, 1);
+}
+
+int WiFiClass::hostByName(const char* host, IPAddress& result)
+{
+    struct addrinfo hints = {};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* info = nullptr;
+    if (getaddrinfo(host, nullptr, &hints, &info) != 0 || info == nullptr) {
+        return 0;
+    }
+    result = IPAddress(reinterpret_cast<sockaddr_in*>(info->ai_addr)->sin_addr.s_addr);
+    freeaddrinfo(info);
+    return 1;
+}
+
+void WiFiClass::Native_linkDown()
+{
+    std::lock_guard<std::mutex> lock(wifiMutex);
+    schedule(0, [] {
+        linkUp = false;
+        dropLink();
+    });
+}
+
+void WiFiClass::Native_linkUp()
+{
+    std::lock_guard<std::mutex> lock(wifiMutex);
+    linkUp = true;
+}
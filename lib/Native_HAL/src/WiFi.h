@@ -0,0 +1,80 @@
+#ifndef _NATIVE_WIFI_H
+#define _NATIVE_WIFI_H
+
+#include "Arduino.h"
+#include "IPAddress.h"
+#include "WiFiClient.h"
+
+typedef enum {
+    WL_IDLE_STATUS = 0,
+    WL_NO_SSID_AVAIL = 1,
+    WL_SCAN_COMPLETED = 2,
+    WL_CONNECTED = 3,
+    WL_CONNECT_FAILED = 4,
+    WL_CONNECTION_LOST = 5,
+    WL_DISCONNECTED = 6
+} wl_status_t;
+
+typedef enum { WIFI_OFF = 0, WIFI_STA = 1, WIFI_AP = 2, WIFI_AP_STA = 3 } wifi_mode_t;
+
+typedef enum {
+    WIFI_EVENT_STA_START,
+    WIFI_EVENT_STA_STOP,
+    WIFI_EVENT_STA_CONNECTED,
+    WIFI_EVENT_STA_DISCONNECTED,
+    IP_EVENT_STA_GOT_IP,
+    IP_EVENT_STA_LOST_IP
+} WiFiEvent_t;
+
+typedef void (*WiFiEventCb)(WiFiEvent_t event);
+
+/// @brief Host stand-in for the station interface. The link comes up after a simulated scan and
+/// DHCP delay, and can be scripted up and down through NATIVE_WIFI_SCRIPT, e.g.
+/// "down@30000,up@45000" (milliseconds since start), or with Native_linkDown()/Native_linkUp().
+class WiFiClass {
+   public:
+    bool mode(wifi_mode_t mode);
+    wifi_mode_t getMode() const { return m_mode; }
+    void onEvent(WiFiEventCb callback);
+
+    wl_status_t begin(const char* ssid, const char* passphrase = nullptr, int32_t channel = 0,
+                      const uint8_t* bssid = nullptr, bool connect = true);
+    wl_status_t begin(const String& ssid, const String& passphrase = String(),
+                      int32_t channel = 0, const uint8_t* bssid = nullptr, bool connect = true)
+    {
+        return begin(ssid.c_str(), passphrase.c_str(), channel, bssid, connect);
+    }
+    bool config(IPAddress localIP, IPAddress gateway, IPAddress subnet,
+                IPAddress dns1 = IPAddress(), IPAddress dns2 = IPAddress());
+    bool disconnect(bool wifiOff = false, bool eraseAp = false);
+    bool setAutoReconnect(bool autoReconnect) { return (void)autoReconnect, true; }
+    void persistent(bool persistent) { (void)persistent; }
+
+    wl_status_t status();
+    bool isConnected() { return status() == WL_CONNECTED; }
+
+    String macAddress();
+    uint8_t* macAddress(uint8_t* mac);
+    String SSID();
+    uint8_t* BSSID();
+    int32_t channel();
+    int8_t RSSI();
+    IPAddress localIP();
+    IPAddress gatewayIP();
+    IPAddress subnetMask();
+    IPAddress dnsIP(uint8_t index = 0);
+
+    int hostByName(const char* host, IPAddress& result);
+
+    /// @brief Drop the link, as if the access point went away
+    void Native_linkDown();
+    /// @brief Let the next begin() succeed again
+    void Native_linkUp();
+
+   private:
+    wifi_mode_t m_mode = WIFI_OFF;
+};
+
+extern WiFiClass WiFi;
+
+#endif  // _NATIVE_WIFI_H
@@ -0,0 +1,132 @@
+#include "WiFiClient.h"
+
+#include <fcntl.h>
+#include <sys/ioctl.h>
+
+#include <cerrno>
+
+#include "WiFi.h"
+#include "lwip/sockets.h"
+
+int WiFiClient::connect(IPAddress ip, uint16_t port)
+{
+    stop();
+    if (WiFi.status() != WL_CONNECTED) {
+        return 0;
+    }
+    m_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (m_fd < 0) {
+        return 0;
+    }
+    struct sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = static_cast<uint32_t>(ip);
+    if (::connect(m_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        stop();
+        return 0;
+    }
+    setNoDelay(true);
+    return 1;
+}
+
+int WiFiClient::connect(const char* host, uint16_t port)
+{
+    IPAddress ip;
+    if (!WiFi.hostByName(host, ip)) {
+        return 0;
+    }
+    return connect(ip, port);
+}
+
+size_t WiFiClient::write(const uint8_t* buffer, size_t size)
+{
+    if (m_fd < 0) {
+        return 0;
+    }
+    size_t written = 0;
+    while (written < size) {
+        const ssize_t sent = send(m_fd, buffer + written, size - written, MSG_NOSIGNAL);
+        if (sent <= 0) {
+            if (sent < 0 && errno == EINTR) {
+                continue;
+            }
+            stop();
+            break;
+        }
+        written += sent;
+    }
+    return written;
+}
+
+int WiFiClient::available()
+{
+    if (m_fd < 0) {
+        return 0;
+    }
+    int count = 0;
+    if (ioctl(m_fd, FIONREAD, &count) != 0) {
+        return 0;
+    }
+    return count;
+}
+
+int WiFiClient::read()
+{
+    uint8_t c;
+    return read(&c, 1) == 1 ? c : -1;
+}
+
+int WiFiClient::read(uint8_t* buffer, size_t size)
+{
+    if (m_fd < 0 || available() == 0) {
+        return -1;
+    }
+    const ssize_t received = recv(m_fd, buffer, size, MSG_DONTWAIT);
+    if (received <= 0) {
+        if (received == 0) {
+            stop();
+        }
+        return -1;
+    }
+    return static_cast<int>(received);
+}
+
+int WiFiClient::peek()
+{
+    uint8_t c;
+    if (m_fd < 0 || recv(m_fd, &c, 1, MSG_PEEK | MSG_DONTWAIT) != 1) {
+        return -1;
+    }
+    return c;
+}
+
+void WiFiClient::stop()
+{
+    if (m_fd >= 0) {
+        close(m_fd);
+        m_fd = -1;
+    }
+}
+
+uint8_t WiFiClient::connected()
+{
+    if (m_fd < 0) {
+        return 0;
+    }
+    uint8_t c;
+    const ssize_t received = recv(m_fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    if (received == 0 || (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+        stop();
+        return 0;
+    }
+    return 1;
+}
+
+void WiFiClient::setNoDelay(bool noDelay)
+{
+    if (m_fd >= 0) {
+        int flag = noDelay ? 1 : 0;
+        setsockopt(m_fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+    }
+}
@@ -0,0 +1,43 @@
+#ifndef _NATIVE_WIFICLIENT_H
+#define _NATIVE_WIFICLIENT_H
+
+#include "Arduino.h"
+#include "Client.h"
+
+/// @brief TCP client on host sockets, e.g. towards a local mosquitto broker
+class WiFiClient : public Client {
+   public:
+    WiFiClient() = default;
+    WiFiClient(const WiFiClient&) = delete;
+    WiFiClient& operator=(const WiFiClient&) = delete;
+    ~WiFiClient() override { stop(); }
+
+    int connect(IPAddress ip, uint16_t port) override;
+    int connect(const char* host, uint16_t port) override;
+    int connect(const char* host, uint16_t port, int32_t timeoutMs)
+    {
+        (void)timeoutMs;
+        return connect(host, port);
+    }
+
+    using Print::write;
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t* buffer, size_t size) override;
+
+    int available() override;
+    int read() override;
+    int read(uint8_t* buffer, size_t size) override;
+    int peek() override;
+    void flush() override {}
+    void stop() override;
+    uint8_t connected() override;
+    operator bool() override { return connected(); }
+
+    int fd() const { return m_fd; }
+    void setNoDelay(bool noDelay);
+
+   private:
+    int m_fd = -1;
+};
+
+#endif  // _NATIVE_WIFICLIENT_H
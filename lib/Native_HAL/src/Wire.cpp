@@ -0,0 +1,187 @@
+#include "Wire.h"
+
+#include <sys/time.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+
+TwoWire Wire;
+
+namespace {
+
+constexpr uint8_t RTC_ADDRESS = 0x68;
+constexpr uint8_t RTC_REGISTERS = 0x13;
+constexpr uint8_t RTC_TIME_REGISTERS = 7;
+constexpr uint8_t RTC_REG_STATUS = 0x0F;
+constexpr uint8_t RTC_STATUS_OSF = 0x80;
+
+std::mutex rtcMutex;
+bool rtcPresent = false;
+time_t rtcOffset = 0;  // RTC time minus host time
+uint8_t rtcRegisters[RTC_REGISTERS] = {};
+uint8_t rtcPointer = 0;
+
+uint8_t toBcd(uint8_t value) { return ((value / 10) << 4) | (value % 10); }
+uint8_t fromBcd(uint8_t value) { return (value >> 4) * 10 + (value & 0x0F); }
+
+time_t hostTime()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return now.tv_sec;
+}
+
+void setState(Native_Rtc state, time_t time)
+{
+    rtcPresent = state != Native_Rtc::ABSENT;
+    rtcOffset = time - hostTime();
+    if (state == Native_Rtc::STOPPED) {
+        rtcRegisters[RTC_REG_STATUS] |= RTC_STATUS_OSF;
+    } else {
+        rtcRegisters[RTC_REG_STATUS] &= ~RTC_STATUS_OSF;
+    }
+}
+
+/// @brief Apply NATIVE_DS3231 once, before the first access
+void loadState()
+{
+    static bool loaded = false;
+    if (loaded) {
+        return;
+    }
+    loaded = true;
+    const char* state = getenv("NATIVE_DS3231");
+    if (state == nullptr) {
+        return;
+    }
+    if (strcmp(state, "running") == 0) {
+        setState(Native_Rtc::RUNNING, hostTime());
+    } else if (strcmp(state, "stopped") == 0) {
+        setState(Native_Rtc::STOPPED, 0);
+    }
+}
+
+/// @brief Latch the current time into the time registers, UTC in 24 hour mode
+void latchTime()
+{
+    const time_t now = hostTime() + rtcOffset;
+    struct tm utc;
+    gmtime_r(&now, &utc);
+    rtcRegisters[0] = toBcd(utc.tm_sec);
+    rtcRegisters[1] = toBcd(utc.tm_min);
+    rtcRegisters[2] = toBcd(utc.tm_hour);
+    rtcRegisters[3] = utc.tm_wday + 1;
+    rtcRegisters[4] = toBcd(utc.tm_mday);
+    rtcRegisters[5] = toBcd(utc.tm_mon + 1) | (utc.tm_year >= 200 ? 0x80 : 0);
+    rtcRegisters[6] = toBcd(utc.tm_year % 100);
+}
+
+/// @brief Take the time written to the time registers
+void storeTime()
+{
+    struct tm utc = {};
+    utc.tm_sec = fromBcd(rtcRegisters[0] & 0x7F);
+    utc.tm_min = fromBcd(rtcRegisters[1] & 0x7F);
+    utc.tm_hour = fromBcd(rtcRegisters[2] & 0x3F);
+    utc.tm_mday = fromBcd(rtcRegisters[4] & 0x3F);
+    utc.tm_mon = fromBcd(rtcRegisters[5] & 0x1F) - 1;
+    utc.tm_year = 100 + fromBcd(rtcRegisters[6]) + ((rtcRegisters[5] & 0x80) ? 100 : 0);
+    rtcOffset = timegm(&utc) - hostTime();
+}
+
+}  // namespace
+
+void Native_setRtc(Native_Rtc state, time_t time)
+{
+    std::lock_guard<std::mutex> lock(rtcMutex);
+    loadState();
+    setState(state, time);
+}
+
+time_t Native_rtcTime()
+{
+    std::lock_guard<std::mutex> lock(rtcMutex);
+    loadState();
+    return hostTime() + rtcOffset;
+}
+
+bool Native_rtcStopped()
+{
+    std::lock_guard<std::mutex> lock(rtcMutex);
+    loadState();
+    return (rtcRegisters[RTC_REG_STATUS] & RTC_STATUS_OSF) != 0;
+}
+
+void TwoWire::beginTransmission(uint8_t address)
+{
+    m_address = address;
+    m_txLength = 0;
+}
+
+size_t TwoWire::write(uint8_t data)
+{
+    if (m_txLength >= sizeof(m_tx)) {
+        return 0;
+    }
+    m_tx[m_txLength++] = data;
+    return 1;
+}
+
+size_t TwoWire::write(const uint8_t* data, size_t length)
+{
+    size_t written = 0;
+    while (written < length && write(data[written]) == 1) {
+        written++;
+    }
+    return written;
+}
+
+uint8_t TwoWire::endTransmission(bool sendStop)
+{
+    (void)sendStop;
+    std::lock_guard<std::mutex> lock(rtcMutex);
+    loadState();
+    if (m_address != RTC_ADDRESS || !rtcPresent) {
+        return 2;
+    }
+    if (m_txLength == 0) {
+        return 0;
+    }
+    // The first byte sets the register pointer, the following ones are written from there
+    rtcPointer = m_tx[0] % RTC_REGISTERS;
+    bool timeWritten = false;
+    for (size_t i = 1; i < m_txLength; i++) {
+        rtcRegisters[rtcPointer] = m_tx[i];
+        timeWritten = timeWritten || rtcPointer < RTC_TIME_REGISTERS;
+        rtcPointer = (rtcPointer + 1) % RTC_REGISTERS;
+    }
+    if (timeWritten) {
+        storeTime();
+    }
+    return 0;
+}
+
+uint8_t TwoWire::requestFrom(uint8_t address, uint8_t quantity, bool sendStop)
+{
+    (void)sendStop;
+    std::lock_guard<std::mutex> lock(rtcMutex);
+    loadState();
+    m_rxLength = 0;
+    m_rxPosition = 0;
+    if (address != RTC_ADDRESS || !rtcPresent) {
+        return 0;
+    }
+    latchTime();
+    m_rxLength = std::min<size_t>(quantity, sizeof(m_rx));
+    for (size_t i = 0; i < m_rxLength; i++) {
+        m_rx[i] = rtcRegisters[rtcPointer];
+        rtcPointer = (rtcPointer + 1) % RTC_REGISTERS;
+    }
+    return m_rxLength;
+}
+
+int TwoWire::available() { return m_rxLength - m_rxPosition; }
+
+int TwoWire::read() { return m_rxPosition < m_rxLength ? m_rx[m_rxPosition++] : -1; }
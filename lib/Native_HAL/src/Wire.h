@@ -0,0 +1,52 @@
+#ifndef _NATIVE_WIRE_H
+#define _NATIVE_WIRE_H
+
+#include <time.h>
+
+#include <cstddef>
+#include <cstdint>
+
+//
+// Host stand-in for the I2C master, the only device on the bus is a simulated DS3231 RTC at
+// 0x68. NATIVE_DS3231 sets its state at start: absent (default), running (keeps the host time)
+// or stopped (oscillator stop flag set, the time is not valid).
+//
+enum class Native_Rtc : uint8_t { ABSENT, RUNNING, STOPPED };
+
+/// @brief Put the simulated DS3231 into a state, it keeps counting from the given time
+void Native_setRtc(Native_Rtc state, time_t time = 0);
+
+/// @brief Time the simulated DS3231 holds now
+time_t Native_rtcTime();
+
+/// @brief Whether the oscillator stop flag of the simulated DS3231 is set
+bool Native_rtcStopped();
+
+class TwoWire {
+   public:
+    bool begin() { return true; }
+    bool end() { return true; }
+    void setClock(uint32_t frequency) { (void)frequency; }
+
+    void beginTransmission(uint8_t address);
+    size_t write(uint8_t data);
+    size_t write(const uint8_t* data, size_t length);
+    /// @return 0 on success, 2 if the address was not acknowledged
+    uint8_t endTransmission(bool sendStop = true);
+
+    uint8_t requestFrom(uint8_t address, uint8_t quantity, bool sendStop = true);
+    int available();
+    int read();
+
+   private:
+    uint8_t m_address = 0;
+    uint8_t m_tx[32] = {};
+    size_t m_txLength = 0;
+    uint8_t m_rx[32] = {};
+    size_t m_rxLength = 0;
+    size_t m_rxPosition = 0;
+};
+
+extern TwoWire Wire;
+
+#endif  // _NATIVE_WIRE_H
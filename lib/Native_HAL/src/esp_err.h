@@ -0,0 +1,17 @@
+#ifndef _NATIVE_ESP_ERR_H
+#define _NATIVE_ESP_ERR_H
+
+//
+// Host stand-in for the ESP-IDF error codes used by the partition and OTA stand-ins
+//
+typedef int esp_err_t;
+
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERR_INVALID_ARG 0x102
+#define ESP_ERR_INVALID_SIZE 0x104
+#define ESP_ERR_NOT_FOUND 0x105
+
+const char* esp_err_to_name(esp_err_t code);
+
+#endif  // _NATIVE_ESP_ERR_H
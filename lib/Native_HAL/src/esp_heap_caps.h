@@ -0,0 +1,23 @@
+#ifndef _NATIVE_ESP_HEAP_CAPS_H
+#define _NATIVE_ESP_HEAP_CAPS_H
+
+#include <cstddef>
+#include <cstdint>
+
+//
+// Host stand-in for the heap capability API. The heap is a notional NATIVE_HEAP_SIZE bytes
+// (default 320 KB) minus what the process has allocated with malloc().
+//
+#define MALLOC_CAP_DEFAULT (1 << 12)
+#define MALLOC_CAP_8BIT (1 << 2)
+#define MALLOC_CAP_INTERNAL (1 << 11)
+
+size_t heap_caps_get_free_size(uint32_t caps);
+size_t heap_caps_get_largest_free_block(uint32_t caps);
+size_t heap_caps_get_minimum_free_size(uint32_t caps);
+
+/// @brief Number of malloc(), calloc() and realloc() calls of the process so far, operator new
+/// included, to check that a code path does not allocate. Host only.
+size_t Native_heapAllocations();
+
+#endif  // _NATIVE_ESP_HEAP_CAPS_H
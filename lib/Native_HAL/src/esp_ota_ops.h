@@ -0,0 +1,16 @@
+#ifndef _NATIVE_ESP_OTA_OPS_H
+#define _NATIVE_ESP_OTA_OPS_H
+
+#include "esp_err.h"
+#include "esp_partition.h"
+
+//
+// Host stand-in for the OTA partition selection, see esp_partition.h. The running image is
+// always the factory one, the boot partition is only recorded.
+//
+const esp_partition_t* esp_ota_get_running_partition();
+const esp_partition_t* esp_ota_get_next_update_partition(const esp_partition_t* start);
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t* partition);
+esp_err_t esp_ota_mark_app_valid_cancel_rollback();
+
+#endif  // _NATIVE_ESP_OTA_OPS_H
@@ -0,0 +1,35 @@
+#ifndef _NATIVE_ESP_PARTITION_H
+#define _NATIVE_ESP_PARTITION_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "esp_err.h"
+
+//
+// Host stand-in for the flash partition API. The OTA update partition is the file ota_0.bin in
+// NATIVE_NVS_DIR, NATIVE_OTA_PARTITION_SIZE bytes (default 1920 KB). It behaves like NOR flash:
+// erasing sets 4 KB sectors to 0xFF and writing can only clear bits, so writing a range twice
+// without erasing it corrupts it like it would on the chip. Data partitions, e.g. the telemetry
+// spill area, are found by any label and are files of NATIVE_DATA_PARTITION_SIZE bytes next to it.
+//
+#define SPI_FLASH_SEC_SIZE 4096
+
+typedef struct {
+    uint32_t address;
+    uint32_t size;
+    char label[17];
+} esp_partition_t;
+
+typedef enum { ESP_PARTITION_TYPE_APP = 0x00, ESP_PARTITION_TYPE_DATA = 0x01 } esp_partition_type_t;
+typedef enum { ESP_PARTITION_SUBTYPE_ANY = 0xFF } esp_partition_subtype_t;
+
+const esp_partition_t* esp_partition_find_first(esp_partition_type_t type,
+                                                esp_partition_subtype_t subtype, const char* label);
+esp_err_t esp_partition_erase_range(const esp_partition_t* partition, size_t offset, size_t size);
+esp_err_t esp_partition_write(const esp_partition_t* partition, size_t offset, const void* source,
+                              size_t size);
+esp_err_t esp_partition_read(const esp_partition_t* partition, size_t offset, void* destination,
+                             size_t size);
+
+#endif  // _NATIVE_ESP_PARTITION_H
@@ -0,0 +1,13 @@
+#ifndef _NATIVE_ESP_SNTP_H
+#define _NATIVE_ESP_SNTP_H
+
+//
+// Host stand-in for the SNTP client, see configTime() in Native_Time.cpp
+//
+#include <sys/time.h>
+
+typedef void (*sntp_sync_time_cb_t)(struct timeval* tv);
+
+void sntp_set_time_sync_notification_cb(sntp_sync_time_cb_t callback);
+
+#endif  // _NATIVE_ESP_SNTP_H
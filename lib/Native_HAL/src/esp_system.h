@@ -0,0 +1,9 @@
+#ifndef _NATIVE_ESP_SYSTEM_H
+#define _NATIVE_ESP_SYSTEM_H
+
+//
+// Host stand-in for the restart of the chip, the process exits as there is no other image to boot
+//
+void esp_restart();
+
+#endif  // _NATIVE_ESP_SYSTEM_H
@@ -0,0 +1,68 @@
+#ifndef _NATIVE_FREERTOS_H
+#define _NATIVE_FREERTOS_H
+
+//
+// Host stand-in for FreeRTOS, tasks are threads and one tick is one millisecond
+//
+#include <cstdint>
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t StackType_t;
+
+#define configTICK_RATE_HZ 1000
+#define configMAX_PRIORITIES 25
+#define portTICK_PERIOD_MS 1
+#define portMAX_DELAY UINT32_MAX
+#define portNUM_PROCESSORS 2
+#define pdMS_TO_TICKS(ms) (static_cast<TickType_t>(ms))
+#define pdTICKS_TO_MS(ticks) (static_cast<uint32_t>(ticks))
+
+#define pdFALSE 0
+#define pdTRUE 1
+#define pdFAIL 0
+#define pdPASS 1
+
+#define portYIELD_FROM_ISR(woken) (void)(woken)
+#define tskNO_AFFINITY 0x7FFFFFFF
+
+#ifndef BIT0
+#define BIT31 0x80000000
+#define BIT30 0x40000000
+#define BIT29 0x20000000
+#define BIT28 0x10000000
+#define BIT27 0x08000000
+#define BIT26 0x04000000
+#define BIT25 0x02000000
+#define BIT24 0x01000000
+#define BIT23 0x00800000
+#define BIT22 0x00400000
+#define BIT21 0x00200000
+#define BIT20 0x00100000
+#define BIT19 0x00080000
+#define BIT18 0x00040000
+#define BIT17 0x00020000
+#define BIT16 0x00010000
+#define BIT15 0x00008000
+#define BIT14 0x00004000
+#define BIT13 0x00002000
+#define BIT12 0x00001000
+#define BIT11 0x00000800
+#define BIT10 0x00000400
+#define BIT9 0x00000200
+#define BIT8 0x00000100
+#define BIT7 0x00000080
+#define BIT6 0x00000040
+#define BIT5 0x00000020
+#define BIT4 0x00000010
+#define BIT3 0x00000008
+#define BIT2 0x00000004
+#define BIT1 0x00000002
+#define BIT0 0x00000001
+#endif
+
+/// @brief There are no interrupts on the host, "ISR" callers run on ordinary threads
+inline bool xPortInIsrContext() { return false; }
+
+#endif  // _NATIVE_FREERTOS_H
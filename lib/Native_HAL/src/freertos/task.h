@@ -0,0 +1,37 @@
+#ifndef _NATIVE_FREERTOS_TASK_H
+#define _NATIVE_FREERTOS_TASK_H
+
+#include "freertos/FreeRTOS.h"
+
+struct Native_Task;
+typedef Native_Task* TaskHandle_t;
+typedef void (*TaskFunction_t)(void*);
+
+typedef enum { eNoAction, eSetBits, eIncrement, eSetValueWithOverwrite } eNotifyAction;
+
+BaseType_t xTaskCreate(TaskFunction_t function, const char* name, uint32_t stackDepth,
+                       void* parameters, UBaseType_t priority, TaskHandle_t* handle);
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char* name, uint32_t stackDepth,
+                                   void* parameters, UBaseType_t priority, TaskHandle_t* handle,
+                                   BaseType_t core);
+void vTaskDelete(TaskHandle_t task);
+void vTaskDelay(TickType_t ticks);
+TickType_t xTaskGetTickCount();
+TaskHandle_t xTaskGetCurrentTaskHandle();
+const char* pcTaskGetName(TaskHandle_t task);
+/// @brief Threads are scheduled by the host, priorities are accepted and ignored
+void vTaskPrioritySet(TaskHandle_t task, UBaseType_t priority);
+
+BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value, eNotifyAction action);
+BaseType_t xTaskNotifyFromISR(TaskHandle_t task, uint32_t value, eNotifyAction action,
+                              BaseType_t* higherPriorityTaskWoken);
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t* higherPriorityTaskWoken);
+BaseType_t xTaskNotifyWait(uint32_t clearOnEntry, uint32_t clearOnExit, uint32_t* value,
+                           TickType_t ticks);
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticks);
+
+/// @brief Thread stacks are not instrumented on the host, the configured depth is reported
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task);
+
+#endif  // _NATIVE_FREERTOS_TASK_H
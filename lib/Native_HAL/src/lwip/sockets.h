@@ -0,0 +1,14 @@
+#ifndef _NATIVE_LWIP_SOCKETS_H
+#define _NATIVE_LWIP_SOCKETS_H
+
+// The host BSD sockets stand in for lwIP
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#endif  // _NATIVE_LWIP_SOCKETS_H
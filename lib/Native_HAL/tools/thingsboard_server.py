@@ -0,0 +1,278 @@
+#!/usr/bin/env python3
+"""Local stand-in for ThingsBoard to benchmark firmware downloads and RPCs of the native build.
+
+Speaks just enough MQTT 3.1.1 for one device: provisioning, attribute requests, QoS 1 telemetry,
+the firmware chunk API and server side RPC.
+
+With --size the firmware assigned is a random image of that many bytes, chunk responses are
+delayed by --delay milliseconds to stand in for the round trip to a real server. The download
+time is printed once the device reports fw_state UPDATING.
+
+    python3 lib/Native_HAL/tools/thingsboard_server.py --size 1048576 --delay 20
+
+With --rpc-count a switch_set RPC is sent every --rpc-interval milliseconds once the device
+subscribed, and the round trip to its response is timed. The device reports the latency of the
+RPC stages with its memory telemetry, once every RPC has been reported the round trips are
+printed next to the reported stages and checked against them: every RPC counted once, no
+reported percentile above the longest round trip. The exit status is 1 if the check failed.
+With --rpc-burst the RPCs go out that many at a time in one write, back to back, so the device
+handles several of them in one loop.
+
+    python3 lib/Native_HAL/tools/thingsboard_server.py --size 0 --rpc-count 500
+    python3 lib/Native_HAL/tools/thingsboard_server.py --size 0 --rpc-count 500 --rpc-burst 4
+"""
+
+import argparse
+import hashlib
+import json
+import os
+import random
+import re
+import socket
+import threading
+import time
+
+CONNECT, CONNACK, PUBLISH, PUBACK, SUBSCRIBE, SUBACK = 1, 2, 3, 4, 8, 9
+PINGREQ, PINGRESP, DISCONNECT = 12, 13, 14
+
+CHUNK_REQUEST = re.compile(r"v2/fw/request/(\d+)/chunk/(\d+)")
+ATTRIBUTE_REQUEST = re.compile(r"v1/devices/me/attributes/request/(\d+)")
+RPC_RESPONSE = re.compile(r"v1/devices/me/rpc/response/(\d+)")
+RPC_REQUEST_TOPICS = "v1/devices/me/rpc/request/+"
+RPC_STAGES = ("mqtt_queue", "rpc_dispatch", "rpc_actuate", "rpc_respond", "rpc_total")
+
+
+def packet(kind, flags, body):
+    length = len(body)
+    encoded = bytearray()
+    while True:
+        byte = length & 0x7F
+        length >>= 7
+        encoded.append(byte | (0x80 if length else 0))
+        if not length:
+            break
+    return bytes([kind << 4 | flags]) + bytes(encoded) + body
+
+
+def publish(topic, payload):
+    topic = topic.encode()
+    return packet(PUBLISH, 0, len(topic).to_bytes(2, "big") + topic + payload)
+
+
+def percentile(values, percent):
+    ordered = sorted(values)
+    return ordered[max(0, (len(ordered) * percent + 99) // 100 - 1)]
+
+
+def telemetry_values(document):
+    """Key value pairs of a telemetry payload, a values object or a list of ts and values"""
+    if isinstance(document, list):
+        for entry in document:
+            yield from telemetry_values(entry)
+    elif isinstance(document, dict):
+        yield from document.get("values", document).items()
+
+
+class Device:
+    def __init__(self, connection, args, image):
+        self.connection = connection
+        self.args = args
+        self.image = image
+        self.lock = threading.Lock()
+        self.started = None
+        self.rpc_sent = {}
+        self.round_trips = []
+        self.reports = []
+
+    def send(self, data):
+        with self.lock:
+            try:
+                self.connection.sendall(data)
+            except OSError:
+                pass
+
+    def attributes(self):
+        if not self.image:
+            return {}
+        return {
+            "fw_title": self.args.title,
+            "fw_version": self.args.version,
+            "fw_checksum": hashlib.sha256(self.image).hexdigest(),
+            "fw_checksum_algorithm": "SHA256",
+            "fw_size": len(self.image),
+        }
+
+    def chunk(self, request_id, index, size):
+        if self.started is None:
+            self.started = time.monotonic()
+        data = self.image[index * size:(index + 1) * size]
+        response = publish(f"v2/fw/response/{request_id}/chunk/{index}", data)
+        if self.args.delay > 0:
+            threading.Timer(self.args.delay / 1000, self.send, (response,)).start()
+        else:
+            self.send(response)
+
+    def send_rpcs(self):
+        for first in range(1, self.args.rpc_count + 1, self.args.rpc_burst):
+            last = min(first + self.args.rpc_burst, self.args.rpc_count + 1)
+            requests = b""
+            for request_id in range(first, last):
+                params = {"switch_state_0": request_id % 2 == 1}
+                payload = json.dumps({"method": "switch_set", "params": params},
+                                     separators=(",", ":")).encode()
+                requests += publish(f"v1/devices/me/rpc/request/{request_id}", payload)
+            sent = time.monotonic()
+            for request_id in range(first, last):
+                self.rpc_sent[request_id] = sent
+            self.send(requests)
+            time.sleep(self.args.rpc_interval / 1000)
+
+    def rpc_responded(self, request_id):
+        sent = self.rpc_sent.pop(request_id, None)
+        if sent is not None:
+            self.round_trips.append((time.monotonic() - sent) * 1e6)
+
+    def reported(self, values):
+        report = {key: value for key, value in values if key.startswith(RPC_STAGES)}
+        if not report:
+            return
+        self.reports.append(report)
+        counted = sum(r.get("rpc_total_count", 0) for r in self.reports)
+        print(f"Device reported {report.get('rpc_total_count', 0)} RPC(s), {counted} of "
+              f"{len(self.round_trips)} answered", flush=True)
+        if self.args.rpc_count and counted >= self.args.rpc_count:
+            os._exit(self.check(counted))
+
+    def check(self, counted):
+        longest = max(self.round_trips)
+        print(f"Round trip   {len(self.round_trips):5d} RPCs, "
+              f"p50 {percentile(self.round_trips, 50):8.0f} us, "
+              f"p99 {percentile(self.round_trips, 99):8.0f} us, max {longest:8.0f} us")
+        failed = counted != len(self.round_trips)
+        for stage in RPC_STAGES:
+            for report in self.reports:
+                if f"{stage}_count" not in report:
+                    continue
+                p50, p99 = report[f"{stage}_p50_us"], report[f"{stage}_p99_us"]
+                print(f"{stage:12} {report[f'{stage}_count']:5d} RPCs, p50 {p50:8d} us, "
+                      f"p99 {p99:8d} us")
+                failed |= p99 > longest
+        print("Latency check", "FAILED" if failed else "passed", flush=True)
+        return 1 if failed else 0
+
+    def received(self, topic, payload):
+        match = CHUNK_REQUEST.fullmatch(topic)
+        if match:
+            size = int(payload or b"0")
+            self.chunk(match.group(1), int(match.group(2)), size)
+            return
+        match = ATTRIBUTE_REQUEST.fullmatch(topic)
+        if match:
+            response = json.dumps({"shared": self.attributes()}, separators=(",", ":")).encode()
+            self.send(publish(f"v1/devices/me/attributes/response/{match.group(1)}", response))
+            return
+        match = RPC_RESPONSE.fullmatch(topic)
+        if match:
+            self.rpc_responded(int(match.group(1)))
+            return
+        if topic == "/provision/request":
+            response = {"status": "SUCCESS", "credentialsType": "ACCESS_TOKEN",
+                        "credentialsValue": "stand-in"}
+            self.send(publish("/provision/response", json.dumps(response).encode()))
+            return
+        if topic != "v1/devices/me/telemetry":
+            return
+        try:
+            document = json.loads(payload)
+        except ValueError:
+            return
+        self.reported(telemetry_values(document))
+        if isinstance(document, dict) and "fw_state" in document:
+            print("fw_state", document["fw_state"], document.get("fw_error", ""), flush=True)
+            if document["fw_state"] == "UPDATING" and self.started is not None:
+                elapsed = time.monotonic() - self.started
+                print(f"Downloaded {len(self.image)} bytes in {elapsed * 1000:.0f} ms, "
+                      f"{len(self.image) / 1024 / elapsed:.1f} KB/s", flush=True)
+
+    def subscribed(self, body):
+        topic_length = int.from_bytes(body[2:4], "big")
+        topic = body[4:4 + topic_length].decode()
+        if topic == RPC_REQUEST_TOPICS and self.args.rpc_count:
+            threading.Thread(target=self.send_rpcs, daemon=True).start()
+
+    def serve(self):
+        buffer = b""
+        while True:
+            data = self.connection.recv(65536)
+            if not data:
+                return
+            buffer += data
+            while True:
+                parsed = self.parse(buffer)
+                if parsed is None:
+                    break
+                buffer = buffer[parsed:]
+
+    def parse(self, buffer):
+        if len(buffer) < 2:
+            return None
+        length, shift, position = 0, 0, 1
+        while True:
+            if position >= len(buffer):
+                return None
+            byte = buffer[position]
+            length |= (byte & 0x7F) << shift
+            shift += 7
+            position += 1
+            if not byte & 0x80:
+                break
+        if len(buffer) < position + length:
+            return None
+        kind, flags = buffer[0] >> 4, buffer[0] & 0x0F
+        body = buffer[position:position + length]
+        if kind == CONNECT:
+            self.send(packet(CONNACK, 0, b"\x00\x00"))
+        elif kind == SUBSCRIBE:
+            self.send(packet(SUBACK, 0, body[:2] + b"\x00"))
+            self.subscribed(body)
+        elif kind == PINGREQ:
+            self.send(packet(PINGRESP, 0, b""))
+        elif kind == PUBLISH:
+            topic_length = int.from_bytes(body[:2], "big")
+            topic = body[2:2 + topic_length].decode()
+            payload = body[2 + topic_length:]
+            if flags & 0x06:
+                self.send(packet(PUBACK, 0, payload[:2]))
+                payload = payload[2:]
+            self.received(topic, payload)
+        elif kind == DISCONNECT:
+            self.connection.close()
+        return position + length
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--port", type=int, default=1883)
+    parser.add_argument("--size", type=int, default=1024 * 1024,
+                        help="firmware image size in bytes, 0 to assign none")
+    parser.add_argument("--delay", type=float, default=0, help="chunk response delay in ms")
+    parser.add_argument("--title", default="XX-1")
+    parser.add_argument("--version", default="00.02")
+    parser.add_argument("--rpc-count", type=int, default=0, help="switch_set RPCs to send")
+    parser.add_argument("--rpc-interval", type=float, default=100, help="ms between RPCs")
+    parser.add_argument("--rpc-burst", type=int, default=1,
+                        help="RPCs sent back to back in one write")
+    args = parser.parse_args()
+
+    image = random.Random(1).randbytes(args.size)
+    server = socket.create_server(("127.0.0.1", args.port), reuse_port=True)
+    print(f"Serving {args.title} {args.version}, {args.size} bytes on port {args.port}",
+          flush=True)
+    while True:
+        connection, _ = server.accept()
+        connection.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        threading.Thread(target=Device(connection, args, image).serve, daemon=True).start()
+
+
+if __name__ == "__main__":
+    main()
@@ -2,17 +2,131 @@
 #include <EasyButton.h>
 #include <Preferences.h>
 
+#include "Boot_Timeline.h"
+#include "Device_Events.h"
+#include "Device_State.h"
+#include "Latency_Benchmark.h"
+#include "Latency_Histogram.h"
+#include "Low_Power.h"
+#include "Memory_Monitor.h"
+#include "OTA_Update.h"
+#include "Payload_Encoder.h"
+#include "Publish_Pipeline.h"
+#include "Report_Policy.h"
+#include "SPSC_Queue.h"
+#include "Task_Events.h"
+#include "Task_Topology.h"
+#include "Telemetry_Batch.h"
+#include "Telemetry_Buffer.h"
 #include "ThingsBoard_Manager.h"
+#include "Time_Manager.h"
+#include "Upload_Controller.h"
 #include "WiFi_Manager.h"
+#include "Window_Aggregate.h"
 
 void WiFi_task(void* pvParameters);
+void Sensor_task(void* pvParameters);
 void ThingsBoard_task(void* pvParameters);
+uint32_t ThingsBoard_nextWakeup();
+uint32_t ThingsBoard_connectionWakeup();
+void ThingsBoard_sampleTelemetry();
+void ThingsBoard_aggregateReadings();
+void Sensor_read(float& temperature, float& humidity);
+#ifdef LOW_POWER_MODE
+void Low_Power_sample();
+void ThingsBoard_sleep();
+#endif
+size_t ThingsBoard_sendBufferedTelemetry();
+void ThingsBoard_telemetryAcked(uint16_t packetId, uint32_t latencyMs);
+size_t ThingsBoard_pendingTelemetry();
+bool ThingsBoard_uploadBurst();
+uint32_t ThingsBoard_telemetryWait();
+void ThingsBoard_addWindow(const char* key, const Telemetry_Window& window);
+void ThingsBoard_renderIdentity();
+bool ThingsBoard_sendAttributes(bool withStatic, uint32_t& published);
+void ThingsBoard_processDeviceEvents();
+void setSwitchState(uint8_t i, bool state);
+void setTelemetryInterval(uint32_t interval);
+void setSensorInterval(uint32_t interval);
+bool ThingsBoard_readFirmware(const char* key, JsonVariantConst value, OTA_Firmware& firmware);
 
 //
 // ThinkgsBoard timings
 //
-constexpr uint64_t THINGSBOARD_ATTRIBUTE__SEND_INTERVAL = 5 * 60 * 1000;  // 5 minute
-constexpr uint64_t THINGSBOARD_TELEMETRY_SEND_INTERVAL = 30000;           // 30 seconds
+// Sensor readings are aggregated over windows of this length, the window statistics are reported
+// by exception, see TELEMETRY_REPORT_POLICIES. This is the default, the telemetry_interval shared
+// attribute overrides it.
+constexpr uint64_t THINGSBOARD_TELEMETRY_SAMPLE_INTERVAL = 1000;  // 1 second
+constexpr uint32_t THINGSBOARD_TELEMETRY_SAMPLE_INTERVAL_MIN = 100;             // 100 ms
+constexpr uint32_t THINGSBOARD_TELEMETRY_SAMPLE_INTERVAL_MAX = 60 * 60 * 1000;  // 1 hour
+// Buffered telemetry is rendered in bursts of at most this many samples, bursts are sent while
+// the publish pipeline has room, see PUBLISH_WINDOW
+constexpr size_t THINGSBOARD_TELEMETRY_DRAIN_BATCH = 10;
+// The task blocks on events, these bound how long it sleeps while connecting or connected
+constexpr uint32_t THINGSBOARD_CONNECT_STEP_INTERVAL = 10;  // 10 milliseconds
+constexpr uint32_t THINGSBOARD_KEEPALIVE_INTERVAL = 5000;  // 5 seconds
+// The sensor task reads the sensor at this rate, independent of the telemetry window. This is the
+// default, the sensor_interval shared attribute overrides it.
+constexpr uint32_t SENSOR_SAMPLE_INTERVAL = 100;  // 100 milliseconds
+constexpr uint32_t SENSOR_SAMPLE_INTERVAL_MIN = 10;         // 10 ms
+constexpr uint32_t SENSOR_SAMPLE_INTERVAL_MAX = 60 * 1000;  // 1 minute
+// Readings queued for the ThingsBoard task, it is woken to aggregate them every half queue
+constexpr size_t SENSOR_READING_QUEUE_SIZE = 128;
+// Stack and heap usage is reported this often
+constexpr uint32_t MEMORY_REPORT_INTERVAL = 60000;  // 1 minute
+// Changed settings are written once they have been stable this long, so a burst of updates
+// costs one flash write
+constexpr uint32_t SETTINGS_COMMIT_DELAY = 5000;  // 5 seconds
+
+//
+// Task handles, their cores, priorities and stacks are in Task_Topology.h
+//
+TaskHandle_t WiFi_taskHandle = nullptr;
+TaskHandle_t ThingsBoard_taskHandle = nullptr;
+TaskHandle_t Sensor_taskHandle = nullptr;
+
+//
+// Telemetry reporting, indexes into TELEMETRY_REPORT_POLICIES
+//
+constexpr size_t TELEMETRY_KEY_TEMPERATURE = 0;
+constexpr size_t TELEMETRY_KEY_HUMIDITY = 1;
+constexpr size_t TELEMETRY_KEY_RSSI = 2;
+constexpr size_t TELEMETRY_KEY_COUNT = 3;
+
+constexpr Report_Policy TELEMETRY_REPORT_POLICIES[TELEMETRY_KEY_COUNT] = {
+    // key, deadband type, deadband, min interval, max interval
+    {"temperature", Deadband_Type::ABSOLUTE, 0.3f, 1000, 5 * 60 * 1000},
+    {"humidity", Deadband_Type::PERCENT, 2.0f, 1000, 5 * 60 * 1000},
+    {"rssi", Deadband_Type::ABSOLUTE, 6.0f, 10000, 5 * 60 * 1000},
+};
+Report_Filter<TELEMETRY_KEY_COUNT> Telemetry_filter(TELEMETRY_REPORT_POLICIES);
+
+Setting<uint32_t> Telemetry_sampleInterval(ThingsBoard_settings, PREFS_TELEMETRY_INTERVAL,
+                                           THINGSBOARD_TELEMETRY_SAMPLE_INTERVAL);
+TimerHandle_t Telemetry_timer = nullptr;
+// Samples sent or dropped since the last report after they waited too long for the system time,
+// see Telemetry_late()
+uint32_t Telemetry_lateSamples = 0;
+
+Setting<uint32_t> Sensor_sampleInterval(ThingsBoard_settings, PREFS_SENSOR_INTERVAL,
+                                        SENSOR_SAMPLE_INTERVAL);
+// Copy of the setting read by the sensor task, the ThingsBoard task owns the setting
+std::atomic<uint32_t> Sensor_interval{SENSOR_SAMPLE_INTERVAL};
+
+//
+// Sensor readings, produced by the sensor task and aggregated per window by the ThingsBoard task
+//
+struct Sensor_Reading {
+    uint32_t timestamp;  // millis() of the reading
+    float temperature;
+    float humidity;
+};
+
+SPSC_Queue<Sensor_Reading, SENSOR_READING_QUEUE_SIZE> Sensor_readings;
+Window_Aggregate<float> Telemetry_temperatureWindow;
+Window_Aggregate<float> Telemetry_humidityWindow;
+uint32_t Telemetry_windowEnd = 0;  // millis() of the last reading in the windows
+
 //
 // Buttons configuration
 //
@@ -23,6 +137,17 @@ EasyButton bt_flash_power(BUTTON_FLASH_POWER_PIN);
 EasyButton bt_switch4_mode(BUTTON_SWITCH4_MODE_PIN);
 
 constexpr uint64_t BUTTON_LONG_PRESS_TIME = 2000;  // 2 seconds
+// loop() polls the buttons at this rate while a press is pending, it blocks otherwise
+constexpr uint32_t BUTTON_POLL_INTERVAL = 10;  // 10 milliseconds
+// Longer than the EasyButton debounce time, 35 ms by default
+constexpr uint32_t BUTTON_DEBOUNCE_TIME = 50;  // 50 milliseconds
+
+// Task running loop(), woken by the button interrupts
+TaskHandle_t Button_task = nullptr;
+// millis() of the last button interrupt
+uint32_t Button_lastEdge = 0;
+// A button without interrupt support is polled all the time
+bool Button_polled = false;
 
 void bt_flash_power_ISR_handler(void);
 void bt_flash_power_handler_onPressed(void);
@@ -31,55 +156,78 @@ void bt_switch4_mode_ISR_handler(void);
 void bt_switch4_mode_handler_onPressed(void);
 void bt_switch4_mode_handler_onPressedFor(void);
 
-bool switch_state[6] = {false, false, false, false, false, false};
-
-#ifdef BOARD_SUPERMINI
-#define LED_BUILTIN_PIN 8
-#endif
-
 //
 // Main setup
 //
 void setup()
 {
+    BOOT_MARK(SETUP_START);
     Serial.begin(SERIAL_BAUDRATE);
     Serial.println();
 
+#ifdef LOW_POWER_MODE
+    // Every wake takes a sample, only upload wakes go on to start WiFi and ThingsBoard
+    const bool upload = Low_Power_begin();
+    Low_Power_sample();
+    if (!upload) {
+        Low_Power_sleep(Telemetry_buffer);
+    }
+#endif
+
+    Button_task = xTaskGetCurrentTaskHandle();
+    Task_setupButton();
     bt_flash_power.begin();
     bt_flash_power.onPressed(bt_flash_power_handler_onPressed);
     bt_flash_power.onPressedFor(BUTTON_LONG_PRESS_TIME, bt_flash_power_handler_onPressedFor);
     if (bt_flash_power.supportsInterrupt()) {
         bt_flash_power.enableInterrupt(bt_flash_power_ISR_handler);
+    } else {
+        Button_polled = true;
     }
     bt_switch4_mode.begin();
     bt_switch4_mode.onPressed(bt_switch4_mode_handler_onPressed);
     bt_switch4_mode.onPressedFor(BUTTON_LONG_PRESS_TIME, bt_switch4_mode_handler_onPressedFor);
     if (bt_switch4_mode.supportsInterrupt()) {
         bt_switch4_mode.enableInterrupt(bt_switch4_mode_ISR_handler);
+    } else {
+        Button_polled = true;
     }
 
-#ifdef BOARD_SUPERMINI
-    pinMode(LED_BUILTIN_PIN, OUTPUT);
-    digitalWrite(LED_BUILTIN_PIN, HIGH);  // Turn off the LED
-#endif
+    // Actuator outputs start switched off
+    for (uint8_t i = 0; i < ACTUATOR_COUNT; i++) {
+        if (ACTUATORS[i].pin != ACTUATOR_NO_PIN) {
+            pinMode(ACTUATORS[i].pin, OUTPUT);
+            digitalWrite(ACTUATORS[i].pin, ACTUATORS[i].activeLow ? HIGH : LOW);
+        }
+    }
+
+    Events_setup();
 
     // Create tasks for WiFi
-    xTaskCreate(WiFi_task,   /* Task function. */
-                "WiFi_task", /* String with name of task. */
-                8192,        /* Stack size in bytes. */
-                NULL,        /* Parameter passed as input of the task */
-                1,           /* Priority of the task. */
-                NULL);       /* Task handle. */
+    Task_create(TASK_WIFI, WiFi_task, &WiFi_taskHandle);
+    BOOT_MARK(WIFI_TASK_CREATED);
 
     vTaskDelay(500 / portTICK_PERIOD_MS);
 
     // Create tasks for ThingsBoard
-    xTaskCreate(ThingsBoard_task,   /* Task function. */
-                "ThingsBoard_task", /* String with name of task. */
-                8192,               /* Stack size in bytes. */
-                NULL,               /* Parameter passed as input of the task */
-                1,                  /* Priority of the task. */
-                NULL);              /* Task handle. */
+    Task_create(TASK_THINGSBOARD, ThingsBoard_task, &ThingsBoard_taskHandle);
+
+#ifndef LOW_POWER_MODE
+    // Create tasks for the sensor
+    Task_create(TASK_SENSOR, Sensor_task, &Sensor_taskHandle);
+#endif
+    Task_printTopology();
+
+    Memory_watchTask(Button_task, TASK_BUTTON.stackSize);
+    Memory_watchTask(WiFi_taskHandle, TASK_WIFI.stackSize);
+    Memory_watchTask(ThingsBoard_taskHandle, TASK_THINGSBOARD.stackSize);
+    Memory_watchTask(Sensor_taskHandle, TASK_SENSOR.stackSize);
+    Memory_watchTask(Events_socketWatcher, TASK_EVENTS.stackSize);
+    Memory_printBudget();
+#ifdef TASK_LATENCY_BENCHMARK
+    Latency_benchmarkBegin(Button_task);
+#endif
+    BOOT_MARK(SETUP_END);
 }
 
 //
@@ -90,11 +238,11 @@ void WiFi_task(void* pvParameters)
     Serial.println("WiFi_task()");
 
     WiFi_setup();
+    Time_setup();
+    BOOT_MARK(WIFI_SETUP_DONE);
 
     for (;;) {
-        if (WiFi.status() != WL_CONNECTED) {
-            WiFi_connect();
-        }
+        WiFi_connect();
         if (WiFi.status() == WL_CONNECTED) {
             if (WiFi.status() != lastWiFiStatus) {
                 // Serial.println();
@@ -109,20 +257,100 @@ void WiFi_task(void* pvParameters)
     vTaskDelete(NULL);
 }
 
+//
+// Task of sensor sampling
+//
+void Sensor_task(void* pvParameters)
+{
+    Serial.println("Sensor_task()");
+
+    uint32_t queued = 0;
+    for (;;) {
+        Sensor_Reading reading;
+        reading.timestamp = millis();
+        Sensor_read(reading.temperature, reading.humidity);
+        // Dropped if the ThingsBoard task falls behind, counted by the queue
+        if (Sensor_readings.push(reading) && ++queued == SENSOR_READING_QUEUE_SIZE / 2) {
+            queued = 0;
+            Events_signal(EVENT_SENSOR_READINGS);
+        }
+        vTaskDelay(Sensor_interval.load() / portTICK_PERIOD_MS);
+    }
+    vTaskDelete(NULL);
+}
+
 //
 // Task of ThingsBoard connection management
 //
 void ThingsBoard_task(void* pvParameters)
 {
     Serial.println("ThingsBoard_task()");
+    BOOT_MARK(THINGSBOARD_TASK_START);
 
     ThingsBoard_setup();
+    Sensor_interval = Sensor_sampleInterval.get();
+    Telemetry_buffer.begin();
+    Upload_begin();
+    Publish_pipeline.setAckObserver(ThingsBoard_telemetryAcked);
+    WiFi_client.observePublishes(Latency_published);
+    OTA_update.begin();
+
+#ifdef LOW_POWER_MODE
+    // The samples were taken on the previous wakes, nothing is sampled while uploading
+    Low_Power_restore(Telemetry_buffer);
+    bool lowPowerReported = false;
+#else
+    Telemetry_timer =
+        Events_startTimer("telemetry", Telemetry_sampleInterval.get(), EVENT_TELEMETRY_DUE);
+    Events_signal(EVENT_TELEMETRY_DUE);
+#endif
+    Events_startTimer("memory", MEMORY_REPORT_INTERVAL, EVENT_MEMORY_DUE);
+    // Static attributes go out once per session, switch states whenever they are dirty
+    bool staticAttributesSent = false;
 
     for (;;) {
-        vTaskDelay(10 / portTICK_PERIOD_MS);
+#ifdef LOW_POWER_MODE
+        // Checked before blocking, so the wake ends as soon as the last PUBACK has been read
+        if (Low_Power_uploadFinished(currentThingsBoardConnectionStatus && lowPowerReported &&
+                                     staticAttributesSent && Telemetry_buffer.empty() &&
+                                     !OTA_update.active())) {
+            ThingsBoard_sleep();
+        }
+#endif
+        const EventBits_t events = Events_wait(EVENT_ALL, ThingsBoard_nextWakeup());
+
+        if (events & EVENT_DEVICE) {
+            ThingsBoard_processDeviceEvents();
+        }
+#ifdef TASK_LATENCY_BENCHMARK
+        uint32_t receivedAt = 0;
+        if ((events & EVENT_MQTT_RX) && Latency_takeRpc(receivedAt)) {
+            // Handled by the switch_set callback, only Latency_rpc records it
+            JsonDocument params;
+            params[ACTUATORS[0].key] = !switch_state[0];
+            JsonDocument response;
+            Latency_synthetic = true;
+            processSwitchStateRPC(params.as<JsonVariantConst>(), response);
+            Latency_synthetic = false;
+            LATENCY_RECORD_RPC(micros() - receivedAt);
+        }
+#endif
+
+        // Close the telemetry window, reported windows are kept in the store-and-forward buffer
+        // until they have been sent
+        ThingsBoard_aggregateReadings();
+        if (events & EVENT_TELEMETRY_DUE) {
+            ThingsBoard_sampleTelemetry();
+        }
+
+        // Settings changed over MQTT, written once they stopped changing
+        ThingsBoard_settings.commitIfSettled(SETTINGS_COMMIT_DELAY, millis());
 
         // WiFi status
         if (WiFi.status() != WL_CONNECTED) {
+            if (currentThingsBoardConnectionStatus) {
+                ThingsBoard_reconnect.lost(millis());
+            }
             currentThingsBoardConnectionStatus = false;
             continue;
         }
@@ -134,6 +362,11 @@ void ThingsBoard_task(void* pvParameters)
         if (currentThingsBoardConnectionStatus != lastThingsBoardConnectionStatus) {
             if (currentThingsBoardConnectionStatus) {
                 Serial.println("Connected to ThingsBoard");
+                ThingsBoard_renderIdentity();
+                // Whatever was in flight on the old connection is sent again
+                Publish_pipeline.reset();
+                OTA_update.connected();
+                staticAttributesSent = false;
             } else {
                 Serial.println("Disconnected from ThingsBoard.");
             }
@@ -142,77 +375,571 @@ void ThingsBoard_task(void* pvParameters)
         if (currentThingsBoardConnectionStatus) {
             // Sent telemetry and attributes to ThingsBoard
 
-            static unsigned long _lastSentAttributes = 0;
-            static unsigned long _lastSentTelemitry = 0;
-            if (!currentThingsBoardConnectionStatus) {
-                _lastSentTelemitry = 0;
-            } else {
-                if ((_lastSentAttributes == 0 ||
-                     millis() - _lastSentAttributes > THINGSBOARD_ATTRIBUTE__SEND_INTERVAL) &&
-                    sharedAttributeSubscribed) {
-                    _lastSentAttributes = millis();
-
-                    String hwVersion = DEVICE_HW_VERSION;
-                    String hwSerial = "SO-0001";
-                    String fwVersion = DEVICE_SW_VERSION;
-                    Serial.print("Send attributes: ");
-                    Serial.print(hwVersion);
-                    Serial.print(", ");
-                    Serial.print(hwSerial);
-                    Serial.print(", ");
-                    Serial.print(fwVersion);
-                    Serial.print(", ");
-                    Serial.print(WiFi_ssid);
-                    Serial.print(", ");
-                    Serial.print(WiFi.macAddress());
-                    Serial.print(", ");
-                    Serial.println(WiFi.localIP());
-
-                    // Send device attributes
-                    ThingsBoard_client.sendAttributeData("hwVersion", hwVersion.c_str());
-                    ThingsBoard_client.sendAttributeData("hwSerial", hwSerial.c_str());
-                    ThingsBoard_client.sendAttributeData("fwVersion", fwVersion.c_str());
-                    ThingsBoard_client.sendAttributeData("ssid", WiFi_ssid.c_str());
-                    ThingsBoard_client.sendAttributeData("macAddress",
-                                                         String(WiFi.macAddress()).c_str());
-                    ThingsBoard_client.sendAttributeData("ipAddress",
-                                                         String(WiFi.localIP().toString()).c_str());
-
-                    Serial.println("Send switch states");
-
-                    // Send switch states
-                    ThingsBoard_client.sendAttributeData("switch_state_0", switch_state[0]);
-                    ThingsBoard_client.sendAttributeData("switch_state_1", switch_state[1]);
-                    ThingsBoard_client.sendAttributeData("switch_state_2", switch_state[2]);
-                    ThingsBoard_client.sendAttributeData("switch_state_3", switch_state[3]);
-                    ThingsBoard_client.sendAttributeData("switch_state_4", switch_state[4]);
-                    ThingsBoard_client.sendAttributeData("switch_state_5", switch_state[5]);
+            if (sharedAttributeSubscribed && (!staticAttributesSent || Device_isDirty())) {
+                uint32_t published = 0;
+                if (ThingsBoard_sendAttributes(!staticAttributesSent, published)) {
+                    staticAttributesSent = true;
                 }
+            }
 
-                if (_lastSentTelemitry == 0 ||
-                    millis() - _lastSentTelemitry > THINGSBOARD_TELEMETRY_SEND_INTERVAL) {
-                    _lastSentTelemitry = millis();
-
-                    float temperature = 24.0 + (rand() % 100) / 10.0;
-                    float humidity = 50.0 + (rand() % 100) / 10.0;
-                    Serial.print("Send telemetry: ");
-                    Serial.print(temperature);
-                    Serial.print(", ");
-                    Serial.print(humidity);
-                    Serial.print(", ");
-                    Serial.println(WiFi.RSSI());
-                    ThingsBoard_client.sendTelemetryData("temperature", temperature);
-                    ThingsBoard_client.sendTelemetryData("humidity", humidity);
-                    ThingsBoard_client.sendTelemetryData("rssi", WiFi.RSSI());
+#ifdef LOW_POWER_MODE
+            // The radio is only up for the upload, everything goes out at once
+            ThingsBoard_uploadBurst();
+#else
+            // Bursts sized by the link quality, see Upload_Controller.h
+            if (Upload_controller.due(ThingsBoard_pendingTelemetry(), TELEMETRY_BUFFER_CAPACITY,
+                                      millis()) &&
+                ThingsBoard_uploadBurst()) {
+                Upload_controller.drained(millis());
+            }
+#endif
+            BOOT_PUBLISH_TIMELINE(Telemetry_batch);
+#ifdef LOW_POWER_MODE
+            if (!lowPowerReported) {
+                Low_Power_report(Telemetry_batch);
+                lowPowerReported = Telemetry_batch.flush();
+            }
+#endif
+
+            if (events & EVENT_MEMORY_DUE) {
+                Memory_report(Telemetry_batch);
+                Latency_report(Telemetry_batch);
+                Telemetry_batch.flush();
+                Telemetry_batch.resetStats();
+                Publish_pipeline.printStats(millis());
+                if (Telemetry_lateSamples > 0) {
+                    Serial.printf("Telemetry: %u sample(s) waited too long for the system time\n",
+                                  static_cast<unsigned>(Telemetry_lateSamples));
+                    Telemetry_lateSamples = 0;
                 }
+                WiFi_client.printStats();
+                Upload_controller.printStats();
+                OTA_update.printStats();
             }
         }
 
         ThingsBoard_client.loop();
+        if (ThingsBoard_client.connected()) {
+            // PUBACKs read by the client release the samples, overdue messages are sent again
+            Publish_pipeline.poll(Telemetry_buffer, millis());
+            // Firmware chunks were written as the client read them
+            OTA_update.poll(millis());
+            Events_watchSocket(WiFi_client.fd());
+        } else {
+            if (currentThingsBoardConnectionStatus) {
+                // Spread the reconnects of all devices that lost the broker at the same time
+                ThingsBoard_reconnect.lost(millis());
+            }
+            currentThingsBoardConnectionStatus = false;
+        }
     }
     vTaskDelete(NULL);
 }
 
+/// @brief How long the ThingsBoard task may block when no event arrives
+/// @return Timeout in milliseconds
+uint32_t ThingsBoard_nextWakeup()
+{
+    const uint32_t wakeup = ThingsBoard_connectionWakeup();
+#ifdef LOW_POWER_MODE
+    // Waits for events like the always on mode, up to the end of the upload wake
+    return std::min(wakeup, Low_Power_uploadRemaining());
+#else
+    return wakeup;
+#endif
+}
+
+/// @brief How long the ThingsBoard task may block for the connection and the uploads
+/// @return Timeout in milliseconds
+uint32_t ThingsBoard_connectionWakeup()
+{
+    if (WiFi.status() != WL_CONNECTED) {
+        return UINT32_MAX;
+    }
+    if (!currentThingsBoardConnectionStatus) {
+        // Connecting and subscribing take several steps, retries are scheduled by
+        // ThingsBoard_reconnect
+        const uint32_t remaining = ThingsBoard_reconnect.remaining(millis());
+        return remaining == 0 ? THINGSBOARD_CONNECT_STEP_INTERVAL : remaining;
+    }
+    if (WiFi_client.buffered() > 0) {
+        // Read ahead or decrypted already, the socket does not become readable for it again
+        return 0;
+    }
+    // PUBACKs arrive on the socket, only retransmits and the next burst have to be timed
+    uint32_t wakeup =
+        std::min(Publish_pipeline.remaining(millis()), THINGSBOARD_KEEPALIVE_INTERVAL);
+    if (!Publish_pipeline.full()) {
+        const uint32_t wait = ThingsBoard_telemetryWait();
+        wakeup = std::min(wakeup, wait > 0 ? wait
+                                           : Upload_controller.remaining(
+                                                 ThingsBoard_pendingTelemetry(),
+                                                 TELEMETRY_BUFFER_CAPACITY, millis()));
+    }
+    return std::min(wakeup, OTA_update.remaining(millis()));
+}
+
+/// @brief Read the sensor, simulated by slowly drifting readings with an occasional step
+void Sensor_read(float& temperature, float& humidity)
+{
+    // Kept over deep sleep, so the readings keep drifting in low power mode
+    RTC_DATA_ATTR static float _temperature = 24.0;
+    RTC_DATA_ATTR static float _humidity = 55.0;
+    _temperature += (rand() % 21 - 10) / 1500.0;
+    _humidity += (rand() % 21 - 10) / 600.0;
+    if (rand() % 6000 == 0) {
+        _temperature += rand() % 2 == 0 ? 2.0 : -2.0;
+    }
+    _temperature = constrain(_temperature, 15.0f, 35.0f);
+    _humidity = constrain(_humidity, 20.0f, 80.0f);
+    temperature = _temperature;
+    humidity = _humidity;
+}
+
+/// @brief Add the queued sensor readings to the current telemetry window
+void ThingsBoard_aggregateReadings()
+{
+    Sensor_Reading reading;
+    while (Sensor_readings.pop(reading)) {
+        Telemetry_temperatureWindow.add(reading.temperature);
+        Telemetry_humidityWindow.add(reading.humidity);
+        Telemetry_windowEnd = reading.timestamp;
+    }
+}
+
+/// @brief Window statistics in hundredths of the unit
+Telemetry_Window Telemetry_toWindow(const Window_Aggregate<float>& aggregate)
+{
+    const auto hundredths = [](float value) {
+        return static_cast<int16_t>(lroundf(constrain(value * 100.0f, -32767.0f, 32767.0f)));
+    };
+    Telemetry_Window window;
+    window.min = hundredths(aggregate.min());
+    window.max = hundredths(aggregate.max());
+    window.last = hundredths(aggregate.last());
+    window.stddev = static_cast<uint16_t>(hundredths(aggregate.stddev()));
+    return window;
+}
+
+/// @brief Close the telemetry window and buffer the statistics that have to be reported
+void ThingsBoard_sampleTelemetry()
+{
+    if (Telemetry_temperatureWindow.empty()) {
+        return;
+    }
+    const float values[TELEMETRY_KEY_COUNT] = {Telemetry_temperatureWindow.mean(),
+                                               Telemetry_humidityWindow.mean(),
+                                               static_cast<float>(WiFi.RSSI())};
+    Upload_controller.addRssi(values[TELEMETRY_KEY_RSSI]);
+    const uint8_t reported = Telemetry_filter.report(values, millis());
+    if (reported != 0) {
+        Telemetry_Sample sample;
+        sample.timestamp = Telemetry_windowEnd;
+        sample.temperature = values[TELEMETRY_KEY_TEMPERATURE];
+        sample.humidity = values[TELEMETRY_KEY_HUMIDITY];
+        sample.rssi = static_cast<int16_t>(values[TELEMETRY_KEY_RSSI]);
+        sample.count = static_cast<uint16_t>(std::min<uint32_t>(
+            Telemetry_temperatureWindow.count(), UINT16_MAX));
+        sample.reported = reported;
+        sample.temperatureWindow = Telemetry_toWindow(Telemetry_temperatureWindow);
+        sample.humidityWindow = Telemetry_toWindow(Telemetry_humidityWindow);
+        Serial.printf("Report telemetry: %.2f, %.2f, %d over %u reading(s) (mask 0x%02x)\n",
+                      sample.temperature, sample.humidity, sample.rssi,
+                      static_cast<unsigned>(sample.count), reported);
+        Telemetry_buffer.push(sample);
+    }
+    Telemetry_temperatureWindow.reset();
+    Telemetry_humidityWindow.reset();
+
+    static unsigned long _lastFilterReport = 0;
+    if (millis() - _lastFilterReport >= 60000) {
+        _lastFilterReport = millis();
+        Serial.printf("Telemetry windows reported in the last minute: %u of %u, %u reading(s) "
+                      "dropped\n",
+                      static_cast<unsigned>(Telemetry_filter.reported()),
+                      static_cast<unsigned>(Telemetry_filter.evaluated()),
+                      static_cast<unsigned>(Sensor_readings.overflows()));
+        Telemetry_filter.resetStats();
+    }
+}
+
+#ifdef LOW_POWER_MODE
+/// @brief Take the reading of this wake into RTC memory, every value is reported since the
+/// report filter does not survive deep sleep
+void Low_Power_sample()
+{
+    Telemetry_Sample sample = {};
+    sample.timestamp = Low_Power_now();
+    Sensor_read(sample.temperature, sample.humidity);
+    sample.reported = (1U << TELEMETRY_KEY_TEMPERATURE) | (1U << TELEMETRY_KEY_HUMIDITY);
+    Low_Power_store(sample);
+}
+
+/// @brief End the upload wake, close the session cleanly and sleep until the next sample
+void ThingsBoard_sleep()
+{
+    ThingsBoard_settings.commit();
+    if (ThingsBoard_client.connected()) {
+        ThingsBoard_client.disconnect();
+    }
+    delay(LOW_POWER_LINGER);
+    WiFi.disconnect(true);
+    Low_Power_sleep(Telemetry_buffer);
+}
+#endif
+
+/// @brief Add the window statistics of a key as <key>_min, <key>_max, <key>_last and
+/// <key>_stddev
+void ThingsBoard_addWindow(const char* key, const Telemetry_Window& window)
+{
+    const struct {
+        const char* suffix;
+        float value;
+    } stats[] = {
+        {"min", window.min / 100.0f},
+        {"max", window.max / 100.0f},
+        {"last", window.last / 100.0f},
+        {"stddev", window.stddev / 100.0f},
+    };
+    for (const auto& stat : stats) {
+        char name[32];
+        snprintf(name, sizeof(name), "%s_%s", key, stat.suffix);
+        Telemetry_batch.add(name, stat.value);
+    }
+}
+
+// Press latencies in the last telemetry message reporting them and the packet id of that message
+Latency_Stats ThingsBoard_pressReported;
+uint16_t ThingsBoard_pressPacketId = 0;
+
+/// @brief Publish_Pipeline acknowledgement observer
+void ThingsBoard_telemetryAcked(uint16_t packetId, uint32_t latencyMs)
+{
+    Upload_ackLatency(latencyMs);
+    if (ThingsBoard_pressReported.count > 0 && packetId == ThingsBoard_pressPacketId) {
+        Device_pressLatency.remove(ThingsBoard_pressReported);
+        ThingsBoard_pressReported.reset();
+    }
+}
+
+/// @brief Number of buffered telemetry samples not sent yet
+size_t ThingsBoard_pendingTelemetry()
+{
+    return Publish_pipeline.pending(Telemetry_buffer.first(), Telemetry_buffer.size());
+}
+
+/// @brief Send buffered telemetry until the publish pipeline is full or nothing more goes out
+/// @return Whether the pass ended the burst, false if it waits for the pipeline to open
+bool ThingsBoard_uploadBurst()
+{
+    while (!Publish_pipeline.full() && ThingsBoard_sendBufferedTelemetry() > 0) {
+    }
+    // Samples held back by the clock or a failed publish wait for the next burst, not in a loop
+    return !Publish_pipeline.full();
+}
+
+/// @brief Milliseconds until the oldest buffered sample not in flight yet can be sent, see
+/// Telemetry_clockWait()
+/// @return UINT32_MAX if it is late and waits for the messages in flight to be dropped
+uint32_t ThingsBoard_telemetryWait()
+{
+    const uint32_t first = Publish_pipeline.next(Telemetry_buffer.first());
+    Telemetry_Sample sample;
+    if (Telemetry_buffer.peek(&sample, 1, first - Telemetry_buffer.first()) == 0) {
+        return 0;
+    }
+    if (Payload_Encoder::NEEDS_TIMESTAMPS && Telemetry_late(sample) &&
+        Publish_pipeline.inFlight() > 0) {
+        return UINT32_MAX;
+    }
+    return Telemetry_clockWait(sample, Payload_Encoder::NEEDS_TIMESTAMPS);
+}
+
+/// @brief Drop the late samples at the head of the buffer, the payload cannot carry them without
+/// their timestamp. Nothing may be in flight, the buffer only releases its oldest samples.
+void ThingsBoard_dropLateTelemetry()
+{
+    size_t late = 0;
+    Telemetry_Sample sample;
+    while (Telemetry_buffer.peek(&sample, 1, late) == 1 && Telemetry_late(sample)) {
+        late++;
+    }
+    if (late == 0) {
+        return;
+    }
+    Telemetry_buffer.release(Telemetry_buffer.first() + late);
+    Telemetry_lateSamples += late;
+    Serial.printf("Dropped %u sample(s) that waited too long for the system time\n",
+                  static_cast<unsigned>(late));
+}
+
+/// @brief Send the oldest buffered telemetry samples not in flight yet through the publish
+/// pipeline, they are removed from the buffer once their messages have been acknowledged
+/// @return Number of samples sent
+size_t ThingsBoard_sendBufferedTelemetry()
+{
+    if (Publish_pipeline.full() || ThingsBoard_telemetryWait() > 0) {
+        // Samples wait for the clock, they cannot be sent without their time
+        return 0;
+    }
+    if (Payload_Encoder::NEEDS_TIMESTAMPS) {
+        ThingsBoard_dropLateTelemetry();
+    }
+    const uint32_t first = Publish_pipeline.next(Telemetry_buffer.first());
+    Telemetry_Sample samples[THINGSBOARD_TELEMETRY_DRAIN_BATCH];
+    size_t count = Telemetry_buffer.peek(samples, THINGSBOARD_TELEMETRY_DRAIN_BATCH,
+                                         first - Telemetry_buffer.first());
+    // A sample neither fresh nor late waits for the clock, with the samples behind it
+    size_t sendable = 0;
+    while (sendable < count &&
+           Telemetry_clockWait(samples[sendable], Payload_Encoder::NEEDS_TIMESTAMPS) == 0) {
+        sendable++;
+    }
+    count = sendable;
+    if (count == 0) {
+        return 0;
+    }
+
+    Telemetry_batch.setPublisher(Publish_telemetry);
+    bool sent = true;
+    const uint32_t now = millis();
+    const uint64_t nowMs = Time_epochMs();
+    for (size_t i = 0; i < count; i++) {
+        // A message flushed from here on holds the samples before this one
+        Publish_pipeline.mark(first + i);
+        const uint64_t ts = Telemetry_sampleEpochMs(samples[i].timestamp, nowMs, now);
+        if (ts != 0) {
+            Telemetry_batch.beginEntry(ts);
+        } else {
+            // Without wall clock time the server stamps the values, one sample per message
+            sent &= Telemetry_batch.flush();
+        }
+        const uint8_t reported = samples[i].reported;
+        const bool windowed = samples[i].count > 0;
+        if (reported & (1U << TELEMETRY_KEY_TEMPERATURE)) {
+            const char* key = Telemetry_filter.policy(TELEMETRY_KEY_TEMPERATURE).key;
+            Telemetry_batch.add(key, samples[i].temperature);
+            if (windowed) {
+                ThingsBoard_addWindow(key, samples[i].temperatureWindow);
+            }
+        }
+        if (reported & (1U << TELEMETRY_KEY_HUMIDITY)) {
+            const char* key = Telemetry_filter.policy(TELEMETRY_KEY_HUMIDITY).key;
+            Telemetry_batch.add(key, samples[i].humidity);
+            if (windowed) {
+                ThingsBoard_addWindow(key, samples[i].humidityWindow);
+            }
+        }
+        if (reported & (1U << TELEMETRY_KEY_RSSI)) {
+            Telemetry_batch.add(Telemetry_filter.policy(TELEMETRY_KEY_RSSI).key, samples[i].rssi);
+        }
+        if (windowed && (reported & ((1U << TELEMETRY_KEY_TEMPERATURE) |
+                                     (1U << TELEMETRY_KEY_HUMIDITY)))) {
+            Telemetry_batch.add("readings", samples[i].count);
+        }
+    }
+    Publish_pipeline.mark(first + count);
+    const Latency_Stats pressLatency = Device_pressLatency;
+    const bool withLatency = pressLatency.count > 0;
+    if (withLatency) {
+        Telemetry_batch.add("press_count", pressLatency.count);
+        Telemetry_batch.add("press_latency_mean_us", pressLatency.mean());
+        Telemetry_batch.add("press_latency_max_us", pressLatency.max);
+    }
+    const bool flushed = !Publish_pipeline.full();
+    if (flushed) {
+        sent &= Telemetry_batch.flush();
+    } else {
+        // The rest waits for the window to open, it is rendered again then
+        Telemetry_batch.discard();
+    }
+    Telemetry_batch.setPublisher(nullptr);
+
+    const size_t published = Publish_pipeline.next(Telemetry_buffer.first()) - first;
+    if (published > 0) {
+        BOOT_MARK(FIRST_TELEMETRY);
+    }
+    for (size_t i = 0; i < published && i < count; i++) {
+        Telemetry_lateSamples += Telemetry_late(samples[i]) ? 1 : 0;
+    }
+    if (flushed && sent && published == count && withLatency) {
+        // Removed from the statistics once the PUBACK arrives, see ThingsBoard_telemetryAcked()
+        ThingsBoard_pressReported = pressLatency;
+        ThingsBoard_pressPacketId = Publish_pipeline.lastPacketId();
+    }
+    Serial.printf("Sent %u buffered sample(s) in %u message(s), %u bytes, %u in flight, %u "
+                  "pending\n",
+                  static_cast<unsigned>(published),
+                  static_cast<unsigned>(Telemetry_batch.publishes()),
+                  static_cast<unsigned>(Telemetry_batch.bytes()),
+                  static_cast<unsigned>(Publish_pipeline.inFlight()),
+                  static_cast<unsigned>(Telemetry_buffer.size()));
+    Telemetry_batch.resetStats();
+    return published;
+}
+
+// Device identity attributes, encoded once per connection
+Payload_Fragment<320> ThingsBoard_identity(Batch_Type::ATTRIBUTES);
+
+/// @brief Encode the identity attributes of the current connection into ThingsBoard_identity
+void ThingsBoard_renderIdentity()
+{
+    const IPAddress ip = WiFi.localIP();
+    char ipAddress[16];
+    snprintf(ipAddress, sizeof(ipAddress), "%u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]);
+
+    const char* const pairs[][2] = {
+        {"hwVersion", DEVICE_HW_VERSION}, {"hwSerial", "SO-0001"},
+        {"fwVersion", DEVICE_SW_VERSION}, {"ssid", WiFi_ssid.c_str()},
+        {"macAddress", deviceMac},        {"ipAddress", ipAddress},
+    };
+    ThingsBoard_identity.clear();
+    for (const auto& pair : pairs) {
+        if (!ThingsBoard_identity.add(pair[0], pair[1])) {
+            // Truncated, publishing a broken document would be worse than none
+            ThingsBoard_identity.clear();
+            Serial.println("Identity attributes do not fit into their buffer");
+            return;
+        }
+    }
+    Serial.printf("Identity attributes: %u bytes\n",
+                  static_cast<unsigned>(ThingsBoard_identity.length()));
+}
+
+/// @brief Publish the dirty switch states, and the cached identity attributes if asked to, as
+/// one batched message without heap allocations. Switches that fail to publish stay dirty.
+/// @param published Bitmask of the switches published
+/// @return false if the message failed to publish
+bool ThingsBoard_sendAttributes(bool withStatic, uint32_t& published)
+{
+    if (withStatic && !ThingsBoard_identity.empty()) {
+        Attribute_batch.addFragment(ThingsBoard_identity.data(), ThingsBoard_identity.length());
+    }
+
+    const uint32_t dirty = Device_takeDirty();
+    for (uint8_t i = 0; i < SWITCH_COUNT; i++) {
+        if (dirty & (1U << i)) {
+            Serial.printf("Send %s: %s\n", ACTUATORS[i].key, switch_state[i] ? "true" : "false");
+            Attribute_batch.add(ACTUATORS[i].key, switch_state[i]);
+        }
+    }
+
+    const bool sent = Attribute_batch.flush();
+    if (!sent) {
+        Device_restoreDirty(dirty);
+    }
+    Serial.printf("Sent attributes in %u message(s), %u bytes\n",
+                  static_cast<unsigned>(Attribute_batch.publishes()),
+                  static_cast<unsigned>(Attribute_batch.bytes()));
+    Attribute_batch.resetStats();
+    published = sent ? dirty : 0;
+    return sent;
+}
+
+/// @brief Apply the queued device events. Toggles of the same switch are coalesced and the
+/// resulting switch states are published in one message.
+void ThingsBoard_processDeviceEvents()
+{
+    uint8_t toggles[SWITCH_COUNT] = {};
+    uint32_t queuedAt[SWITCH_COUNT] = {};
+    // The first toggle of the switch came from the latency benchmark
+    bool synthetic[SWITCH_COUNT] = {};
+
+    Device_Event event;
+    while (Device_events.pop(event)) {
+        switch (event.type) {
+            case Device_Event_Type::SWITCH_TOGGLE:
+            case Device_Event_Type::SYNTHETIC_TOGGLE:
+                if (event.channel >= SWITCH_COUNT) {
+                    break;
+                }
+                if (toggles[event.channel] == 0) {
+                    queuedAt[event.channel] = event.timestamp;
+                    synthetic[event.channel] =
+                        event.type == Device_Event_Type::SYNTHETIC_TOGGLE;
+                }
+                toggles[event.channel]++;
+                break;
+            case Device_Event_Type::LONG_PRESS:
+                Serial.printf("Button %u has been pressed for %u secs!\n", event.channel,
+                              static_cast<unsigned>(BUTTON_LONG_PRESS_TIME / 1000));
+                break;
+        }
+    }
+
+    for (uint8_t i = 0; i < SWITCH_COUNT; i++) {
+        // An even number of toggles leaves the switch as it was
+        if (toggles[i] % 2 != 0) {
+            setSwitchState(i, !switch_state[i]);
+        }
+    }
+    if (!Device_isDirty() || !currentThingsBoardConnectionStatus || !sharedAttributeSubscribed) {
+        // Published once the connection is back
+        return;
+    }
+
+    uint32_t published = 0;
+    ThingsBoard_sendAttributes(false, published);
+    const uint32_t now = micros();
+    bool measured = false;
+    for (uint8_t i = 0; i < SWITCH_COUNT; i++) {
+        if (toggles[i] % 2 == 0 || !(published & (1U << i))) {
+            continue;
+        }
+        if (synthetic[i]) {
+            LATENCY_RECORD_PRESS(now - queuedAt[i]);
+            continue;
+        }
+        Device_pressLatency.add(now - queuedAt[i]);
+        measured = true;
+    }
+    if (measured) {
+        Serial.printf("Button press to publish latency: mean %u us, max %u us\n",
+                      static_cast<unsigned>(Device_pressLatency.mean()),
+                      static_cast<unsigned>(Device_pressLatency.max));
+    }
+}
+
+/// @brief Set a switch and drive its output, a change is marked for publishing
+void setSwitchState(uint8_t i, bool state)
+{
+    if (i >= SWITCH_COUNT) {
+        return;
+    }
+    if (switch_state[i] != state) {
+        Device_markDirty(i);
+    }
+    switch_state[i] = state;
+    if (ACTUATORS[i].pin != ACTUATOR_NO_PIN) {
+        digitalWrite(ACTUATORS[i].pin, state != ACTUATORS[i].activeLow ? HIGH : LOW);
+    }
+}
+
+/// @brief Change the telemetry sample interval, it is persisted by the settings commit
+void setTelemetryInterval(uint32_t interval)
+{
+    interval = constrain(interval, THINGSBOARD_TELEMETRY_SAMPLE_INTERVAL_MIN,
+                         THINGSBOARD_TELEMETRY_SAMPLE_INTERVAL_MAX);
+    if (!Telemetry_sampleInterval.set(interval)) {
+        return;
+    }
+    Serial.printf("Telemetry sample interval: %u ms\n", static_cast<unsigned>(interval));
+    if (Telemetry_timer != nullptr) {
+        xTimerChangePeriod(Telemetry_timer, pdMS_TO_TICKS(interval), portMAX_DELAY);
+    }
+}
+
+/// @brief Change the sensor read interval, it is persisted by the settings commit
+void setSensorInterval(uint32_t interval)
+{
+    interval = constrain(interval, SENSOR_SAMPLE_INTERVAL_MIN, SENSOR_SAMPLE_INTERVAL_MAX);
+    if (!Sensor_sampleInterval.set(interval)) {
+        return;
+    }
+    Serial.printf("Sensor sample interval: %u ms\n", static_cast<unsigned>(interval));
+    Sensor_interval = interval;
+}
+
 /// @brief Processes function for RPC call "switch_set"
 /// JsonVariantConst is a JSON variant, that can be queried using operator[]
 /// See https://arduinojson.org/v5/api/jsonvariant/subscript/ for more details
@@ -221,30 +948,25 @@ void ThingsBoard_task(void* pvParameters)
 /// sent to the cloud. Useful for getMethods
 void processSwitchStateRPC(const JsonVariantConst& params, JsonDocument& response)
 {
+    const uint32_t dispatchedAt = Latency_dispatched(Latency_Stage::RPC_DISPATCH);
     Serial.println("Received the switch set method");
 
     JsonObjectConst json = params.as<JsonObjectConst>();
 
     for (JsonPairConst kv : json) {
-        String key = kv.key().c_str();
-
-        if (key.startsWith("switch_state_")) {
-            bool state = kv.value().as<bool>();
-
-            Serial.printf("Switch %s state: %s\n", key.c_str(), state ? "true" : "false");
+        const int i = Actuator_find(kv.key().c_str());
+        if (i < 0) {
+            Serial.printf("Unknown switch %s\n", kv.key().c_str());
+            continue;
+        }
+        bool state = kv.value().as<bool>();
 
-            int i = key.substring(strlen("switch_state_")).toInt();
-            switch_state[i] = state;
+        Serial.printf("Switch %s state: %s\n", ACTUATORS[i].key, state ? "true" : "false");
 
-#ifdef BOARD_SUPERMINI
-            if (i == 0) {
-                digitalWrite(LED_BUILTIN_PIN, switch_state[i] ? LOW : HIGH);
-            }
-#endif
-            ThingsBoard_client.sendAttributeData(key.c_str(), switch_state[i]);
-            response.set(switch_state[i]);
-        }
+        setSwitchState(i, state);
+        response.set(switch_state[i]);
     }
+    Latency_actuated(dispatchedAt);
 }
 
 /// @brief Update callback that will be called as soon as one of the provided shared attributes
@@ -252,78 +974,134 @@ void processSwitchStateRPC(const JsonVariantConst& params, JsonDocument& respons
 /// @param json Data containing the shared attributes that were changed and their current value
 void processSharedAttributeUpdate(const JsonObjectConst& json)
 {
+    const uint32_t dispatchedAt = Latency_dispatched(Latency_Stage::ATTR_DISPATCH);
     Serial.println("Received shared attribute update");
+    Upload_Limits limits = Upload_controller.limits();
+    bool limitsChanged = false;
+    OTA_Firmware firmware = {};
+    bool firmwareChanged = false;
     for (auto it = json.begin(); it != json.end(); ++it) {
-        String key = it->key().c_str();
-        if (key.startsWith("switch_state_")) {
-            Serial.printf("Switch %s state: %s\n", it->key().c_str(),
-                          it->value().as<boolean>() ? "true" : "false");
-            int i = key.substring(strlen("switch_state_")).toInt();
-            switch_state[i] = it->value().as<boolean>();
-#ifdef BOARD_SUPERMINI
-            if (i == 0) {
-                digitalWrite(LED_BUILTIN_PIN, switch_state[i] ? LOW : HIGH);
-            }
-#endif
+        if (strcmp(it->key().c_str(), TELEMETRY_INTERVAL_ATTRIBUTE) == 0) {
+            setTelemetryInterval(it->value().as<uint32_t>());
+            continue;
+        }
+        if (strcmp(it->key().c_str(), SENSOR_INTERVAL_ATTRIBUTE) == 0) {
+            setSensorInterval(it->value().as<uint32_t>());
+            continue;
+        }
+        if (strcmp(it->key().c_str(), UPLOAD_INTERVAL_MIN_ATTRIBUTE) == 0) {
+            limits.minInterval = it->value().as<uint32_t>();
+            limitsChanged = true;
+            continue;
+        }
+        if (strcmp(it->key().c_str(), UPLOAD_INTERVAL_MAX_ATTRIBUTE) == 0) {
+            limits.maxInterval = it->value().as<uint32_t>();
+            limitsChanged = true;
+            continue;
+        }
+        if (strcmp(it->key().c_str(), UPLOAD_BATCH_ATTRIBUTE) == 0) {
+            limits.maxBatch = it->value().as<uint32_t>();
+            limitsChanged = true;
+            continue;
         }
+        if (strncmp(it->key().c_str(), "fw_", 3) == 0) {
+            firmwareChanged |= ThingsBoard_readFirmware(it->key().c_str(), it->value(), firmware);
+            continue;
+        }
+        const int i = Actuator_find(it->key().c_str());
+        if (i < 0) {
+            continue;
+        }
+        Serial.printf("Switch %s state: %s\n", ACTUATORS[i].key,
+                      it->value().as<boolean>() ? "true" : "false");
+        setSwitchState(i, it->value().as<boolean>());
+    }
+    if (limitsChanged) {
+        Upload_setLimits(limits);
+    }
+    if (firmwareChanged) {
+        OTA_update.offer(firmware, millis());
+    }
+    Latency_applied(dispatchedAt);
+}
+
+/// @brief Take one of the fw_* shared attributes describing the assigned firmware
+/// @return false if the key is not one of them
+bool ThingsBoard_readFirmware(const char* key, JsonVariantConst value, OTA_Firmware& firmware)
+{
+    if (strcmp(key, FW_SIZE_ATTRIBUTE) == 0) {
+        firmware.size = value.as<uint32_t>();
+        return true;
     }
+    char* field = nullptr;
+    size_t size = 0;
+    if (strcmp(key, FW_TITLE_ATTRIBUTE) == 0) {
+        field = firmware.title;
+        size = sizeof(firmware.title);
+    } else if (strcmp(key, FW_VERSION_ATTRIBUTE) == 0) {
+        field = firmware.version;
+        size = sizeof(firmware.version);
+    } else if (strcmp(key, FW_CHECKSUM_ATTRIBUTE) == 0) {
+        field = firmware.checksum;
+        size = sizeof(firmware.checksum);
+    } else if (strcmp(key, FW_CHECKSUM_ALGORITHM_ATTRIBUTE) == 0) {
+        field = firmware.algorithm;
+        size = sizeof(firmware.algorithm);
+    } else {
+        return false;
+    }
+    const char* text = value.as<const char*>();
+    strncpy(field, text != nullptr ? text : "", size - 1);
+    field[size - 1] = '\0';
+    return true;
 }
 
 //
-// Button handling
+// Button handling, the handlers run in loop() and only queue events for the ThingsBoard task
 //
 void bt_flash_power_ISR_handler(void)
 {
-    // bt_flash_power->read();
-    bt_flash_power.read();
+    // Defer to loop(), so the button callbacks never run in interrupt context
+    BaseType_t higherPriorityTaskWoken = pdFALSE;
+    vTaskNotifyGiveFromISR(Button_task, &higherPriorityTaskWoken);
+    portYIELD_FROM_ISR(higherPriorityTaskWoken);
 }
 void bt_flash_power_handler_onPressed(void)
 {
-    Serial.println("Button button has been pressed!");
-
-    if (currentThingsBoardConnectionStatus) {
-        u8_t i = 0;
-        switch_state[i] = !switch_state[i];
-
-        char sprintf_buffer[] = "switch_state_x";
-        sprintf(sprintf_buffer, "switch_state_%d", i);
-
-        Serial.printf("Send %s: ", sprintf_buffer);
-        Serial.println(switch_state[i]);
-        ThingsBoard_client.sendAttributeData(sprintf_buffer, switch_state[i]);
-    }
+    Device_postEvent(Device_Event_Type::SWITCH_TOGGLE, 0);
 }
 void bt_flash_power_handler_onPressedFor(void)
 {
-    Serial.print("Button button has been pressed for ");
-    Serial.print(BUTTON_LONG_PRESS_TIME / 1000);
-    Serial.println(" secs!");
+    Device_postEvent(Device_Event_Type::LONG_PRESS, 0);
 }
 void bt_switch4_mode_ISR_handler(void)
 {
-    bt_switch4_mode.read();
+    BaseType_t higherPriorityTaskWoken = pdFALSE;
+    vTaskNotifyGiveFromISR(Button_task, &higherPriorityTaskWoken);
+    portYIELD_FROM_ISR(higherPriorityTaskWoken);
 }
 void bt_switch4_mode_handler_onPressed(void)
 {
-    Serial.println("Button button has been pressed!");
-
-    if (currentThingsBoardConnectionStatus) {
-        u8_t i = 1;
-        switch_state[i] = !switch_state[i];
-
-        char sprintf_buffer[] = "switch_state_x";
-        sprintf(sprintf_buffer, "switch_state_%d", i);
-
-        Serial.printf("Send %s: ", sprintf_buffer);
-        Serial.println(switch_state[i]);
-        ThingsBoard_client.sendAttributeData(sprintf_buffer, switch_state[i]);
-    }
+    Device_postEvent(Device_Event_Type::SWITCH_TOGGLE, 1);
 }
 void bt_switch4_mode_handler_onPressedFor(void)
 {
-    Serial.print("Button button has been pressed for ");
-    Serial.print(BUTTON_LONG_PRESS_TIME / 1000);
-    Serial.println(" secs!");
+    Device_postEvent(Device_Event_Type::LONG_PRESS, 1);
+}
+
+/// @brief Whether loop() has to poll the buttons: an edge is being debounced, or a button is held
+/// and its long press has not been reached yet. Releases are edges, they wake loop() again.
+bool Button_pending()
+{
+    if (Button_polled) {
+        return true;
+    }
+    const uint32_t sinceEdge = millis() - Button_lastEdge;
+    if (sinceEdge < BUTTON_DEBOUNCE_TIME) {
+        return true;
+    }
+    return sinceEdge < BUTTON_LONG_PRESS_TIME + BUTTON_DEBOUNCE_TIME &&
+           (bt_flash_power.isPressed() || bt_switch4_mode.isPressed());
 }
 
 //
@@ -331,12 +1109,19 @@ void bt_switch4_mode_handler_onPressedFor(void)
 //
 void loop()
 {
-    if (bt_flash_power.supportsInterrupt()) {
-        bt_flash_power.update();
+    // Woken by a button interrupt, polls only while a press is debounced or timed
+    const TickType_t wait =
+        Button_pending() ? pdMS_TO_TICKS(BUTTON_POLL_INTERVAL) : portMAX_DELAY;
+    if (ulTaskNotifyTake(pdTRUE, wait) > 0) {
+        Button_lastEdge = millis();
     }
-    if (bt_switch4_mode.supportsInterrupt()) {
-        bt_switch4_mode.update();
+#ifdef TASK_LATENCY_BENCHMARK
+    uint32_t pressedAt = 0;
+    if (Latency_takePress(pressedAt)) {
+        Device_postEvent(Device_Event_Type::SYNTHETIC_TOGGLE, 0, pressedAt);
     }
+#endif
 
-    delay(10);
+    bt_flash_power.read();
+    bt_switch4_mode.read();
 }
@@ -0,0 +1,75 @@
+#include <Arduino.h>
+#include <unity.h>
+
+#include "Actuator_Table.h"
+
+void setUp(void) {}
+
+void tearDown(void) {}
+
+void test_every_key_resolves_to_its_actuator(void)
+{
+    for (uint8_t i = 0; i < ACTUATOR_COUNT; i++) {
+        TEST_ASSERT_EQUAL_INT(i, Actuator_find(ACTUATORS[i].key));
+        // A copy of the key, not the pointer of the table
+        char key[32];
+        strncpy(key, ACTUATORS[i].key, sizeof(key));
+        TEST_ASSERT_EQUAL_INT(i, Actuator_find(key));
+    }
+}
+
+void test_unknown_keys_rejected(void)
+{
+    const char* unknown[] = {
+        "",
+        "switch_state_",
+        "switch_state_6",
+        "switch_state_00",
+        "switch_state_10",
+        "Switch_state_0",
+        "switch_state_0 ",
+        "temperature",
+        "telemetry_interval",
+    };
+    for (const char* key : unknown) {
+        TEST_ASSERT_EQUAL_INT_MESSAGE(-1, Actuator_find(key), key);
+    }
+    TEST_ASSERT_EQUAL_INT(-1, Actuator_find(nullptr));
+}
+
+void test_every_slot_holds_at_most_one_actuator(void)
+{
+    uint8_t occupied = 0;
+    for (size_t slot = 0; slot < ACTUATOR_SLOTS; slot++) {
+        const int8_t index = ACTUATOR_SLOT_INDEX[slot];
+        if (index < 0) {
+            continue;
+        }
+        occupied++;
+        const uint32_t hash = Actuator_hash(ACTUATORS[index].key, ACTUATOR_HASH_SEED);
+        TEST_ASSERT_EQUAL_UINT32(slot, hash & (ACTUATOR_SLOTS - 1U));
+    }
+    TEST_ASSERT_EQUAL_UINT8(ACTUATOR_COUNT, occupied);
+    TEST_ASSERT_TRUE(ACTUATOR_SLOTS >= ACTUATOR_COUNT * 2U);
+}
+
+void test_keys_padded_with_nullptr(void)
+{
+    constexpr std::array<const char*, ACTUATOR_COUNT + 2> keys =
+        Actuator_keys<ACTUATOR_COUNT + 2>();
+    for (uint8_t i = 0; i < ACTUATOR_COUNT; i++) {
+        TEST_ASSERT_EQUAL_STRING(ACTUATORS[i].key, keys[i]);
+    }
+    TEST_ASSERT_TRUE(keys[ACTUATOR_COUNT] == nullptr);
+    TEST_ASSERT_TRUE(keys[ACTUATOR_COUNT + 1] == nullptr);
+}
+
+int main(int argc, char** argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_every_key_resolves_to_its_actuator);
+    RUN_TEST(test_unknown_keys_rejected);
+    RUN_TEST(test_every_slot_holds_at_most_one_actuator);
+    RUN_TEST(test_keys_padded_with_nullptr);
+    return UNITY_END();
+}
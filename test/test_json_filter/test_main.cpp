@@ -0,0 +1,162 @@
+// The keys kept are those of the firmware, built into the test
+#include "../../src/main.cpp"
+
+#include <unity.h>
+
+// Payload of a filtered packet, what is left after the fixed header and the topic
+constexpr size_t TEST_OUTPUT_SIZE = MQTT_FILTERED_PACKET_SIZE - 5 - 2 - 26;
+// Socket reads of MQTT_Transport::filterBody()
+constexpr size_t TEST_CHUNK_SIZE = 64;
+
+const char TEST_KEPT[] = "{\"shared\":{\"switch_state_0\":true,\"telemetry_interval\":5000}}";
+
+Json_Filter Test_jsonFilter;
+char Test_output[TEST_OUTPUT_SIZE];
+
+/// @brief Render a shared attribute response of about the given size, one switch state and the
+/// telemetry interval among unrelated attributes, strings, arrays and nested objects
+size_t Test_document(char* document, size_t size)
+{
+    size_t length = snprintf(document, size, "{\"shared\":{");
+    // Room for one more setting and the closing members
+    for (uint32_t i = 0; length + 160 < size; i++) {
+        switch (i % 4) {
+            case 0:
+                length += snprintf(document + length, size - length, "\"setting_%03u\":\"%032u\",",
+                                   static_cast<unsigned>(i), static_cast<unsigned>(i));
+                break;
+            case 1:
+                length += snprintf(document + length, size - length,
+                                   "\"label_%03u\":\"{\\\"switch_state_0\\\":false}, [\",",
+                                   static_cast<unsigned>(i));
+                break;
+            case 2:
+                length += snprintf(document + length, size - length,
+                                   "\"list_%03u\" : [1, {\"switch_state_0\":false}, \"]\"] ,",
+                                   static_cast<unsigned>(i));
+                break;
+            default:
+                length += snprintf(document + length, size - length,
+                                   "\"config_%03u\":{\"depth\":{\"value\":-1.5e3}},",
+                                   static_cast<unsigned>(i));
+                break;
+        }
+    }
+    length += snprintf(document + length, size - length,
+                       "\"switch_state_0\":true,\n\"telemetry_interval\":5000}}");
+    return length;
+}
+
+/// @brief Filter a document fed in chunks of the given size
+size_t Test_filterChunks(const char* document, size_t length, size_t chunk)
+{
+    Test_jsonFilter.begin(ThingsBoard_keepKey, Test_output, sizeof(Test_output));
+    for (size_t offset = 0; offset < length; offset += chunk) {
+        Test_jsonFilter.feed(reinterpret_cast<const uint8_t*>(document) + offset,
+                         std::min(chunk, length - offset));
+    }
+    return Test_jsonFilter.finish();
+}
+
+size_t Test_filter(const char* document)
+{
+    return Test_filterChunks(document, strlen(document), TEST_CHUNK_SIZE);
+}
+
+void Test_assertKept(const char* expected, size_t length)
+{
+    TEST_ASSERT_EQUAL_UINT32(strlen(expected), length);
+    TEST_ASSERT_EQUAL_MEMORY(expected, Test_output, length);
+}
+
+void setUp(void) {}
+
+void tearDown(void) {}
+
+void test_multi_kb_attributes_filtered(void)
+{
+    const size_t sizes[] = {2048, 4096, 8192, 32768};
+    for (size_t size : sizes) {
+        char* document = static_cast<char*>(malloc(size));
+        const size_t length = Test_document(document, size);
+        TEST_ASSERT_GREATER_THAN(size - 200, length);
+        Test_assertKept(TEST_KEPT, Test_filterChunks(document, length, TEST_CHUNK_SIZE));
+        free(document);
+    }
+}
+
+void test_chunk_boundaries_do_not_matter(void)
+{
+    char document[4096];
+    const size_t length = Test_document(document, sizeof(document));
+    const size_t chunks[] = {1, 2, 3, 7, 63, 64, 65, 1000, sizeof(document)};
+    for (size_t chunk : chunks) {
+        Test_assertKept(TEST_KEPT, Test_filterChunks(document, length, chunk));
+    }
+}
+
+void test_nothing_wanted_leaves_empty_objects(void)
+{
+    Test_assertKept("{}", Test_filter("{\"other\":{\"nested\":{\"value\":1}},\"list\":[1,2]}"));
+    Test_assertKept("{\"shared\":{\"switch_state_1\":false}}",
+                    Test_filter("{\"client\":{\"a\":1},\"shared\":{\"x\":{},"
+                                "\"switch_state_1\":false}}"));
+}
+
+void test_switch_rpc_kept(void)
+{
+    const char request[] = "{\"method\":\"switch_set\",\"params\":{\"switch_state_2\":true}}";
+    Test_assertKept(request, Test_filter(request));
+}
+
+void test_rpc_params_kept_whole(void)
+{
+    const char request[] =
+        "{\"method\":\"getStatus\",\"params\":{\"verbose\":true,\"keys\":[\"a\",\"b\"]},"
+        "\"note\":\"dropped\"}";
+    Test_assertKept("{\"method\":\"getStatus\",\"params\":{\"verbose\":true,\"keys\":[\"a\","
+                    "\"b\"]}}",
+                    Test_filter(request));
+    Test_assertKept("{\"method\":\"reboot\",\"params\":5}",
+                    Test_filter("{\"method\":\"reboot\",\"params\":5}"));
+}
+
+void test_oversized_kept_value_rejected(void)
+{
+    char document[2048];
+    size_t length = snprintf(document, sizeof(document), "{\"method\":\"x\",\"params\":\"");
+    while (length < sizeof(document) - 8) {
+        document[length++] = 'p';
+    }
+    length += snprintf(document + length, sizeof(document) - length, "\"}");
+    TEST_ASSERT_EQUAL_UINT32(0, Test_filterChunks(document, length, TEST_CHUNK_SIZE));
+    TEST_ASSERT_TRUE(Test_jsonFilter.overflowed());
+}
+
+void test_malformed_rejected(void)
+{
+    const char* malformed[] = {
+        "",
+        "[1,2]",
+        "{\"shared\":{\"switch_state_0\":true}",
+        "{\"shared\" {}}",
+        "{\"shared\":{}}}",
+        "{\"shared\":{},}x",
+    };
+    for (const char* document : malformed) {
+        TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, Test_filter(document), document);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_multi_kb_attributes_filtered);
+    RUN_TEST(test_chunk_boundaries_do_not_matter);
+    RUN_TEST(test_nothing_wanted_leaves_empty_objects);
+    RUN_TEST(test_switch_rpc_kept);
+    RUN_TEST(test_rpc_params_kept_whole);
+    RUN_TEST(test_oversized_kept_value_rejected);
+    RUN_TEST(test_malformed_rejected);
+    return UNITY_END();
+}
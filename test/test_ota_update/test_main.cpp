@@ -0,0 +1,329 @@
+// The firmware update of the firmware itself, built into the test
+#include "../../src/main.cpp"
+
+#include <unity.h>
+
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Spans several persisted progress intervals and ends with a partial chunk
+constexpr uint32_t TEST_IMAGE_SIZE = 3 * OTA_PROGRESS_INTERVAL + OTA_CHUNK_SIZE / 2;
+constexpr uint32_t TEST_DOWNLOAD_TIMEOUT = 20000;
+// Round trip of a chunk request to its response
+constexpr uint32_t TEST_ROUND_TRIP = 20;
+constexpr char TEST_VERSION[] = "99.00";
+
+//
+// ThingsBoard stand-in on the loopback interface, it answers the chunk requests from the image
+// TEST_ROUND_TRIP after they arrived and records the fw_state telemetry
+//
+int Test_listener = -1;
+std::vector<uint8_t> Test_image;
+std::mutex Test_mutex;
+std::mutex Test_sendMutex;
+std::vector<std::string> Test_states;
+uint32_t Test_chunkRequests = 0;
+
+/// @brief Read exactly length bytes
+bool Test_receive(int fd, uint8_t* buffer, size_t length)
+{
+    while (length > 0) {
+        const ssize_t count = recv(fd, buffer, length, 0);
+        if (count <= 0) {
+            return false;
+        }
+        buffer += count;
+        length -= count;
+    }
+    return true;
+}
+
+void Test_publish(int fd, const std::string& topic, const uint8_t* payload, size_t length)
+{
+    std::string packet(1, static_cast<char>(MQTT_PUBLISH));
+    size_t remaining = 2 + topic.size() + length;
+    do {
+        const uint8_t byte = remaining & 0x7F;
+        remaining >>= 7;
+        packet += static_cast<char>(remaining > 0 ? byte | 0x80 : byte);
+    } while (remaining > 0);
+    packet += static_cast<char>(topic.size() >> 8);
+    packet += static_cast<char>(topic.size() & 0xFF);
+    packet += topic;
+    packet.append(reinterpret_cast<const char*>(payload), length);
+    std::lock_guard<std::mutex> lock(Test_sendMutex);
+    send(fd, packet.data(), packet.size(), MSG_NOSIGNAL);
+}
+
+void Test_broker()
+{
+    const int fd = accept(Test_listener, nullptr, nullptr);
+    // Responses go out in several writes, do not hold them back for the ACK of the first
+    int noDelay = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    std::vector<uint8_t> body;
+    for (;;) {
+        uint8_t header;
+        if (!Test_receive(fd, &header, 1)) {
+            break;
+        }
+        size_t length = 0;
+        uint8_t shift = 0;
+        uint8_t byte;
+        do {
+            if (!Test_receive(fd, &byte, 1)) {
+                return;
+            }
+            length |= static_cast<size_t>(byte & 0x7F) << shift;
+            shift += 7;
+        } while (byte & 0x80);
+        body.resize(length);
+        if (!Test_receive(fd, body.data(), length)) {
+            break;
+        }
+        if ((header & 0xF0) != MQTT_PUBLISH) {
+            continue;
+        }
+        const size_t topicLength = (body[0] << 8) | body[1];
+        const std::string topic(reinterpret_cast<const char*>(body.data()) + 2, topicLength);
+        const std::string payload(reinterpret_cast<const char*>(body.data()) + 2 + topicLength,
+                                  length - 2 - topicLength);
+        unsigned requestId;
+        unsigned chunk;
+        if (sscanf(topic.c_str(), "v2/fw/request/%u/chunk/%u", &requestId, &chunk) == 2) {
+            const size_t offset = std::min<size_t>(chunk * OTA_CHUNK_SIZE, Test_image.size());
+            const size_t count = std::min<size_t>(OTA_CHUNK_SIZE, Test_image.size() - offset);
+            const std::string response =
+                "v2/fw/response/" + std::to_string(requestId) + "/chunk/" + std::to_string(chunk);
+            // Requests in flight at the same time are answered at the same time
+            std::thread([fd, response, offset, count]() {
+                delay(TEST_ROUND_TRIP);
+                Test_publish(fd, response, Test_image.data() + offset, count);
+            }).detach();
+            std::lock_guard<std::mutex> lock(Test_mutex);
+            Test_chunkRequests++;
+            continue;
+        }
+        const size_t state = payload.find("\"fw_state\":\"");
+        if (topic == TELEMETRY_BATCH_TOPIC && state != std::string::npos) {
+            const size_t start = state + strlen("\"fw_state\":\"");
+            std::lock_guard<std::mutex> lock(Test_mutex);
+            Test_states.push_back(payload.substr(start, payload.find('"', start) - start));
+        }
+    }
+    close(fd);
+}
+
+/// @brief Connect WiFi_client to the stand-in, as the ThingsBoard task does
+void Test_connect()
+{
+    WiFi.begin(WiFi_ssid.c_str(), WiFi_pass.c_str());
+    while (WiFi.status() != WL_CONNECTED) {
+        delay(5);
+    }
+    Test_listener = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t size = sizeof(address);
+    bind(Test_listener, reinterpret_cast<sockaddr*>(&address), size);
+    listen(Test_listener, 1);
+    getsockname(Test_listener, reinterpret_cast<sockaddr*>(&address), &size);
+    std::thread(Test_broker).detach();
+    TEST_ASSERT_EQUAL_INT(1, WiFi_client.connect(IPAddress(127, 0, 0, 1),
+                                                 ntohs(address.sin_port)));
+}
+
+/// @brief The fw_* shared attributes of the image
+OTA_Firmware Test_firmware(const char* checksum)
+{
+    OTA_Firmware firmware = {};
+    strncpy(firmware.title, OTA_FIRMWARE_TITLE, sizeof(firmware.title) - 1);
+    strncpy(firmware.version, TEST_VERSION, sizeof(firmware.version) - 1);
+    strncpy(firmware.checksum, checksum, sizeof(firmware.checksum) - 1);
+    strncpy(firmware.algorithm, "SHA256", sizeof(firmware.algorithm) - 1);
+    firmware.size = Test_image.size();
+    return firmware;
+}
+
+/// @brief Run the ThingsBoard task part of the update until it leaves DOWNLOADING
+void Test_download()
+{
+    const uint32_t start = millis();
+    while (OTA_update.state() == OTA_State::DOWNLOADING &&
+           millis() - start < TEST_DOWNLOAD_TIMEOUT) {
+        // Chunk responses are diverted to the update as the MQTT client reads
+        uint8_t packets[256];
+        while (WiFi_client.available() > 0) {
+            WiFi_client.read(packets, sizeof(packets));
+        }
+        OTA_update.poll(millis());
+        delay(1);
+    }
+    // The telemetry sent last reaches the stand-in
+    delay(50);
+}
+
+/// @brief States reported since the last call
+std::vector<std::string> Test_takeStates()
+{
+    std::lock_guard<std::mutex> lock(Test_mutex);
+    std::vector<std::string> states;
+    states.swap(Test_states);
+    return states;
+}
+
+uint32_t Test_takeRequests()
+{
+    std::lock_guard<std::mutex> lock(Test_mutex);
+    const uint32_t requests = Test_chunkRequests;
+    Test_chunkRequests = 0;
+    return requests;
+}
+
+void Test_assertStates(const std::vector<std::string>& expected)
+{
+    const std::vector<std::string> states = Test_takeStates();
+    TEST_ASSERT_EQUAL_UINT32(expected.size(), states.size());
+    for (size_t i = 0; i < expected.size(); i++) {
+        TEST_ASSERT_EQUAL_STRING(expected[i].c_str(), states[i].c_str());
+    }
+}
+
+void setUp(void) {}
+
+void tearDown(void) {}
+
+void test_unsupported_firmware_not_retried(void)
+{
+    OTA_Firmware firmware = Test_firmware("00");
+    strncpy(firmware.algorithm, "MD5", sizeof(firmware.algorithm) - 1);
+    OTA_update.offer(firmware, millis());
+    TEST_ASSERT_EQUAL_INT(static_cast<int>(OTA_State::FAILED),
+                          static_cast<int>(OTA_update.state()));
+    // Every attribute response offers it again
+    OTA_update.offer(firmware, millis());
+    OTA_update.offer(firmware, millis());
+    delay(50);
+    Test_assertStates({"FAILED"});
+}
+
+void test_checksum_mismatch_not_retried(void)
+{
+    const OTA_Firmware firmware = Test_firmware(
+        "0000000000000000000000000000000000000000000000000000000000000000");
+    OTA_update.offer(firmware, millis());
+    Test_download();
+    TEST_ASSERT_EQUAL_INT(static_cast<int>(OTA_State::FAILED),
+                          static_cast<int>(OTA_update.state()));
+    Test_assertStates({"DOWNLOADING", "FAILED"});
+    TEST_ASSERT_EQUAL_UINT32((TEST_IMAGE_SIZE + OTA_CHUNK_SIZE - 1) / OTA_CHUNK_SIZE,
+                             Test_takeRequests());
+
+    // The same image is not downloaded again
+    OTA_update.offer(firmware, millis());
+    Test_download();
+    TEST_ASSERT_EQUAL_INT(static_cast<int>(OTA_State::FAILED),
+                          static_cast<int>(OTA_update.state()));
+    Test_assertStates({});
+    TEST_ASSERT_EQUAL_UINT32(0, Test_takeRequests());
+}
+
+void test_download_verified(void)
+{
+    uint8_t digest[32];
+    mbedtls_sha256_context sha;
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts(&sha, 0);
+    mbedtls_sha256_update(&sha, Test_image.data(), Test_image.size());
+    mbedtls_sha256_finish(&sha, digest);
+    mbedtls_sha256_free(&sha);
+    char checksum[65];
+    for (size_t i = 0; i < sizeof(digest); i++) {
+        snprintf(checksum + i * 2, 3, "%02x", digest[i]);
+    }
+
+    // The server corrected the checksum, another assignment
+    const OTA_Firmware firmware = Test_firmware(checksum);
+    const uint32_t start = millis();
+    OTA_update.offer(firmware, start);
+    // Offered again while downloading
+    OTA_update.offer(firmware, start);
+    Test_download();
+    const uint32_t elapsed = millis() - start;
+    Serial.printf("Downloaded %u bytes in %u ms, chunk %u, window %u\n",
+                  static_cast<unsigned>(TEST_IMAGE_SIZE), static_cast<unsigned>(elapsed),
+                  static_cast<unsigned>(OTA_CHUNK_SIZE), static_cast<unsigned>(OTA_WINDOW));
+    TEST_ASSERT_EQUAL_INT(static_cast<int>(OTA_State::UPDATING),
+                          static_cast<int>(OTA_update.state()));
+    Test_assertStates({"DOWNLOADING", "DOWNLOADED", "VERIFIED", "UPDATING"});
+    // Every chunk requested once, the link is lossless
+    const uint32_t chunks = (TEST_IMAGE_SIZE + OTA_CHUNK_SIZE - 1) / OTA_CHUNK_SIZE;
+    TEST_ASSERT_EQUAL_UINT32(chunks, Test_takeRequests());
+    // One round trip per window of chunks, not per chunk
+    const uint32_t roundTrips = (chunks + OTA_WINDOW - 1) / OTA_WINDOW;
+    TEST_ASSERT_GREATER_OR_EQUAL_UINT32(roundTrips * TEST_ROUND_TRIP, elapsed);
+    TEST_ASSERT_LESS_THAN_UINT32(roundTrips * TEST_ROUND_TRIP * 3 / 2 + 200, elapsed);
+
+    std::vector<uint8_t> written(TEST_IMAGE_SIZE);
+    const esp_partition_t* partition = esp_ota_get_next_update_partition(nullptr);
+    TEST_ASSERT_EQUAL_INT(ESP_OK,
+                          esp_partition_read(partition, 0, written.data(), written.size()));
+    TEST_ASSERT_EQUAL_MEMORY(Test_image.data(), written.data(), written.size());
+    // The progress of the download was cleared
+    TEST_ASSERT_FALSE(OTA_progressSetting.get().magic == OTA_PROGRESS_MAGIC);
+}
+
+void test_offers_ignored_while_updating(void)
+{
+    OTA_Firmware firmware = Test_firmware("");
+    OTA_update.offer(firmware, millis());
+    strncpy(firmware.version, "99.01", sizeof(firmware.version) - 1);
+    OTA_update.offer(firmware, millis());
+    delay(50);
+    TEST_ASSERT_EQUAL_INT(static_cast<int>(OTA_State::UPDATING),
+                          static_cast<int>(OTA_update.state()));
+    Test_assertStates({});
+    TEST_ASSERT_EQUAL_UINT32(0, Test_takeRequests());
+}
+
+int main(int argc, char** argv)
+{
+    setenv("NATIVE_NVS_DIR", ".nvs_test_ota", 1);
+    setenv("NATIVE_WIFI_SCAN_MS", "0", 1);
+    setenv("NATIVE_WIFI_DHCP_MS", "0", 1);
+    Preferences preferences;
+    preferences.begin(OTA_PREFS_NAMESPACE);
+    preferences.clear();
+    preferences.end();
+
+    uint32_t random = 1;
+    Test_image.resize(TEST_IMAGE_SIZE);
+    for (uint8_t& byte : Test_image) {
+        random = random * 1664525U + 1013904223U;
+        byte = random >> 24;
+    }
+    Test_connect();
+    OTA_update.begin();
+    OTA_update.connected();
+    delay(50);
+    Test_takeStates();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_unsupported_firmware_not_retried);
+    RUN_TEST(test_checksum_mismatch_not_retried);
+    RUN_TEST(test_download_verified);
+    RUN_TEST(test_offers_ignored_while_updating);
+    // The simulated WiFi driver and the broker threads never return, leave without running
+    // static destructors
+    const int failures = UNITY_END();
+    Serial.flush();
+    _Exit(failures);
+}
@@ -0,0 +1,129 @@
+// The encoders depend on the ThingsBoard callbacks of the firmware, built into the test
+#include "../../src/main.cpp"
+
+#include <unity.h>
+
+// 2026-01-01 00:00:00 UTC
+constexpr uint64_t TEST_TS = 1767225600000ULL;
+
+// A windowed telemetry sample as ThingsBoard_sendBufferedTelemetry() renders it
+const struct {
+    const char* key;
+    float value;
+} TEST_PAIRS[] = {
+    {"temperature", 24.31f},     {"humidity", 55.62f},
+    {"temperature_min", 24.12f}, {"temperature_max", 24.47f},
+    {"temperature_last", 24.3f}, {"temperature_stddev", 0.09f},
+    {"humidity_min", 55.1f},     {"humidity_max", 56.03f},
+    {"humidity_last", 55.58f},   {"humidity_stddev", 0.21f},
+};
+
+// Static, each encoder holds a message buffer
+Json_Encoder Test_json(Batch_Type::TELEMETRY, BATCH_MESSAGE_SIZE);
+Protobuf_Encoder Test_protobuf(Batch_Type::TELEMETRY, BATCH_MESSAGE_SIZE);
+
+/// @brief Encode entries samples one second apart into one message
+/// @return Length of the message, 0 if a sample did not fit
+template <typename Encoder>
+size_t Test_encode(Encoder& encoder, size_t entries)
+{
+    encoder.clear();
+    for (size_t i = 0; i < entries; i++) {
+        if (!encoder.beginEntry(TEST_TS + i * 1000)) {
+            return 0;
+        }
+        for (const auto& pair : TEST_PAIRS) {
+            if (encoder.append(pair.key, Payload_Value(pair.value)) != Append_Result::ADDED) {
+                return 0;
+            }
+        }
+        if (encoder.append("rssi", Payload_Value(static_cast<int64_t>(-61))) !=
+                Append_Result::ADDED ||
+            encoder.append("readings", Payload_Value(static_cast<int64_t>(10))) !=
+                Append_Result::ADDED) {
+            return 0;
+        }
+    }
+    const size_t length = encoder.finish();
+    encoder.clear();
+    encoder.endEntries();
+    return length;
+}
+
+void setUp(void) {}
+
+void tearDown(void) {}
+
+void test_protobuf_sample_smaller_than_json(void)
+{
+    const size_t json = Test_encode(Test_json, 1);
+    const size_t protobuf = Test_encode(Test_protobuf, 1);
+    Serial.printf("One sample: JSON %u bytes, Protobuf %u bytes\n", static_cast<unsigned>(json),
+                  static_cast<unsigned>(protobuf));
+    TEST_ASSERT_GREATER_THAN(0, protobuf);
+    // Field numbers and fixed32 floats instead of quoted keys and decimal text
+    TEST_ASSERT_LESS_THAN(json / 3, protobuf);
+}
+
+void test_protobuf_batch_smaller_on_the_wire(void)
+{
+    // What fits into one JSON message
+    size_t entries = 1;
+    while (Test_encode(Test_json, entries + 1) != 0) {
+        entries++;
+    }
+    TEST_ASSERT_GREATER_THAN(1, entries);
+    // A Protobuf message carries a single timestamp, one message per sample
+    TEST_ASSERT_EQUAL_UINT32(0, Test_encode(Test_protobuf, 2));
+    const size_t overhead = MQTT_PUBLISH_OVERHEAD + strlen(TELEMETRY_BATCH_TOPIC);
+    const size_t json = Test_encode(Test_json, entries) + overhead;
+    const size_t protobuf = entries * (Test_encode(Test_protobuf, 1) + overhead);
+    Serial.printf("%u samples on the wire: JSON %u bytes, Protobuf %u bytes\n",
+                  static_cast<unsigned>(entries), static_cast<unsigned>(json),
+                  static_cast<unsigned>(protobuf));
+    TEST_ASSERT_LESS_THAN(json / 2, protobuf);
+}
+
+void test_json_sample_text(void)
+{
+    Test_json.clear();
+    Test_json.beginEntry(TEST_TS);
+    Test_json.append("temperature", Payload_Value(24.5f));
+    Test_json.append("rssi", Payload_Value(static_cast<int64_t>(-61)));
+    const size_t length = Test_json.finish();
+    const char expected[] =
+        "[{\"ts\":1767225600000,\"values\":{\"temperature\":24.50,\"rssi\":-61}}]";
+    TEST_ASSERT_EQUAL_UINT32(strlen(expected), length);
+    TEST_ASSERT_EQUAL_MEMORY(expected, Test_json.data(), length);
+    Test_json.clear();
+    Test_json.endEntries();
+}
+
+void test_unencodable_values_rejected(void)
+{
+    Test_protobuf.clear();
+    Test_protobuf.beginEntry(TEST_TS);
+    TEST_ASSERT_EQUAL_INT(static_cast<int>(Append_Result::UNKNOWN),
+                          static_cast<int>(Test_protobuf.append("pressure",
+                                                                Payload_Value(1013.2f))));
+    TEST_ASSERT_EQUAL_INT(static_cast<int>(Append_Result::INVALID),
+                          static_cast<int>(Test_protobuf.append("temperature",
+                                                                Payload_Value(NAN))));
+    TEST_ASSERT_TRUE(Test_protobuf.empty());
+    Test_protobuf.endEntries();
+
+    Test_json.clear();
+    TEST_ASSERT_EQUAL_INT(static_cast<int>(Append_Result::INVALID),
+                          static_cast<int>(Test_json.append("temperature", Payload_Value(NAN))));
+    TEST_ASSERT_TRUE(Test_json.empty());
+}
+
+int main(int argc, char** argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_protobuf_sample_smaller_than_json);
+    RUN_TEST(test_protobuf_batch_smaller_on_the_wire);
+    RUN_TEST(test_json_sample_text);
+    RUN_TEST(test_unencodable_values_rejected);
+    return UNITY_END();
+}
@@ -0,0 +1,211 @@
+// The publish path of the firmware itself, built into the test
+#include "../../src/main.cpp"
+
+#include <unity.h>
+
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <thread>
+
+constexpr uint8_t TEST_CYCLES = 20;
+constexpr uint32_t TEST_ACK_TIMEOUT = 2000;
+
+//
+// Broker stand-in on the loopback interface, it acknowledges every QoS 1 PUBLISH it reads
+//
+int Test_listener = -1;
+
+/// @brief Read exactly length bytes
+bool Test_receive(int fd, uint8_t* buffer, size_t length)
+{
+    while (length > 0) {
+        const ssize_t count = recv(fd, buffer, length, 0);
+        if (count <= 0) {
+            return false;
+        }
+        buffer += count;
+        length -= count;
+    }
+    return true;
+}
+
+void Test_broker()
+{
+    const int fd = accept(Test_listener, nullptr, nullptr);
+    uint8_t body[BATCH_MESSAGE_SIZE + 128];
+    for (;;) {
+        uint8_t header;
+        if (!Test_receive(fd, &header, 1)) {
+            break;
+        }
+        size_t length = 0;
+        uint8_t shift = 0;
+        uint8_t byte;
+        do {
+            if (!Test_receive(fd, &byte, 1)) {
+                return;
+            }
+            length |= static_cast<size_t>(byte & 0x7F) << shift;
+            shift += 7;
+        } while (byte & 0x80);
+        if (length > sizeof(body) || !Test_receive(fd, body, length)) {
+            break;
+        }
+        if ((header & 0xF0) == MQTT_PUBLISH && (header & MQTT_PUBLISH_QOS_MASK) != 0) {
+            const size_t topicLength = (body[0] << 8) | body[1];
+            const uint8_t ack[] = {MQTT_PUBACK, 2, body[2 + topicLength], body[3 + topicLength]};
+            send(fd, ack, sizeof(ack), MSG_NOSIGNAL);
+        }
+    }
+    close(fd);
+}
+
+/// @brief Connect WiFi_client to the broker stand-in, as the ThingsBoard task does
+void Test_connect()
+{
+    WiFi.begin(WiFi_ssid.c_str(), WiFi_pass.c_str());
+    while (WiFi.status() != WL_CONNECTED) {
+        delay(5);
+    }
+    Test_listener = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t size = sizeof(address);
+    bind(Test_listener, reinterpret_cast<sockaddr*>(&address), size);
+    listen(Test_listener, 1);
+    getsockname(Test_listener, reinterpret_cast<sockaddr*>(&address), &size);
+    std::thread(Test_broker).detach();
+    TEST_ASSERT_EQUAL_INT(1, WiFi_client.connect(IPAddress(127, 0, 0, 1),
+                                                 ntohs(address.sin_port)));
+}
+
+/// @brief Buffer samples like ThingsBoard_sampleTelemetry(), with and without windows
+void Test_sample(uint16_t count)
+{
+    for (uint16_t i = 0; i < count; i++) {
+        Telemetry_Sample sample = {};
+        sample.timestamp = millis();
+        sample.temperature = 24.5f + i;
+        sample.humidity = 55.0f;
+        sample.rssi = -60;
+        sample.count = i % 2 == 0 ? 10 : 0;
+        sample.reported = 0x07;
+        sample.temperatureWindow = {240, 260, 250, 12};
+        sample.humidityWindow = {540, 560, 550, 8};
+        Telemetry_buffer.push(sample);
+    }
+    Device_pressLatency.add(1200);
+}
+
+/// @brief Send every buffered sample and wait for the acknowledgements, as the ThingsBoard task
+/// does while connected
+void Test_drain()
+{
+    const uint32_t start = millis();
+    while (Telemetry_buffer.size() > 0 && millis() - start < TEST_ACK_TIMEOUT) {
+        while (!Publish_pipeline.full() && ThingsBoard_sendBufferedTelemetry() > 0) {
+        }
+        delay(1);
+        // The MQTT client reads the PUBACKs, the transport takes note of them
+        uint8_t packets[64];
+        while (WiFi_client.available() > 0) {
+            WiFi_client.read(packets, sizeof(packets));
+        }
+        Publish_pipeline.poll(Telemetry_buffer, millis());
+    }
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, Telemetry_buffer.size(), "Samples were not acknowledged");
+}
+
+void setUp(void) {}
+
+void tearDown(void) {}
+
+void test_publish_cycle_does_not_allocate(void)
+{
+    Test_connect();
+    Publish_pipeline.reset();
+    Publish_pipeline.setAckObserver(ThingsBoard_telemetryAcked);
+    // The first cycle may still set up the C library, e.g. the buffer of stdout
+    Test_sample(THINGSBOARD_TELEMETRY_DRAIN_BATCH);
+    Test_drain();
+
+    const size_t allocations = Native_heapAllocations();
+    for (uint8_t cycle = 0; cycle < TEST_CYCLES; cycle++) {
+        Test_sample(THINGSBOARD_TELEMETRY_DRAIN_BATCH + cycle);
+        Test_drain();
+    }
+    TEST_ASSERT_EQUAL_UINT32(allocations, Native_heapAllocations());
+    TEST_ASSERT_EQUAL_UINT32(0, Device_pressLatency.count);
+}
+
+void test_press_latency_kept_until_acknowledged(void)
+{
+    Test_sample(1);
+    const uint32_t presses = Device_pressLatency.count;
+    TEST_ASSERT_EQUAL_UINT32(1, ThingsBoard_sendBufferedTelemetry());
+    // Handed to the socket but not acknowledged yet
+    TEST_ASSERT_EQUAL_UINT32(presses, Device_pressLatency.count);
+    // A press after the message was rendered is reported with the next one
+    Device_pressLatency.add(900);
+    Test_drain();
+    TEST_ASSERT_EQUAL_UINT32(1, Device_pressLatency.count);
+    TEST_ASSERT_EQUAL_UINT32(900, Device_pressLatency.mean());
+    Test_sample(1);
+    Test_drain();
+    TEST_ASSERT_EQUAL_UINT32(0, Device_pressLatency.count);
+}
+
+void test_failed_write_stays_in_flight(void)
+{
+    WiFi_client.stop();
+    Test_sample(1);
+    const size_t buffered = Telemetry_buffer.size();
+    // Nothing reaches the closed connection, the message waits for the retransmit
+    TEST_ASSERT_EQUAL_UINT32(buffered, ThingsBoard_sendBufferedTelemetry());
+    TEST_ASSERT_EQUAL_UINT32(1, Publish_pipeline.inFlight());
+    TEST_ASSERT_EQUAL_UINT32(buffered, Telemetry_buffer.size());
+    TEST_ASSERT_FALSE(WiFi_client.connected());
+    // After reconnecting the samples are sent again from the buffer
+    Publish_pipeline.reset();
+    TEST_ASSERT_EQUAL_UINT32(buffered, ThingsBoard_pendingTelemetry());
+}
+
+void test_attribute_publish_does_not_allocate(void)
+{
+    ThingsBoard_renderIdentity();
+    // Only the rendering is measured, the MQTT client belongs to the ThingsBoard library
+    Attribute_batch.setPublisher([](const char* payload, size_t length) {
+        return length > 0 ? Publish_Result::SENT : Publish_Result::FAILED;
+    });
+    uint32_t published = 0;
+    // Dirty since boot
+    ThingsBoard_sendAttributes(true, published);
+    const size_t allocations = Native_heapAllocations();
+    for (uint8_t cycle = 0; cycle < TEST_CYCLES; cycle++) {
+        Device_markDirty(cycle % SWITCH_COUNT);
+        TEST_ASSERT_TRUE(ThingsBoard_sendAttributes(cycle % 4 == 0, published));
+        TEST_ASSERT_EQUAL_UINT32(1U << (cycle % SWITCH_COUNT), published);
+    }
+    TEST_ASSERT_EQUAL_UINT32(allocations, Native_heapAllocations());
+    Attribute_batch.setPublisher(nullptr);
+}
+
+int main(int argc, char** argv)
+{
+    setenv("NATIVE_NVS_DIR", ".nvs_test_publish", 1);
+    setenv("NATIVE_WIFI_SCAN_MS", "0", 1);
+    setenv("NATIVE_WIFI_DHCP_MS", "0", 1);
+    UNITY_BEGIN();
+    RUN_TEST(test_publish_cycle_does_not_allocate);
+    RUN_TEST(test_press_latency_kept_until_acknowledged);
+    RUN_TEST(test_failed_write_stays_in_flight);
+    RUN_TEST(test_attribute_publish_does_not_allocate);
+    // The simulated WiFi driver and the broker threads never return, leave without running
+    // static destructors
+    const int failures = UNITY_END();
+    Serial.flush();
+    _Exit(failures);
+}
@@ -0,0 +1,281 @@
+// The QoS 1 publish path of the firmware itself, built into the test
+#include "../../src/main.cpp"
+
+#include <unity.h>
+
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Round trip of the simulated link, the broker holds every PUBACK this long
+constexpr uint32_t TEST_RTT = 40;
+// Messages of a throughput run, a multiple of every window size
+constexpr uint32_t TEST_MESSAGES = 12;
+// Scheduling of the test process, per round trip
+constexpr uint32_t TEST_SLACK = 10;
+constexpr uint32_t TEST_TIMEOUT = 2000;
+
+//
+// Broker stand-in on the loopback interface. It acknowledges every QoS 1 PUBLISH TEST_RTT after
+// reading it, as a broker behind a slow link would appear, and keeps the packet ids and DUP flags
+// it received.
+//
+struct Test_Publish {
+    uint16_t packetId;
+    bool duplicate;
+};
+
+struct Test_Ack {
+    std::chrono::steady_clock::time_point due;
+    uint8_t packet[4];
+};
+
+int Test_listener = -1;
+std::atomic<int> Test_fd(-1);
+// PUBACKs still to be lost
+std::atomic<int> Test_dropAcks(0);
+std::mutex Test_mutex;
+std::condition_variable Test_acksQueued;
+std::deque<Test_Ack> Test_acks;
+std::vector<Test_Publish> Test_publishes;
+
+/// @brief Read exactly length bytes
+bool Test_receive(int fd, uint8_t* buffer, size_t length)
+{
+    while (length > 0) {
+        const ssize_t count = recv(fd, buffer, length, 0);
+        if (count <= 0) {
+            return false;
+        }
+        buffer += count;
+        length -= count;
+    }
+    return true;
+}
+
+/// @brief Send the PUBACKs once they are due, in the order the messages arrived
+void Test_acker()
+{
+    std::unique_lock<std::mutex> lock(Test_mutex);
+    for (;;) {
+        Test_acksQueued.wait(lock, [] { return !Test_acks.empty(); });
+        const Test_Ack ack = Test_acks.front();
+        Test_acks.pop_front();
+        lock.unlock();
+        std::this_thread::sleep_until(ack.due);
+        send(Test_fd, ack.packet, sizeof(ack.packet), MSG_NOSIGNAL);
+        lock.lock();
+    }
+}
+
+void Test_broker()
+{
+    const int fd = accept(Test_listener, nullptr, nullptr);
+    int noDelay = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    Test_fd = fd;
+    std::thread(Test_acker).detach();
+    uint8_t body[BATCH_MESSAGE_SIZE + 128];
+    for (;;) {
+        uint8_t header;
+        if (!Test_receive(fd, &header, 1)) {
+            break;
+        }
+        size_t length = 0;
+        uint8_t shift = 0;
+        uint8_t byte;
+        do {
+            if (!Test_receive(fd, &byte, 1)) {
+                return;
+            }
+            length |= static_cast<size_t>(byte & 0x7F) << shift;
+            shift += 7;
+        } while (byte & 0x80);
+        if (length > sizeof(body) || !Test_receive(fd, body, length)) {
+            break;
+        }
+        if ((header & 0xF0) != MQTT_PUBLISH || (header & MQTT_PUBLISH_QOS_MASK) == 0) {
+            continue;
+        }
+        const size_t topicLength = (body[0] << 8) | body[1];
+        const uint8_t high = body[2 + topicLength];
+        const uint8_t low = body[3 + topicLength];
+        std::lock_guard<std::mutex> lock(Test_mutex);
+        Test_publishes.push_back({static_cast<uint16_t>(high << 8 | low),
+                                  (header & MQTT_PUBLISH_DUP) != 0});
+        if (Test_dropAcks > 0) {
+            Test_dropAcks--;
+            continue;
+        }
+        Test_acks.push_back({std::chrono::steady_clock::now() +
+                                 std::chrono::milliseconds(TEST_RTT),
+                             {MQTT_PUBACK, 2, high, low}});
+        Test_acksQueued.notify_one();
+    }
+    close(fd);
+}
+
+/// @brief Connect WiFi_client to the broker stand-in, as the ThingsBoard task does
+void Test_connect()
+{
+    WiFi.begin(WiFi_ssid.c_str(), WiFi_pass.c_str());
+    while (WiFi.status() != WL_CONNECTED) {
+        delay(5);
+    }
+    Test_listener = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t size = sizeof(address);
+    bind(Test_listener, reinterpret_cast<sockaddr*>(&address), size);
+    listen(Test_listener, 1);
+    getsockname(Test_listener, reinterpret_cast<sockaddr*>(&address), &size);
+    std::thread(Test_broker).detach();
+    TEST_ASSERT_EQUAL_INT(1, WiFi_client.connect(IPAddress(127, 0, 0, 1),
+                                                 ntohs(address.sin_port)));
+    while (Test_fd < 0) {
+        delay(1);
+    }
+}
+
+/// @brief Buffer samples like ThingsBoard_sampleTelemetry(), a full drain batch is one message.
+/// They share their time, a Protobuf message holds samples of one timestamp only.
+void Test_sample(uint32_t count)
+{
+    const uint32_t now = millis();
+    for (uint32_t i = 0; i < count; i++) {
+        Telemetry_Sample sample = {};
+        sample.timestamp = now;
+        sample.temperature = 24.5f;
+        sample.humidity = 55.0f;
+        sample.rssi = -60;
+        sample.reported = 0x07;
+        Telemetry_buffer.push(sample);
+    }
+}
+
+/// @brief Send what the window allows and read the acknowledgements, as the ThingsBoard task
+/// does while connected
+/// @param offset Added to the time the pipeline sees, to let messages time out
+void Test_send(uint32_t offset)
+{
+    ThingsBoard_uploadBurst();
+    delay(1);
+    // The MQTT client reads the PUBACKs, the transport takes note of them
+    uint8_t packets[64];
+    while (WiFi_client.available() > 0) {
+        WiFi_client.read(packets, sizeof(packets));
+    }
+    Publish_pipeline.poll(Telemetry_buffer, millis() + offset);
+}
+
+/// @brief The PUBLISH packets the broker received, a copy taken under the lock so a failed
+/// assertion never leaves it held
+std::vector<Test_Publish> Test_received()
+{
+    std::lock_guard<std::mutex> lock(Test_mutex);
+    return Test_publishes;
+}
+
+/// @brief Upload TEST_MESSAGES messages with the given window
+/// @return Milliseconds until the last one was acknowledged
+uint32_t Test_upload(uint8_t window)
+{
+    Publish_pipeline.setWindow(window);
+    Test_sample(TEST_MESSAGES * THINGSBOARD_TELEMETRY_DRAIN_BATCH);
+    {
+        std::lock_guard<std::mutex> lock(Test_mutex);
+        Test_publishes.clear();
+    }
+    const uint32_t start = millis();
+    while (!Telemetry_buffer.empty() && millis() - start < TEST_TIMEOUT) {
+        Test_send(0);
+    }
+    const uint32_t elapsed = millis() - start;
+    TEST_ASSERT_TRUE_MESSAGE(Telemetry_buffer.empty(), "Samples were not acknowledged");
+    TEST_ASSERT_EQUAL_UINT32(TEST_MESSAGES, Test_received().size());
+    Serial.printf("Window %u: %u messages in %u ms, %.1f msg/s\n", static_cast<unsigned>(window),
+                  static_cast<unsigned>(TEST_MESSAGES), static_cast<unsigned>(elapsed),
+                  TEST_MESSAGES * 1000.0f / elapsed);
+    return elapsed;
+}
+
+void setUp(void)
+{
+    Publish_pipeline.reset();
+}
+
+void tearDown(void)
+{
+    Publish_pipeline.setWindow(PUBLISH_WINDOW);
+}
+
+void test_throughput_scales_with_the_window(void)
+{
+    uint32_t previous = UINT32_MAX;
+    for (uint8_t window = 1; window <= PUBLISH_WINDOW_MAX; window++) {
+        const uint32_t elapsed = Test_upload(window);
+        // A new message goes out as each PUBACK frees its slot, a round trip per window's worth
+        const uint32_t rounds = TEST_MESSAGES / window;
+        TEST_ASSERT_GREATER_OR_EQUAL_UINT32(rounds * TEST_RTT, elapsed);
+        TEST_ASSERT_LESS_THAN_UINT32(rounds * (TEST_RTT + TEST_SLACK), elapsed);
+        TEST_ASSERT_LESS_THAN_UINT32(previous, elapsed);
+        previous = elapsed;
+    }
+}
+
+void test_lost_puback_is_retransmitted_as_duplicate(void)
+{
+    Test_dropAcks = 1;
+    Test_sample(THINGSBOARD_TELEMETRY_DRAIN_BATCH);
+    {
+        std::lock_guard<std::mutex> lock(Test_mutex);
+        Test_publishes.clear();
+    }
+    uint32_t start = millis();
+    while (millis() - start < 3 * TEST_RTT) {
+        Test_send(0);
+    }
+    // The PUBACK was lost, the samples wait for it
+    TEST_ASSERT_EQUAL_UINT32(1, Publish_pipeline.inFlight());
+    TEST_ASSERT_EQUAL_UINT32(THINGSBOARD_TELEMETRY_DRAIN_BATCH, Telemetry_buffer.size());
+
+    // Once it timed out the message is sent again, flagged as duplicate, and acknowledged
+    start = millis();
+    while (!Telemetry_buffer.empty() && millis() - start < TEST_TIMEOUT) {
+        Test_send(PUBLISH_ACK_TIMEOUT);
+    }
+    TEST_ASSERT_TRUE_MESSAGE(Telemetry_buffer.empty(), "Retransmit was not acknowledged");
+    TEST_ASSERT_EQUAL_UINT32(0, Publish_pipeline.inFlight());
+    const std::vector<Test_Publish> publishes = Test_received();
+    TEST_ASSERT_EQUAL_UINT32(2, publishes.size());
+    TEST_ASSERT_FALSE(publishes[0].duplicate);
+    TEST_ASSERT_TRUE(publishes[1].duplicate);
+    TEST_ASSERT_EQUAL_UINT16(publishes[0].packetId, publishes[1].packetId);
+}
+
+int main(int argc, char** argv)
+{
+    setenv("NATIVE_NVS_DIR", ".nvs_test_publish_window", 1);
+    setenv("NATIVE_WIFI_SCAN_MS", "0", 1);
+    setenv("NATIVE_WIFI_DHCP_MS", "0", 1);
+    Test_connect();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_throughput_scales_with_the_window);
+    RUN_TEST(test_lost_puback_is_retransmitted_as_duplicate);
+    const int failures = UNITY_END();
+    Serial.flush();
+    // The simulated WiFi driver and the broker threads never return, leave without running
+    // static destructors
+    _Exit(failures);
+}
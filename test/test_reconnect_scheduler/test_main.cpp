@@ -0,0 +1,151 @@
+#include <Arduino.h>
+#include <unity.h>
+
+#include <memory>
+#include <vector>
+
+#include "Reconnect_Scheduler.h"
+
+//
+// A fleet of devices losing their broker at the same time, with the ThingsBoard backoff
+//
+constexpr uint32_t TEST_BASE = 2000;         // 2 seconds
+constexpr uint32_t TEST_CAP = 5 * 60 * 1000;  // 5 minutes
+constexpr size_t TEST_FLEET = 100;
+constexpr uint32_t TEST_OUTAGE = 10 * 60 * 1000;  // 10 minutes
+constexpr uint32_t TEST_STEP = 100;               // Simulation resolution, 100 ms
+constexpr uint32_t TEST_FIXED_INTERVAL = 10000;   // The old fixed reconnect timer
+
+struct Fleet_Result {
+    uint32_t attempts = 0;
+    uint32_t peakAfterOutage = 0;  // Most attempts within one second once the broker is back
+    uint32_t lastReconnect = 0;    // Time the last device was connected again
+    bool delaysBounded = true;     // Every backoff within [base, cap]
+};
+
+/// @brief Drops every connection at time 0 and restores the broker after the outage
+/// @param jitter False to simulate the old fixed interval instead of the scheduler
+Fleet_Result Test_fleet(bool jitter)
+{
+    std::vector<std::unique_ptr<Reconnect_Scheduler>> fleet;
+    std::vector<bool> connected(TEST_FLEET, false);
+    std::vector<uint32_t> lastAttempt(TEST_FLEET, 0);
+    for (size_t i = 0; i < TEST_FLEET; i++) {
+        fleet.emplace_back(new Reconnect_Scheduler("Device", TEST_BASE, TEST_CAP));
+        fleet.back()->lost(0);
+    }
+    Fleet_Result result;
+    std::vector<uint32_t> perSecond((TEST_OUTAGE + 2 * TEST_CAP) / 1000, 0);
+    size_t remaining = TEST_FLEET;
+    for (uint32_t now = 0; remaining > 0 && now / 1000 < perSecond.size(); now += TEST_STEP) {
+        for (size_t i = 0; i < TEST_FLEET; i++) {
+            Reconnect_Scheduler& scheduler = *fleet[i];
+            const bool due = jitter ? scheduler.due(now)
+                                    : now - lastAttempt[i] >= TEST_FIXED_INTERVAL || now == 0;
+            if (connected[i] || !due) {
+                continue;
+            }
+            result.attempts++;
+            lastAttempt[i] = now;
+            if (now >= TEST_OUTAGE) {
+                perSecond[now / 1000]++;
+                scheduler.succeeded();
+                connected[i] = true;
+                remaining--;
+                result.lastReconnect = now;
+                continue;
+            }
+            scheduler.failed(Connect_Failure::TCP, now);
+            const uint32_t delay = scheduler.remaining(now);
+            result.delaysBounded = result.delaysBounded && delay >= TEST_BASE && delay <= TEST_CAP;
+        }
+    }
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, remaining, "Devices never reconnected");
+    for (uint32_t attempts : perSecond) {
+        result.peakAfterOutage = std::max(result.peakAfterOutage, attempts);
+    }
+    return result;
+}
+
+void setUp(void) {}
+
+void tearDown(void) {}
+
+void test_failures_back_off_within_bounds(void)
+{
+    Reconnect_Scheduler scheduler("Test", TEST_BASE, TEST_CAP);
+    uint32_t now = 0;
+    uint32_t longest = 0;
+    for (int attempt = 0; attempt < 40; attempt++) {
+        scheduler.failed(Connect_Failure::TCP, now);
+        const uint32_t delay = scheduler.remaining(now);
+        TEST_ASSERT_TRUE(delay >= TEST_BASE);
+        TEST_ASSERT_TRUE(delay <= TEST_CAP);
+        TEST_ASSERT_FALSE(scheduler.due(now + delay - 1));
+        TEST_ASSERT_TRUE(scheduler.due(now + delay));
+        longest = std::max(longest, delay);
+        now += delay;
+    }
+    // 40 failures reach the cap region, the first one never exceeds 3 x base
+    TEST_ASSERT_GREATER_THAN_UINT32(TEST_CAP / 3, longest);
+
+    scheduler.succeeded();
+    TEST_ASSERT_TRUE(scheduler.due(now));
+    scheduler.failed(Connect_Failure::TCP, now);
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(3 * TEST_BASE, scheduler.remaining(now));
+}
+
+void test_lost_connection_spreads_first_attempt(void)
+{
+    Reconnect_Scheduler scheduler("Test", TEST_BASE, TEST_CAP);
+    bool early = false;
+    bool late = false;
+    for (int i = 0; i < 100; i++) {
+        scheduler.lost(1000);
+        const uint32_t delay = scheduler.remaining(1000);
+        TEST_ASSERT_LESS_OR_EQUAL_UINT32(TEST_BASE, delay);
+        early = early || delay < TEST_BASE / 2;
+        late = late || delay >= TEST_BASE / 2;
+    }
+    TEST_ASSERT_TRUE(early && late);
+}
+
+void test_only_auth_refusals_counted(void)
+{
+    Reconnect_Scheduler scheduler("Test", TEST_BASE, TEST_CAP);
+    scheduler.failed(Connect_Failure::DNS, 0);
+    scheduler.failed(Connect_Failure::TCP, 0);
+    scheduler.failed(Connect_Failure::MQTT, 0);
+    TEST_ASSERT_EQUAL_UINT8(0, scheduler.authFailures());
+    scheduler.failed(Connect_Failure::MQTT_AUTH, 0);
+    scheduler.failed(Connect_Failure::MQTT_AUTH, 0);
+    TEST_ASSERT_EQUAL_UINT8(2, scheduler.authFailures());
+    scheduler.succeeded();
+    TEST_ASSERT_EQUAL_UINT8(0, scheduler.authFailures());
+}
+
+void test_fleet_does_not_reconnect_in_lockstep(void)
+{
+    const Fleet_Result fixed = Test_fleet(false);
+    const Fleet_Result jittered = Test_fleet(true);
+    // With the fixed timer every device hits the restored broker within the same second
+    TEST_ASSERT_EQUAL_UINT32(TEST_FLEET, fixed.peakAfterOutage);
+    TEST_ASSERT_TRUE(jittered.delaysBounded);
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(TEST_FLEET / 10, jittered.peakAfterOutage);
+    // Fewer attempts against the broker while it is down
+    TEST_ASSERT_LESS_THAN_UINT32(fixed.attempts / 3, jittered.attempts);
+    // And nobody waits longer than one capped backoff once it is back
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(TEST_OUTAGE + TEST_CAP, jittered.lastReconnect);
+}
+
+int main(int argc, char** argv)
+{
+    // Same sequence on every run
+    randomSeed(1);
+    UNITY_BEGIN();
+    RUN_TEST(test_failures_back_off_within_bounds);
+    RUN_TEST(test_lost_connection_spreads_first_attempt);
+    RUN_TEST(test_only_auth_refusals_counted);
+    RUN_TEST(test_fleet_does_not_reconnect_in_lockstep);
+    return UNITY_END();
+}
@@ -0,0 +1,205 @@
+#include <Arduino.h>
+#include <unity.h>
+
+#include "Report_Policy.h"
+
+//
+// Report_Filter over an hour of readings at one per second, the policies of the firmware
+//
+constexpr size_t TEST_TEMPERATURE = 0;
+constexpr size_t TEST_HUMIDITY = 1;
+constexpr size_t TEST_KEYS = 2;
+constexpr uint32_t TEST_INTERVAL = 1000;    // 1 second
+constexpr uint32_t TEST_DURATION = 3600;    // Readings, one hour
+constexpr uint32_t TEST_HEARTBEAT = 300000;  // 5 minutes
+
+constexpr Report_Policy TEST_POLICIES[TEST_KEYS] = {
+    {"temperature", Deadband_Type::ABSOLUTE, 0.3f, 1000, TEST_HEARTBEAT},
+    {"humidity", Deadband_Type::PERCENT, 2.0f, 1000, TEST_HEARTBEAT},
+};
+
+struct Trace_Result {
+    uint32_t messages = 0;  // Readings with at least one key reported
+    uint32_t reported[TEST_KEYS] = {};
+    uint32_t longestSilence[TEST_KEYS] = {};
+    // Largest difference between a reading and the value last reported for it
+    float largestError[TEST_KEYS] = {};
+};
+
+using Trace_Function = void (*)(uint32_t index, float (&values)[TEST_KEYS]);
+
+Trace_Result Test_run(Trace_Function trace)
+{
+    Report_Filter<TEST_KEYS> filter(TEST_POLICIES);
+    Trace_Result result;
+    float reportedValue[TEST_KEYS] = {};
+    uint32_t reportedAt[TEST_KEYS] = {};
+    for (uint32_t i = 0; i < TEST_DURATION; i++) {
+        const uint32_t now = i * TEST_INTERVAL;
+        float values[TEST_KEYS];
+        trace(i, values);
+        const uint8_t mask = filter.report(values, now);
+        if (mask != 0) {
+            result.messages++;
+        }
+        for (size_t key = 0; key < TEST_KEYS; key++) {
+            if (mask & (1U << key)) {
+                result.reported[key]++;
+                reportedValue[key] = values[key];
+                reportedAt[key] = now;
+            }
+            result.longestSilence[key] =
+                std::max(result.longestSilence[key], now - reportedAt[key]);
+            result.largestError[key] =
+                std::max(result.largestError[key], fabsf(values[key] - reportedValue[key]));
+        }
+    }
+    return result;
+}
+
+void Trace_flat(uint32_t index, float (&values)[TEST_KEYS])
+{
+    (void)index;
+    values[TEST_TEMPERATURE] = 24.0f;
+    values[TEST_HUMIDITY] = 55.0f;
+}
+
+void Trace_step(uint32_t index, float (&values)[TEST_KEYS])
+{
+    values[TEST_TEMPERATURE] = index < 450 ? 24.0f : 26.0f;
+    values[TEST_HUMIDITY] = 55.0f;
+}
+
+void Trace_noise(uint32_t index, float (&values)[TEST_KEYS])
+{
+    // Toggles by more than the deadbands on every reading
+    values[TEST_TEMPERATURE] = index % 2 == 0 ? 24.0f : 25.0f;
+    values[TEST_HUMIDITY] = index % 2 == 0 ? 50.0f : 55.0f;
+}
+
+uint32_t Test_random = 1;
+
+/// @brief Deterministic stand-in for rand(), so the trace is the same on every run
+uint32_t Test_nextRandom()
+{
+    Test_random = Test_random * 1103515245U + 12345U;
+    return (Test_random >> 16) & 0x7FFF;
+}
+
+void Trace_office(uint32_t index, float (&values)[TEST_KEYS])
+{
+    // Slow random walk with an occasional step, like the simulated sensor of the firmware
+    static float temperature;
+    static float humidity;
+    if (index == 0) {
+        Test_random = 1;
+        temperature = 24.0f;
+        humidity = 55.0f;
+    }
+    temperature += (static_cast<int>(Test_nextRandom() % 21) - 10) / 150.0f;
+    humidity += (static_cast<int>(Test_nextRandom() % 21) - 10) / 60.0f;
+    if (index % 900 == 450) {
+        temperature += 2.0f;
+    }
+    values[TEST_TEMPERATURE] = constrain(temperature, 15.0f, 35.0f);
+    values[TEST_HUMIDITY] = constrain(humidity, 20.0f, 80.0f);
+}
+
+void setUp(void) {}
+
+void tearDown(void) {}
+
+void test_flat_trace_reports_heartbeats_only(void)
+{
+    const Trace_Result result = Test_run(Trace_flat);
+    // The first reading and one heartbeat every 5 minutes
+    const uint32_t expected = 1 + (TEST_DURATION - 1) * TEST_INTERVAL / TEST_HEARTBEAT;
+    TEST_ASSERT_EQUAL_UINT32(expected, result.messages);
+    TEST_ASSERT_EQUAL_UINT32(expected, result.reported[TEST_TEMPERATURE]);
+    TEST_ASSERT_EQUAL_UINT32(expected, result.reported[TEST_HUMIDITY]);
+    // Silence measured at the reading before each heartbeat
+    TEST_ASSERT_EQUAL_UINT32(TEST_HEARTBEAT - TEST_INTERVAL,
+                             result.longestSilence[TEST_TEMPERATURE]);
+}
+
+void test_step_reported_on_the_next_reading(void)
+{
+    const Trace_Result result = Test_run(Trace_step);
+    // Never further from the reported value than the deadband, the step included
+    TEST_ASSERT_FLOAT_WITHIN(0.001f, 0.0f, result.largestError[TEST_TEMPERATURE]);
+    // The step is one report more than the flat trace, the heartbeats move with it
+    TEST_ASSERT_EQUAL_UINT32(Test_run(Trace_flat).reported[TEST_TEMPERATURE] + 1,
+                             result.reported[TEST_TEMPERATURE]);
+}
+
+void test_noise_limited_by_min_interval(void)
+{
+    Report_Filter<TEST_KEYS> filter(TEST_POLICIES);
+    const float low[TEST_KEYS] = {24.0f, 50.0f};
+    const float high[TEST_KEYS] = {25.0f, 55.0f};
+    // Readings every 100 ms, changes within the min interval are held back
+    uint32_t reports = 0;
+    for (uint32_t now = 0; now < 10000; now += 100) {
+        const uint8_t mask = filter.report((now / 100) % 2 == 0 ? low : high, now);
+        if (mask & (1U << TEST_TEMPERATURE)) {
+            reports++;
+        }
+    }
+    TEST_ASSERT_EQUAL_UINT32(10, reports);
+    TEST_ASSERT_EQUAL_UINT32(200, filter.evaluated());
+    TEST_ASSERT_EQUAL_UINT32(20, filter.reported());
+
+    // At one reading per second every change goes out
+    const Trace_Result result = Test_run(Trace_noise);
+    TEST_ASSERT_EQUAL_UINT32(TEST_DURATION, result.messages);
+}
+
+void test_percent_deadband_scales_with_value(void)
+{
+    Report_Filter<TEST_KEYS> filter(TEST_POLICIES);
+    const float start[TEST_KEYS] = {24.0f, 55.0f};
+    TEST_ASSERT_EQUAL_UINT8(0x03, filter.report(start, 0));
+    // 2 % of 55 is 1.1
+    const float within[TEST_KEYS] = {24.0f, 56.0f};
+    TEST_ASSERT_EQUAL_UINT8(0x00, filter.report(within, 2000));
+    const float beyond[TEST_KEYS] = {24.0f, 56.2f};
+    TEST_ASSERT_EQUAL_UINT8(1U << TEST_HUMIDITY, filter.report(beyond, 3000));
+    // The reference is the reported value, not the last reading
+    const float back[TEST_KEYS] = {24.29f, 55.2f};
+    TEST_ASSERT_EQUAL_UINT8(0x00, filter.report(back, 4000));
+}
+
+void test_invalidate_reports_every_key(void)
+{
+    Report_Filter<TEST_KEYS> filter(TEST_POLICIES);
+    const float values[TEST_KEYS] = {24.0f, 55.0f};
+    filter.report(values, 0);
+    TEST_ASSERT_EQUAL_UINT8(0x00, filter.report(values, 1000));
+    filter.invalidate();
+    TEST_ASSERT_EQUAL_UINT8(0x03, filter.report(values, 1100));
+}
+
+void test_office_trace_reduces_messages(void)
+{
+    const Trace_Result result = Test_run(Trace_office);
+    // A fixed 30 second interval sends 120 messages an hour
+    TEST_ASSERT_LESS_THAN_UINT32(120, result.messages);
+    TEST_ASSERT_GREATER_THAN_UINT32(TEST_DURATION * TEST_INTERVAL / TEST_HEARTBEAT,
+                                    result.messages);
+    // Every change beyond the deadband went out on the reading it happened
+    TEST_ASSERT_TRUE(result.largestError[TEST_TEMPERATURE] <= 0.3f + 0.001f);
+    TEST_ASSERT_LESS_THAN_UINT32(TEST_HEARTBEAT, result.longestSilence[TEST_TEMPERATURE]);
+    TEST_ASSERT_LESS_THAN_UINT32(TEST_HEARTBEAT, result.longestSilence[TEST_HUMIDITY]);
+}
+
+int main(int argc, char** argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_flat_trace_reports_heartbeats_only);
+    RUN_TEST(test_step_reported_on_the_next_reading);
+    RUN_TEST(test_noise_limited_by_min_interval);
+    RUN_TEST(test_percent_deadband_scales_with_value);
+    RUN_TEST(test_invalidate_reports_every_key);
+    RUN_TEST(test_office_trace_reduces_messages);
+    return UNITY_END();
+}
@@ -0,0 +1,220 @@
+// The RPC latency stages of the firmware itself, built into the test
+#include "../../src/main.cpp"
+
+#include <unity.h>
+
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+
+constexpr uint32_t TEST_READ_TIMEOUT = 2000;
+// Time the device spends on another packet in the same loop()
+constexpr uint32_t TEST_HANDLING = 20;
+// Time the response to the first RPC waits behind the others
+constexpr uint32_t TEST_RESPONSE_DELAY = 80;
+// Slack of the measured latencies, scheduling of the test process
+constexpr uint32_t TEST_SLACK_US = 40000;
+
+//
+// Server stand-in on the loopback interface, RPC requests are sent by the test and everything
+// the device writes is read and dropped
+//
+int Test_listener = -1;
+std::atomic<int> Test_fd(-1);
+
+void Test_broker()
+{
+    const int fd = accept(Test_listener, nullptr, nullptr);
+    int noDelay = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    Test_fd = fd;
+    uint8_t buffer[256];
+    while (recv(fd, buffer, sizeof(buffer), 0) > 0) {
+    }
+    close(fd);
+}
+
+/// @brief Connect WiFi_client to the stand-in, as the ThingsBoard task does
+void Test_connect()
+{
+    WiFi.begin(WiFi_ssid.c_str(), WiFi_pass.c_str());
+    while (WiFi.status() != WL_CONNECTED) {
+        delay(5);
+    }
+    Test_listener = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t size = sizeof(address);
+    bind(Test_listener, reinterpret_cast<sockaddr*>(&address), size);
+    listen(Test_listener, 1);
+    getsockname(Test_listener, reinterpret_cast<sockaddr*>(&address), &size);
+    std::thread(Test_broker).detach();
+    TEST_ASSERT_EQUAL_INT(1, WiFi_client.connect(IPAddress(127, 0, 0, 1),
+                                                 ntohs(address.sin_port)));
+    while (Test_fd < 0) {
+        delay(1);
+    }
+}
+
+/// @brief A switch_set request as the server sends it
+std::string Test_request(uint32_t requestId)
+{
+    const std::string topic = RPC_REQUEST_TOPIC_PREFIX + std::to_string(requestId);
+    const std::string payload = "{\"method\":\"switch_set\",\"params\":{\"switch_1\":true}}";
+    std::string packet(1, static_cast<char>(MQTT_PUBLISH));
+    packet += static_cast<char>(2 + topic.size() + payload.size());
+    packet += static_cast<char>(topic.size() >> 8);
+    packet += static_cast<char>(topic.size() & 0xFF);
+    return packet + topic + payload;
+}
+
+/// @brief Read the next packet as the MQTT client does, with the length from its fixed header
+/// @return Its topic
+std::string Test_readPacket()
+{
+    std::string packet;
+    size_t expected = 2;
+    const uint32_t start = millis();
+    while (packet.size() < expected && millis() - start < TEST_READ_TIMEOUT) {
+        uint8_t byte;
+        if (WiFi_client.available() <= 0 || WiFi_client.read(&byte, 1) != 1) {
+            delay(1);
+            continue;
+        }
+        packet += static_cast<char>(byte);
+        if (packet.size() == 2) {
+            expected = 2 + byte;
+        }
+    }
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(expected, packet.size(), "RPC request not received");
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(packet.data());
+    return packet.substr(4, bytes[2] << 8 | bytes[3]);
+}
+
+/// @brief Handle the request the client read last, as the ThingsBoard client calls switch_set
+void Test_dispatch()
+{
+    JsonVariantConst params;
+    JsonDocument response;
+    processSwitchStateRPC(params, response);
+}
+
+/// @brief Respond to a request, as the ThingsBoard client does after the callback returned
+void Test_respond(uint32_t requestId)
+{
+    const std::string topic = RPC_RESPONSE_TOPIC_PREFIX + std::to_string(requestId);
+    const uint8_t payload[] = {'t', 'r', 'u', 'e'};
+    TEST_ASSERT_TRUE(ThingsBoard_publish(topic.c_str(), payload, sizeof(payload)));
+}
+
+const Latency_Histogram& Test_stage(Latency_Stage stage)
+{
+    return Latency_stages[static_cast<size_t>(stage)];
+}
+
+void setUp(void)
+{
+    for (Latency_Histogram& histogram : Latency_stages) {
+        histogram.reset();
+    }
+}
+
+void tearDown(void) {}
+
+void test_back_to_back_rpcs_timed_per_request(void)
+{
+    // Both requests arrive in one segment and are read by the client in the same loop()
+    const std::string requests = Test_request(7) + Test_request(8);
+    send(Test_fd, requests.data(), requests.size(), MSG_NOSIGNAL);
+
+    TEST_ASSERT_EQUAL_STRING("v1/devices/me/rpc/request/7", Test_readPacket().c_str());
+    Test_dispatch();
+    delay(TEST_HANDLING);
+    TEST_ASSERT_EQUAL_STRING("v1/devices/me/rpc/request/8", Test_readPacket().c_str());
+    Test_dispatch();
+    delay(TEST_HANDLING);
+    Test_respond(8);
+    delay(TEST_RESPONSE_DELAY);
+    Test_respond(7);
+
+    TEST_ASSERT_EQUAL_UINT32(2, Test_stage(Latency_Stage::RPC_DISPATCH).count());
+    TEST_ASSERT_EQUAL_UINT32(2, Test_stage(Latency_Stage::RPC_ACTUATE).count());
+    TEST_ASSERT_EQUAL_UINT32(2, Test_stage(Latency_Stage::RPC_RESPOND).count());
+    TEST_ASSERT_EQUAL_UINT32(2, Test_stage(Latency_Stage::RPC_TOTAL).count());
+    // Request 7 waited for the handling of 8 and for its own response, measured from its own
+    // receipt rather than from the packet read last
+    const uint32_t longest = (2 * TEST_HANDLING + TEST_RESPONSE_DELAY) * 1000;
+    TEST_ASSERT_GREATER_OR_EQUAL_UINT32(longest, Test_stage(Latency_Stage::RPC_TOTAL).max());
+    TEST_ASSERT_LESS_THAN_UINT32(longest + TEST_SLACK_US,
+                                 Test_stage(Latency_Stage::RPC_TOTAL).max());
+    TEST_ASSERT_GREATER_OR_EQUAL_UINT32(longest, Test_stage(Latency_Stage::RPC_RESPOND).max());
+    // Request 8 was read and answered TEST_HANDLING apart, the median is within its bucket
+    TEST_ASSERT_LESS_THAN_UINT32(2 * TEST_HANDLING * 1000,
+                                 Test_stage(Latency_Stage::RPC_TOTAL).percentile(50));
+}
+
+void test_response_timed_once_written_whole(void)
+{
+    const std::string request = Test_request(9);
+    send(Test_fd, request.data(), request.size(), MSG_NOSIGNAL);
+    Test_readPacket();
+    Test_dispatch();
+
+    // The topic is out, the payload is not
+    const std::string topic = RPC_RESPONSE_TOPIC_PREFIX + std::string("9");
+    TEST_ASSERT_TRUE(MQTT_client.begin_publish(topic.c_str(), 4));
+    TEST_ASSERT_EQUAL_UINT32(0, Test_stage(Latency_Stage::RPC_TOTAL).count());
+    TEST_ASSERT_EQUAL_UINT32(4, MQTT_client.write(reinterpret_cast<const uint8_t*>("true"), 4));
+    TEST_ASSERT_TRUE(MQTT_client.end_publish());
+    TEST_ASSERT_EQUAL_UINT32(1, Test_stage(Latency_Stage::RPC_TOTAL).count());
+
+    // Answered once only
+    Test_respond(9);
+    TEST_ASSERT_EQUAL_UINT32(1, Test_stage(Latency_Stage::RPC_TOTAL).count());
+}
+
+void test_other_publishes_not_timed(void)
+{
+    const std::string request = Test_request(10);
+    send(Test_fd, request.data(), request.size(), MSG_NOSIGNAL);
+    Test_readPacket();
+    Test_dispatch();
+
+    // Telemetry and the response to a request that was not actuated
+    const char payload[] = "{\"temperature\":24.5}";
+    TEST_ASSERT_TRUE(ThingsBoard_publish("v1/devices/me/telemetry",
+                                         reinterpret_cast<const uint8_t*>(payload),
+                                         strlen(payload)));
+    Test_respond(11);
+    TEST_ASSERT_EQUAL_UINT32(0, Test_stage(Latency_Stage::RPC_RESPOND).count());
+
+    Test_respond(10);
+    TEST_ASSERT_EQUAL_UINT32(1, Test_stage(Latency_Stage::RPC_RESPOND).count());
+}
+
+int main(int argc, char** argv)
+{
+    setenv("NATIVE_NVS_DIR", ".nvs_test_rpc_latency", 1);
+    // As ThingsBoard_setup() and the ThingsBoard task set up the transport
+    WiFi_client.filter(THINGSBOARD_FILTERED_TOPICS,
+                       sizeof(THINGSBOARD_FILTERED_TOPICS) / sizeof(THINGSBOARD_FILTERED_TOPICS[0]),
+                       ThingsBoard_keepKey);
+    WiFi_client.observePublishes(Latency_published);
+    Test_connect();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_back_to_back_rpcs_timed_per_request);
+    RUN_TEST(test_response_timed_once_written_whole);
+    RUN_TEST(test_other_publishes_not_timed);
+    const int failures = UNITY_END();
+    Serial.flush();
+    // The simulated WiFi driver and the broker thread never return, leave without running
+    // static destructors
+    _Exit(failures);
+}
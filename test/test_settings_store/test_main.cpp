@@ -0,0 +1,127 @@
+#include <Arduino.h>
+#include <unity.h>
+
+#include "Settings_Store.h"
+
+constexpr char TEST_NAMESPACE[] = "test_settings";
+constexpr size_t TEST_CREDENTIAL_SIZE = 65;
+constexpr uint8_t TEST_BOOTS = 10;
+
+constexpr char TEST_TOKEN[] = "A1b2C3d4E5f6G7h8I9j0";
+
+struct Test_Limits {
+    uint32_t min;
+    uint32_t max;
+};
+
+/// @brief The settings of one boot, constructed and loaded like the firmware does at start
+struct Test_Device {
+    Settings_Store store{TEST_NAMESPACE};
+    String_Setting<TEST_CREDENTIAL_SIZE> username{store, "username"};
+    String_Setting<TEST_CREDENTIAL_SIZE> password{store, "password"};
+    Setting<Test_Limits> limits{store, "limits", Test_Limits{1000, 60000}};
+
+    Test_Device() { store.begin(); }
+};
+
+void setUp(void)
+{
+    Preferences preferences;
+    preferences.begin(TEST_NAMESPACE);
+    preferences.clear();
+    preferences.end();
+}
+
+void tearDown(void) {}
+
+void test_unchanged_values_are_not_written_again(void)
+{
+    {
+        Test_Device device;
+        TEST_ASSERT_TRUE(device.username.set(TEST_TOKEN));
+        TEST_ASSERT_FALSE(device.password.set(""));
+        TEST_ASSERT_TRUE(device.limits.set(Test_Limits{2000, 30000}));
+        TEST_ASSERT_TRUE(device.store.commit());
+        TEST_ASSERT_EQUAL_UINT32(2, device.store.writes());
+    }
+    // Every later boot receives the same values again, e.g. from provisioning and attributes
+    for (uint8_t boot = 0; boot < TEST_BOOTS; boot++) {
+        Test_Device device;
+        TEST_ASSERT_EQUAL_STRING(TEST_TOKEN, device.username.c_str());
+        TEST_ASSERT_EQUAL_UINT32(30000, device.limits.get().max);
+        TEST_ASSERT_FALSE(device.username.set(TEST_TOKEN));
+        TEST_ASSERT_FALSE(device.password.set(""));
+        TEST_ASSERT_FALSE(device.limits.set(Test_Limits{2000, 30000}));
+        TEST_ASSERT_FALSE(device.store.dirty());
+        TEST_ASSERT_TRUE(device.store.commit());
+        TEST_ASSERT_EQUAL_UINT32(0, device.store.writes());
+        TEST_ASSERT_EQUAL_UINT32(3, device.store.avoided());
+    }
+}
+
+void test_changed_values_written_once_per_commit(void)
+{
+    Test_Device device;
+    device.username.set("first");
+    device.username.set("second");
+    device.limits.set(Test_Limits{1, 2});
+    device.limits.set(Test_Limits{3, 4});
+    TEST_ASSERT_TRUE(device.store.commit());
+    TEST_ASSERT_EQUAL_UINT32(2, device.store.writes());
+    TEST_ASSERT_EQUAL_UINT32(1, device.store.commits());
+    TEST_ASSERT_EQUAL_UINT32(1, device.username.writes());
+
+    // A shorter value with the same prefix is a change
+    TEST_ASSERT_TRUE(device.username.set("sec"));
+    TEST_ASSERT_TRUE(device.store.commit());
+    Test_Device next;
+    TEST_ASSERT_EQUAL_STRING("sec", next.username.c_str());
+    TEST_ASSERT_FALSE(next.username.set("sec"));
+}
+
+void test_commit_waits_for_settled_changes(void)
+{
+    Test_Device device;
+    device.username.set("burst");
+    const uint32_t changedAt = millis();
+    TEST_ASSERT_TRUE(device.store.commitIfSettled(5000, changedAt + 1000));
+    TEST_ASSERT_TRUE(device.store.dirty());
+    TEST_ASSERT_TRUE(device.store.commitIfSettled(5000, changedAt + 5000));
+    TEST_ASSERT_FALSE(device.store.dirty());
+    TEST_ASSERT_EQUAL_UINT32(1, device.store.writes());
+}
+
+void test_oversized_credential_rejected(void)
+{
+    Test_Device device;
+    device.username.set(TEST_TOKEN);
+    char longest[TEST_CREDENTIAL_SIZE];
+    memset(longest, 'x', sizeof(longest) - 1);
+    longest[sizeof(longest) - 1] = '\0';
+    char tooLong[TEST_CREDENTIAL_SIZE + 1];
+    memset(tooLong, 'y', sizeof(tooLong) - 1);
+    tooLong[sizeof(tooLong) - 1] = '\0';
+
+    TEST_ASSERT_FALSE(device.password.fits(tooLong));
+    TEST_ASSERT_FALSE(device.username.set(tooLong));
+    // Not truncated, the last good value stays
+    TEST_ASSERT_EQUAL_STRING(TEST_TOKEN, device.username.c_str());
+
+    TEST_ASSERT_TRUE(device.password.fits(longest));
+    TEST_ASSERT_TRUE(device.password.set(longest));
+    TEST_ASSERT_TRUE(device.store.commit());
+    Test_Device next;
+    TEST_ASSERT_EQUAL_STRING(longest, next.password.c_str());
+    TEST_ASSERT_FALSE(next.password.set(longest));
+}
+
+int main(int argc, char** argv)
+{
+    setenv("NATIVE_NVS_DIR", ".nvs_test_settings", 1);
+    UNITY_BEGIN();
+    RUN_TEST(test_unchanged_values_are_not_written_again);
+    RUN_TEST(test_changed_values_written_once_per_commit);
+    RUN_TEST(test_commit_waits_for_settled_changes);
+    RUN_TEST(test_oversized_credential_rejected);
+    return UNITY_END();
+}
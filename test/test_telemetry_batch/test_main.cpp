@@ -0,0 +1,282 @@
+// The telemetry publish path of the firmware itself, built into the test
+#include "../../src/main.cpp"
+
+#include <unity.h>
+
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <mutex>
+#include <string>
+#include <thread>
+
+constexpr uint32_t TEST_ACK_TIMEOUT = 2000;
+
+//
+// Broker stand-in on the loopback interface, it acknowledges every QoS 1 PUBLISH it reads and
+// keeps the telemetry payloads
+//
+struct Test_Traffic {
+    uint32_t messages = 0;
+    uint32_t payloadBytes = 0;
+    uint32_t wireBytes = 0;  // Whole PUBLISH packets, fixed header and topic included
+    std::string payloads;
+};
+
+int Test_listener = -1;
+std::mutex Test_mutex;
+Test_Traffic Test_traffic;
+
+/// @brief Read exactly length bytes
+bool Test_receive(int fd, uint8_t* buffer, size_t length)
+{
+    while (length > 0) {
+        const ssize_t count = recv(fd, buffer, length, 0);
+        if (count <= 0) {
+            return false;
+        }
+        buffer += count;
+        length -= count;
+    }
+    return true;
+}
+
+void Test_broker()
+{
+    const int fd = accept(Test_listener, nullptr, nullptr);
+    int noDelay = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    uint8_t body[BATCH_MESSAGE_SIZE + 128];
+    for (;;) {
+        uint8_t header;
+        if (!Test_receive(fd, &header, 1)) {
+            break;
+        }
+        size_t length = 0;
+        size_t lengthBytes = 0;
+        uint8_t shift = 0;
+        uint8_t byte;
+        do {
+            if (!Test_receive(fd, &byte, 1)) {
+                return;
+            }
+            length |= static_cast<size_t>(byte & 0x7F) << shift;
+            lengthBytes++;
+            shift += 7;
+        } while (byte & 0x80);
+        if (length > sizeof(body) || !Test_receive(fd, body, length)) {
+            break;
+        }
+        if ((header & 0xF0) != MQTT_PUBLISH || (header & MQTT_PUBLISH_QOS_MASK) == 0) {
+            continue;
+        }
+        const size_t topicLength = (body[0] << 8) | body[1];
+        const std::string topic(reinterpret_cast<const char*>(body + 2), topicLength);
+        if (topic == TELEMETRY_BATCH_TOPIC) {
+            const size_t offset = 2 + topicLength + 2;
+            std::lock_guard<std::mutex> lock(Test_mutex);
+            Test_traffic.messages++;
+            Test_traffic.payloadBytes += length - offset;
+            Test_traffic.wireBytes += 1 + lengthBytes + length;
+            Test_traffic.payloads.append(reinterpret_cast<const char*>(body + offset),
+                                         length - offset);
+        }
+        const uint8_t ack[] = {MQTT_PUBACK, 2, body[2 + topicLength], body[3 + topicLength]};
+        send(fd, ack, sizeof(ack), MSG_NOSIGNAL);
+    }
+    close(fd);
+}
+
+/// @brief Connect WiFi_client to the broker stand-in, as the ThingsBoard task does
+void Test_connect()
+{
+    WiFi.begin(WiFi_ssid.c_str(), WiFi_pass.c_str());
+    while (WiFi.status() != WL_CONNECTED) {
+        delay(5);
+    }
+    Test_listener = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t size = sizeof(address);
+    bind(Test_listener, reinterpret_cast<sockaddr*>(&address), size);
+    listen(Test_listener, 1);
+    getsockname(Test_listener, reinterpret_cast<sockaddr*>(&address), &size);
+    std::thread(Test_broker).detach();
+    TEST_ASSERT_EQUAL_INT(1, WiFi_client.connect(IPAddress(127, 0, 0, 1),
+                                                 ntohs(address.sin_port)));
+}
+
+/// @brief Buffer samples like ThingsBoard_sampleTelemetry(), the temperature numbers them
+/// @param windowed With the window statistics, several times the size of a plain sample
+void Test_sample(uint32_t count, bool windowed)
+{
+    for (uint32_t i = 0; i < count; i++) {
+        Telemetry_Sample sample = {};
+        sample.timestamp = millis();
+        sample.temperature = i + 0.5f;
+        sample.humidity = 55.0f;
+        sample.rssi = -60;
+        sample.count = windowed ? 10 : 0;
+        sample.reported = 0x07;
+        sample.temperatureWindow = {240, 260, 250, 12};
+        sample.humidityWindow = {540, 560, 550, 8};
+        Telemetry_buffer.push(sample);
+    }
+}
+
+/// @brief One send cycle of the ThingsBoard task over the buffered samples, then wait for the
+/// acknowledgements
+/// @return What the broker received in the cycle
+Test_Traffic Test_cycle()
+{
+    {
+        std::lock_guard<std::mutex> lock(Test_mutex);
+        Test_traffic = Test_Traffic();
+    }
+    const size_t buffered = Telemetry_buffer.size();
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(buffered, ThingsBoard_sendBufferedTelemetry(),
+                                     "Samples left for another cycle");
+    const uint32_t start = millis();
+    while (Telemetry_buffer.size() > 0 && millis() - start < TEST_ACK_TIMEOUT) {
+        delay(1);
+        // The MQTT client reads the PUBACKs, the transport takes note of them
+        uint8_t packets[64];
+        while (WiFi_client.available() > 0) {
+            WiFi_client.read(packets, sizeof(packets));
+        }
+        Publish_pipeline.poll(Telemetry_buffer, millis());
+    }
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, Telemetry_buffer.size(), "Samples were not acknowledged");
+    std::lock_guard<std::mutex> lock(Test_mutex);
+    return Test_traffic;
+}
+
+/// @brief Send the samples one message each, as without batching
+Test_Traffic Test_unbatched(uint32_t count, bool windowed)
+{
+    Test_Traffic total;
+    for (uint32_t i = 0; i < count; i++) {
+        Test_sample(1, windowed);
+        const Test_Traffic traffic = Test_cycle();
+        TEST_ASSERT_EQUAL_UINT32(1, traffic.messages);
+        total.messages += traffic.messages;
+        total.payloadBytes += traffic.payloadBytes;
+        total.wireBytes += traffic.wireBytes;
+    }
+    Serial.printf("Unbatched: %u sample(s) in %u message(s), %u payload bytes, %u on the wire\n",
+                  static_cast<unsigned>(count), static_cast<unsigned>(total.messages),
+                  static_cast<unsigned>(total.payloadBytes),
+                  static_cast<unsigned>(total.wireBytes));
+    return total;
+}
+
+/// @brief Send the samples in one cycle
+Test_Traffic Test_batched(uint32_t count, bool windowed)
+{
+    Test_sample(count, windowed);
+    const Test_Traffic traffic = Test_cycle();
+    Serial.printf("Batched:   %u sample(s) in %u message(s), %u payload bytes, %u on the wire\n",
+                  static_cast<unsigned>(count), static_cast<unsigned>(traffic.messages),
+                  static_cast<unsigned>(traffic.payloadBytes),
+                  static_cast<unsigned>(traffic.wireBytes));
+    return traffic;
+}
+
+size_t Test_occurrences(const std::string& text, const char* pattern)
+{
+    size_t count = 0;
+    for (size_t found = text.find(pattern); found != std::string::npos;
+         found = text.find(pattern, found + 1)) {
+        count++;
+    }
+    return count;
+}
+
+/// @brief Every sample is in the payloads once, in order. The JSON payloads are checked, a
+/// Protobuf message is only released by its PUBACK, see Test_cycle().
+/// @param messages A sample split over two messages has its timestamp in both
+void Test_assertSamples(const Test_Traffic& traffic, uint32_t count, uint32_t messages)
+{
+    if (Payload_Encoder::NEEDS_TIMESTAMPS) {
+        return;
+    }
+    size_t position = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        const std::string value = "\"temperature\":" + std::to_string(i) + ".5";
+        const size_t found = traffic.payloads.find(value, position);
+        TEST_ASSERT_TRUE_MESSAGE(found != std::string::npos, value.c_str());
+        position = found + value.size();
+    }
+    TEST_ASSERT_EQUAL_UINT32(count, Test_occurrences(traffic.payloads, "\"temperature\":"));
+    const size_t entries = Test_occurrences(traffic.payloads, "\"ts\":");
+    TEST_ASSERT_GREATER_OR_EQUAL_UINT32(count, entries);
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(count + messages - 1, entries);
+}
+
+void setUp(void)
+{
+    Publish_pipeline.reset();
+}
+
+void tearDown(void) {}
+
+void test_single_sample_is_one_message(void)
+{
+    const Test_Traffic traffic = Test_batched(1, true);
+    TEST_ASSERT_EQUAL_UINT32(1, traffic.messages);
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(BATCH_MESSAGE_SIZE, traffic.wireBytes);
+    Test_assertSamples(traffic, 1, traffic.messages);
+}
+
+void test_full_cycle_is_one_message(void)
+{
+    const uint32_t count = THINGSBOARD_TELEMETRY_DRAIN_BATCH;
+    const Test_Traffic unbatched = Test_unbatched(count, false);
+    const Test_Traffic batched = Test_batched(count, false);
+    TEST_ASSERT_EQUAL_UINT32(1, batched.messages);
+    Test_assertSamples(batched, count, batched.messages);
+    // The MQTT header, the topic and the packet id are paid once instead of per sample
+    TEST_ASSERT_LESS_THAN_UINT32(unbatched.wireBytes, batched.wireBytes);
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(unbatched.payloadBytes, batched.payloadBytes);
+}
+
+void test_overflowing_cycle_is_split(void)
+{
+    const uint32_t count = THINGSBOARD_TELEMETRY_DRAIN_BATCH;
+    const Test_Traffic unbatched = Test_unbatched(count, true);
+    const Test_Traffic batched = Test_batched(count, true);
+    // As few messages as the samples fit into, each within the size limit and the pipeline window.
+    // Protobuf samples are small enough for a cycle to fit one message, JSON ones are split.
+    const uint32_t payloadMax = BATCH_MESSAGE_SIZE - MQTT_PUBLISH_OVERHEAD -
+                                strlen(TELEMETRY_BATCH_TOPIC);
+    const uint32_t needed = (unbatched.payloadBytes + payloadMax - 1) / payloadMax;
+    TEST_ASSERT_GREATER_OR_EQUAL_UINT32(needed, batched.messages);
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(needed + 1, batched.messages);
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(PUBLISH_WINDOW, batched.messages);
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(batched.messages * BATCH_MESSAGE_SIZE, batched.wireBytes);
+    // No sample is lost or repeated at a split
+    Test_assertSamples(batched, count, batched.messages);
+    TEST_ASSERT_LESS_THAN_UINT32(unbatched.messages, batched.messages);
+    TEST_ASSERT_LESS_THAN_UINT32(unbatched.wireBytes, batched.wireBytes);
+}
+
+int main(int argc, char** argv)
+{
+    setenv("NATIVE_NVS_DIR", ".nvs_test_telemetry_batch", 1);
+    setenv("NATIVE_WIFI_SCAN_MS", "0", 1);
+    setenv("NATIVE_WIFI_DHCP_MS", "0", 1);
+    Test_connect();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_single_sample_is_one_message);
+    RUN_TEST(test_full_cycle_is_one_message);
+    RUN_TEST(test_overflowing_cycle_is_split);
+    const int failures = UNITY_END();
+    Serial.flush();
+    // The simulated WiFi driver and the broker thread never return, leave without running
+    // static destructors
+    _Exit(failures);
+}
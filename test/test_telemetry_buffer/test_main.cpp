@@ -0,0 +1,316 @@
+// Spill to a small data partition, so a long outage fills RAM and flash
+#define TELEMETRY_SPILL_PARTITION "test_spill"
+// Samples give up on the system time after a few seconds rather than half a minute
+#define TELEMETRY_CLOCK_WAIT_MAX 3000
+// The send path of the firmware itself, built into the test
+#include "../../src/main.cpp"
+
+#include <unity.h>
+
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <thread>
+
+//
+// Outages of different lengths: samples are buffered while offline, then drained in bursts like
+// the ThingsBoard task does, with sampling going on between the bursts
+//
+constexpr size_t TEST_CAPACITY = 32;
+constexpr size_t TEST_DRAIN_BATCH = 10;
+constexpr uint32_t TEST_SAMPLE_INTERVAL = 1000;  // 1 second
+// Three sectors, a spilled sample never straddles two and two sectors worth of slots are kept
+// free, see Telemetry_Spill::push()
+constexpr char TEST_SPILL_SIZE[] = "12288";
+constexpr size_t TEST_SPILL_CAPACITY = SPI_FLASH_SEC_SIZE / sizeof(Telemetry_Sample) + 1;
+// Outage without a clock, its samples are older than a server stamp may be
+constexpr uint32_t TEST_CLOCKLESS_OUTAGE = 4000;  // 4 seconds
+
+struct Drain_Result {
+    uint32_t delivered = 0;
+    uint32_t bursts = 0;
+    uint32_t firstIndex = UINT32_MAX;  // Of the first sample delivered
+    uint32_t lastIndex = 0;
+    bool ordered = true;
+};
+
+Telemetry_Sample Test_sample(uint32_t index)
+{
+    Telemetry_Sample sample = {};
+    sample.timestamp = index * TEST_SAMPLE_INTERVAL;
+    sample.temperature = static_cast<float>(index);
+    sample.reported = 1;
+    return sample;
+}
+
+/// @brief Buffer the samples of an outage, then drain the buffer, one new sample arriving before
+/// every burst
+template <size_t Capacity>
+Drain_Result Test_outage(Telemetry_Buffer<Capacity>& buffer, uint32_t outageSamples)
+{
+    uint32_t index = 0;
+    for (; index < outageSamples; index++) {
+        buffer.push(Test_sample(index));
+    }
+
+    Drain_Result result;
+    while (!buffer.empty() && result.bursts < 10000) {
+        buffer.push(Test_sample(index++));
+        Telemetry_Sample burst[TEST_DRAIN_BATCH];
+        const size_t count = buffer.peek(burst, TEST_DRAIN_BATCH);
+        for (size_t i = 0; i < count; i++) {
+            const uint32_t sampleIndex = burst[i].timestamp / TEST_SAMPLE_INTERVAL;
+            if (result.delivered > 0 && sampleIndex <= result.lastIndex) {
+                result.ordered = false;
+            }
+            if (static_cast<uint32_t>(burst[i].temperature) != sampleIndex) {
+                result.ordered = false;
+            }
+            result.firstIndex = std::min(result.firstIndex, sampleIndex);
+            result.lastIndex = sampleIndex;
+            result.delivered++;
+        }
+        // Acknowledged, like Publish_Pipeline releases the samples of a PUBACK
+        buffer.release(buffer.first() + count);
+        result.bursts++;
+    }
+    return result;
+}
+
+/// @brief Bursts needed to drain held samples, each burst taking TEST_DRAIN_BATCH while one new
+/// sample arrives
+uint32_t Test_expectedBursts(uint32_t held)
+{
+    return (held + TEST_DRAIN_BATCH - 2) / (TEST_DRAIN_BATCH - 1);
+}
+
+//
+// Broker stand-in on the loopback interface, it acknowledges every QoS 1 PUBLISH it reads
+//
+int Test_listener = -1;
+
+/// @brief Read exactly length bytes
+bool Test_receive(int fd, uint8_t* buffer, size_t length)
+{
+    while (length > 0) {
+        const ssize_t count = recv(fd, buffer, length, 0);
+        if (count <= 0) {
+            return false;
+        }
+        buffer += count;
+        length -= count;
+    }
+    return true;
+}
+
+void Test_broker()
+{
+    const int fd = accept(Test_listener, nullptr, nullptr);
+    int noDelay = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    uint8_t body[BATCH_MESSAGE_SIZE + 128];
+    for (;;) {
+        uint8_t header;
+        if (!Test_receive(fd, &header, 1)) {
+            break;
+        }
+        size_t length = 0;
+        uint8_t shift = 0;
+        uint8_t byte;
+        do {
+            if (!Test_receive(fd, &byte, 1)) {
+                return;
+            }
+            length |= static_cast<size_t>(byte & 0x7F) << shift;
+            shift += 7;
+        } while (byte & 0x80);
+        if (length > sizeof(body) || !Test_receive(fd, body, length)) {
+            break;
+        }
+        if ((header & 0xF0) == MQTT_PUBLISH && (header & MQTT_PUBLISH_QOS_MASK) != 0) {
+            const size_t topicLength = (body[0] << 8) | body[1];
+            const uint8_t ack[] = {MQTT_PUBACK, 2, body[2 + topicLength], body[3 + topicLength]};
+            send(fd, ack, sizeof(ack), MSG_NOSIGNAL);
+        }
+    }
+    close(fd);
+}
+
+/// @brief Connect WiFi_client to the broker stand-in, as the ThingsBoard task does
+void Test_connect()
+{
+    WiFi.begin(WiFi_ssid.c_str(), WiFi_pass.c_str());
+    while (WiFi.status() != WL_CONNECTED) {
+        delay(5);
+    }
+    Test_listener = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t size = sizeof(address);
+    bind(Test_listener, reinterpret_cast<sockaddr*>(&address), size);
+    listen(Test_listener, 1);
+    getsockname(Test_listener, reinterpret_cast<sockaddr*>(&address), &size);
+    std::thread(Test_broker).detach();
+    TEST_ASSERT_EQUAL_INT(1, WiFi_client.connect(IPAddress(127, 0, 0, 1),
+                                                 ntohs(address.sin_port)));
+}
+
+/// @brief Send what can be sent and read the acknowledgements, as the ThingsBoard task does
+/// while connected
+void Test_send()
+{
+    while (!Publish_pipeline.full() && ThingsBoard_sendBufferedTelemetry() > 0) {
+    }
+    delay(1);
+    uint8_t packets[64];
+    while (WiFi_client.available() > 0) {
+        WiFi_client.read(packets, sizeof(packets));
+    }
+    Publish_pipeline.poll(Telemetry_buffer, millis());
+}
+
+void setUp(void) {}
+
+void tearDown(void) {}
+
+void test_short_outage_keeps_every_sample(void)
+{
+    Telemetry_Buffer<TEST_CAPACITY> buffer(Overflow_Policy::DROP_OLDEST);
+    const Drain_Result result = Test_outage(buffer, 20);
+
+    TEST_ASSERT_TRUE(result.ordered);
+    TEST_ASSERT_EQUAL_UINT32(0, result.firstIndex);
+    TEST_ASSERT_EQUAL_UINT32(0, buffer.dropped());
+    // Every outage sample and every one taken while draining
+    TEST_ASSERT_EQUAL_UINT32(20 + result.bursts, result.delivered);
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(Test_expectedBursts(20), result.bursts);
+}
+
+void test_long_outage_drop_oldest_keeps_newest(void)
+{
+    Telemetry_Buffer<TEST_CAPACITY> buffer(Overflow_Policy::DROP_OLDEST);
+    const uint32_t outage = 1000;
+    const Drain_Result result = Test_outage(buffer, outage);
+
+    TEST_ASSERT_TRUE(result.ordered);
+    // The first new sample pushed out one more
+    TEST_ASSERT_EQUAL_UINT32(outage - TEST_CAPACITY + 1, result.firstIndex);
+    TEST_ASSERT_EQUAL_UINT32(outage - TEST_CAPACITY + 1, buffer.dropped());
+    TEST_ASSERT_EQUAL_UINT32(TEST_CAPACITY - 1 + result.bursts, result.delivered);
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(Test_expectedBursts(TEST_CAPACITY), result.bursts);
+}
+
+void test_long_outage_decimate_spans_outage(void)
+{
+    Telemetry_Buffer<TEST_CAPACITY> buffer(Overflow_Policy::DECIMATE);
+    const uint32_t outage = 100;
+    const Drain_Result result = Test_outage(buffer, outage);
+
+    TEST_ASSERT_TRUE(result.ordered);
+    // The whole outage is covered at a lower resolution
+    TEST_ASSERT_EQUAL_UINT32(0, result.firstIndex);
+    TEST_ASSERT_GREATER_OR_EQUAL_UINT32(outage, result.lastIndex);
+    TEST_ASSERT_GREATER_THAN_UINT32(0, buffer.dropped());
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(Test_expectedBursts(TEST_CAPACITY), result.bursts);
+}
+
+void test_spill_extends_outage(void)
+{
+    Telemetry_Buffer<TEST_CAPACITY> buffer(Overflow_Policy::DROP_OLDEST);
+    buffer.begin();
+    const uint32_t outage = 100;
+    const Drain_Result result = Test_outage(buffer, outage);
+
+    TEST_ASSERT_TRUE(result.ordered);
+    TEST_ASSERT_EQUAL_UINT32(0, result.firstIndex);
+    TEST_ASSERT_EQUAL_UINT32(0, buffer.dropped());
+    TEST_ASSERT_EQUAL_UINT32(outage + result.bursts, result.delivered);
+}
+
+void test_spill_full_drops_oldest_across_tiers(void)
+{
+    Telemetry_Buffer<TEST_CAPACITY> buffer(Overflow_Policy::DROP_OLDEST);
+    buffer.begin();
+    const uint32_t outage = 1000;
+    const uint32_t held = TEST_CAPACITY + TEST_SPILL_CAPACITY;
+    const Drain_Result result = Test_outage(buffer, outage);
+
+    // The newest samples are kept, whether they are in RAM or spilled
+    TEST_ASSERT_TRUE(result.ordered);
+    TEST_ASSERT_EQUAL_UINT32(outage - held + 1, result.firstIndex);
+    TEST_ASSERT_EQUAL_UINT32(outage - held + 1, buffer.dropped());
+    TEST_ASSERT_EQUAL_UINT32(held - 1 + result.bursts, result.delivered);
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(Test_expectedBursts(held), result.bursts);
+}
+
+void test_clockless_outage_resumes_sending(void)
+{
+    // No SNTP server and, built without USE_DS3231, no RTC: the system time is never set
+    setenv("NATIVE_SNTP_MS", "-1", 1);
+    // Cold boot, the simulated system clock is unset
+    const struct timeval unset = {0, 0};
+    settimeofday(&unset, nullptr);
+    Time_setup();
+    TEST_ASSERT_FALSE(Time_valid());
+    Test_connect();
+    Publish_pipeline.reset();
+
+    // Samples of the outage, two a second, the oldest taken TEST_CLOCKLESS_OUTAGE ago
+    const uint32_t now = millis();
+    for (uint32_t age = TEST_CLOCKLESS_OUTAGE; age > 0; age -= 500) {
+        Telemetry_Sample sample = Test_sample(0);
+        sample.timestamp = now - age;
+        sample.temperature = 24.5f;
+        Telemetry_buffer.push(sample);
+    }
+    const size_t outage = Telemetry_buffer.size();
+
+    // The late ones go at once, then one too old for a server stamp holds back the rest until it
+    // is late as well
+    Test_send();
+    TEST_ASSERT_LESS_THAN_UINT32(outage, Telemetry_buffer.size());
+    TEST_ASSERT_GREATER_THAN_UINT32(0, Telemetry_buffer.size());
+    const uint32_t start = millis();
+    while (!Telemetry_buffer.empty() && millis() - start < TELEMETRY_CLOCK_WAIT_MAX) {
+        Test_send();
+    }
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, Telemetry_buffer.size(), "Sending did not resume");
+    TEST_ASSERT_FALSE(Time_valid());
+    TEST_ASSERT_EQUAL_UINT32(0, Publish_pipeline.inFlight());
+
+    // A fresh sample goes out straight away if the server can stamp it, later otherwise
+    Telemetry_Sample sample = Test_sample(0);
+    sample.timestamp = millis();
+    Telemetry_buffer.push(sample);
+    while (!Telemetry_buffer.empty() &&
+           millis() - sample.timestamp < 2 * TELEMETRY_CLOCK_WAIT_MAX) {
+        Test_send();
+    }
+    TEST_ASSERT_TRUE(Telemetry_buffer.empty());
+    if (!Payload_Encoder::NEEDS_TIMESTAMPS) {
+        TEST_ASSERT_LESS_THAN_UINT32(TELEMETRY_UNSTAMPED_AGE_MAX, millis() - sample.timestamp);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    setenv("NATIVE_NVS_DIR", ".nvs_test", 1);
+    setenv("NATIVE_DATA_PARTITION_SIZE", TEST_SPILL_SIZE, 1);
+
+    UNITY_BEGIN();
+    RUN_TEST(test_short_outage_keeps_every_sample);
+    RUN_TEST(test_long_outage_drop_oldest_keeps_newest);
+    RUN_TEST(test_long_outage_decimate_spans_outage);
+    RUN_TEST(test_spill_extends_outage);
+    RUN_TEST(test_spill_full_drops_oldest_across_tiers);
+    RUN_TEST(test_clockless_outage_resumes_sending);
+    const int failures = UNITY_END();
+    Serial.flush();
+    // The simulated WiFi driver and the broker thread never return, leave without running
+    // static destructors
+    _Exit(failures);
+}
@@ -0,0 +1,161 @@
+#include <Arduino.h>
+#include <unity.h>
+
+#define USE_DS3231 1
+
+#include "Telemetry_Buffer.h"
+#include "Time_Manager.h"
+
+constexpr time_t TEST_RTC_TIME = 1714564800;   // 2024-05-01 12:00:00 UTC
+constexpr time_t TEST_KEPT_TIME = 1735689600;  // 2025-01-01 00:00:00 UTC
+constexpr uint32_t TEST_SYNC_TIMEOUT = 2000;
+
+time_t Test_now()
+{
+    struct timeval now;
+    gettimeofday(&now, nullptr);
+    return now.tv_sec;
+}
+
+time_t Test_hostTime()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return now.tv_sec;
+}
+
+/// @brief Set the system clock, 0 leaves it unset like a cold boot
+void Test_setClock(time_t time)
+{
+    const struct timeval value = {time, 0};
+    settimeofday(&value, nullptr);
+}
+
+/// @brief Boot with the given SNTP delay, negative never syncs
+void Test_boot(const char* sntpMs)
+{
+    setenv("NATIVE_SNTP_MS", sntpMs, 1);
+    Time_setup();
+}
+
+bool Test_waitForSync()
+{
+    const uint32_t start = millis();
+    while (Time_source != Time_Source::SNTP && millis() - start < TEST_SYNC_TIMEOUT) {
+        delay(5);
+    }
+    return Time_source == Time_Source::SNTP;
+}
+
+void setUp(void)
+{
+    Time_source = Time_Source::NONE;
+    Test_setClock(0);
+    Native_setRtc(Native_Rtc::ABSENT);
+}
+
+void tearDown(void) {}
+
+void test_no_source_leaves_clock_unset(void)
+{
+    Test_boot("-1");
+    TEST_ASSERT_TRUE(Time_source == Time_Source::NONE);
+    TEST_ASSERT_FALSE(Time_valid());
+    TEST_ASSERT_EQUAL_UINT64(0, Time_epochMs());
+}
+
+void test_rtc_sets_clock_at_boot(void)
+{
+    Native_setRtc(Native_Rtc::RUNNING, TEST_RTC_TIME);
+    Test_boot("-1");
+    TEST_ASSERT_TRUE(Time_source == Time_Source::DS3231);
+    TEST_ASSERT_TRUE(Time_valid());
+    TEST_ASSERT_LESS_OR_EQUAL(1, llabs(Test_now() - TEST_RTC_TIME));
+}
+
+void test_stopped_rtc_is_ignored(void)
+{
+    Native_setRtc(Native_Rtc::STOPPED, TEST_RTC_TIME);
+    Test_boot("-1");
+    TEST_ASSERT_TRUE(Time_source == Time_Source::NONE);
+    TEST_ASSERT_FALSE(Time_valid());
+}
+
+void test_kept_clock_wins_over_rtc(void)
+{
+    // Survived deep sleep or a software reset
+    Test_setClock(TEST_KEPT_TIME);
+    Native_setRtc(Native_Rtc::RUNNING, TEST_RTC_TIME);
+    Test_boot("-1");
+    TEST_ASSERT_TRUE(Time_source == Time_Source::SYSTEM);
+    TEST_ASSERT_LESS_OR_EQUAL(1, llabs(Test_now() - TEST_KEPT_TIME));
+}
+
+void test_sntp_corrects_clock_and_rtc(void)
+{
+    Native_setRtc(Native_Rtc::RUNNING, TEST_RTC_TIME);
+    Test_boot("50");
+    TEST_ASSERT_TRUE(Time_source == Time_Source::DS3231);
+    TEST_ASSERT_TRUE(Test_waitForSync());
+    TEST_ASSERT_LESS_OR_EQUAL(1, llabs(Test_now() - Test_hostTime()));
+    // Written back, the next boot without network starts from the synced time
+    TEST_ASSERT_LESS_OR_EQUAL(1, llabs(Native_rtcTime() - Test_hostTime()));
+}
+
+void test_sntp_restarts_stopped_rtc(void)
+{
+    Native_setRtc(Native_Rtc::STOPPED, 0);
+    Test_boot("50");
+    TEST_ASSERT_TRUE(Test_waitForSync());
+    TEST_ASSERT_FALSE(Native_rtcStopped());
+    TEST_ASSERT_LESS_OR_EQUAL(1, llabs(Native_rtcTime() - Test_hostTime()));
+
+    // Next boot without network
+    Time_source = Time_Source::NONE;
+    Test_setClock(0);
+    Test_boot("-1");
+    TEST_ASSERT_TRUE(Time_source == Time_Source::DS3231);
+}
+
+void test_samples_wait_for_the_clock(void)
+{
+    Test_boot("-1");
+    Telemetry_Sample sample = {};
+    sample.timestamp = millis();
+    // Server side timestamps are fine while the sample is fresh
+    TEST_ASSERT_UINT32_WITHIN(5, TELEMETRY_CLOCK_WAIT_MAX, Telemetry_clockWait(sample, true));
+    TEST_ASSERT_EQUAL_UINT32(0, Telemetry_clockWait(sample, false));
+    const uint32_t age = TELEMETRY_UNSTAMPED_AGE_MAX + 1;
+    sample.timestamp = millis() - age;
+    TEST_ASSERT_UINT32_WITHIN(5, TELEMETRY_CLOCK_WAIT_MAX - age,
+                              Telemetry_clockWait(sample, false));
+    TEST_ASSERT_FALSE(Telemetry_late(sample));
+
+    // The clock may never come, late samples are not held back any longer
+    Telemetry_Sample late = {};
+    late.timestamp = millis() - TELEMETRY_CLOCK_WAIT_MAX;
+    TEST_ASSERT_EQUAL_UINT32(0, Telemetry_clockWait(late, true));
+    TEST_ASSERT_TRUE(Telemetry_late(late));
+
+    // Once any source set the clock every sample carries its own time
+    Native_setRtc(Native_Rtc::RUNNING, TEST_RTC_TIME);
+    Test_boot("-1");
+    TEST_ASSERT_EQUAL_UINT32(0, Telemetry_clockWait(sample, true));
+    TEST_ASSERT_EQUAL_UINT32(0, Telemetry_clockWait(sample, false));
+    TEST_ASSERT_FALSE(Telemetry_late(late));
+    const int64_t error = Telemetry_sampleEpochMs(sample.timestamp) - (Time_epochMs() - age);
+    TEST_ASSERT_LESS_OR_EQUAL(5, llabs(error));
+}
+
+int main(int argc, char** argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_no_source_leaves_clock_unset);
+    RUN_TEST(test_rtc_sets_clock_at_boot);
+    RUN_TEST(test_stopped_rtc_is_ignored);
+    RUN_TEST(test_kept_clock_wins_over_rtc);
+    RUN_TEST(test_sntp_corrects_clock_and_rtc);
+    RUN_TEST(test_sntp_restarts_stopped_rtc);
+    RUN_TEST(test_samples_wait_for_the_clock);
+    return UNITY_END();
+}
@@ -0,0 +1,235 @@
+// The controller with the limits of the firmware, built into the test
+#include "../../src/main.cpp"
+
+#include <unity.h>
+
+//
+// An hour of one sample per second uploaded over link quality traces, by the controller and by
+// the fixed schedule that sends every sample at once. The radio model: every round trip of
+// messages wakes the radio from modem sleep for TEST_WAKE plus the round trip, each transmission
+// adds its airtime at a PHY rate falling with the RSSI, and a lost message is sent again in a
+// later round. Bursts overlapping the previous one find the radio awake, the time is only
+// counted once.
+//
+constexpr uint32_t TEST_SECONDS = 3600;
+constexpr uint32_t TEST_SAMPLES_PER_MESSAGE = 10;
+constexpr uint32_t TEST_WINDOW = 4;
+constexpr float TEST_WAKE = 30.0f;  // Milliseconds awake around each round trip
+constexpr uint32_t TEST_MESSAGE_BYTES = 1024;
+
+struct Test_Link {
+    float rssi;
+    float rtt;  // Milliseconds
+};
+
+Test_Link Test_good(uint32_t second)
+{
+    (void)second;
+    return {-55.0f, 40.0f};
+}
+
+Test_Link Test_poor(uint32_t second)
+{
+    (void)second;
+    return {-83.0f, 900.0f};
+}
+
+/// @brief Fading between -50 and -88 dBm over ten minutes
+Test_Link Test_fading(uint32_t second)
+{
+    const float rssi = -69.0f + 19.0f * sinf(2.0f * PI * second / 600.0f);
+    return {rssi, 40.0f + std::max(0.0f, -65.0f - rssi) * 40.0f};
+}
+
+struct Test_Result {
+    uint32_t bursts = 0;
+    uint32_t messages = 0;
+    float radioMs = 0.0f;
+    float radioUntil = 0.0f;  // End of the last burst, in milliseconds since the start
+    uint64_t delaySum = 0;    // Seconds, summed over the samples
+    uint32_t maxDelay = 0;    // Seconds
+    uint32_t samples = 0;
+
+    float meanDelay() const
+    {
+        return samples == 0 ? 0.0f : static_cast<float>(delaySum) / samples;
+    }
+};
+
+/// @brief Send a burst of samples over the link
+/// @param start Start of the burst, in milliseconds since the start
+void Test_burst(const Test_Link& link, uint32_t samples, float start, uint32_t& random,
+                Test_Result& result)
+{
+    const float quality = constrain(
+        (link.rssi - UPLOAD_RSSI_POOR) / (UPLOAD_RSSI_GOOD - UPLOAD_RSSI_POOR), 0.0f, 1.0f);
+    const float loss = 0.3f * (1.0f - quality);
+    const float rateMbps = 1.0f + 53.0f * quality;
+    const float airtime = TEST_MESSAGE_BYTES * 8.0f / (rateMbps * 1000.0f);
+
+    uint32_t unsent = (samples + TEST_SAMPLES_PER_MESSAGE - 1) / TEST_SAMPLES_PER_MESSAGE;
+    float duration = 0.0f;
+    while (unsent > 0) {
+        const uint32_t sent = std::min(unsent, TEST_WINDOW);
+        duration += TEST_WAKE + link.rtt + sent * airtime;
+        result.messages += sent;
+        for (uint32_t i = 0; i < sent; i++) {
+            random = random * 1664525U + 1013904223U;
+            if ((random >> 8) / static_cast<float>(1U << 24) >= loss) {
+                unsent--;
+            }
+        }
+    }
+    const float end = start + duration;
+    if (end > result.radioUntil) {
+        result.radioMs += end - std::max(start, result.radioUntil);
+        result.radioUntil = end;
+    }
+    result.bursts++;
+}
+
+Test_Result Test_run(const char* name, Test_Link (*trace)(uint32_t second), bool adaptive)
+{
+    Upload_Controller controller(UPLOAD_DEFAULT_LIMITS);
+    Test_Result result;
+    uint32_t random = 1;
+    uint32_t pending = 0;
+    uint32_t oldest = 0;
+    uint64_t pendingSince = 0;  // Sum of the sample times of the pending samples
+    for (uint32_t second = 1; second <= TEST_SECONDS; second++) {
+        const Test_Link link = trace(second);
+        controller.addRssi(link.rssi);
+        if (pending++ == 0) {
+            oldest = second;
+        }
+        pendingSince += second;
+        if (adaptive && !controller.due(pending, TELEMETRY_BUFFER_CAPACITY, second * 1000)) {
+            continue;
+        }
+        Test_burst(link, pending, second * 1000.0f, random, result);
+        controller.addLatency(link.rtt);
+        controller.drained(second * 1000);
+        result.delaySum += static_cast<uint64_t>(second) * pending - pendingSince;
+        result.maxDelay = std::max(result.maxDelay, second - oldest);
+        result.samples += pending;
+        pending = 0;
+        pendingSince = 0;
+    }
+    Serial.printf("Upload %-6s %-8s %4u samples in %4u bursts, %4u messages, radio on %7.1f s, "
+                  "mean wait %5.1f s, max wait %3u s\n",
+                  name, adaptive ? "adaptive" : "fixed", static_cast<unsigned>(result.samples),
+                  static_cast<unsigned>(result.bursts), static_cast<unsigned>(result.messages),
+                  result.radioMs / 1000.0f, result.meanDelay(),
+                  static_cast<unsigned>(result.maxDelay));
+    return result;
+}
+
+void setUp(void) {}
+
+void tearDown(void) {}
+
+void test_good_link_sends_every_sample_at_once(void)
+{
+    const Test_Result fixed = Test_run("good", Test_good, false);
+    const Test_Result adaptive = Test_run("good", Test_good, true);
+    TEST_ASSERT_EQUAL_UINT32(TEST_SECONDS, adaptive.samples);
+    TEST_ASSERT_EQUAL_UINT32(fixed.bursts, adaptive.bursts);
+    TEST_ASSERT_EQUAL_UINT32(0, adaptive.maxDelay);
+}
+
+void test_poor_link_batches_bursts(void)
+{
+    const Test_Result fixed = Test_run("poor", Test_poor, false);
+    const Test_Result adaptive = Test_run("poor", Test_poor, true);
+    // The last batch is still collecting at the end of the hour
+    TEST_ASSERT_LESS_THAN(UPLOAD_DEFAULT_LIMITS.maxBatch, TEST_SECONDS - adaptive.samples);
+    // A few dozen bursts instead of one per sample
+    TEST_ASSERT_LESS_THAN(TEST_SECONDS / 30, adaptive.bursts);
+    TEST_ASSERT_LESS_THAN(fixed.radioMs / 5, adaptive.radioMs);
+    // No sample waits longer than the poor link interval
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(UPLOAD_DEFAULT_LIMITS.maxInterval / 1000, adaptive.maxDelay);
+}
+
+void test_fading_link_follows_the_quality(void)
+{
+    const Test_Result fixed = Test_run("fading", Test_fading, false);
+    const Test_Result adaptive = Test_run("fading", Test_fading, true);
+    TEST_ASSERT_LESS_THAN(UPLOAD_DEFAULT_LIMITS.maxBatch, TEST_SECONDS - adaptive.samples);
+    TEST_ASSERT_LESS_THAN(fixed.radioMs / 5, adaptive.radioMs);
+    TEST_ASSERT_LESS_THAN(fixed.bursts / 2, adaptive.bursts);
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(UPLOAD_DEFAULT_LIMITS.maxInterval / 1000, adaptive.maxDelay);
+    // Shorter waits than on a link that stays poor
+    TEST_ASSERT_LESS_THAN(Test_run("poor", Test_poor, true).meanDelay(), adaptive.meanDelay());
+}
+
+void test_filling_buffer_drains_at_half(void)
+{
+    Upload_Controller controller(UPLOAD_DEFAULT_LIMITS);
+    controller.addRssi(-90);
+    TEST_ASSERT_EQUAL_UINT32(UPLOAD_DEFAULT_LIMITS.maxInterval, controller.interval(0.0f));
+    TEST_ASSERT_EQUAL_UINT32(UPLOAD_DEFAULT_LIMITS.maxInterval / 2, controller.interval(0.25f));
+    TEST_ASSERT_EQUAL_UINT32(0, controller.interval(0.5f));
+    TEST_ASSERT_EQUAL_UINT32(0, controller.remaining(50, 100, 0));
+    TEST_ASSERT_TRUE(controller.due(50, 100, 0));
+}
+
+void test_limits_are_ordered_and_capped(void)
+{
+    Upload_Controller controller(UPLOAD_DEFAULT_LIMITS);
+    controller.setLimits({120000, 30000, 0});
+    TEST_ASSERT_EQUAL_UINT32(30000, controller.limits().minInterval);
+    TEST_ASSERT_EQUAL_UINT32(30000, controller.limits().maxInterval);
+    TEST_ASSERT_EQUAL_UINT32(1, controller.limits().maxBatch);
+    controller.setLimits({0, UINT32_MAX, UINT32_MAX});
+    TEST_ASSERT_EQUAL_UINT32(UPLOAD_INTERVAL_MAX, controller.limits().maxInterval);
+    TEST_ASSERT_EQUAL_UINT32(UPLOAD_BATCH_MAX, controller.limits().maxBatch);
+}
+
+void test_burst_ends_with_the_pass(void)
+{
+    // A poor link and no system time yet, samples are collected for a burst. Taken before the
+    // server could stamp them, they wait for the clock.
+    Upload_controller.addRssi(-90);
+    const timeval epoch = {0, 0};
+    settimeofday(&epoch, nullptr);
+    TEST_ASSERT_FALSE(Time_valid());
+    const uint32_t start = millis();
+    for (uint32_t i = 0; i < UPLOAD_DEFAULT_LIMITS.maxBatch; i++) {
+        Telemetry_Sample sample = {};
+        sample.timestamp = start - 2 * TELEMETRY_UNSTAMPED_AGE_MAX;
+        sample.temperature = static_cast<float>(i);
+        sample.reported = 1;
+        Telemetry_buffer.push(sample);
+    }
+    const size_t pending = ThingsBoard_pendingTelemetry();
+    TEST_ASSERT_EQUAL_UINT32(UPLOAD_DEFAULT_LIMITS.maxBatch, pending);
+    TEST_ASSERT_TRUE(Upload_controller.due(pending, TELEMETRY_BUFFER_CAPACITY, start));
+
+    // Nothing goes out and the pipeline stays open: the pass ends the burst
+    TEST_ASSERT_TRUE(ThingsBoard_uploadBurst());
+    TEST_ASSERT_EQUAL_UINT32(pending, ThingsBoard_pendingTelemetry());
+    Upload_controller.drained(start);
+
+    // The samples left over wait for the next burst instead of keeping the task awake, a new
+    // burst starts once the batch is collected again
+    Telemetry_buffer.release(Telemetry_buffer.first() + 1);
+    const size_t left = ThingsBoard_pendingTelemetry();
+    TEST_ASSERT_FALSE(Upload_controller.due(left, TELEMETRY_BUFFER_CAPACITY, start));
+    TEST_ASSERT_GREATER_THAN_UINT32(0, Upload_controller.remaining(left, TELEMETRY_BUFFER_CAPACITY,
+                                                                   start));
+    TEST_ASSERT_TRUE(Upload_controller.due(left, TELEMETRY_BUFFER_CAPACITY,
+                                           start + UPLOAD_DEFAULT_LIMITS.maxInterval));
+}
+
+int main(int argc, char** argv)
+{
+    setenv("NATIVE_NVS_DIR", ".nvs_test_upload_controller", 1);
+    UNITY_BEGIN();
+    RUN_TEST(test_good_link_sends_every_sample_at_once);
+    RUN_TEST(test_poor_link_batches_bursts);
+    RUN_TEST(test_fading_link_follows_the_quality);
+    RUN_TEST(test_filling_buffer_drains_at_half);
+    RUN_TEST(test_limits_are_ordered_and_capped);
+    RUN_TEST(test_burst_ends_with_the_pass);
+    return UNITY_END();
+}
@@ -0,0 +1,122 @@
+#include <Arduino.h>
+#include <unity.h>
+
+// Short attempts, the simulated link answers within a few hundred milliseconds
+#define WIFI_CONNECT_ATTEMPS_TIMOUT 500
+
+#include "WiFi_Manager.h"
+
+constexpr unsigned long TEST_SCAN_MS = 300;
+constexpr unsigned long TEST_CONNECT_TIMEOUT = 5000;
+
+/// @brief Run WiFi_connect() like the WiFi task until the link is up and the cache is stored
+/// @return Time from the start of the successful attempt to the link being up
+unsigned long Test_connect()
+{
+    const unsigned long start = millis();
+    while (millis() - start < TEST_CONNECT_TIMEOUT) {
+        WiFi_connect();
+        if (WiFi.status() == WL_CONNECTED) {
+            const unsigned long elapsed = millis() - WiFi_attemptStartedAt;
+            WiFi_connect();
+            return elapsed;
+        }
+        delay(5);
+    }
+    TEST_FAIL_MESSAGE("WiFi did not connect");
+    return 0;
+}
+
+/// @brief Drop the link and let WiFi_connect() notice, the next attempt fails until Test_linkUp()
+void Test_linkDown()
+{
+    WiFi.Native_linkDown();
+    while (WiFi.status() == WL_CONNECTED) {
+        delay(5);
+    }
+    WiFi_connect();
+}
+
+void setUp(void) {}
+
+void tearDown(void) {}
+
+void test_first_connect_scans_and_stores_cache(void)
+{
+    TEST_ASSERT_TRUE(WiFi_cache.magic != WIFI_CACHE_MAGIC);
+    const unsigned long elapsed = Test_connect();
+    TEST_ASSERT_FALSE(WiFi_fastConnect);
+    TEST_ASSERT_GREATER_OR_EQUAL_UINT32(TEST_SCAN_MS, elapsed);
+    TEST_ASSERT_EQUAL_UINT32(WIFI_CACHE_MAGIC, WiFi_cache.magic);
+    TEST_ASSERT_EQUAL_UINT8(WiFi.channel(), WiFi_cache.channel);
+    TEST_ASSERT_EQUAL_MEMORY(WiFi.BSSID(), WiFi_cache.bssid, sizeof(WiFi_cache.bssid));
+    TEST_ASSERT_EQUAL_UINT32(static_cast<uint32_t>(WiFi.localIP()), WiFi_cache.ip);
+
+    // Stored in NVS for the next boot
+    Preferences preferences;
+    preferences.begin(WIFI_PREFS_NAMESPACE, true);
+    WiFi_Cache stored = {};
+    preferences.getBytes(WIFI_PREFS_CACHE, &stored, sizeof(stored));
+    preferences.end();
+    TEST_ASSERT_EQUAL_UINT32(WIFI_CACHE_MAGIC, stored.magic);
+}
+
+void test_reconnect_skips_the_scan(void)
+{
+    Test_linkDown();
+    WiFi.Native_linkUp();
+    const unsigned long elapsed = Test_connect();
+    TEST_ASSERT_TRUE(WiFi_fastConnect);
+    TEST_ASSERT_LESS_THAN_UINT32(TEST_SCAN_MS, elapsed);
+    TEST_ASSERT_EQUAL_UINT32(WIFI_CACHE_MAGIC, WiFi_cache.magic);
+}
+
+void test_failed_fast_connect_falls_back_to_scan(void)
+{
+    Test_linkDown();
+    // The directed attempt times out while the access point is away
+    const unsigned long start = millis();
+    while (WiFi_cache.magic == WIFI_CACHE_MAGIC && millis() - start < TEST_CONNECT_TIMEOUT) {
+        WiFi_connect();
+        delay(5);
+    }
+    TEST_ASSERT_TRUE(WiFi_cache.magic != WIFI_CACHE_MAGIC);
+
+    WiFi.Native_linkUp();
+    Test_connect();
+    TEST_ASSERT_FALSE(WiFi_fastConnect);
+    TEST_ASSERT_EQUAL_UINT32(WIFI_CACHE_MAGIC, WiFi_cache.magic);
+}
+
+void test_boot_loads_cache_from_nvs(void)
+{
+    // A cold boot, RTC memory is lost but NVS is not
+    WiFi_cache = {};
+    WiFi_loadCache();
+    TEST_ASSERT_EQUAL_UINT32(WIFI_CACHE_MAGIC, WiFi_cache.magic);
+    TEST_ASSERT_EQUAL_UINT8(WiFi.channel(), WiFi_cache.channel);
+}
+
+int main(int argc, char** argv)
+{
+    setenv("NATIVE_NVS_DIR", ".nvs_test_wifi", 1);
+    setenv("NATIVE_WIFI_SCAN_MS", "300", 1);
+    setenv("NATIVE_WIFI_ASSOCIATE_MS", "20", 1);
+    setenv("NATIVE_WIFI_DHCP_MS", "50", 1);
+    // No access point remembered from an earlier run
+    Preferences preferences;
+    preferences.begin(WIFI_PREFS_NAMESPACE);
+    preferences.clear();
+    preferences.end();
+
+    WiFi_setup();
+    UNITY_BEGIN();
+    RUN_TEST(test_first_connect_scans_and_stores_cache);
+    RUN_TEST(test_reconnect_skips_the_scan);
+    RUN_TEST(test_failed_fast_connect_falls_back_to_scan);
+    RUN_TEST(test_boot_loads_cache_from_nvs);
+    // The simulated WiFi driver thread never returns, leave without running static destructors
+    const int failures = UNITY_END();
+    Serial.flush();
+    _Exit(failures);
+}
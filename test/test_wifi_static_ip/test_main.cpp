@@ -0,0 +1,82 @@
+#include <Arduino.h>
+#include <unity.h>
+
+// Short attempts, the simulated link answers within a few hundred milliseconds
+#define WIFI_CONNECT_ATTEMPS_TIMOUT 500
+#define WIFI_STATIC_IP "192.168.4.50"
+#define WIFI_STATIC_GATEWAY "192.168.4.1"
+
+#include "WiFi_Manager.h"
+
+constexpr unsigned long TEST_DHCP_MS = 300;
+constexpr unsigned long TEST_CONNECT_TIMEOUT = 5000;
+
+/// @brief Run WiFi_connect() like the WiFi task until the link is up and the cache is stored
+/// @return Time from the start of the successful attempt to the link being up
+unsigned long Test_connect()
+{
+    const unsigned long start = millis();
+    while (millis() - start < TEST_CONNECT_TIMEOUT) {
+        WiFi_connect();
+        if (WiFi.status() == WL_CONNECTED) {
+            const unsigned long elapsed = millis() - WiFi_attemptStartedAt;
+            WiFi_connect();
+            return elapsed;
+        }
+        delay(5);
+    }
+    TEST_FAIL_MESSAGE("WiFi did not connect");
+    return 0;
+}
+
+void setUp(void) {}
+
+void tearDown(void) {}
+
+void test_full_scan_uses_configured_address(void)
+{
+    const unsigned long elapsed = Test_connect();
+    TEST_ASSERT_FALSE(WiFi_fastConnect);
+    // No DHCP round trip
+    TEST_ASSERT_LESS_THAN_UINT32(TEST_DHCP_MS, elapsed);
+    TEST_ASSERT_TRUE(WiFi.localIP() == IPAddress(192, 168, 4, 50));
+    TEST_ASSERT_TRUE(WiFi.gatewayIP() == IPAddress(192, 168, 4, 1));
+    TEST_ASSERT_TRUE(WiFi.subnetMask() == IPAddress(255, 255, 255, 0));
+    // The DNS server defaults to the gateway
+    TEST_ASSERT_TRUE(WiFi.dnsIP() == IPAddress(192, 168, 4, 1));
+}
+
+void test_fast_connect_keeps_configured_address(void)
+{
+    WiFi.Native_linkDown();
+    while (WiFi.status() == WL_CONNECTED) {
+        delay(5);
+    }
+    WiFi_connect();
+    WiFi.Native_linkUp();
+    Test_connect();
+    TEST_ASSERT_TRUE(WiFi_fastConnect);
+    TEST_ASSERT_TRUE(WiFi.localIP() == IPAddress(192, 168, 4, 50));
+}
+
+int main(int argc, char** argv)
+{
+    setenv("NATIVE_NVS_DIR", ".nvs_test_wifi", 1);
+    setenv("NATIVE_WIFI_SCAN_MS", "0", 1);
+    setenv("NATIVE_WIFI_ASSOCIATE_MS", "20", 1);
+    setenv("NATIVE_WIFI_DHCP_MS", "300", 1);
+    // No access point remembered from an earlier run
+    Preferences preferences;
+    preferences.begin(WIFI_PREFS_NAMESPACE);
+    preferences.clear();
+    preferences.end();
+
+    WiFi_setup();
+    UNITY_BEGIN();
+    RUN_TEST(test_full_scan_uses_configured_address);
+    RUN_TEST(test_fast_connect_keeps_configured_address);
+    // The simulated WiFi driver thread never returns, leave without running static destructors
+    const int failures = UNITY_END();
+    Serial.flush();
+    _Exit(failures);
+}
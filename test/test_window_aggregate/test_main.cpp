@@ -0,0 +1,139 @@
+#include <Arduino.h>
+#include <unity.h>
+
+#include "Window_Aggregate.h"
+
+// One minute of readings at the default sensor interval
+constexpr size_t READINGS = 600;
+
+void setUp(void) {}
+
+void tearDown(void) {}
+
+/// @brief Deterministic readings around offset, spread uniformly over +-spread
+static void Test_readings(float* readings, float offset, float spread)
+{
+    uint32_t state = 12345;
+    for (size_t i = 0; i < READINGS; i++) {
+        state = state * 1664525U + 1013904223U;
+        const float unit = static_cast<float>(state >> 8) / static_cast<float>(1U << 24);
+        readings[i] = offset + (unit * 2.0f - 1.0f) * spread;
+    }
+}
+
+/// @brief Reference mean and sample variance, two passes in double
+static void Test_twoPass(const float* readings, double& mean, double& variance)
+{
+    mean = 0.0;
+    for (size_t i = 0; i < READINGS; i++) {
+        mean += readings[i];
+    }
+    mean /= READINGS;
+    variance = 0.0;
+    for (size_t i = 0; i < READINGS; i++) {
+        variance += (readings[i] - mean) * (readings[i] - mean);
+    }
+    variance /= READINGS - 1;
+}
+
+/// @brief Compares a float and a double accumulator against the two-pass reference
+static void Test_compare(float offset, float spread, double floatTolerance)
+{
+    float readings[READINGS];
+    Test_readings(readings, offset, spread);
+    double mean, variance;
+    Test_twoPass(readings, mean, variance);
+
+    Window_Aggregate<float> single;
+    Window_Aggregate<float, double> precise;
+    for (size_t i = 0; i < READINGS; i++) {
+        single.add(readings[i]);
+        precise.add(readings[i]);
+    }
+
+    TEST_ASSERT_FLOAT_WITHIN(offset * 1e-6f + 1e-6f, mean, single.mean());
+    TEST_ASSERT_FLOAT_WITHIN(variance * floatTolerance, variance, single.variance());
+    TEST_ASSERT_TRUE(fabs(precise.mean() - mean) <= fabs(mean) * 1e-12 + 1e-12);
+    TEST_ASSERT_TRUE(fabs(precise.variance() - variance) <= variance * 1e-9);
+}
+
+void test_room_temperature_matches_two_pass(void)
+{
+    Test_compare(25.0f, 0.5f, 1e-4);
+}
+
+void test_large_offset_stays_accurate(void)
+{
+    // Pressure in pascal, the spread is eight orders of magnitude below the squared offset
+    Test_compare(101325.0f, 2.0f, 1e-2);
+}
+
+void test_naive_sum_of_squares_loses_large_offset(void)
+{
+    // The one pass textbook formula, what Window_Aggregate avoids
+    float readings[READINGS];
+    Test_readings(readings, 101325.0f, 2.0f);
+    double mean, variance;
+    Test_twoPass(readings, mean, variance);
+
+    float sum = 0.0f;
+    float squares = 0.0f;
+    for (size_t i = 0; i < READINGS; i++) {
+        sum += readings[i];
+        squares += readings[i] * readings[i];
+    }
+    const float naive = (squares - sum * sum / READINGS) / (READINGS - 1);
+    TEST_ASSERT_TRUE(fabs(naive - variance) > variance);
+}
+
+void test_min_max_last_count(void)
+{
+    Window_Aggregate<float> window;
+    TEST_ASSERT_TRUE(window.empty());
+    const float readings[] = {3.0f, -1.5f, 7.25f, 2.0f};
+    for (float reading : readings) {
+        window.add(reading);
+    }
+    TEST_ASSERT_FALSE(window.empty());
+    TEST_ASSERT_EQUAL_UINT32(4, window.count());
+    TEST_ASSERT_EQUAL_FLOAT(-1.5f, window.min());
+    TEST_ASSERT_EQUAL_FLOAT(7.25f, window.max());
+    TEST_ASSERT_EQUAL_FLOAT(2.0f, window.last());
+    TEST_ASSERT_FLOAT_WITHIN(1e-6f, 2.6875f, window.mean());
+}
+
+void test_single_reading_has_no_variance(void)
+{
+    Window_Aggregate<float> window;
+    window.add(42.0f);
+    TEST_ASSERT_EQUAL_FLOAT(42.0f, window.mean());
+    TEST_ASSERT_EQUAL_FLOAT(0.0f, window.variance());
+    TEST_ASSERT_EQUAL_FLOAT(0.0f, window.stddev());
+}
+
+void test_reset_starts_a_new_window(void)
+{
+    Window_Aggregate<float> window;
+    window.add(100.0f);
+    window.add(200.0f);
+    window.reset();
+    TEST_ASSERT_TRUE(window.empty());
+    window.add(5.0f);
+    TEST_ASSERT_EQUAL_UINT32(1, window.count());
+    TEST_ASSERT_EQUAL_FLOAT(5.0f, window.min());
+    TEST_ASSERT_EQUAL_FLOAT(5.0f, window.max());
+    TEST_ASSERT_EQUAL_FLOAT(5.0f, window.mean());
+    TEST_ASSERT_EQUAL_FLOAT(0.0f, window.variance());
+}
+
+int main(int argc, char** argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_room_temperature_matches_two_pass);
+    RUN_TEST(test_large_offset_stays_accurate);
+    RUN_TEST(test_naive_sum_of_squares_loses_large_offset);
+    RUN_TEST(test_min_max_last_count);
+    RUN_TEST(test_single_reading_has_no_variance);
+    RUN_TEST(test_reset_starts_a_new_window);
+    return UNITY_END();
+}